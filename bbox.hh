@@ -0,0 +1,169 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file bbox.hh The BBox class, an axis aligned bounding box.
+*/
+
+#ifndef BBOX_HH
+#define BBOX_HH
+
+#include <cfloat>
+#include "vector.hh"
+#include "ray.hh"
+
+/** An axis aligned bounding box.
+* A freshly constructed box is empty (Min > Max) so that it can be grown
+* with extend().
+*/
+class BBox
+{
+public:
+
+/** The corner with the smallest coordinates. */
+  Vector3D Min;
+
+/** The corner with the largest coordinates. */
+  Vector3D Max;
+
+/** The default constructor. Builds an empty box. */
+  BBox();
+
+/** Builds the box spanned by two corners. */
+  BBox(const Vector3D & Min_, const Vector3D & Max_);
+
+/** Grows the box so that it contains a point. */
+  void extend(const Vector3D & Point);
+
+/** Grows the box so that it contains another box. */
+  void extend(const BBox & Other);
+
+/** Returns true if the box contains nothing. */
+  bool empty() const;
+
+/** The center of the box. */
+  const Vector3D centroid() const;
+
+/** The extent of the box along each axis. */
+  const Vector3D diagonal() const;
+
+/** The axis (0, 1 or 2) along which the box is the longest. */
+  int longestAxis() const;
+
+/** The surface area of the box. Used by the SAH cost function. */
+  float area() const;
+
+/** Slab test against a ray.
+* @param R The ray.
+* @param tmax Intersections further than this are ignored.
+* @param tnear Receives the entry distance if the box is hit.
+* @return True if the ray enters the box between R.getTMin() and tmax.
+*/
+  bool hit(const Ray & R, float tmax, float & tnear) const;
+};
+
+
+inline BBox::BBox()
+{
+  Min = Vector3D(FLT_MAX, FLT_MAX, FLT_MAX);
+  Max = Vector3D(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+}
+
+inline BBox::BBox(const Vector3D & Min_, const Vector3D & Max_)
+{
+  Min = Min_;
+  Max = Max_;
+}
+
+inline void BBox::extend(const Vector3D & Point)
+{
+  for (int i = 0; i < 3; i++)
+  {
+    if (Point[i] < Min[i]) Min[i] = Point[i];
+    if (Point[i] > Max[i]) Max[i] = Point[i];
+  }
+}
+
+inline void BBox::extend(const BBox & Other)
+{
+  for (int i = 0; i < 3; i++)
+  {
+    if (Other.Min[i] < Min[i]) Min[i] = Other.Min[i];
+    if (Other.Max[i] > Max[i]) Max[i] = Other.Max[i];
+  }
+}
+
+inline bool BBox::empty() const
+{
+  return (Min[0] > Max[0]) || (Min[1] > Max[1]) || (Min[2] > Max[2]);
+}
+
+inline const Vector3D BBox::centroid() const
+{
+  return 0.5 * (Min + Max);
+}
+
+inline const Vector3D BBox::diagonal() const
+{
+  return Max - Min;
+}
+
+inline int BBox::longestAxis() const
+{
+  Vector3D D = diagonal();
+  if ((D[0] >= D[1]) && (D[0] >= D[2])) return 0;
+  return (D[1] >= D[2]) ? 1 : 2;
+}
+
+inline float BBox::area() const
+{
+  if (empty()) return 0;
+  Vector3D D = diagonal();
+  return 2 * (D[0] * D[1] + D[1] * D[2] + D[2] * D[0]);
+}
+
+inline bool BBox::hit(const Ray & R, float tmax, float & tnear) const
+{
+  const Vector3D & O = R.getOrigin();
+  const Vector3D & InvDir = R.getInvDirection();
+  float t0 = R.getTMin(), t1 = tmax;
+
+  // The sign of the direction tells which slab plane is entered first
+  for (int i = 0; i < 3; i++)
+  {
+    int s = R.getSign(i);
+    float tA = ((s ? Max : Min)[i] - O[i]) * InvDir[i];
+    float tB = ((s ? Min : Max)[i] - O[i]) * InvDir[i];
+    t0 = (tA > t0) ? tA : t0;
+    t1 = (tB < t1) ? tB : t1;
+  }
+
+  tnear = t0;
+  return t0 <= t1;
+}
+
+/** Output of a box in the form [Min, Max]. */
+inline ostream & operator<<(ostream & os, const BBox & B)
+{
+  os << "[" << B.Min << ", " << B.Max << "]";
+  return os;
+}
+
+#endif //BBOX_HH
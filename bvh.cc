@@ -0,0 +1,201 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file bvh.cc Construction of the bounding volume hierarchy.
+*/
+
+#include <algorithm>
+#include "bvh.hh"
+
+/** The number of bins used to evaluate the SAH along an axis. */
+const int SAH_BINS = 12;
+
+/** The cost of traversing a node relative to intersecting a primitive. */
+const float SAH_TRAVERSAL_COST = 1.0;
+
+
+/** Orders primitive indices by their centroid along one axis. */
+class CentroidLess
+{
+  const vector<Vector3D> & Centroids;
+  int axis;
+
+public:
+  CentroidLess(const vector<Vector3D> & Centroids_, int axis_):
+  Centroids(Centroids_), axis(axis_) {}
+
+  bool operator()(unsigned int a, unsigned int b) const
+  {
+    return Centroids[a][axis] < Centroids[b][axis];
+  }
+};
+
+
+void BVH::Build(const vector<BBox> & PrimBounds, unsigned int MaxLeafSize)
+{
+  unsigned int n = PrimBounds.size();
+  vector<Vector3D> Centroids(n);
+
+  assert(MaxLeafSize > 0);
+
+  Nodes.clear();
+  Indices.resize(n);
+
+  if (n == 0) return;
+
+  for (unsigned int i = 0; i < n; i++)
+  {
+    Indices[i] = i;
+    Centroids[i] = PrimBounds[i].centroid();
+  }
+
+  // A binary tree with leaves of at least one primitive has < 2n nodes
+  Nodes.reserve(2 * n);
+  BuildNode(PrimBounds, Centroids, 0, n, MaxLeafSize, 0);
+}
+
+
+unsigned int BVH::BuildNode(const vector<BBox> & PrimBounds,
+                            const vector<Vector3D> & Centroids,
+                            unsigned int Start, unsigned int End,
+                            unsigned int MaxLeafSize, int Depth)
+{
+  unsigned int index = Nodes.size();
+  unsigned int count = End - Start;
+  BBox Box, CBox;
+  int i, axis = 0, split = -1;
+  float bestCost = FLT_MAX;
+
+  Nodes.push_back(BVHNode());
+
+  for (unsigned int k = Start; k < End; k++)
+  {
+    Box.extend(PrimBounds[Indices[k]]);
+    CBox.extend(Centroids[Indices[k]]);
+  }
+
+  for (i = 0; i < 3; i++)
+  {
+    Nodes[index].Min[i] = Box.Min[i];
+    Nodes[index].Max[i] = Box.Max[i];
+  }
+
+  if (count <= 1)
+  {
+    Nodes[index].Offset = Start;
+    Nodes[index].Count = count;
+    return index;
+  }
+
+  // Evaluate the binned SAH along every axis with a non-degenerate extent
+  for (int a = 0; a < 3; a++)
+  {
+    float extent = CBox.Max[a] - CBox.Min[a];
+    if (extent <= 0) continue;
+
+    BBox Bins[SAH_BINS], Right[SAH_BINS];
+    unsigned int Counts[SAH_BINS] = {0};
+    float scale = SAH_BINS / extent;
+
+    for (unsigned int k = Start; k < End; k++)
+    {
+      int b = (int) ((Centroids[Indices[k]][a] - CBox.Min[a]) * scale);
+      if (b >= SAH_BINS) b = SAH_BINS - 1;
+      Counts[b]++;
+      Bins[b].extend(PrimBounds[Indices[k]]);
+    }
+
+    BBox Acc;
+    unsigned int rightCount[SAH_BINS];
+    unsigned int acc = 0;
+    for (i = SAH_BINS - 1; i > 0; i--)
+    {
+      Acc.extend(Bins[i]);
+      acc += Counts[i];
+      Right[i] = Acc;
+      rightCount[i] = acc;
+    }
+
+    BBox Left;
+    unsigned int leftCount = 0;
+    for (i = 0; i < SAH_BINS - 1; i++)
+    {
+      Left.extend(Bins[i]);
+      leftCount += Counts[i];
+      if ((leftCount == 0) || (rightCount[i + 1] == 0)) continue;
+
+      float cost = Left.area() * leftCount +
+                   Right[i + 1].area() * rightCount[i + 1];
+      if (cost < bestCost)
+      {
+        bestCost = cost;
+        axis = a;
+        split = i;
+      }
+    }
+  }
+
+  float leafCost = Box.area() * count;
+  bestCost = SAH_TRAVERSAL_COST * Box.area() + bestCost;
+
+  if ((count <= MaxLeafSize) && ((split < 0) || (bestCost >= leafCost)))
+  {
+    Nodes[index].Offset = Start;
+    Nodes[index].Count = count;
+    return index;
+  }
+
+  unsigned int mid;
+
+  if ((split < 0) || (Depth >= BVH_MAX_DEPTH / 2))
+  {
+    // Degenerate centroids or a deep tree: fall back to a median split
+    axis = CBox.longestAxis();
+    mid = Start + count / 2;
+    nth_element(Indices.begin() + Start, Indices.begin() + mid,
+                Indices.begin() + End, CentroidLess(Centroids, axis));
+  }
+  else
+  {
+    float scale = SAH_BINS / (CBox.Max[axis] - CBox.Min[axis]);
+    unsigned int * first = &Indices[0] + Start;
+    unsigned int * last = &Indices[0] + End;
+
+    while (first < last)
+    {
+      int b = (int) ((Centroids[*first][axis] - CBox.Min[axis]) * scale);
+      if (b >= SAH_BINS) b = SAH_BINS - 1;
+      if (b <= split)
+        first++;
+      else
+        swap(*first, *--last);
+    }
+    mid = first - &Indices[0];
+  }
+
+  Nodes[index].Count = 0;
+  BuildNode(PrimBounds, Centroids, Start, mid, MaxLeafSize, Depth + 1);
+  unsigned int right = BuildNode(PrimBounds, Centroids, mid, End,
+                                 MaxLeafSize, Depth + 1);
+  Nodes[index].Offset = right;
+
+  return index;
+}
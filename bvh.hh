@@ -0,0 +1,202 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file bvh.hh A bounding volume hierarchy over an arbitrary set of
+* primitives.
+*/
+
+#ifndef BVH_HH
+#define BVH_HH
+
+#include <vector>
+#include "bbox.hh"
+#include "ray.hh"
+
+using namespace std;
+
+/** The maximal depth of a BVH. Deeper subtrees are split at the median. */
+const int BVH_MAX_DEPTH = 64;
+
+/** A node of the BVH, stored in a flat array (32 bytes).
+* The left child of an interior node immediately follows it in the array.
+*/
+struct BVHNode
+{
+/** The bounds of everything below this node. */
+  float Min[3], Max[3];
+
+/** First entry in BVH::Indices for a leaf, the right child for an
+* interior node.
+*/
+  unsigned int Offset;
+
+/** The number of primitives in a leaf. Zero for interior nodes. */
+  unsigned int Count;
+};
+
+
+/** A binary bounding volume hierarchy built with the binned surface area
+* heuristic.
+* The hierarchy only knows about the bounding boxes of the primitives, the
+* owner supplies the actual intersection test through Traverse().
+*/
+class BVH
+{
+public:
+
+/** The nodes, the root being the first one. */
+  vector<BVHNode> Nodes;
+
+/** The primitive indices referenced by the leaves. */
+  vector<unsigned int> Indices;
+
+/** Builds the hierarchy.
+* @param PrimBounds The bounding box of every primitive.
+* @param MaxLeafSize Leaves never hold more primitives than this.
+*/
+  void Build(const vector<BBox> & PrimBounds, unsigned int MaxLeafSize = 4);
+
+/** True if the hierarchy holds no primitives. */
+  bool empty() const;
+
+/** The bounds of the whole hierarchy. */
+  const BBox Bounds() const;
+
+/** Walks the hierarchy front to back along a ray.
+* @param R The ray.
+* @param tmax The distance to the closest hit so far. The leaf test is
+* expected to shrink it when it finds a closer hit.
+* @param Test A functor called as Test(primitive, tmax) for every
+* primitive in a leaf touched by the ray. Returns true on a closer hit.
+* @return True if any primitive was hit.
+*/
+  template <class LeafTest>
+  bool Traverse(const Ray & R, float & tmax, LeafTest & Test) const;
+
+private:
+
+/** Recursive part of Build(). Returns the index of the new node. */
+  unsigned int BuildNode(const vector<BBox> & PrimBounds,
+                         const vector<Vector3D> & Centroids,
+                         unsigned int Start, unsigned int End,
+                         unsigned int MaxLeafSize, int Depth);
+};
+
+
+/** Slab test of a BVH node against a ray.
+* @param Node The node.
+* @param O The ray origin.
+* @param Inv The inverse of the ray direction.
+* @param Neg For each axis, 1 if the ray direction is negative.
+* @param tmin Entries before this distance are moved up to it.
+* @param tmax Entries past this distance are ignored.
+* @param tnear Receives the entry distance.
+*/
+inline bool hitNode(const BVHNode & Node, const float O[3], const float Inv[3],
+                    const int Neg[3], float tmin, float tmax, float & tnear)
+{
+  float t0 = tmin, t1 = tmax;
+
+  for (int i = 0; i < 3; i++)
+  {
+    float tA = ((Neg[i] ? Node.Max : Node.Min)[i] - O[i]) * Inv[i];
+    float tB = ((Neg[i] ? Node.Min : Node.Max)[i] - O[i]) * Inv[i];
+    t0 = (tA > t0) ? tA : t0;
+    t1 = (tB < t1) ? tB : t1;
+  }
+
+  tnear = t0;
+  return t0 <= t1;
+}
+
+
+inline bool BVH::empty() const
+{
+  return Nodes.empty();
+}
+
+inline const BBox BVH::Bounds() const
+{
+  if (Nodes.empty()) return BBox();
+
+  return BBox(Vector3D(Nodes[0].Min[0], Nodes[0].Min[1], Nodes[0].Min[2]),
+              Vector3D(Nodes[0].Max[0], Nodes[0].Max[1], Nodes[0].Max[2]));
+}
+
+template <class LeafTest>
+bool BVH::Traverse(const Ray & R, float & tmax, LeafTest & Test) const
+{
+  if (Nodes.empty()) return false;
+
+  const Vector3D & Origin = R.getOrigin(), & InvDir = R.getInvDirection();
+  float O[3], Inv[3], tmin = R.getTMin(), tnear, tleft, tright;
+  int Neg[3];
+  unsigned int Stack[2 * BVH_MAX_DEPTH];
+  int top = 0;
+  bool found = false;
+
+  for (int i = 0; i < 3; i++)
+  {
+    O[i] = Origin[i];
+    Inv[i] = InvDir[i];
+    Neg[i] = R.getSign(i);
+  }
+
+  if (!hitNode(Nodes[0], O, Inv, Neg, tmin, tmax, tnear)) return false;
+  Stack[top++] = 0;
+
+  while (top > 0)
+  {
+    const BVHNode & Node = Nodes[Stack[--top]];
+
+    if (Node.Count > 0)
+    {
+      for (unsigned int i = 0; i < Node.Count; i++)
+        if (Test(Indices[Node.Offset + i], tmax)) found = true;
+      continue;
+    }
+
+    unsigned int left = &Node - &Nodes[0] + 1, right = Node.Offset;
+    bool hitL = hitNode(Nodes[left], O, Inv, Neg, tmin, tmax, tleft);
+    bool hitR = hitNode(Nodes[right], O, Inv, Neg, tmin, tmax, tright);
+
+    // Push the far child first so that the near one is popped next
+    if (hitL && hitR)
+    {
+      if (tleft < tright)
+      {
+        Stack[top++] = right;
+        Stack[top++] = left;
+      }
+      else
+      {
+        Stack[top++] = left;
+        Stack[top++] = right;
+      }
+    }
+    else if (hitL) Stack[top++] = left;
+    else if (hitR) Stack[top++] = right;
+  }
+
+  return found;
+}
+
+#endif //BVH_HH
@@ -77,6 +77,25 @@ public:
 */
 
   Ray getRayForPixel(int x, int y, int imgSize) const;
+
+/** Returns the ray which passes through a pixel of a rectangular image.
+* The field of view spans the width; the pixels are square, so the
+* height of the view follows the aspect ratio.
+* @param x The column of the pixel, 0 <= x < Width.
+* @param y The row of the pixel, 0 <= y < Height.
+* @param Width The width of the image, in pixels, at least 2.
+* @param Height The height of the image, in pixels, at least 2.
+*/
+  Ray getRayForPixel(int x, int y, int Width, int Height) const;
+
+/** Returns a ray through a point within a pixel, for several samples per
+* pixel.
+* @param dx The offset from the center of the pixel to the right, in
+* pixels, -0.5 to 0.5.
+* @param dy The offset downwards, in pixels.
+*/
+  Ray getRayForPixel(int x, int y, int Width, int Height,
+                     float dx, float dy) const;
 };
 
 inline Camera::Camera(Vector3D Position,
@@ -101,19 +120,32 @@ inline Camera::Camera(Vector3D Position,
 
 inline Ray Camera::getRayForPixel(int x, int y, int imgSize) const
 {
-  assert(x >= 0);
-  assert(y >= 0);
-  assert(imgSize >= 0);
-  assert((x < imgSize) && (y < imgSize));
-    
+  return getRayForPixel(x, y, imgSize, imgSize);
+}
+
+inline Ray Camera::getRayForPixel(int x, int y, int Width, int Height) const
+{
+  return getRayForPixel(x, y, Width, Height, 0, 0);
+}
+
+inline Ray Camera::getRayForPixel(int x, int y, int Width, int Height,
+                                  float dx, float dy) const
+{
+  assert((x >= 0) && (y >= 0));
+  assert((Width >= 2) && (Height >= 2));
+  assert((x < Width) && (y < Height));
+
+  // 1 for square images, which keeps their rays exactly as they were
+  float Aspect = (float) (Height - 1) / (float) (Width - 1);
   Vector3D pixelDir;
   pixelDir = Dist * Dir;
-  pixelDir += (0.5 - (float) y / (float) (imgSize - 1) ) * Up;
-  pixelDir += ((float) x / (float) (imgSize - 1) - 0.5) * Right;
-  
+  pixelDir += (0.5 - ((float) y + dy) / (float) (Height - 1)) * Aspect * Up;
+  pixelDir += (((float) x + dx) / (float) (Width - 1) - 0.5) * Right;
+
+  // The cone of the ray spans one pixel
   Ray pixelRay(Pos, pixelDir);
+  pixelRay.setCone(0, 1 / ((Width - 1) * pixelDir.magn()));
   return pixelRay;
 }
 
-
 #endif //CAMERA_HH
@@ -31,11 +31,13 @@
 #include <iostream>
 #include <cassert>
 #include <cmath>
+#include "simd.hh"
 
 using namespace std;
 
 
 /** An RGB color class.
+* Like Vector3D, the components live in a 16 byte aligned SIMD register.
 */
 class Color
 {
@@ -46,9 +48,14 @@ class Color
   * vec[0] == RED \n
   * vec[1] == GREEN
   * vec[2] == BLUE
+  * vec[3] == 0, padding
   * All magnitudes are supposed to be in the interval [0,1]
   */
-  float vec[3];
+  union
+  {
+    float vec[4];
+    simd4f v;
+  };
   
  public:
  
@@ -122,17 +129,13 @@ class Color
 //Default constructor
 inline Color::Color()
 {
-  vec[0] = 0;
-  vec[1] = 0;
-  vec[2] = 0;
+  v = simd_splat(0);
 }
 
 
 inline Color::Color(float * vec_)
 {
-  vec[0] = vec_[0];
-  vec[1] = vec_[1];
-  vec[2] = vec_[2];
+  v = simd_set(vec_[0], vec_[1], vec_[2], 0);
 }
 
 
@@ -140,17 +143,13 @@ inline Color::Color(float * vec_)
 //Initialization with other color not implemented due to a priori support
 inline Color::Color(float R, float G, float B)
 {
-  vec[0] = R;
-  vec[1] = G;
-  vec[2] = B;
+  v = simd_set(R, G, B, 0);
 }
 
 // Compound addition, supports chaining
 inline Color & Color::operator+=(const Color & Other)
 {
-  vec[0] += Other.get_red();
-  vec[1] += Other.get_green();
-  vec[2] += Other.get_blue();
+  v = simd_add(v, Other.v);
   
   return *this;
 }
@@ -158,9 +157,7 @@ inline Color & Color::operator+=(const Color & Other)
 // Compound -, supports chaining
 inline Color & Color::operator-=(const Color & Other)
 {
-  vec[0] -= Other.get_red();
-  vec[1] -= Other.get_green();
-  vec[2] -= Other.get_blue();
+  v = simd_sub(v, Other.v);
   
   // Check that colors are positive
   //assert(vec[0] >= 0);
@@ -173,9 +170,7 @@ inline Color & Color::operator-=(const Color & Other)
 // Compound multiplication, supports chaining
 inline Color & Color::operator*=(const Color & Other)
 {
-  vec[0] *= Other.get_red();
-  vec[1] *= Other.get_green();
-  vec[2] *= Other.get_blue();
+  v = simd_mul(v, Other.v);
   
   return *this;
 }
@@ -185,9 +180,7 @@ inline Color & Color::operator*=(const float scalar)
 { 
   //assert(scalar > 0);
   
-  vec[0] *= scalar;
-  vec[1] *= scalar;
-  vec[2] *= scalar;
+  v = simd_mul(v, simd_splat(scalar));
   
   return *this;
 }
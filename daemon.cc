@@ -0,0 +1,579 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file daemon.cc Implementation of the render daemon and its client
+*/
+
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <iterator>
+#include <new>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <boost/bind/bind.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include "daemon.hh"
+#include "parser.hh"
+
+
+/** Frames longer than this are refused. */
+const unsigned int MAX_FRAME = 1u << 30;
+
+
+struct CachedScene
+{
+/** The hash of the scene text. */
+  string Hash;
+
+/** The scene, finalized: one copy for each NUMA node if they are
+* replicated, a single one otherwise.
+*/
+  vector<Scene *> Replicas;
+
+/** Its camera. */
+  Camera * Cr;
+
+  CachedScene(): Cr(0) {}
+  ~CachedScene()
+  {
+    for (unsigned int i = 0; i < Replicas.size(); i++) delete Replicas[i];
+    delete Cr;
+  }
+};
+
+
+/** A job being rendered, shared by the tasks rendering its bands. */
+struct RenderJob
+{
+  boost::shared_ptr<CachedScene> Source;
+  Camera Cam;
+  int Size, X, Y;
+  FrameBuffer Frame;
+
+/** The bands not rendered yet. */
+  unsigned int Remaining;
+  boost::mutex Lock;
+  boost::condition_variable Done;
+
+  RenderJob(const Camera & Cam_): Cam(Cam_) {}
+};
+
+
+/** Renders the rows y0 to y1 - 1 of a job's region, with the copy of the
+* scene of a NUMA node.
+*/
+static void renderBand(RenderJob * Job, int y0, int y1, int Node)
+{
+  const vector<Scene *> & Replicas = Job->Source->Replicas;
+  const Scene * Sc = Replicas[min(Node, (int) Replicas.size() - 1)];
+
+  for (int y = y0; y < y1; y++)
+  {
+    for (int x = 0; x < Job->Frame.getWidth(); x++)
+    {
+      Job->Frame.setPixel(x, y, Sc->tracePixel(Job->Cam, Job->X + x,
+                                                Job->Y + y, Job->Size,
+                                                Job->Size));
+    }
+  }
+
+  boost::mutex::scoped_lock Guard(Job->Lock);
+  if (--Job->Remaining == 0) Job->Done.notify_all();
+}
+
+
+/** Reads and finalizes a scene on a thread of its own, so that its memory
+* is placed as that thread's NUMA settings say.
+* @param Node Pin the thread to the processors of this node, if not -1.
+* @param Interleave Spread the memory of the scene over all nodes.
+* @param Sc Receives the scene.
+* @param Cr Receives its camera.
+* @param Error Receives the error if the scene is malformed or too large.
+*/
+static void loadReplica(const string * Text, const NumaTopology * Topology,
+                        int Node, bool Interleave, Scene ** Sc, Camera ** Cr,
+                        string * Error)
+{
+  // Both only last as long as the thread
+  if (Node >= 0) Topology->pinThread(Node);
+  if (Interleave) Topology->interleaveMemory(true);
+
+  istringstream in(*Text);
+  *Sc = new Scene;
+  // An exception must not leave the thread
+  try
+  {
+    readScene(in, *Sc, Cr);
+    (*Sc)->finalize();
+  }
+  catch (invalid_argument & e)
+  {
+    *Error = e.what();
+  }
+  catch (bad_alloc &)
+  {
+    *Error = "not enough memory for the scene";
+  }
+}
+
+
+/** The 64 bit FNV-1a hash of a text, in hexadecimal. */
+static string hashText(const string & Text)
+{
+  unsigned long long h = 14695981039346656037ull;
+  char Hex[17];
+
+  for (unsigned int i = 0; i < Text.size(); i++)
+    h = (h ^ (unsigned char) Text[i]) * 1099511628211ull;
+
+  snprintf(Hex, sizeof(Hex), "%016llx", h);
+  return Hex;
+}
+
+
+RenderRequest::RenderRequest()
+  : Size(0), OverrideCamera(false), Priority(0)
+{
+  for (int i = 0; i < 4; i++) Region[i] = 0;
+  for (int i = 0; i < 10; i++) Camera[i] = 0;
+}
+
+
+string RenderRequest::encode() const
+{
+  ostringstream out;
+
+  if (!ScenePath.empty()) out << "scene " << ScenePath << "\n";
+  if (!SceneHash.empty()) out << "hash " << SceneHash << "\n";
+  out << "size " << Size << "\n";
+  if (Region[2] > 0)
+    out << "region " << Region[0] << " " << Region[1] << " "
+        << Region[2] << " " << Region[3] << "\n";
+  if (OverrideCamera)
+  {
+    out << "camera";
+    for (int i = 0; i < 10; i++) out << " " << Camera[i];
+    out << "\n";
+  }
+  out << "priority " << Priority << "\n";
+  if (!Output.empty()) out << "output " << Output << "\n";
+
+  return out.str();
+}
+
+
+bool RenderRequest::decode(const string & Text, string & Error)
+{
+  istringstream in(Text);
+  string Line;
+
+  *this = RenderRequest();
+
+  while (getline(in, Line))
+  {
+    istringstream Fields(Line);
+    string Key;
+
+    if (!(Fields >> Key)) continue;
+
+    if ((Key == "scene") || (Key == "output"))
+    {
+      // Paths may hold spaces, they run to the end of the line
+      string Path;
+      getline(Fields >> ws, Path);
+      (Key == "scene" ? ScenePath : Output) = Path;
+    }
+    else if (Key == "hash") Fields >> SceneHash;
+    else if (Key == "size") Fields >> Size;
+    else if (Key == "priority") Fields >> Priority;
+    else if (Key == "region")
+      Fields >> Region[0] >> Region[1] >> Region[2] >> Region[3];
+    else if (Key == "camera")
+    {
+      OverrideCamera = true;
+      for (int i = 0; i < 10; i++) Fields >> Camera[i];
+    }
+    else
+    {
+      Error = "unknown request field " + Key;
+      return false;
+    }
+
+    if (Fields.fail())
+    {
+      Error = "bad values for " + Key;
+      return false;
+    }
+  }
+
+  if (ScenePath.empty() == SceneHash.empty())
+    Error = "a request needs either a scene or a hash";
+  else if ((Size < 2) || (Size > DAEMON_MAX_SIZE))
+  {
+    ostringstream Message;
+    Message << "the image size must be from 2 to " << DAEMON_MAX_SIZE
+            << " pixels";
+    Error = Message.str();
+  }
+  else if ((Region[2] < 0) || (Region[3] < 0) ||
+           ((Region[2] > 0) && ((Region[0] < 0) || (Region[1] < 0) ||
+                                (Region[3] == 0) ||
+                                (Region[0] > Size - Region[2]) ||
+                                (Region[1] > Size - Region[3]))))
+    Error = "the region is not within the image";
+  else
+    return true;
+
+  return false;
+}
+
+
+bool sendFrame(int fd, const string & Data)
+{
+  unsigned char Length[4];
+  unsigned int n = Data.size();
+
+  for (int i = 0; i < 4; i++) Length[i] = (n >> (8 * i)) & 0xff;
+
+  string Frame((const char *) Length, 4);
+  Frame += Data;
+
+  // MSG_NOSIGNAL: a client hanging up must not kill the daemon
+  for (size_t sent = 0; sent < Frame.size(); )
+  {
+    ssize_t k = send(fd, Frame.data() + sent, Frame.size() - sent, MSG_NOSIGNAL);
+    if (k < 0 && errno == EINTR) continue;
+    if (k <= 0) return false;
+    sent += k;
+  }
+  return true;
+}
+
+
+/** Receives exactly n bytes. */
+static bool receiveAll(int fd, char * Data, size_t n)
+{
+  for (size_t got = 0; got < n; )
+  {
+    ssize_t k = recv(fd, Data + got, n - got, 0);
+    if (k < 0 && errno == EINTR) continue;
+    if (k <= 0) return false;
+    got += k;
+  }
+  return true;
+}
+
+
+bool receiveFrame(int fd, string & Data)
+{
+  unsigned char Length[4];
+
+  if (!receiveAll(fd, (char *) Length, 4)) return false;
+
+  unsigned int n = 0;
+  for (int i = 0; i < 4; i++) n |= (unsigned int) Length[i] << (8 * i);
+  if (n > MAX_FRAME) return false;
+
+  Data.resize(n);
+  return (n == 0) || receiveAll(fd, &Data[0], n);
+}
+
+
+RenderDaemon::RenderDaemon(const string & SocketPath_, unsigned int Threads,
+                           unsigned int CacheSize_, NumaPolicy Policy_,
+                           const NumaTopology & Topology_)
+  : SocketPath(SocketPath_),
+    Policy(Topology_.nodes() > 1 ? Policy_ : NUMA_OFF),
+    Topology(Policy == NUMA_OFF ? NumaTopology() : Topology_),
+    Pool(Threads, Topology, Policy != NUMA_OFF), CacheSize(CacheSize_)
+{
+  assert(CacheSize > 0);
+
+  if ((Policy == NUMA_INTERLEAVE) && !Topology.isReal())
+    cerr << "The NUMA nodes are made up, scenes cannot be interleaved" << endl;
+}
+
+
+boost::shared_ptr<CachedScene> RenderDaemon::getScene(const RenderRequest & Request,
+                                                      string & Error)
+{
+  boost::mutex::scoped_lock Guard(CacheLock);
+  string Text, Hash = Request.SceneHash;
+
+  if (!Request.ScenePath.empty())
+  {
+    ifstream fin(Request.ScenePath.c_str());
+    if (!fin)
+    {
+      Error = "cannot open " + Request.ScenePath;
+      return boost::shared_ptr<CachedScene>();
+    }
+    Text.assign(istreambuf_iterator<char>(fin), istreambuf_iterator<char>());
+    Hash = hashText(Text);
+  }
+
+  for (list<boost::shared_ptr<CachedScene> >::iterator i = Cache.begin();
+       i != Cache.end(); i++)
+  {
+    if ((*i)->Hash == Hash)
+    {
+      boost::shared_ptr<CachedScene> Found = *i;
+      Cache.erase(i);
+      Cache.push_front(Found);
+      return Found;
+    }
+  }
+
+  if (Request.ScenePath.empty())
+  {
+    Error = "scene " + Hash + " is not loaded";
+    return boost::shared_ptr<CachedScene>();
+  }
+
+  boost::shared_ptr<CachedScene> Loaded(new CachedScene);
+  bool Replicate = (Policy == NUMA_REPLICATE);
+  int Copies = Replicate ? Topology.nodes() : 1;
+  vector<Camera *> Cameras(Copies, (Camera *) 0);
+  vector<string> Errors(Copies);
+
+  Loaded->Hash = Hash;
+  Loaded->Replicas.assign(Copies, (Scene *) 0);
+
+  if (Policy == NUMA_OFF)
+    loadReplica(&Text, &Topology, -1, false, &Loaded->Replicas[0],
+                &Cameras[0], &Errors[0]);
+  else
+  {
+    // Each copy is first touched by a thread of its node
+    boost::thread_group Loaders;
+    for (int n = 0; n < Copies; n++)
+      Loaders.create_thread(boost::bind(loadReplica, &Text, &Topology,
+                                        Replicate ? n : -1,
+                                        Policy == NUMA_INTERLEAVE,
+                                        &Loaded->Replicas[n], &Cameras[n],
+                                        &Errors[n]));
+    Loaders.join_all();
+  }
+
+  Loaded->Cr = Cameras[0];
+  for (int n = 1; n < Copies; n++) delete Cameras[n];
+
+  for (int n = 0; n < Copies; n++)
+    if (!Errors[n].empty())
+    {
+      Error = Request.ScenePath + ": " + Errors[n];
+      return boost::shared_ptr<CachedScene>();
+    }
+
+  if (!Loaded->Replicas[0]->isFinalized())
+  {
+    Error = Request.ScenePath + " has a degenerate object";
+    return boost::shared_ptr<CachedScene>();
+  }
+
+  Cache.push_front(Loaded);
+  if (Cache.size() > CacheSize) Cache.pop_back();
+  return Loaded;
+}
+
+
+string RenderDaemon::runJob(const RenderRequest & Request)
+{
+  string Error;
+  boost::shared_ptr<CachedScene> Source = getScene(Request, Error);
+
+  if (!Source) return "error " + Error + "\n";
+
+  const float * C = Request.Camera;
+  if (!Request.OverrideCamera && (Source->Cr == 0))
+    return "error the scene has no camera\n";
+
+  RenderJob Job(Request.OverrideCamera ?
+                Camera(Vector3D(C[0], C[1], C[2]), Vector3D(C[3], C[4], C[5]),
+                       Vector3D(C[6], C[7], C[8]), C[9]) :
+                *Source->Cr);
+  bool whole = (Request.Region[2] == 0);
+
+  Job.Source = Source;
+  Job.Size = Request.Size;
+  Job.X = whole ? 0 : Request.Region[0];
+  Job.Y = whole ? 0 : Request.Region[1];
+
+  int Width = whole ? Request.Size : Request.Region[2];
+  int Height = whole ? Request.Size : Request.Region[3];
+
+  // Leave the pages of the image to the workers that render them
+  if ((Policy == NUMA_OFF) || !Job.Frame.resizeUntouched(Width, Height))
+    Job.Frame.resize(Width, Height);
+
+  int Bands = (Height + DAEMON_BAND_ROWS - 1) / DAEMON_BAND_ROWS;
+  Job.Remaining = Bands;
+
+  // Each node gets a run of consecutive bands, whose rows share pages
+  for (int b = 0; b < Bands; b++)
+  {
+    int y = b * DAEMON_BAND_ROWS, Node = (long) b * Pool.nodes() / Bands;
+    Pool.submit(boost::bind(renderBand, &Job, y,
+                            min(y + DAEMON_BAND_ROWS, Height), Node),
+                Request.Priority, Node);
+  }
+
+  {
+    boost::mutex::scoped_lock Guard(Job.Lock);
+    while (Job.Remaining > 0) Job.Done.wait(Guard);
+  }
+
+  if (!Request.Output.empty())
+  {
+    ofstream out(Request.Output.c_str(), ios::binary);
+    Job.Frame.writePFM(out);
+    if (!out) return "error cannot write " + Request.Output + "\n";
+    return "ok " + Source->Hash + " file " + Request.Output + "\n";
+  }
+
+  ostringstream Reply;
+  Reply << "ok " << Source->Hash << " pfm\n";
+  Job.Frame.writePFM(Reply);
+  return Reply.str();
+}
+
+
+void RenderDaemon::serve(int fd)
+{
+  string Data, Error;
+  RenderRequest Request;
+
+  while (receiveFrame(fd, Data))
+  {
+    string Reply;
+
+    if (!Request.decode(Data, Error)) Reply = "error " + Error + "\n";
+    else
+    {
+      try
+      {
+        Reply = runJob(Request);
+      }
+      catch (bad_alloc &)
+      {
+        Reply = "error not enough memory for the job\n";
+      }
+    }
+
+    if (!sendFrame(fd, Reply)) break;
+  }
+
+  close(fd);
+}
+
+
+/** Fills the address of a socket.
+* @return False if the path is too long.
+*/
+static bool socketAddress(const string & Path, struct sockaddr_un & Address)
+{
+  memset(&Address, 0, sizeof(Address));
+  Address.sun_family = AF_UNIX;
+  if (Path.size() >= sizeof(Address.sun_path)) return false;
+
+  strcpy(Address.sun_path, Path.c_str());
+  return true;
+}
+
+
+int RenderDaemon::run()
+{
+  struct sockaddr_un Address;
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  if ((fd < 0) || !socketAddress(SocketPath, Address))
+  {
+    cerr << "Cannot create the socket " << SocketPath << endl;
+    return 1;
+  }
+
+  // A socket left over by an earlier daemon would make bind() fail
+  unlink(SocketPath.c_str());
+  if ((bind(fd, (struct sockaddr *) &Address, sizeof(Address)) < 0) ||
+      (listen(fd, 16) < 0))
+  {
+    cerr << "Cannot listen on " << SocketPath << ": " << strerror(errno) << endl;
+    close(fd);
+    return 1;
+  }
+
+  cout << "Listening on " << SocketPath << " with " << Pool.size()
+       << " threads";
+  if (Pool.nodes() > 1) cout << " on " << Pool.nodes() << " NUMA nodes";
+  cout << endl;
+
+  while (true)
+  {
+    int Client = accept(fd, 0, 0);
+    if ((Client < 0) && (errno == EINTR)) continue;
+    if (Client < 0)
+    {
+      cerr << "accept failed: " << strerror(errno) << endl;
+      close(fd);
+      return 1;
+    }
+
+    boost::thread(boost::bind(&RenderDaemon::serve, this, Client)).detach();
+  }
+}
+
+
+bool submitRender(const string & SocketPath, const RenderRequest & Request,
+                  FrameBuffer & Frame, string & Reply)
+{
+  struct sockaddr_un Address;
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  if ((fd < 0) || !socketAddress(SocketPath, Address) ||
+      (connect(fd, (struct sockaddr *) &Address, sizeof(Address)) < 0))
+  {
+    Reply = "cannot connect to " + SocketPath;
+    if (fd >= 0) close(fd);
+    return false;
+  }
+
+  string Data;
+  bool ok = sendFrame(fd, Request.encode()) && receiveFrame(fd, Data);
+  close(fd);
+
+  if (!ok)
+  {
+    Reply = "the daemon hung up";
+    return false;
+  }
+
+  istringstream in(Data);
+  getline(in, Reply);
+  if (Reply.compare(0, 3, "ok ") != 0) return false;
+
+  if (Reply.size() >= 4 && Reply.compare(Reply.size() - 4, 4, " pfm") == 0)
+    return Frame.readPFM(in);
+  return true;
+}
@@ -0,0 +1,207 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file daemon.hh The render daemon, which keeps scenes loaded and renders
+* jobs sent over a Unix domain socket, and the client side of its protocol.
+*
+* Every message is a frame: its length as a 4 byte little endian number,
+* then that many bytes. A request is text, one "key values" line each:
+*   scene PATH        the scene file, or
+*   hash HASH         a scene already loaded, as named by an earlier reply
+*   size N            the size of the whole image, at most DAEMON_MAX_SIZE
+*   region X Y W H    the part of the image to render (default all of it)
+*   camera PX PY PZ LX LY LZ UX UY UZ FOV
+*                     position, look at point, up and field of view, in
+*                     place of the scene's camera
+*   priority N        higher runs first (default 0)
+*   output PATH       have the daemon write the region as a PFM image
+* The reply is "error MESSAGE\n", or "ok HASH file PATH\n" when the daemon
+* wrote the image, or "ok HASH pfm\n" followed by the image as PFM.
+*/
+
+#ifndef DAEMON_HH
+#define DAEMON_HH
+
+#include <list>
+#include <string>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include "framebuffer.hh"
+#include "numa.hh"
+#include "threadpool.hh"
+
+using namespace std;
+
+
+/** The rows of a job rendered by one task of the thread pool. */
+const int DAEMON_BAND_ROWS = 8;
+
+/** The largest image a job may ask for, so that its size cannot overflow
+* and a client cannot have the daemon allocate any amount of memory.
+*/
+const int DAEMON_MAX_SIZE = 16384;
+
+/** The number of scenes the daemon keeps loaded by default. */
+const unsigned int DAEMON_CACHE_SIZE = 4;
+
+
+/** A render job, as sent to the daemon. */
+struct RenderRequest
+{
+/** The scene file. Either this or SceneHash is set. */
+  string ScenePath;
+
+/** The hash of a scene the daemon has loaded. */
+  string SceneHash;
+
+/** The size of the whole image. */
+  int Size;
+
+/** The region rendered: x, y, width and height. A width of 0 means the
+* whole image.
+*/
+  int Region[4];
+
+/** If set, Camera replaces the camera of the scene. */
+  bool OverrideCamera;
+
+/** Position, look at point, up vector and field of view. */
+  float Camera[10];
+
+/** Jobs with a higher priority are rendered first. */
+  int Priority;
+
+/** If not empty, the daemon writes the image there instead of sending it. */
+  string Output;
+
+/** A request for the whole image of a scene, with the default camera. */
+  RenderRequest();
+
+/** The request as the text of a frame. */
+  string encode() const;
+
+/** Reads a request from the text of a frame.
+* @return False, with Error set, if the text is not a valid request.
+*/
+  bool decode(const string & Text, string & Error);
+};
+
+
+/** Sends a frame over a socket.
+* @return False if the connection failed.
+*/
+bool sendFrame(int fd, const string & Data);
+
+/** Receives a frame from a socket.
+* @return False if the connection failed or was closed.
+*/
+bool receiveFrame(int fd, string & Data);
+
+
+/** A scene loaded by the daemon, with its camera. */
+struct CachedScene;
+
+
+/** The render daemon.
+* Every client connection is served by its own thread, which reads the
+* requests one at a time. A job is cut into bands of rows that go to a
+* thread pool shared by all jobs, ordered by the priority of their job.
+* Scenes are kept by the hash of their text, the least recently used is
+* dropped when the cache is full; jobs still rendering it keep it alive.
+* With a NUMA policy the workers are pinned to the nodes, each node gets
+* a run of consecutive bands of every job, and the rows of the image are
+* first written by the workers that render them, so their pages end up on
+* that node. The scenes are then also interleaved over the nodes or read
+* once by each node, as the policy says.
+*/
+class RenderDaemon
+{
+private:
+
+/** The path of the socket. */
+  string SocketPath;
+
+/** The NUMA placement, NUMA_OFF on a single node. */
+  NumaPolicy Policy;
+
+/** The NUMA nodes, a single one unless Policy places anything. */
+  NumaTopology Topology;
+
+/** The workers. */
+  ThreadPool Pool;
+
+/** The most recently used scenes, the most recent first. */
+  list<boost::shared_ptr<CachedScene> > Cache;
+
+/** The number of scenes kept. */
+  unsigned int CacheSize;
+
+/** Guards Cache. Scenes are read with it held, one at a time. */
+  boost::mutex CacheLock;
+
+/** Finds the scene of a request, reading it if needed.
+* @return The scene, or a null pointer with Error set.
+*/
+  boost::shared_ptr<CachedScene> getScene(const RenderRequest & Request,
+                                          string & Error);
+
+/** Renders a job.
+* @return The reply to send.
+*/
+  string runJob(const RenderRequest & Request);
+
+/** Serves one client until it hangs up, then closes the socket. A job
+* that runs out of memory fails alone, with an error reply.
+*/
+  void serve(int fd);
+
+public:
+
+/** The constructor. Starts the workers.
+* @param SocketPath_ The path of the socket.
+* @param Threads The number of workers.
+* @param CacheSize_ The number of scenes kept loaded.
+* @param Policy_ Where to put the threads and scenes on a NUMA machine.
+* @param Topology_ The NUMA nodes of the machine.
+*/
+  RenderDaemon(const string & SocketPath_, unsigned int Threads,
+               unsigned int CacheSize_ = DAEMON_CACHE_SIZE,
+               NumaPolicy Policy_ = NUMA_OFF,
+               const NumaTopology & Topology_ = NumaTopology());
+
+/** Accepts clients until an error occurs.
+* @return The exit status.
+*/
+  int run();
+};
+
+
+/** Sends a job to a daemon and waits for it.
+* @param SocketPath The socket of the daemon.
+* @param Request The job.
+* @param Frame Receives the image, unless the daemon wrote it to a file.
+* @param Reply Receives the first line of the reply, or the error.
+* @return False if the job failed.
+*/
+bool submitRender(const string & SocketPath, const RenderRequest & Request,
+                  FrameBuffer & Frame, string & Reply);
+
+#endif //DAEMON_HH
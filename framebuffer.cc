@@ -0,0 +1,198 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file framebuffer.cc Implementation of the FrameBuffer class
+*/
+
+#include <string>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "framebuffer.hh"
+
+
+MappedPFM::MappedPFM(int fd, size_t Length_)
+  : Base(0), Length(Length_), Data(0)
+{
+  int Flags = (fd < 0) ? MAP_PRIVATE | MAP_ANONYMOUS : MAP_SHARED;
+  void * p = mmap(0, Length, PROT_READ | PROT_WRITE, Flags, fd, 0);
+  if (p != MAP_FAILED) Base = (char *) p;
+}
+
+
+MappedPFM::~MappedPFM()
+{
+  if (Base) munmap(Base, Length);
+}
+
+
+FrameBuffer::FrameBuffer(int Width_, int Height_, bool Half_)
+{
+  Half = Half_;
+  resize(Width_, Height_);
+}
+
+
+void FrameBuffer::resize(int Width_, int Height_)
+{
+  assert((Width_ >= 0) && (Height_ >= 0));
+
+  Width = Width_;
+  Height = Height_;
+  Map.reset();
+
+  size_t n = 3 * (size_t) Width * Height;
+
+  if (Half)
+  {
+    HalfData.assign(n, 0);
+    Data.clear();
+  }
+  else
+  {
+    Data.assign(n, 0);
+    HalfData.clear();
+  }
+}
+
+
+size_t FrameBuffer::Bytes() const
+{
+  return Data.size() * sizeof(float) + HalfData.size() * sizeof(unsigned short);
+}
+
+
+bool FrameBuffer::mapPFM(const string & Path, int Width_, int Height_)
+{
+  assert((Width_ > 0) && (Height_ > 0));
+
+  // The scale is padded so that the floats after the header are aligned
+  ostringstream Header;
+  Header << "PF\n" << Width_ << " " << Height_ << "\n"
+         << (littleEndian() ? "-1.0" : "1.0");
+  string Padded = Header.str();
+  if (Padded.find('.') == string::npos) Padded += '.';
+  while ((Padded.size() + 1) % sizeof(float)) Padded += '0';
+  Padded += '\n';
+
+  size_t Length = Padded.size() + 3 * sizeof(float) * (size_t) Width_ * Height_;
+
+  int fd = open(Path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) return false;
+
+  // The pixels start as a hole in the file, which reads as zeros
+  bool ok = (ftruncate(fd, Length) == 0) &&
+            (pwrite(fd, Padded.data(), Padded.size(), 0) ==
+             (ssize_t) Padded.size());
+  boost::shared_ptr<MappedPFM> File;
+  if (ok) File.reset(new MappedPFM(fd, Length));
+  close(fd);
+  if (!ok || !File->Base) return false;
+
+  File->Data = (float *) (File->Base + Padded.size());
+
+  resize(0, 0);
+  Width = Width_;
+  Height = Height_;
+  Map = File;
+  return true;
+}
+
+
+bool FrameBuffer::resizeUntouched(int Width_, int Height_)
+{
+  assert((Width_ > 0) && (Height_ > 0));
+
+  boost::shared_ptr<MappedPFM> Memory(
+    new MappedPFM(-1, 3 * sizeof(float) * (size_t) Width_ * Height_));
+  if (!Memory->Base) return false;
+
+  Memory->Data = (float *) Memory->Base;
+
+  resize(0, 0);
+  Width = Width_;
+  Height = Height_;
+  Map = Memory;
+  return true;
+}
+
+
+void FrameBuffer::getRow(int y, float * rgb) const
+{
+  assert((y >= 0) && (y < Height));
+
+  size_t first = 3 * (size_t) y * Width;
+  int n = 3 * Width;
+
+  if (Map)
+    memcpy(rgb, mapped(0, y), n * sizeof(float));
+  else if (Half)
+    for (int i = 0; i < n; i++) rgb[i] = halfToFloat(HalfData[first + i]);
+  else
+    memcpy(rgb, &Data[first], n * sizeof(float));
+}
+
+
+void FrameBuffer::writePFM(ostream & out) const
+{
+  vector<float> Row(3 * Width);
+
+  // A negative scale marks little endian data
+  out << "PF\n" << Width << " " << Height << "\n-1.0\n";
+
+  // Rows are stored bottom to top
+  for (int y = Height - 1; y >= 0; y--)
+  {
+    getRow(y, &Row[0]);
+    if (!littleEndian()) swapBytes(&Row[0], Row.size());
+    out.write((const char *) &Row[0], Row.size() * sizeof(float));
+  }
+}
+
+
+bool FrameBuffer::readPFM(istream & in)
+{
+  string magic;
+  int w, h;
+  float scale;
+
+  in >> magic >> w >> h >> scale;
+  if (!in || (magic != "PF") || (w <= 0) || (h <= 0)) return false;
+  in.get();    // The single whitespace after the header
+
+  resize(w, h);
+
+  vector<float> Row(3 * Width);
+  bool swapped = (scale < 0) != littleEndian();
+
+  for (int y = Height - 1; y >= 0; y--)
+  {
+    in.read((char *) &Row[0], Row.size() * sizeof(float));
+    if (!in) return false;
+    if (swapped) swapBytes(&Row[0], Row.size());
+
+    for (int x = 0; x < Width; x++)
+      setPixel(x, y, Color(Row[3 * x], Row[3 * x + 1], Row[3 * x + 2]));
+  }
+
+  return true;
+}
@@ -0,0 +1,310 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file framebuffer.hh The FrameBuffer class, a floating point RGB image.
+*/
+
+#ifndef FRAMEBUFFER_HH
+#define FRAMEBUFFER_HH
+
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <boost/shared_ptr.hpp>
+#include "color.hh"
+
+using namespace std;
+
+
+/** Converts a float to an IEEE 754 half precision float.
+* Rounds to nearest, overflows to infinity and flushes tiny values to zero.
+*/
+inline unsigned short floatToHalf(float f)
+{
+  unsigned int bits;
+  memcpy(&bits, &f, sizeof(bits));
+
+  unsigned int sign = (bits >> 16) & 0x8000;
+  int exp = (int) ((bits >> 23) & 0xff) - 127 + 15;
+  unsigned int mant = bits & 0x7fffff;
+
+  if (((bits >> 23) & 0xff) == 0xff)              // Inf or NaN
+    return sign | 0x7c00 | (mant ? 0x200 : 0);
+  if (exp >= 31) return sign | 0x7c00;              // Overflow
+  if (exp <= 0)                                     // Denormal or zero
+  {
+    if (exp < -10) return sign;
+    mant |= 0x800000;
+    unsigned int shift = 14 - exp;
+    unsigned int half = mant >> shift;
+    if ((mant >> (shift - 1)) & 1) half++;
+    return sign | half;
+  }
+
+  unsigned int half = sign | (exp << 10) | (mant >> 13);
+  if (mant & 0x1000) half++;                        // Round, may carry
+  return half;
+}
+
+/** Converts an IEEE 754 half precision float to a float. */
+inline float halfToFloat(unsigned short h)
+{
+  unsigned int sign = (h & 0x8000) << 16;
+  unsigned int exp = (h >> 10) & 0x1f;
+  unsigned int mant = h & 0x3ff;
+  unsigned int bits;
+
+  if (exp == 0)
+  {
+    if (mant == 0)
+      bits = sign;
+    else
+    {
+      // Normalize the denormal
+      exp = 1;
+      while (!(mant & 0x400)) { mant <<= 1; exp--; }
+      mant &= 0x3ff;
+      bits = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+    }
+  }
+  else if (exp == 31)
+    bits = sign | 0x7f800000 | (mant << 13);
+  else
+    bits = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+
+  float f;
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+
+/** True if floats are stored least significant byte first. */
+inline bool littleEndian()
+{
+  unsigned int one = 1;
+  return *(unsigned char *) &one == 1;
+}
+
+/** Reverses the byte order of n floats. */
+inline void swapBytes(float * f, int n)
+{
+  for (int i = 0; i < n; i++)
+  {
+    unsigned char * b = (unsigned char *) (f + i);
+    swap(b[0], b[3]);
+    swap(b[1], b[2]);
+  }
+}
+
+
+/** A PFM image file mapped into memory, see FrameBuffer::mapPFM(), or
+* anonymous memory laid out the same way, see FrameBuffer::resizeUntouched().
+*/
+struct MappedPFM
+{
+/** The start of the mapping, and its length. */
+  char * Base;
+  size_t Length;
+
+/** The pixels, in the rows of the file: bottom to top. */
+  float * Data;
+
+/** Maps a file of the given length, or anonymous memory if fd is -1.
+* Base is null if that failed.
+*/
+  MappedPFM(int fd, size_t Length_);
+
+/** Unmaps the file, which keeps everything written to it. */
+  ~MappedPFM();
+};
+
+
+/** A high dynamic range RGB image.
+* Colors are stored unclamped, as 32 bit floats or, to halve the memory,
+* as 16 bit half floats. Quantization to 8 bits is left to ToneMapper.
+* Images larger than the memory can instead live in a PFM file mapped
+* into memory, see mapPFM().
+* @see ToneMapper
+*/
+class FrameBuffer
+{
+private:
+
+/** The size of the image in pixels. */
+  int Width, Height;
+
+/** True if the pixels are stored as half floats. */
+  bool Half;
+
+/** The pixels as floats, row by row, 3 per pixel. */
+  vector<float> Data;
+
+/** The pixels as half floats, used instead of Data if Half is set. */
+  vector<unsigned short> HalfData;
+
+/** The mapped file, used instead of both if set. */
+  boost::shared_ptr<MappedPFM> Map;
+
+/** Where a pixel is in the mapped file, whose rows go bottom to top. */
+  float * mapped(int x, int y) const;
+
+public:
+
+/** The constructor. All pixels start black.
+* @param Width_ The width of the image.
+* @param Height_ The height of the image.
+* @param Half_ Store the pixels as half floats.
+*/
+  FrameBuffer(int Width_ = 0, int Height_ = 0, bool Half_ = false);
+
+/** Changes the size of the image. The content is lost, and a mapped
+* file is left as it is and no longer used.
+*/
+  void resize(int Width_, int Height_);
+
+/** Keeps the image in a file mapped into memory rather than in memory.
+* The file is created as a PFM image of the given size, all black, in the
+* byte order of the machine and always with floats. Pixels are written
+* straight into it, so once rendered the file is the finished image, and
+* only the pages in use need to be in memory. Rows are contiguous in the
+* file, so rendering a band of rows at a time touches few of them. Copies
+* of the frame buffer share the file.
+* @return False if the file could not be created or mapped.
+*/
+  bool mapPFM(const string & Path, int Width_, int Height_);
+
+/** Like resize(), but the pixels are left untouched until they are first
+* written, so on a NUMA machine each page is placed on the node of the
+* thread that writes it first. Always stores floats.
+* @return False if the memory could not be mapped.
+*/
+  bool resizeUntouched(int Width_, int Height_);
+
+/** True if the image is in mapped memory. */
+  bool isMapped() const;
+
+/** The width of the image. */
+  int getWidth() const;
+
+/** The height of the image. */
+  int getHeight() const;
+
+/** True if the pixels are stored as half floats. */
+  bool isHalf() const;
+
+/** The memory taken by the pixels, in bytes, 0 for a mapped file. */
+  size_t Bytes() const;
+
+/** Sets the color of a pixel. */
+  void setPixel(int x, int y, const Color & C);
+
+/** Returns the color of a pixel. */
+  const Color getPixel(int x, int y) const;
+
+/** Copies a row of pixels out as floats.
+* @param y The row.
+* @param rgb Receives 3 * getWidth() floats.
+*/
+  void getRow(int y, float * rgb) const;
+
+/** Writes the image as a little endian Portable Float Map. */
+  void writePFM(ostream & out) const;
+
+/** Reads an image written by writePFM().
+* @return False if the stream does not hold a color PFM image.
+*/
+  bool readPFM(istream & in);
+};
+
+
+inline int FrameBuffer::getWidth() const
+{
+  return Width;
+}
+
+inline int FrameBuffer::getHeight() const
+{
+  return Height;
+}
+
+inline bool FrameBuffer::isHalf() const
+{
+  return Half;
+}
+
+inline bool FrameBuffer::isMapped() const
+{
+  return Map.get() != 0;
+}
+
+inline float * FrameBuffer::mapped(int x, int y) const
+{
+  return Map->Data + 3 * ((size_t) (Height - 1 - y) * Width + x);
+}
+
+inline void FrameBuffer::setPixel(int x, int y, const Color & C)
+{
+  assert((x >= 0) && (x < Width) && (y >= 0) && (y < Height));
+
+  size_t i = 3 * ((size_t) y * Width + x);
+
+  if (Map)
+  {
+    float * P = mapped(x, y);
+    P[0] = C.get_red();
+    P[1] = C.get_green();
+    P[2] = C.get_blue();
+  }
+  else if (Half)
+  {
+    HalfData[i]     = floatToHalf(C.get_red());
+    HalfData[i + 1] = floatToHalf(C.get_green());
+    HalfData[i + 2] = floatToHalf(C.get_blue());
+  }
+  else
+  {
+    Data[i]     = C.get_red();
+    Data[i + 1] = C.get_green();
+    Data[i + 2] = C.get_blue();
+  }
+}
+
+inline const Color FrameBuffer::getPixel(int x, int y) const
+{
+  assert((x >= 0) && (x < Width) && (y >= 0) && (y < Height));
+
+  size_t i = 3 * ((size_t) y * Width + x);
+
+  if (Map)
+  {
+    const float * P = mapped(x, y);
+    return Color(P[0], P[1], P[2]);
+  }
+  else if (Half)
+    return Color(halfToFloat(HalfData[i]), halfToFloat(HalfData[i + 1]),
+                 halfToFloat(HalfData[i + 2]));
+  else
+    return Color(Data[i], Data[i + 1], Data[i + 2]);
+}
+
+#endif //FRAMEBUFFER_HH
@@ -0,0 +1,73 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file gbuffer.cc Implementation of the GBuffer class
+*/
+
+#include <string>
+#include "gbuffer.hh"
+
+
+GBuffer::GBuffer(int Width_, int Height_)
+{
+  resize(Width_, Height_);
+}
+
+
+void GBuffer::resize(int Width_, int Height_)
+{
+  assert((Width_ >= 0) && (Height_ >= 0));
+
+  GBufferTexel Background;
+  Background.clear();
+
+  Width = Width_;
+  Height = Height_;
+  Texels.assign((size_t) Width * Height, Background);
+}
+
+
+// The header names the texel size, so that a file from a different
+// build is refused instead of misread
+void GBuffer::write(ostream & out) const
+{
+  out << "GBUF\n" << Width << " " << Height << " "
+      << sizeof(GBufferTexel) << "\n";
+  out.write((const char *) &Texels[0], Texels.size() * sizeof(GBufferTexel));
+}
+
+
+bool GBuffer::read(istream & in)
+{
+  string magic;
+  int w, h;
+  size_t texelSize;
+
+  in >> magic >> w >> h >> texelSize;
+  if (!in || (magic != "GBUF") || (w <= 0) || (h <= 0) ||
+      (texelSize != sizeof(GBufferTexel)))
+    return false;
+  in.get();    // The newline after the header
+
+  resize(w, h);
+  in.read((char *) &Texels[0], Texels.size() * sizeof(GBufferTexel));
+  return (bool) in;
+}
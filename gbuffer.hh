@@ -0,0 +1,150 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file gbuffer.hh The GBuffer class, the camera ray hits of an image.
+*/
+
+#ifndef GBUFFER_HH
+#define GBUFFER_HH
+
+#include <cassert>
+#include <iostream>
+#include <vector>
+#include "color.hh"
+
+using namespace std;
+
+
+/** A set of objects, one bit per object, several objects may share a bit.
+* @see Scene::touchBit()
+*/
+typedef unsigned long long TouchMask;
+
+
+/** What the camera ray of one pixel hit.
+* Everything the shading of the hit needs, so that the image can be lit
+* again without intersecting the camera rays.
+*/
+struct GBufferTexel
+{
+/** The index of the object in Scene::SObjects, -1 for the background. */
+  int Object;
+
+/** The weight of the reflection. */
+  float Reflectivity;
+
+/** The transparency of the object, whose rays Relight() traces again. */
+  float Transparency;
+
+/** The hit point in world coordinates. */
+  float Point[3];
+
+/** The surface normal, as the object reported it. */
+  float Normal[3];
+
+/** The color of the object at the hit point. */
+  float BaseColor[3];
+
+/** The objects hit by the camera ray and its reflections. */
+  TouchMask Touched;
+
+/** Makes this the texel of a pixel that sees the background. */
+  void clear();
+};
+
+
+/** The camera ray hits of every pixel of an image.
+* Filled by Scene::Render() and used by Scene::Relight(). It is only
+* valid for the camera and the geometry it was made with; lights may
+* change freely.
+*/
+class GBuffer
+{
+private:
+
+/** The size of the image in pixels. */
+  int Width, Height;
+
+/** The hits, row by row. */
+  vector<GBufferTexel> Texels;
+
+public:
+
+/** The constructor. Every pixel starts as background. */
+  GBuffer(int Width_ = 0, int Height_ = 0);
+
+/** Changes the size. The content is lost. */
+  void resize(int Width_, int Height_);
+
+/** The width of the image. */
+  int getWidth() const;
+
+/** The height of the image. */
+  int getHeight() const;
+
+/** The hit of a pixel. */
+  GBufferTexel & at(int x, int y);
+
+/** The hit of a pixel. */
+  const GBufferTexel & at(int x, int y) const;
+
+/** Writes the buffer as a small header followed by the raw texels. */
+  void write(ostream & out) const;
+
+/** Reads a buffer written by write() on the same kind of machine.
+* @return False if the stream does not hold a G-buffer.
+*/
+  bool read(istream & in);
+};
+
+
+inline void GBufferTexel::clear()
+{
+  Object = -1;
+  Reflectivity = Transparency = 0;
+  Touched = 0;
+  for (int i = 0; i < 3; i++)
+    Point[i] = Normal[i] = BaseColor[i] = 0;
+}
+
+inline int GBuffer::getWidth() const
+{
+  return Width;
+}
+
+inline int GBuffer::getHeight() const
+{
+  return Height;
+}
+
+inline GBufferTexel & GBuffer::at(int x, int y)
+{
+  assert((x >= 0) && (x < Width) && (y >= 0) && (y < Height));
+  return Texels[(size_t) y * Width + x];
+}
+
+inline const GBufferTexel & GBuffer::at(int x, int y) const
+{
+  assert((x >= 0) && (x < Width) && (y >= 0) && (y < Height));
+  return Texels[(size_t) y * Width + x];
+}
+
+#endif //GBUFFER_HH
@@ -0,0 +1,329 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file imagewriter.cc Implementation of the ImageWriter class
+*/
+
+#include <sstream>
+#include <cstdio>
+#include <cerrno>
+#include <cassert>
+#include <fcntl.h>
+#include <unistd.h>
+#include <boost/bind/bind.hpp>
+#include "imagewriter.hh"
+
+
+/** How long the threads sleep when the other side is behind, in us. */
+const unsigned int WRITER_POLL = 100;
+
+
+/** A 32 bit number, most significant byte first, as PNG wants it. */
+static string bigEndian32(unsigned int n)
+{
+  string s(4, 0);
+  for (int i = 0; i < 4; i++) s[i] = (n >> (24 - 8 * i)) & 0xff;
+  return s;
+}
+
+
+ImageWriter::ImageWriter(const string & Path, ImageFormat Format_,
+                         int Width_, int Height_, const ToneMapper & Mapper_,
+                         unsigned int Depth)
+  : Format(Format_), Mapper(Mapper_), Width(Width_), Height(Height_),
+    Slots(Depth), Full(Depth), Free(Depth), Current(-1), NextRow(0),
+    Closing(false), Failed(false), OutOffset(0), DataStart(0),
+    RowBytes(3 * Width_ * sizeof(float)), LastRow(-1), Bytes(3 * Width_),
+    PixelsOnLine(0)
+{
+  assert((Width > 0) && (Height > 0) && (Depth > 0));
+
+  for (unsigned int i = 0; i < Depth; i++)
+  {
+    Slots[i].RGB.resize(3 * Width);
+    Free.push(i);
+  }
+
+  fd = open(Path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) Failed = true;
+
+  ostringstream Header;
+  switch (Format)
+  {
+    case FORMAT_PPM_ASCII:
+      Header << "P3 " << Width << " " << Height << " " << 255 << "\n";
+      break;
+
+    case FORMAT_PPM:
+      Header << "P6\n" << Width << " " << Height << "\n255\n";
+      break;
+
+    case FORMAT_PFM:
+      // A negative scale marks little endian data
+      Header << "PF\n" << Width << " " << Height << "\n-1.0\n";
+      DataStart = Header.str().size();
+      writeAt(Header.str().data(), DataStart, 0);
+      Header.str("");
+      break;
+
+    case FORMAT_PNG:
+    {
+      string Ihdr = bigEndian32(Width) + bigEndian32(Height);
+      Ihdr += string("\x08\x02\x00\x00\x00", 5);  // 8 bit RGB, not interlaced
+
+      Out = "\x89PNG\r\n\x1a\n";
+      pngChunk("IHDR", Ihdr);
+
+      Deflate.zalloc = Z_NULL;
+      Deflate.zfree = Z_NULL;
+      Deflate.opaque = Z_NULL;
+      deflateInit(&Deflate, Z_DEFAULT_COMPRESSION);
+      break;
+    }
+  }
+  Out += Header.str();
+
+  Writer = boost::thread(boost::bind(&ImageWriter::work, this));
+}
+
+
+ImageWriter::~ImageWriter()
+{
+  finish();
+}
+
+
+float * ImageWriter::beginRow(int y)
+{
+  unsigned int i;
+
+  assert((Current < 0) && (y == NextRow) && (y < Height));
+
+  // Only waits if the writer has all the buffers
+  while (!Free.pop(i)) usleep(WRITER_POLL);
+
+  Slots[i].y = y;
+  Current = i;
+  return &Slots[i].RGB[0];
+}
+
+
+void ImageWriter::endRow()
+{
+  assert(Current >= 0);
+
+  // There are as many places in the queue as slots, this cannot fail
+  Full.push(Current);
+  Current = -1;
+  NextRow++;
+}
+
+
+bool ImageWriter::writeFrame(const FrameBuffer & Frame)
+{
+  assert((Frame.getWidth() == Width) && (Frame.getHeight() == Height));
+
+  for (int y = 0; y < Height; y++)
+  {
+    Frame.getRow(y, beginRow(y));
+    endRow();
+  }
+  return finish();
+}
+
+
+bool ImageWriter::finish()
+{
+  if (Writer.joinable())
+  {
+    Closing = true;
+    Writer.join();
+  }
+
+  return !Failed && (NextRow == Height);
+}
+
+
+void ImageWriter::work()
+{
+  unsigned int i;
+
+  while (true)
+  {
+    if (Full.pop(i))
+    {
+      encodeRow(Slots[i]);
+      Free.push(i);
+      if (Out.size() >= WRITER_CHUNK) flush();
+      continue;
+    }
+
+    // Rows queued just before Closing was set are still to be taken
+    if (Closing && !Full.read_available()) break;
+    if (!Closing) usleep(WRITER_POLL);
+  }
+
+  if (Format == FORMAT_PNG)
+  {
+    pngDeflate(Z_FINISH);
+    deflateEnd(&Deflate);
+    pngChunk("IEND", "");
+  }
+  flush();
+
+  if ((fd >= 0) && (close(fd) < 0)) Failed = true;
+}
+
+
+void ImageWriter::encodeRow(const Slot & Row)
+{
+  const float * RGB = &Row.RGB[0];
+  LastRow = Row.y;
+
+  if (Format == FORMAT_PFM)
+  {
+    size_t n = Out.size();
+    Out.append((const char *) RGB, RowBytes);
+    if (!littleEndian()) swapBytes((float *) &Out[n], 3 * Width);
+    return;
+  }
+
+  Mapper.MapRow(RGB, &Bytes[0], 3 * Width);
+
+  if (Format == FORMAT_PPM)
+    Out.append((const char *) &Bytes[0], Bytes.size());
+  else if (Format == FORMAT_PNG)
+  {
+    // Each row starts with its filter type, none
+    string Raw(1, 0);
+    Raw.append((const char *) &Bytes[0], Bytes.size());
+
+    Deflate.next_in = (Bytef *) &Raw[0];
+    Deflate.avail_in = Raw.size();
+    pngDeflate(Z_NO_FLUSH);
+  }
+  else
+  {
+    char Pixel[16];
+
+    for (int x = 0; x < Width; x++)
+    {
+      //Output 4 pixels per line
+      if (PixelsOnLine == 4)
+      {
+        Out += '\n';
+        PixelsOnLine = 0;
+      }
+      PixelsOnLine++;
+
+      snprintf(Pixel, sizeof(Pixel), "%d %d %d ", Bytes[3 * x],
+               Bytes[3 * x + 1], Bytes[3 * x + 2]);
+      Out += Pixel;
+    }
+  }
+}
+
+
+void ImageWriter::flush()
+{
+  if (Out.empty()) return;
+
+  if (Format == FORMAT_PFM)
+  {
+    // Out holds rows top to bottom and ends with LastRow, which is the
+    // first of them in the file
+    size_t Rows = Out.size() / RowBytes;
+    string Block(Out.size(), 0);
+
+    for (size_t r = 0; r < Rows; r++)
+      memcpy(&Block[(Rows - 1 - r) * RowBytes], &Out[r * RowBytes], RowBytes);
+
+    writeAt(Block.data(), Block.size(),
+            DataStart + (off_t) (Height - 1 - LastRow) * RowBytes);
+  }
+  else
+  {
+    writeAt(Out.data(), Out.size(), OutOffset);
+    OutOffset += Out.size();
+  }
+
+  Out.clear();
+}
+
+
+void ImageWriter::writeAt(const char * Data, size_t n, off_t Offset)
+{
+  while ((n > 0) && !Failed)
+  {
+    ssize_t k = pwrite(fd, Data, n, Offset);
+    if ((k < 0) && (errno == EINTR)) continue;
+    if (k <= 0)
+    {
+      Failed = true;
+      return;
+    }
+
+    Data += k;
+    n -= k;
+    Offset += k;
+  }
+}
+
+
+void ImageWriter::pngChunk(const char * Type, const string & Data)
+{
+  string Body = string(Type, 4) + Data;
+  unsigned int Crc = crc32(0, (const Bytef *) Body.data(), Body.size());
+
+  Out += bigEndian32(Data.size()) + Body + bigEndian32(Crc);
+}
+
+
+void ImageWriter::pngDeflate(int Flush)
+{
+  unsigned char Buffer[1 << 16];
+
+  do
+  {
+    Deflate.next_out = Buffer;
+    Deflate.avail_out = sizeof(Buffer);
+    deflate(&Deflate, Flush);
+    Idat.append((const char *) Buffer, sizeof(Buffer) - Deflate.avail_out);
+  }
+  while (Deflate.avail_out == 0);
+
+  if ((Idat.size() >= WRITER_CHUNK) || ((Flush == Z_FINISH) && !Idat.empty()))
+  {
+    pngChunk("IDAT", Idat);
+    Idat.clear();
+  }
+}
+
+
+ImageFormat imageFormatOf(const string & Path, bool Binary)
+{
+  size_t dot = Path.rfind('.');
+  string Extension = (dot == string::npos) ? string() : Path.substr(dot);
+
+  if ((Extension == ".png") || (Extension == ".PNG")) return FORMAT_PNG;
+  if ((Extension == ".pfm") || (Extension == ".PFM")) return FORMAT_PFM;
+  return Binary ? FORMAT_PPM : FORMAT_PPM_ASCII;
+}
@@ -0,0 +1,201 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file imagewriter.hh The ImageWriter class, which encodes and writes an
+* image on its own thread while it is being rendered.
+*/
+
+#ifndef IMAGEWRITER_HH
+#define IMAGEWRITER_HH
+
+#include <string>
+#include <vector>
+#include <zlib.h>
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
+#include "framebuffer.hh"
+#include "tonemap.hh"
+
+using namespace std;
+
+
+/** The number of rows that may wait for the writer by default. */
+const unsigned int WRITER_QUEUE_DEPTH = 32;
+
+/** The writer collects this many bytes before each write to the file. */
+const size_t WRITER_CHUNK = 1 << 20;
+
+
+/** The image file formats. */
+enum ImageFormat
+{
+/** Plain (P3) PNM, tone mapped. */
+  FORMAT_PPM_ASCII,
+/** Binary (P6) PNM, tone mapped. */
+  FORMAT_PPM,
+/** 8 bit RGB PNG, tone mapped. */
+  FORMAT_PNG,
+/** Portable Float Map, the unclamped colors. */
+  FORMAT_PFM
+};
+
+
+/** Writes an image row by row from a thread of its own.
+* The renderer fills a row buffer obtained from beginRow() and hands it
+* over with endRow(); the writer thread tone maps, encodes and writes it
+* in large chunks. Rows travel through lock-free single producer, single
+* consumer queues and their buffers are reused, so at most Depth rows
+* exist at a time and the renderer only ever waits when all of them are
+* still queued. Rows must be given top to bottom, by a single thread.
+*/
+class ImageWriter
+{
+private:
+
+/** A row buffer. */
+  struct Slot
+  {
+    int y;
+    vector<float> RGB;
+  };
+
+/** The format written. */
+  ImageFormat Format;
+
+/** The tone mapping of the 8 bit formats. */
+  ToneMapper Mapper;
+
+/** The size of the image. */
+  int Width, Height;
+
+/** The file descriptor, -1 if the file could not be created. */
+  int fd;
+
+/** The row buffers. */
+  vector<Slot> Slots;
+
+/** Indices of the rows waiting for the writer, and of the unused slots. */
+  boost::lockfree::spsc_queue<unsigned int> Full, Free;
+
+/** The slot being filled by the renderer, -1 if none. */
+  int Current;
+
+/** The next row the renderer must give. */
+  int NextRow;
+
+/** Set by finish() once the last row has been queued. */
+  boost::atomic<bool> Closing;
+
+/** Set if a write failed. */
+  boost::atomic<bool> Failed;
+
+/** Encoded bytes not written yet. */
+  string Out;
+
+/** Where Out goes in the file, for the formats written front to back. */
+  off_t OutOffset;
+
+/** The size of the PFM header, and of a PFM row. */
+  off_t DataStart;
+  size_t RowBytes;
+
+/** The last row encoded. */
+  int LastRow;
+
+/** The tone mapped row, used by the writer thread. */
+  vector<unsigned char> Bytes;
+
+/** The deflate stream of PNG images, and its output not in a chunk yet. */
+  z_stream Deflate;
+  string Idat;
+
+/** Plain PNM puts 4 pixels per line, across rows. */
+  int PixelsOnLine;
+
+/** The writer thread. */
+  boost::thread Writer;
+
+/** The loop of the writer thread. */
+  void work();
+
+/** Encodes a row into Out. */
+  void encodeRow(const Slot & Row);
+
+/** Writes Out to the file. PFM rows are turned bottom to top first. */
+  void flush();
+
+/** Writes n bytes at an offset of the file, sets Failed on errors. */
+  void writeAt(const char * Data, size_t n, off_t Offset);
+
+/** Adds a PNG chunk to Out. */
+  void pngChunk(const char * Type, const string & Data);
+
+/** Runs the deflate stream and puts what it produced into IDAT chunks.
+* @param Flush Z_NO_FLUSH while rows come, Z_FINISH after the last one.
+*/
+  void pngDeflate(int Flush);
+
+public:
+
+/** Creates the file and starts the writer thread.
+* @param Path The file.
+* @param Format_ Its format.
+* @param Width_ The width of the image.
+* @param Height_ The height of the image.
+* @param Mapper_ The tone mapping, unused for PFM.
+* @param Depth The number of row buffers.
+*/
+  ImageWriter(const string & Path, ImageFormat Format_, int Width_, int Height_,
+              const ToneMapper & Mapper_ = ToneMapper(),
+              unsigned int Depth = WRITER_QUEUE_DEPTH);
+
+/** Finishes the image if finish() was not called. */
+  ~ImageWriter();
+
+/** A buffer for the next row, 3 floats per pixel.
+* @param y The row, one more than the last one given.
+*/
+  float * beginRow(int y);
+
+/** Queues the row filled since beginRow(). */
+  void endRow();
+
+/** Writes a whole image of the writer's size and finishes.
+* @return The result of finish().
+*/
+  bool writeFrame(const FrameBuffer & Frame);
+
+/** Waits until everything is written and closes the file.
+* @return False if the file could not be written in full.
+*/
+  bool finish();
+};
+
+
+/** The format of an image file, from its extension: .png, .pfm, or PNM
+* for anything else.
+* @param Path The file name.
+* @param Binary Use binary rather than plain PNM.
+*/
+ImageFormat imageFormatOf(const string & Path, bool Binary);
+
+#endif //IMAGEWRITER_HH
@@ -20,7 +20,19 @@
 
 
 #include <fstream>
+#include <ctime>
+#include <getopt.h>
 #include "parser.hh"
+#include "tonemap.hh"
+#include "wavefront.hh"
+#include "watch.hh"
+#include "daemon.hh"
+#include "imagewriter.hh"
+#include "texture.hh"
+#include "scene_objects/sdf.hh"
+#include "scene_objects/chunked.hh"
+#include <climits>
+#include <cstdlib>
 #include "scene_objects/objects.hh"
 #include <memory>
 //#include "boost/shared_ptr.hpp"
@@ -28,19 +40,493 @@
 using namespace std;
 
 
+void usage(const char * name)
+{
+  cerr << "Usage: " << name << " [options] SIZE scene.txt\n"
+       << "       " << name << " [options] --from-pfm image.pfm\n"
+       << "       " << name << " --daemon SOCKET [--threads N] [--numa POLICY]\n"
+       << "       " << name << " [options] --submit SOCKET SIZE scene.txt|hash:HASH\n\n"
+       << "SIZE is N for N x N pixels, or WIDTHxHEIGHT.\n\n"
+       << "Options:\n"
+       << "  -o, --output FILE    8 bit image to write (default scene.ppm)\n"
+       << "  --binary             write a binary (P6) instead of a plain PNM\n"
+       << "  --hdr FILE           also write the unclamped image as PFM\n"
+       << "  --half               keep the frame buffer in half floats\n"
+       << "  --mmap FILE          keep the frame buffer in FILE, which ends up\n"
+       << "                       as the PFM image, rather than in memory\n"
+       << "  --wavefront          render one bounce at a time over ray queues\n"
+       << "  --sort-rays          like --wavefront, sorting the reflected rays\n"
+       << "  --order ORDER        pixel order: rows (default), or morton or\n"
+       << "                       hilbert within 16x16 tiles\n"
+       << "  --gbuffer FILE       save the camera ray hits for --relight\n"
+       << "  --relight FILE       shade the hits saved by --gbuffer with the\n"
+       << "                       lights of scene.txt instead of tracing the\n"
+       << "                       camera rays; camera and objects must match\n"
+       << "  --stream             hand rows to the image writers as they are\n"
+       << "                       done instead of keeping the whole image\n"
+       << "  --watch              keep running, and render again what changed\n"
+       << "                       every time scene.txt is saved\n"
+       << "  --daemon SOCKET      serve render jobs on a Unix domain socket\n"
+       << "  --threads N          render threads of the daemon (default: one\n"
+       << "                       per processor)\n"
+       << "  --numa POLICY        NUMA placement of the daemon: off (default),\n"
+       << "                       pin the threads to the nodes, and also\n"
+       << "                       interleave or replicate the scenes\n"
+       << "  --numa-nodes N       pretend the processors form N NUMA nodes\n"
+       << "  --submit SOCKET      have the daemon on SOCKET render the image\n"
+       << "  --priority N         job priority, higher runs first (default 0)\n"
+       << "  --region X,Y,W,H     render only this part of the image\n"
+       << "  --camera P,L,U,FOV   replace the camera: 3 numbers for each of\n"
+       << "                       the position, look at point and up vector\n"
+       << "  --remote-pfm FILE    have the daemon write the PFM image itself\n"
+       << "  --texture-cache MB   memory for texture tiles (default 64)\n"
+       << "  --geometry-cache MB  memory for the chunks of <chunkedmesh>\n"
+       << "                       objects (default 256)\n"
+       << "  --ray-budget N       rays traced per pixel at most (default 64)\n"
+       << "  --min-weight W       trace the weaker ray at transparent surfaces\n"
+       << "                       only now and then below this weight\n"
+       << "                       (default 0.01)\n"
+       << "  --samples N          rays per pixel, spread over the pixel\n"
+       << "                       (default 1)\n"
+       << "  --sampler TYPE       sobol (default) or random placement of them\n"
+       << "  --motion-samples N   rays per pixel at least when objects move\n"
+       << "                       (default 16)\n"
+       << "  --shutter OPEN,CLOSE scene times, within 0 to 1, the shutter is\n"
+       << "                       open between (default 0,1)\n"
+       << "  --from-pfm FILE      tone map a PFM image instead of rendering\n"
+       << "  --exposure F         multiply the colors by F (default 1)\n"
+       << "  --gamma F            display gamma (default 1)\n"
+       << "  --tonemap CURVE      clamp (default) or reinhard\n";
+}
+
+
+/** Reads an image size, N or WIDTHxHEIGHT.
+* @return False if it is not one of at least 2 x 2 pixels.
+*/
+bool parseImageSize(const char * Text, int & Width, int & Height)
+{
+  char Extra;
+  int n = sscanf(Text, "%dx%d%c", &Width, &Height, &Extra);
+
+  if (n == 1) Height = Width;
+  return ((n == 1) || (n == 2)) && (Width >= 2) && (Height >= 2);
+}
+
+
+/** Writes the 8 bit image, and the PFM one if asked for.
+* @return False, after saying so, if a file could not be written.
+*/
+bool writeImages(const FrameBuffer & Frame, const ToneMapper & Mapper,
+                 const string & output, const string & hdrOutput, bool binary)
+{
+  int w = Frame.getWidth(), h = Frame.getHeight();
+  bool ok = true;
+
+  if (!hdrOutput.empty() &&
+      !ImageWriter(hdrOutput, FORMAT_PFM, w, h).writeFrame(Frame))
+  {
+    cerr << "Could not write " << hdrOutput << endl;
+    ok = false;
+  }
+
+  if (!ImageWriter(output, imageFormatOf(output, binary), w, h, Mapper)
+      .writeFrame(Frame))
+  {
+    cerr << "Could not write " << output << endl;
+    ok = false;
+  }
+  return ok;
+}
+
+
+/** Renders the image a band of rows at a time, handing each band to the
+* writers as soon as it is done, so that the whole image is never kept.
+* @return False if an image could not be written.
+*/
+bool renderStreaming(const Scene & Sc, const Camera & Cr, int Width, int Height,
+                     PixelOrder Order, bool half, ImageWriter & Out,
+                     ImageWriter * Hdr)
+{
+  int Band = (Order == ORDER_ROWS) ? 1 : TILE_SIZE;
+  FrameBuffer Rows(Width, Band, half);
+
+  for (int y0 = 0; y0 < Height; y0 += Band)
+  {
+    if (Height - y0 < Band) Rows.resize(Width, Height - y0);
+    Sc.RenderRows(Cr, Height, y0, Rows, Order);
+
+    for (int y = 0; y < Rows.getHeight(); y++)
+    {
+      Rows.getRow(y, Out.beginRow(y0 + y));
+      Out.endRow();
+      if (Hdr)
+      {
+        Rows.getRow(y, Hdr->beginRow(y0 + y));
+        Hdr->endRow();
+      }
+    }
+  }
+
+  bool ok = Out.finish();
+  if (Hdr && !Hdr->finish()) ok = false;
+  return ok;
+}
+
+
 int main(int argc, char** argv)
 {
-  Scene * Sc = new Scene;
-  Camera * Cr;
-  
-  unsigned int imgSize = atoi(argv[1]);
-  
-  cout << "Trying to read scene description from: " << argv[2] << endl;
-  ifstream fin(argv[2]); 
-  ofstream file("scene.ppm");
-   
-  readScene(fin, Sc, & Cr);
-  Sc->Render(*Cr, imgSize, file);
+  string output = "scene.ppm", hdrOutput, fromPFM, gbufOutput, relightInput;
+  string mapFile;
+  bool binary = false, half = false, wavefront = false, sortRays = false;
+  bool watch = false, stream = false;
+  string daemonSocket, submitSocket;
+  unsigned int threads = boost::thread::hardware_concurrency();
+  NumaPolicy numaPolicy = NUMA_OFF;
+  int numaNodes = 0;
+  int rayBudget = RAY_BUDGET;
+  float minWeight = MIN_RAY_WEIGHT;
+  int motionSamples = MOTION_SAMPLES, pixelSamples = 1;
+  SamplerType Sampling = SAMPLER_SOBOL;
+  float shutterOpen = 0, shutterClose = 1;
+  RenderRequest Job;
+  ToneMapper Mapper;
+  PixelOrder Order = ORDER_ROWS;
+
+  static struct option longOptions[] =
+  {
+    {"output",   required_argument, 0, 'o'},
+    {"binary",   no_argument,       0, 'b'},
+    {"hdr",      required_argument, 0, 'H'},
+    {"half",     no_argument,       0, 'h'},
+    {"mmap",     required_argument, 0, 'M'},
+    {"wavefront", no_argument,      0, 'w'},
+    {"sort-rays", no_argument,      0, 's'},
+    {"order",    required_argument, 0, 'r'},
+    {"gbuffer",  required_argument, 0, 'G'},
+    {"relight",  required_argument, 0, 'R'},
+    {"watch",    no_argument,       0, 'W'},
+    {"stream",   no_argument,       0, 'm'},
+    {"daemon",   required_argument, 0, 'D'},
+    {"threads",  required_argument, 0, 'T'},
+    {"numa",     required_argument, 0, 'N'},
+    {"numa-nodes", required_argument, 0, 'n'},
+    {"submit",   required_argument, 0, 'S'},
+    {"priority", required_argument, 0, 'P'},
+    {"region",   required_argument, 0, 'x'},
+    {"camera",   required_argument, 0, 'c'},
+    {"remote-pfm", required_argument, 0, 'O'},
+    {"texture-cache", required_argument, 0, 'X'},
+    {"geometry-cache", required_argument, 0, 'C'},
+    {"ray-budget", required_argument, 0, 'B'},
+    {"min-weight", required_argument, 0, 'L'},
+    {"samples",  required_argument, 0, 'A'},
+    {"sampler",  required_argument, 0, 'Q'},
+    {"motion-samples", required_argument, 0, 'q'},
+    {"shutter",  required_argument, 0, 'u'},
+    {"from-pfm", required_argument, 0, 'f'},
+    {"exposure", required_argument, 0, 'e'},
+    {"gamma",    required_argument, 0, 'g'},
+    {"tonemap",  required_argument, 0, 't'},
+    {0, 0, 0, 0}
+  };
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "o:", longOptions, 0)) != -1)
+  {
+    switch (opt)
+    {
+      case 'o': output = optarg; break;
+      case 'b': binary = true; break;
+      case 'H': hdrOutput = optarg; break;
+      case 'h': half = true; break;
+      case 'M': mapFile = optarg; break;
+      case 'w': wavefront = true; break;
+      case 's': wavefront = sortRays = true; break;
+      case 'r':
+        if (!parsePixelOrder(optarg, Order)) { usage(argv[0]); return 1; }
+        break;
+      case 'G': gbufOutput = optarg; break;
+      case 'R': relightInput = optarg; break;
+      case 'W': watch = true; break;
+      case 'm': stream = true; break;
+      case 'D': daemonSocket = optarg; break;
+      case 'T':
+        if (atoi(optarg) <= 0) { usage(argv[0]); return 1; }
+        threads = atoi(optarg);
+        break;
+      case 'N':
+        if (!parseNumaPolicy(optarg, numaPolicy)) { usage(argv[0]); return 1; }
+        break;
+      case 'n':
+        if (atoi(optarg) <= 0) { usage(argv[0]); return 1; }
+        numaNodes = atoi(optarg);
+        break;
+      case 'S': submitSocket = optarg; break;
+      case 'P': Job.Priority = atoi(optarg); break;
+      case 'x':
+        if (sscanf(optarg, "%d,%d,%d,%d", &Job.Region[0], &Job.Region[1],
+                   &Job.Region[2], &Job.Region[3]) != 4 || (Job.Region[2] <= 0))
+        { usage(argv[0]); return 1; }
+        break;
+      case 'c':
+      {
+        float * C = Job.Camera;
+        if (sscanf(optarg, "%f,%f,%f,%f,%f,%f,%f,%f,%f,%f", C, C + 1, C + 2,
+                   C + 3, C + 4, C + 5, C + 6, C + 7, C + 8, C + 9) != 10)
+        { usage(argv[0]); return 1; }
+        Job.OverrideCamera = true;
+        break;
+      }
+      case 'O': Job.Output = optarg; break;
+      case 'X':
+        if (atoi(optarg) <= 0) { usage(argv[0]); return 1; }
+        textureCache().resize(atoi(optarg));
+        break;
+      case 'C':
+        if (atoi(optarg) <= 0) { usage(argv[0]); return 1; }
+        geometryCache().resize(atoi(optarg));
+        break;
+      case 'B':
+        if (atoi(optarg) <= 0) { usage(argv[0]); return 1; }
+        rayBudget = atoi(optarg);
+        break;
+      case 'L':
+        if (atof(optarg) < 0) { usage(argv[0]); return 1; }
+        minWeight = atof(optarg);
+        break;
+      case 'A':
+        if (atoi(optarg) <= 0) { usage(argv[0]); return 1; }
+        pixelSamples = atoi(optarg);
+        break;
+      case 'Q':
+        if (!parseSamplerType(optarg, Sampling)) { usage(argv[0]); return 1; }
+        break;
+      case 'q':
+        if (atoi(optarg) <= 0) { usage(argv[0]); return 1; }
+        motionSamples = atoi(optarg);
+        break;
+      case 'u':
+        if ((sscanf(optarg, "%f,%f", &shutterOpen, &shutterClose) != 2) ||
+            (shutterOpen < 0) || (shutterOpen > shutterClose) ||
+            (shutterClose > 1))
+        { usage(argv[0]); return 1; }
+        break;
+      case 'f': fromPFM = optarg; break;
+      case 'e': Mapper.Exposure = atof(optarg); break;
+      case 'g':
+        if (atof(optarg) <= 0) { usage(argv[0]); return 1; }
+        Mapper.setGamma(atof(optarg));
+        break;
+      case 't':
+        if (!parseToneCurve(optarg, Mapper.Curve)) { usage(argv[0]); return 1; }
+        break;
+      default: usage(argv[0]); return 1;
+    }
+  }
+
+  FrameBuffer Frame(0, 0, half);
+
+  if (!daemonSocket.empty())
+  {
+    RenderDaemon Daemon(daemonSocket, threads > 0 ? threads : 1,
+                        DAEMON_CACHE_SIZE, numaPolicy,
+                        numaNodes > 0 ? NumaTopology::simulate(numaNodes) :
+                                        NumaTopology::detect());
+    return Daemon.run();
+  }
+
+  if (!submitSocket.empty())
+  {
+    if (argc - optind < 2)
+    {
+      usage(argv[0]);
+      return 1;
+    }
+
+    // The daemon runs elsewhere, so it needs the full path of the scene
+    string Name = argv[optind + 1];
+    char Path[PATH_MAX];
+    if (Name.compare(0, 5, "hash:") == 0) Job.SceneHash = Name.substr(5);
+    else if (realpath(Name.c_str(), Path)) Job.ScenePath = Path;
+    else
+    {
+      cerr << "Could not open " << Name << endl;
+      return 1;
+    }
+    int Width, Height;
+    if (!parseImageSize(argv[optind], Width, Height) || (Width != Height))
+    {
+      cerr << "The daemon renders square images of at least 2 pixels\n";
+      return 1;
+    }
+    Job.Size = Width;
+
+    string Reply;
+    if (!submitRender(submitSocket, Job, Frame, Reply))
+    {
+      cerr << "The job failed: " << Reply << endl;
+      return 1;
+    }
+    cout << Reply << endl;
+    if (!Job.Output.empty()) return 0;
+  }
+  else if (!fromPFM.empty())
+  {
+    // Re-exposing an existing image, no rendering needed
+    ifstream fin(fromPFM.c_str(), ios::binary);
+    if (!Frame.readPFM(fin))
+    {
+      cerr << "Could not read a PFM image from " << fromPFM << endl;
+      return 1;
+    }
+  }
+  else
+  {
+    if (argc - optind < 2)
+    {
+      usage(argv[0]);
+      return 1;
+    }
+
+    int Width, Height;
+    if (!parseImageSize(argv[optind], Width, Height))
+    {
+      cerr << "The image size must be at least 2 x 2 pixels\n";
+      return 1;
+    }
+
+    if (watch)
+    {
+      if (Width != Height)
+      {
+        cerr << "--watch renders square images\n";
+        return 1;
+      }
+      SceneWatcher Watcher(argv[optind + 1], Width, Order, half);
+
+      cout << "Watching " << argv[optind + 1] << endl;
+      do
+      {
+        if (Watcher.update())
+          (void) writeImages(Watcher.getFrame(), Mapper, output, hdrOutput, binary);
+      }
+      while (Watcher.wait());
+      return 1;
+    }
+
+    Scene * Sc = new Scene;
+    Camera * Cr = 0;
+
+    cout << "Trying to read scene description from: " << argv[optind + 1] << endl;
+    ifstream fin(argv[optind + 1]); 
+    if (!fin)
+    {
+      cerr << "Could not open " << argv[optind + 1] << endl;
+      return 1;
+    }
+
+    try
+    {
+      readScene(fin, Sc, & Cr);
+    }
+    catch (invalid_argument & e)
+    {
+      cerr << argv[optind + 1] << ": " << e.what() << endl;
+      return 1;
+    }
+
+    if (Cr == 0)
+    {
+      cerr << "The scene has no camera\n";
+      return 1;
+    }
+
+    if (!Sc->finalize()) return 1;
+    Sc->setRayBudget(rayBudget, minWeight);
+    Sc->setMotionBlur(motionSamples, shutterOpen, shutterClose);
+    Sc->setSampling(pixelSamples, Sampling);
+
+    GBuffer GBuf;
+    if (!relightInput.empty())
+    {
+      ifstream gin(relightInput.c_str(), ios::binary);
+      if (!GBuf.read(gin))
+      {
+        cerr << "Could not read a G-buffer from " << relightInput << endl;
+        return 1;
+      }
+      if ((GBuf.getWidth() != Width) || (GBuf.getHeight() != Height))
+      {
+        cerr << relightInput << " was saved at " << GBuf.getWidth() << "x"
+             << GBuf.getHeight() << " pixels, not " << Width << "x" << Height
+             << endl;
+        return 1;
+      }
+    }
+
+    if (stream)
+    {
+      if (wavefront || !gbufOutput.empty() || !relightInput.empty() ||
+          !mapFile.empty())
+      {
+        cerr << "--stream only works with the plain renderer\n";
+        return 1;
+      }
+
+      ImageWriter Out(output, imageFormatOf(output, binary), Width, Height,
+                      Mapper);
+      ImageWriter * Hdr = hdrOutput.empty() ? 0 :
+        new ImageWriter(hdrOutput, FORMAT_PFM, Width, Height);
+
+      clock_t start = clock();
+      bool ok = renderStreaming(*Sc, *Cr, Width, Height, Order, half, Out, Hdr);
+      cout << "Render time: " << (double) (clock() - start) / CLOCKS_PER_SEC
+           << "s" << endl;
+      if (textureCache().lookups() > 0) textureCache().report(cout);
+      if (geometryCache().lookups() > 0) geometryCache().report(cout);
+      if (sphereTraceStats().rays() > 0) sphereTraceStats().report(cout);
+
+      delete Hdr;
+      delete Cr;
+      delete Sc;
+      if (!ok) cerr << "Could not write the image\n";
+      return ok ? 0 : 1;
+    }
+
+    if (mapFile.empty())
+      Frame.resize(Width, Height);
+    else if (!Frame.mapPFM(mapFile, Width, Height))
+    {
+      cerr << "Could not map " << mapFile << endl;
+      return 1;
+    }
+    clock_t start = clock();
+    if (!relightInput.empty())
+      Sc->Relight(*Cr, GBuf, Frame);
+    else if (wavefront && gbufOutput.empty())
+    {
+      WavefrontRenderer Renderer(*Sc, WAVEFRONT_BATCH, sortRays, Order);
+      Renderer.Render(*Cr, Frame);
+      Renderer.PrintStats(cout);
+    }
+    else
+      Sc->Render(*Cr, Frame, Order, gbufOutput.empty() ? 0 : &GBuf);
+    cout << "Render time: " << (double) (clock() - start) / CLOCKS_PER_SEC
+         << "s" << endl;
+    if (textureCache().lookups() > 0) textureCache().report(cout);
+    if (geometryCache().lookups() > 0) geometryCache().report(cout);
+    if (sphereTraceStats().rays() > 0) sphereTraceStats().report(cout);
+
+    if (!gbufOutput.empty())
+    {
+      ofstream gout(gbufOutput.c_str(), ios::binary);
+      GBuf.write(gout);
+    }
+
+    delete Cr;
+    delete Sc;
+  }
+
+  if (!writeImages(Frame, Mapper, output, hdrOutput, binary)) return 1;
  return 0;
 }
-
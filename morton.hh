@@ -0,0 +1,111 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file morton.hh Morton (Z-order) codes and a radix sort for 32 bit keys.
+*/
+
+#ifndef MORTON_HH
+#define MORTON_HH
+
+#include <vector>
+
+using namespace std;
+
+
+/** Spreads the lower 10 bits of x so that two zero bits follow each. */
+inline unsigned int spreadBits3(unsigned int x)
+{
+  x &= 0x3ff;
+  x = (x | (x << 16)) & 0x030000ff;
+  x = (x | (x << 8))  & 0x0300f00f;
+  x = (x | (x << 4))  & 0x030c30c3;
+  x = (x | (x << 2))  & 0x09249249;
+  return x;
+}
+
+/** Interleaves the lower 10 bits of three coordinates, x lowest. */
+inline unsigned int morton3(unsigned int x, unsigned int y, unsigned int z)
+{
+  return spreadBits3(x) | (spreadBits3(y) << 1) | (spreadBits3(z) << 2);
+}
+
+
+/** Gathers every second bit of x, the inverse of spreading by one. */
+inline unsigned int compactBits2(unsigned int x)
+{
+  x &= 0x55555555;
+  x = (x | (x >> 1)) & 0x33333333;
+  x = (x | (x >> 2)) & 0x0f0f0f0f;
+  x = (x | (x >> 4)) & 0x00ff00ff;
+  x = (x | (x >> 8)) & 0x0000ffff;
+  return x;
+}
+
+/** Splits a 2D Morton code into its coordinates, x in the even bits. */
+inline void mortonDecode2(unsigned int code, unsigned int & x, unsigned int & y)
+{
+  x = compactBits2(code);
+  y = compactBits2(code >> 1);
+}
+
+
+/** Sorts indices by 32 bit keys.
+* A stable least significant digit radix sort, one byte per pass; passes
+* in which all keys share the digit are skipped.
+* @param Keys The keys. Reordered along with Order.
+* @param Order Receives the positions the sorted keys had in Keys.
+*/
+inline void radixSort(vector<unsigned int> & Keys, vector<unsigned int> & Order)
+{
+  unsigned int n = Keys.size();
+  vector<unsigned int> TmpKeys(n), TmpOrder(n);
+
+  Order.resize(n);
+  for (unsigned int i = 0; i < n; i++) Order[i] = i;
+
+  for (int shift = 0; shift < 32; shift += 8)
+  {
+    unsigned int Count[256] = {0};
+
+    for (unsigned int i = 0; i < n; i++) Count[(Keys[i] >> shift) & 0xff]++;
+    if ((n == 0) || (Count[(Keys[0] >> shift) & 0xff] == n)) continue;
+
+    unsigned int sum = 0;
+    for (int d = 0; d < 256; d++)
+    {
+      unsigned int c = Count[d];
+      Count[d] = sum;
+      sum += c;
+    }
+
+    for (unsigned int i = 0; i < n; i++)
+    {
+      unsigned int dst = Count[(Keys[i] >> shift) & 0xff]++;
+      TmpKeys[dst] = Keys[i];
+      TmpOrder[dst] = Order[i];
+    }
+
+    Keys.swap(TmpKeys);
+    Order.swap(TmpOrder);
+  }
+}
+
+#endif //MORTON_HH
@@ -0,0 +1,128 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file motionbvh.cc Construction of the motion BVH.
+*/
+
+#include "motionbvh.hh"
+
+/** The largest leaf of the motion BVH. Moving primitives are usually whole
+* objects, whose own tests are costly, so the leaves are kept small.
+*/
+const unsigned int MOTION_BVH_LEAF = 2;
+
+
+/** Copies a box into the arrays of a node. */
+static void storeBox(const BBox & Box, float Min[3], float Max[3])
+{
+  for (int i = 0; i < 3; i++)
+  {
+    Min[i] = Box.Min[i];
+    Max[i] = Box.Max[i];
+  }
+}
+
+
+/** Reads a box back from the arrays of a node. */
+static const BBox loadBox(const float Min[3], const float Max[3])
+{
+  return BBox(Vector3D(Min[0], Min[1], Min[2]),
+              Vector3D(Max[0], Max[1], Max[2]));
+}
+
+
+void MotionBVH::Build(const vector<BBox> & Start, const vector<BBox> & End,
+                      unsigned int Segments_)
+{
+  assert((Segments_ > 0) && (Segments_ <= MOTION_BVH_MAX_SEGMENTS));
+  assert((Start.size() == End.size()) && (Start.size() % Segments_ == 0));
+
+  Segments = Segments_;
+
+  unsigned int n = Start.size() / Segments;
+  vector<BBox> Swept(n);
+  for (unsigned int p = 0; p < n; p++)
+    for (unsigned int k = 0; k < Segments; k++)
+    {
+      Swept[p].extend(Start[p * Segments + k]);
+      Swept[p].extend(End[p * Segments + k]);
+    }
+
+  // The topology is the one of a static tree over the swept boxes
+  BVH Static;
+  Static.Build(Swept, MOTION_BVH_LEAF);
+
+  Nodes.resize(Static.Nodes.size());
+  Boxes.resize(Nodes.size() * Segments);
+  Indices = Static.Indices;
+
+  // Children follow their parents in the array, so walking it backwards
+  // refits every node after its children
+  for (unsigned int i = Nodes.size(); i-- > 0; )
+  {
+    MotionBVHNode & Node = Nodes[i];
+
+    Node.Offset = Static.Nodes[i].Offset;
+    Node.Count = Static.Nodes[i].Count;
+
+    for (unsigned int k = 0; k < Segments; k++)
+    {
+      BBox Box0, Box1;
+
+      if (Node.Count > 0)
+      {
+        for (unsigned int j = 0; j < Node.Count; j++)
+        {
+          Box0.extend(Start[Indices[Node.Offset + j] * Segments + k]);
+          Box1.extend(End[Indices[Node.Offset + j] * Segments + k]);
+        }
+      }
+      else
+      {
+        const MotionBVHBounds & L = Boxes[(i + 1) * Segments + k];
+        const MotionBVHBounds & R = Boxes[Node.Offset * Segments + k];
+        Box0 = loadBox(L.Min0, L.Max0);
+        Box0.extend(loadBox(R.Min0, R.Max0));
+        Box1 = loadBox(L.Min1, L.Max1);
+        Box1.extend(loadBox(R.Min1, R.Max1));
+      }
+
+      MotionBVHBounds & B = Boxes[i * Segments + k];
+      storeBox(Box0, B.Min0, B.Max0);
+      storeBox(Box1, B.Min1, B.Max1);
+    }
+  }
+}
+
+
+const BBox MotionBVH::Bounds() const
+{
+  BBox Box;
+  if (Nodes.empty()) return Box;
+
+  // The root comes first, its segments are the first boxes
+  for (unsigned int k = 0; k < Segments; k++)
+  {
+    Box.extend(loadBox(Boxes[k].Min0, Boxes[k].Max0));
+    Box.extend(loadBox(Boxes[k].Min1, Boxes[k].Max1));
+  }
+  return Box;
+}
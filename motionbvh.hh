@@ -0,0 +1,211 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file motionbvh.hh A bounding volume hierarchy over moving primitives.
+*/
+
+#ifndef MOTIONBVH_HH
+#define MOTIONBVH_HH
+
+#include <vector>
+#include "bvh.hh"
+
+using namespace std;
+
+/** The most parts scene time is cut into by a motion BVH. */
+const unsigned int MOTION_BVH_MAX_SEGMENTS = 8;
+
+/** A node of the motion BVH (8 bytes), laid out like BVHNode without the
+* bounds: the left child of an interior node immediately follows it.
+*/
+struct MotionBVHNode
+{
+/** First entry in MotionBVH::Indices for a leaf, the right child for an
+* interior node.
+*/
+  unsigned int Offset;
+
+/** The number of primitives in a leaf. Zero for interior nodes. */
+  unsigned int Count;
+};
+
+/** The bounds of a node over one segment of scene time (48 bytes): the
+* box at its start and the box at its end. In between, the node lies in
+* the linear blend of the two.
+*/
+struct MotionBVHBounds
+{
+  float Min0[3], Max0[3];
+  float Min1[3], Max1[3];
+};
+
+
+/** A binary bounding volume hierarchy over primitives that move while the
+* shutter is open.
+* One tree serves every ray time: the tree is built once over the boxes
+* swept by the primitives, then every node is refit to the boxes at the
+* ends of each of a few equal segments of scene time, 0 to 1. Traverse()
+* blends those of the segment the ray falls in, so a ray only meets the
+* nodes the primitives are near at its time, and costs little more than
+* in a static tree. Motion along a curve, or through several keys, is
+* bounded more tightly by more segments.
+*/
+class MotionBVH
+{
+public:
+
+/** The nodes, the root being the first one. */
+  vector<MotionBVHNode> Nodes;
+
+/** The bounds of node n over segment k are Boxes[n * Segments + k]. */
+  vector<MotionBVHBounds> Boxes;
+
+/** The primitive indices referenced by the leaves. */
+  vector<unsigned int> Indices;
+
+/** The number of segments scene time is cut into. */
+  unsigned int Segments;
+
+/** The constructor. Builds an empty hierarchy. */
+  MotionBVH(): Segments(1) {}
+
+/** Builds the hierarchy.
+* @param Start The bounding box of every primitive at the start of every
+* segment, primitive after primitive: Start[p * Segments_ + k].
+* @param End The same at the ends of the segments.
+* @param Segments_ The number of segments, at most MOTION_BVH_MAX_SEGMENTS.
+*/
+  void Build(const vector<BBox> & Start, const vector<BBox> & End,
+             unsigned int Segments_ = 1);
+
+/** True if the hierarchy holds no primitives. */
+  bool empty() const;
+
+/** The bounds of the whole hierarchy over the whole motion. */
+  const BBox Bounds() const;
+
+/** Walks the hierarchy front to back along a ray, at the time of the ray.
+* The contract is the one of BVH::Traverse().
+*/
+  template <class LeafTest>
+  bool Traverse(const Ray & R, float & tmax, LeafTest & Test) const;
+};
+
+
+/** Slab test of a node blended within a segment, see hitNode().
+* @param s Where the ray time is within the segment, 0 to 1.
+*/
+inline bool hitMotionNode(const MotionBVHBounds & Node, float s,
+                          const float O[3], const float Inv[3],
+                          const int Neg[3], float tmin, float tmax,
+                          float & tnear)
+{
+  float t0 = tmin, t1 = tmax;
+
+  for (int i = 0; i < 3; i++)
+  {
+    float Min = Node.Min0[i] + s * (Node.Min1[i] - Node.Min0[i]);
+    float Max = Node.Max0[i] + s * (Node.Max1[i] - Node.Max0[i]);
+    float tA = ((Neg[i] ? Max : Min) - O[i]) * Inv[i];
+    float tB = ((Neg[i] ? Min : Max) - O[i]) * Inv[i];
+    t0 = (tA > t0) ? tA : t0;
+    t1 = (tB < t1) ? tB : t1;
+  }
+
+  tnear = t0;
+  return t0 <= t1;
+}
+
+
+inline bool MotionBVH::empty() const
+{
+  return Nodes.empty();
+}
+
+template <class LeafTest>
+bool MotionBVH::Traverse(const Ray & R, float & tmax, LeafTest & Test) const
+{
+  if (Nodes.empty()) return false;
+
+  const Vector3D & Origin = R.getOrigin(), & InvDir = R.getInvDirection();
+  float O[3], Inv[3], tmin = R.getTMin(), tnear, tleft, tright;
+  int Neg[3];
+  unsigned int Stack[2 * BVH_MAX_DEPTH];
+  int top = 0;
+  bool found = false;
+
+  // The boxes only bound the primitives from time 0 to 1
+  float time = R.getTime() * Segments;
+  time = (time < 0) ? 0 : ((time > Segments) ? Segments : time);
+  unsigned int k = (time < Segments) ? (unsigned int) time : Segments - 1;
+  float s = time - k;
+  const MotionBVHBounds * Bounds = &Boxes[k];
+
+  for (int i = 0; i < 3; i++)
+  {
+    O[i] = Origin[i];
+    Inv[i] = InvDir[i];
+    Neg[i] = R.getSign(i);
+  }
+
+  if (!hitMotionNode(Bounds[0], s, O, Inv, Neg, tmin, tmax, tnear))
+    return false;
+  Stack[top++] = 0;
+
+  while (top > 0)
+  {
+    const MotionBVHNode & Node = Nodes[Stack[--top]];
+
+    if (Node.Count > 0)
+    {
+      for (unsigned int i = 0; i < Node.Count; i++)
+        if (Test(Indices[Node.Offset + i], tmax)) found = true;
+      continue;
+    }
+
+    unsigned int left = &Node - &Nodes[0] + 1, right = Node.Offset;
+    bool hitL = hitMotionNode(Bounds[left * Segments], s, O, Inv, Neg, tmin,
+                              tmax, tleft);
+    bool hitR = hitMotionNode(Bounds[right * Segments], s, O, Inv, Neg,
+                              tmin, tmax, tright);
+
+    // Push the far child first so that the near one is popped next
+    if (hitL && hitR)
+    {
+      if (tleft < tright)
+      {
+        Stack[top++] = right;
+        Stack[top++] = left;
+      }
+      else
+      {
+        Stack[top++] = left;
+        Stack[top++] = right;
+      }
+    }
+    else if (hitL) Stack[top++] = left;
+    else if (hitR) Stack[top++] = right;
+  }
+
+  return found;
+}
+
+#endif //MOTIONBVH_HH
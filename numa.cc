@@ -0,0 +1,200 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file numa.cc Implementation of the NUMA layout
+*/
+
+#include <fstream>
+#include <sstream>
+#include <cassert>
+#include <algorithm>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "numa.hh"
+
+
+/** Reads a kernel CPU or node list such as "0-3,8,10-11". */
+static vector<int> parseList(const string & Text)
+{
+  vector<int> List;
+  istringstream in(Text);
+  string Range;
+
+  while (getline(in, Range, ','))
+  {
+    int First, Last;
+    char Dash;
+    istringstream Bounds(Range);
+
+    if (!(Bounds >> First)) continue;
+    if (!(Bounds >> Dash >> Last) || (Dash != '-')) Last = First;
+    for (int i = First; i <= Last; i++) List.push_back(i);
+  }
+  return List;
+}
+
+
+/** Reads the first line of a file, empty if it cannot be read. */
+static string readLine(const string & Path)
+{
+  ifstream in(Path.c_str());
+  string Line;
+
+  getline(in, Line);
+  return Line;
+}
+
+
+/** The processors the process may run on. */
+static vector<int> allowedCpus()
+{
+  vector<int> Allowed;
+  cpu_set_t Set;
+
+  if (sched_getaffinity(0, sizeof(Set), &Set) == 0)
+  {
+    for (int i = 0; i < CPU_SETSIZE; i++)
+      if (CPU_ISSET(i, &Set)) Allowed.push_back(i);
+  }
+  if (Allowed.empty()) Allowed.push_back(0);
+  return Allowed;
+}
+
+
+NumaTopology::NumaTopology()
+  : Cpus(1, allowedCpus())
+{
+}
+
+
+NumaTopology NumaTopology::detect()
+{
+  const string Root = "/sys/devices/system/node/";
+  vector<int> Allowed = allowedCpus();
+  vector<int> Online = parseList(readLine(Root + "online"));
+  NumaTopology Topology;
+
+  Topology.Cpus.clear();
+  for (unsigned int n = 0; n < Online.size(); n++)
+  {
+    ostringstream Path;
+    Path << Root << "node" << Online[n] << "/cpulist";
+
+    vector<int> Listed = parseList(readLine(Path.str())), Usable;
+    for (unsigned int i = 0; i < Listed.size(); i++)
+      if (find(Allowed.begin(), Allowed.end(), Listed[i]) != Allowed.end())
+        Usable.push_back(Listed[i]);
+
+    if (Usable.empty()) continue;
+    Topology.Cpus.push_back(Usable);
+    Topology.Ids.push_back(Online[n]);
+  }
+
+  // No NUMA support in the kernel, or nothing we may run on
+  if (Topology.Cpus.empty()) return NumaTopology();
+  return Topology;
+}
+
+
+NumaTopology NumaTopology::simulate(int Nodes)
+{
+  assert(Nodes > 0);
+
+  vector<int> Allowed = allowedCpus();
+  NumaTopology Topology;
+  unsigned int n = Allowed.size();
+
+  Topology.Cpus.assign(Nodes, vector<int>());
+  if (n >= (unsigned int) Nodes)
+  {
+    for (unsigned int i = 0; i < n; i++)
+      Topology.Cpus[(size_t) i * Nodes / n].push_back(Allowed[i]);
+  }
+  else
+  {
+    for (int k = 0; k < Nodes; k++)
+      Topology.Cpus[k].push_back(Allowed[k % n]);
+  }
+  return Topology;
+}
+
+
+int NumaTopology::nodes() const
+{
+  return Cpus.size();
+}
+
+
+const vector<int> & NumaTopology::cpus(int Node) const
+{
+  assert((Node >= 0) && (Node < nodes()));
+  return Cpus[Node];
+}
+
+
+bool NumaTopology::isReal() const
+{
+  return !Ids.empty();
+}
+
+
+bool NumaTopology::pinThread(int Node) const
+{
+  cpu_set_t Set;
+
+  CPU_ZERO(&Set);
+  for (unsigned int i = 0; i < cpus(Node).size(); i++)
+    CPU_SET(cpus(Node)[i], &Set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(Set), &Set) == 0;
+}
+
+
+bool NumaTopology::interleaveMemory(bool Interleave) const
+{
+  if (!isReal()) return false;
+  if (!Interleave) return syscall(SYS_set_mempolicy, MPOL_DEFAULT, 0, 0) == 0;
+
+  const int Bits = 8 * sizeof(unsigned long);
+  int Last = *max_element(Ids.begin(), Ids.end());
+  vector<unsigned long> Mask(Last / Bits + 1, 0);
+
+  for (unsigned int i = 0; i < Ids.size(); i++)
+    Mask[Ids[i] / Bits] |= 1ul << (Ids[i] % Bits);
+
+  // The kernel reads one bit less than it is told
+  return syscall(SYS_set_mempolicy, MPOL_INTERLEAVE, &Mask[0],
+                 Mask.size() * Bits + 1) == 0;
+}
+
+
+bool parseNumaPolicy(const string & Name, NumaPolicy & Policy)
+{
+  if (Name == "off") Policy = NUMA_OFF;
+  else if (Name == "pin") Policy = NUMA_PIN;
+  else if (Name == "interleave") Policy = NUMA_INTERLEAVE;
+  else if (Name == "replicate") Policy = NUMA_REPLICATE;
+  else return false;
+
+  return true;
+}
@@ -0,0 +1,109 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file numa.hh The NUMA layout of the machine, and placing threads and
+* memory on its nodes.
+*/
+
+#ifndef NUMA_HH
+#define NUMA_HH
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+
+/** Where the render daemon puts its threads and scenes. On a machine with
+* a single node every policy behaves like NUMA_OFF.
+*/
+enum NumaPolicy
+{
+/** Leave it all to the operating system. */
+  NUMA_OFF,
+/** Pin every worker to the processors of one node, and have the bands of
+* an image rendered and first touched by the workers of one node.
+*/
+  NUMA_PIN,
+/** NUMA_PIN, and spread the pages of the scenes over all nodes. */
+  NUMA_INTERLEAVE,
+/** NUMA_PIN, and load a copy of every scene on each node. */
+  NUMA_REPLICATE
+};
+
+
+/** The nodes of the machine and their processors. */
+class NumaTopology
+{
+private:
+
+/** The processors of each node, only those this process may run on. */
+  vector<vector<int> > Cpus;
+
+/** The number the kernel gives each node, empty for a made up layout. */
+  vector<int> Ids;
+
+public:
+
+/** A single node holding all the processors the process may run on. */
+  NumaTopology();
+
+/** The layout of the machine, as listed in /sys/devices/system/node.
+* Nodes without processors are left out.
+*/
+  static NumaTopology detect();
+
+/** A made up layout that deals the processors out to the given number of
+* nodes, sharing them if there are too few. It lets machines with a single
+* node go through the NUMA code paths; memory cannot be placed on its
+* nodes.
+*/
+  static NumaTopology simulate(int Nodes);
+
+/** The number of nodes. */
+  int nodes() const;
+
+/** The processors of a node. */
+  const vector<int> & cpus(int Node) const;
+
+/** True if the nodes are those of the kernel, so memory can be put on them. */
+  bool isReal() const;
+
+/** Restricts the calling thread to the processors of a node.
+* @return False if the kernel refused.
+*/
+  bool pinThread(int Node) const;
+
+/** Spreads the pages the calling thread allocates from now on over all
+* nodes, or goes back to the default policy of allocating on the node of
+* the thread.
+* @return False if the kernel refused or the layout is made up.
+*/
+  bool interleaveMemory(bool Interleave) const;
+};
+
+
+/** Reads a NUMA policy name: off, pin, interleave or replicate.
+* @return False if the name is unknown.
+*/
+bool parseNumaPolicy(const string & Name, NumaPolicy & Policy);
+
+#endif //NUMA_HH
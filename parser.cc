@@ -31,16 +31,31 @@
 #include <exception>
 #include <vector>
 #include <stdexcept>
+#include <map>
+#include <iterator>
 
 #include "scene.hh"
 #include "scene_objects/objects.hh"
+#include "scene_objects/mesh.hh"
+#include "scene_objects/instance.hh"
+#include "scene_objects/csg.hh"
+#include "scene_objects/sdf.hh"
+#include "scene_objects/heightfield.hh"
+#include "scene_objects/particles.hh"
+#include "scene_objects/chunked.hh"
+#include "texture.hh"
 #include "boost/shared_ptr.hpp"
 
 using namespace std;
 
+/** The groups defined so far in the scene file, by name. */
+typedef map<string, boost::shared_ptr<Group> > GroupMap;
+
 
 void readFloats(istream &strm, float vec[]);
 float  readOneFloat(istream &strm);
+string readString(istream &strm);
+SceneObject * readObject(const string & s, istream &strm, GroupMap & Groups);
 
 
 void Trim(string &str)
@@ -55,6 +70,15 @@ void Trim(string &str)
 }
 
 
+/** Gives up on a malformed scene, whose details were written to cerr.
+* @param What The kind of object that is malformed.
+*/
+void malformed(const string & What)
+{
+ throw invalid_argument("malformed " + What);
+}
+
+
 string getNextTag(istream & strm)
 {
  string s;
@@ -124,7 +148,7 @@ for (int i =0; i < 4; i++)
  {
   cerr << "Not enough information about the Camera Object\n"
        << "Missing field number " << i << endl;
-  assert(false); 
+  malformed("camera");
  }
 }
 
@@ -171,7 +195,7 @@ for (int i =0; i < 2; i++)
  {
   cerr << "Not enough information about the Light Object\n"
        << "Missing field number " << i << endl;
-  assert(false); 
+  malformed("light");
  }
 }
 return new Light(Position, Clr);
@@ -180,6 +204,17 @@ return new Light(Position, Clr);
 
 
 
+/** Puts the texture read from a <texture> tag, if any, on an object. */
+void applyTexture(SceneObject * Obj, const string & file, float scale)
+{
+ if (file.empty()) return;
+
+ boost::shared_ptr<ImageTexture> Texture = ImageTexture::load(file);
+ if (!Texture) malformed("texture");
+ Obj->setTexture(Texture, scale);
+}
+
+
 Cube * readCube(istream &strm)
 {
  string s;
@@ -189,6 +224,9 @@ Cube * readCube(istream &strm)
 
  Vector3D v1,v2,v3;
  Color Clr;
+ string texture;
+ float texscale = 1;
+ float transparency = 0, ior = DEFAULT_IOR;
 
  s = getNextTag(strm);
  while((s != "</cube>") && strm)
@@ -223,6 +261,10 @@ Cube * readCube(istream &strm)
  }
 
  if (s == "<reflectivity>") refl = readOneFloat(strm);
+ if (s == "<texture>") texture = readString(strm);
+ if (s == "<texscale>") texscale = readOneFloat(strm);
+ if (s == "<transparency>") transparency = readOneFloat(strm);
+ if (s == "<ior>") ior = readOneFloat(strm);
 
   
  s = getNextTag(strm);
@@ -234,11 +276,14 @@ for (int i =0; i < 4; i++)
  {
   cerr << "Not enough information about the Cube Object\n"
        << "Missing field number " << i << endl;
-  assert(false); 
+  malformed("cube");
  }
 }
 
- return new Cube(v1, v2, v3, Clr, refl);
+ Cube * Obj = new Cube(v1, v2, v3, Clr, refl);
+ applyTexture(Obj, texture, texscale);
+ Obj->setTransparency(transparency, ior);
+ return Obj;
 }
 
 Cylinder * readCylinder(istream & strm)
@@ -251,6 +296,9 @@ Cylinder * readCylinder(istream & strm)
  Vector3D Center, Orientation;
  Color Clr;
  float radius, refl = 0, height;
+ string texture;
+ float texscale = 1;
+ float transparency = 0, ior = DEFAULT_IOR;
 
  s = getNextTag(strm);
  while(s != "</cylinder>")
@@ -290,6 +338,10 @@ Cylinder * readCylinder(istream & strm)
  }
  
  if (s == "<reflectivity>") refl = readOneFloat(strm);
+ if (s == "<texture>") texture = readString(strm);
+ if (s == "<texscale>") texscale = readOneFloat(strm);
+ if (s == "<transparency>") transparency = readOneFloat(strm);
+ if (s == "<ior>") ior = readOneFloat(strm);
 
 
  s = getNextTag(strm);
@@ -301,14 +353,17 @@ Cylinder * readCylinder(istream & strm)
   {
   cerr << "Not enough information about Cylinder Object\n"
        << "Missing field number " << i << endl;
-  assert(false); 
+  malformed("cylinder");
   }
  }
   
  cout << "\t HELLLO \n";
 
  Orientation.normalize();
- return new Cylinder(Center, Orientation, radius, height, Clr, refl);
+ Cylinder * Obj = new Cylinder(Center, Orientation, radius, height, Clr, refl);
+ applyTexture(Obj, texture, texscale);
+ Obj->setTransparency(transparency, ior);
+ return Obj;
 }
 
 Sphere * readSphere(istream &strm)
@@ -321,6 +376,9 @@ Sphere * readSphere(istream &strm)
  Vector3D Center;
  Color Clr;
  float radius, refl = 0;
+ string texture;
+ float texscale = 1;
+ float transparency = 0, ior = DEFAULT_IOR;
 
  s = getNextTag(strm);
  while(s != "</sphere>")
@@ -347,6 +405,10 @@ Sphere * readSphere(istream &strm)
  }
 
  if (s == "<reflectivity>") refl = readOneFloat(strm);
+ if (s == "<texture>") texture = readString(strm);
+ if (s == "<texscale>") texscale = readOneFloat(strm);
+ if (s == "<transparency>") transparency = readOneFloat(strm);
+ if (s == "<ior>") ior = readOneFloat(strm);
 
 
  s = getNextTag(strm);
@@ -358,11 +420,14 @@ Sphere * readSphere(istream &strm)
   {
   cerr << "Not enough information about Sphere Object\n"
        << "Missing field number " << i << endl;
-  assert(false); 
+  malformed("sphere");
   }
  }
 
- return new Sphere(Center, radius, Clr, refl);
+ Sphere * Obj = new Sphere(Center, radius, Clr, refl);
+ applyTexture(Obj, texture, texscale);
+ Obj->setTransparency(transparency, ior);
+ return Obj;
 }
 
 
@@ -378,6 +443,9 @@ Plane * readPlane(istream &strm)
  Vector3D Normal;
  Color Clr;
  float dist = 0, refl = 0;
+ string texture;
+ float texscale = 1;
+ float transparency = 0, ior = DEFAULT_IOR;
 
  s = getNextTag(strm);
 
@@ -405,6 +473,10 @@ Plane * readPlane(istream &strm)
  }
 
  if (s == "<reflectivity>") refl = readOneFloat(strm);
+ if (s == "<texture>") texture = readString(strm);
+ if (s == "<texscale>") texscale = readOneFloat(strm);
+ if (s == "<transparency>") transparency = readOneFloat(strm);
+ if (s == "<ior>") ior = readOneFloat(strm);
 
  s = getNextTag(strm);
 }
@@ -415,15 +487,85 @@ Plane * readPlane(istream &strm)
   {
   cerr << "Not enough information about Cylinder Object\n"
        << "Missing field number " << i << endl;
-  assert(false); 
+  malformed("plane");
   }
  }
 
- return new Plane(dist, Normal, Clr, refl);
+ Plane * Obj = new Plane(dist, Normal, Clr, refl);
+ applyTexture(Obj, texture, texscale);
+ Obj->setTransparency(transparency, ior);
+ return Obj;
 }
 
 
 
+TriangleMesh * readMesh(istream &strm)
+{
+ string s, file;
+ float vec[3], refl = 0;
+ float transparency = 0, ior = DEFAULT_IOR;
+ bool data[2] = {false, false};
+
+ Color Clr;
+
+ s = getNextTag(strm);
+ while((s != "</mesh>") && strm)
+ {
+
+ if (s == "<file>") 
+ {
+  file = readString(strm);
+  data[0] = true;
+ }
+
+ if (s == "<color>") 
+ {
+  readFloats(strm,vec);
+  Clr = Color(vec);
+  data[1] = true;
+ }
+
+ if (s == "<reflectivity>") refl = readOneFloat(strm);
+ if (s == "<transparency>") transparency = readOneFloat(strm);
+ if (s == "<ior>") ior = readOneFloat(strm);
+
+ s = getNextTag(strm);
+}
+
+ for (int i = 0; i < 2; i++)
+ {
+  if (!data[i]) 
+  {
+  cerr << "Not enough information about Mesh Object\n"
+       << "Missing field number " << i << endl;
+  malformed("mesh");
+  }
+ }
+
+ TriangleMesh * Mesh = new TriangleMesh(Clr, refl);
+ if (!Mesh->LoadOBJ(file))
+ {
+  delete Mesh;
+  malformed("mesh");
+ }
+ Mesh->setTransparency(transparency, ior);
+ return Mesh;
+}
+
+
+
+string readString(istream &strm)
+{
+ string tmp;
+
+ getline(strm, tmp, '<');
+ Trim(tmp);
+
+ cout << "string= " << tmp << endl;
+ return tmp;
+}
+
+
 float readOneFloat(istream &strm)
 {
  cout << "\t Reading 1 float " << endl;
@@ -490,29 +632,601 @@ cout << "floats=(" << vec[0] << ", " << vec[1] << ", " << vec[2] << ")" << endl;
 
 
 
-void readScene(istream & strm, Scene * Sc, Camera ** Cr)
+Group * readGroup(istream &strm, GroupMap & Groups)
+{
+ string s, name;
+ SceneObject * Obj;
+ Group * G = new Group;
+
+ s = getNextTag(strm);
+ while((s != "</group>") && strm)
+ {
+
+ if (s == "<name>") name = readString(strm);
+
+ Obj = readObject(s, strm, Groups);
+ if (Obj != 0) G->AddObject(SPSceneObject(Obj));
+
+ s = getNextTag(strm);
+}
+
+ if (name.empty() || (G->size() == 0))
+ {
+  cerr << "A group needs a name and at least one object\n";
+  delete G;
+  malformed("group");
+ }
+
+ Groups[name] = boost::shared_ptr<Group>(G);
+
+ cout << "Group " << name << " with " << G->size() << " objects" << endl;
+ return G;
+}
+
+
+/** Applies a transformation tag to T, after the ones already in it.
+* @return False if s is not a transformation.
+*/
+bool readTransform(const string & s, istream &strm, Transform & T)
+{
+ float vec[3];
+
+ if (s == "<translate>")
+ {
+  readFloats(strm, vec);
+  T = Transform::translate(Vector3D(vec)) * T;
+  return true;
+ }
+
+ if (s == "<scale>")
+ {
+  readFloats(strm, vec);
+  if ((vec[0] == 0) || (vec[1] == 0) || (vec[2] == 0))
+  {
+   cerr << "A scale factor of 0 flattens the object" << endl;
+   malformed("transformation");
+  }
+  T = Transform::scale(Vector3D(vec)) * T;
+  return true;
+ }
+
+ //Angles in degrees around the x, y and z axes, in that order
+ if (s == "<rotate>")
+ {
+  readFloats(strm, vec);
+  for (int i = 0; i < 3; i++)
+   if (vec[i] != 0) T = Transform::rotate(i, vec[i]) * T;
+  return true;
+ }
+
+ return false;
+}
+
+
+/** Reads a keyframe of a moving instance: its time and the
+* transformations that place the instance then.
+* @return False if the key has no time.
+*/
+bool readKey(istream &strm, float & Time, Transform & Key)
+{
+ string s;
+ bool Timed = false;
+
+ s = getNextTag(strm);
+ while((s != "</key>") && strm)
+ {
+
+ if (s == "<time>")
+ {
+  Time = readOneFloat(strm);
+  Timed = true;
+ }
+ readTransform(s, strm, Key);
+
+ s = getNextTag(strm);
+}
+
+ return Timed;
+}
+
+
+SceneObject * readInstance(istream &strm, GroupMap & Groups)
+{
+ string s, name;
+ Transform ToWorld;
+ vector<float> Times;
+ vector<Transform> Keys;
+ unsigned int Timed = 0;
+
+ s = getNextTag(strm);
+ while((s != "</instance>") && strm)
+ {
+
+ if (s == "<of>") name = readString(strm);
+
+ //Transformations apply in the order they are written
+ readTransform(s, strm, ToWorld);
+
+ if (s == "<key>")
+ {
+  float Time = 0;
+  Transform Key;
+  if (readKey(strm, Time, Key)) Timed++;
+  Times.push_back(Time);
+  Keys.push_back(Key);
+ }
+
+ s = getNextTag(strm);
+}
+
+ GroupMap::iterator G = Groups.find(name);
+ if (G == Groups.end())
+ {
+  cerr << "Instance of unknown group " << name << endl;
+  malformed("instance");
+ }
+
+ if (Keys.empty()) return new Instance(G->second, ToWorld);
+
+ //Keys without times are spread evenly over the shutter interval
+ if ((Timed > 0) && (Timed < Keys.size()))
+ {
+  cerr << "Either all keys of an instance have a time or none" << endl;
+  malformed("instance");
+ }
+
+ for (unsigned int i = 0; i < Keys.size(); i++)
+ {
+  if (Timed == 0) Times[i] = (Keys.size() > 1) ? i / (Keys.size() - 1.0f) : 0;
+  if ((i > 0) && (Times[i] <= Times[i - 1]))
+  {
+   cerr << "The keys of an instance must be in time order" << endl;
+   malformed("instance");
+  }
+
+  //The keys move the group in its own space, then it is placed by the
+  //other transformations
+  Keys[i] = ToWorld * Keys[i];
+
+  //A blend between a mirrored and an unmirrored placement flattens the
+  //group on the way
+  if ((i > 0) && (Keys[i].mirrors() != Keys[i - 1].mirrors()))
+  {
+   cerr << "Keys " << i - 1 << " and " << i << " of an instance cannot be "
+        << "blended, only one of them mirrors the group" << endl;
+   malformed("instance");
+  }
+ }
+
+ return new MovingInstance(G->second, Times, Keys);
+}
+
+
+CSG * readCSG(istream &strm, GroupMap & Groups)
+{
+ string s, op;
+ SceneObject * Obj;
+ vector<SPSceneObject> Solids;
+ CSGOperation Op;
+
+ s = getNextTag(strm);
+ while((s != "</csg>") && strm)
+ {
+
+ if (s == "<operation>") op = readString(strm);
+
+ Obj = readObject(s, strm, Groups);
+ if (Obj != 0) Solids.push_back(SPSceneObject(Obj));
+
+ s = getNextTag(strm);
+}
+
+ if (!parseCSGOperation(op, Op) || (Solids.size() < 2))
+ {
+  cerr << "A CSG node needs an operation (union, intersection or difference)"
+       << " and at least two solids\n";
+  malformed("CSG node");
+ }
+
+ for (unsigned int i = 0; i < Solids.size(); i++)
+ {
+  if (!Solids[i]->isSolid())
+  {
+   cerr << "CSG only combines spheres, cylinders, planes and CSG nodes\n";
+   malformed("CSG node");
+  }
+ }
+
+ //Further solids are combined with the result so far: A - B - C
+ CSG * Node = new CSG(Op, Solids[0], Solids[1]);
+ for (unsigned int i = 2; i < Solids.size(); i++)
+  Node = new CSG(Op, SPSceneObject(Node), Solids[i]);
+
+ return Node;
+}
+
+
+/** Reads a node of a distance function.
+* @param s The tag introducing it.
+* @return The node, or 0 if the tag does not introduce one.
+*/
+DistanceNode * readDistance(const string & s, istream &strm)
+{
+ string t, name = s.substr(1, s.size() - 2), end = "</" + name + ">";
+ float vec[3], radius = 0, rounding = 0, thickness = 0, blend = 0;
+ Vector3D Center, Size, From, To;
+ vector<SPDistanceNode> Nodes;
+ CSGOperation Op;
+ bool isOp = parseCSGOperation(name, Op);
+
+ if (!isOp && (name != "sphere") && (name != "box") && (name != "capsule") &&
+     (name != "torus"))
+  return 0;
+
+ t = getNextTag(strm);
+ while((t != end) && strm)
+ {
+
+ if (t == "<center>") { readFloats(strm, vec); Center = Vector3D(vec); }
+ if (t == "<size>") { readFloats(strm, vec); Size = Vector3D(vec); }
+ if (t == "<from>") { readFloats(strm, vec); From = Vector3D(vec); }
+ if (t == "<to>") { readFloats(strm, vec); To = Vector3D(vec); }
+ if (t == "<radius>") radius = readOneFloat(strm);
+ if (t == "<rounding>") rounding = readOneFloat(strm);
+ if (t == "<thickness>") thickness = readOneFloat(strm);
+ if (t == "<blend>") blend = readOneFloat(strm);
+
+ if (isOp)
+ {
+  DistanceNode * Node = readDistance(t, strm);
+  if (Node != 0) Nodes.push_back(SPDistanceNode(Node));
+ }
+
+ t = getNextTag(strm);
+}
+
+ if (name == "sphere") return new DistanceSphere(Center, radius);
+ if (name == "box") return new DistanceBox(Center, Size * 0.5f, rounding);
+ if (name == "capsule") return new DistanceCapsule(From, To, radius);
+ if (name == "torus") return new DistanceTorus(Center, radius, thickness);
+
+ if (Nodes.size() < 2)
+ {
+  cerr << "<" << name << "> in a distance function needs two nodes\n";
+  malformed("distance function");
+ }
+
+ //Further nodes are combined with the result so far, like CSG
+ DistanceNode * Node = new DistanceCombine(Op, blend, Nodes[0], Nodes[1]);
+ for (unsigned int i = 2; i < Nodes.size(); i++)
+  Node = new DistanceCombine(Op, blend, SPDistanceNode(Node), Nodes[i]);
+ return Node;
+}
+
+
+DistanceField * readSDF(istream &strm)
+{
+ string s;
+ float vec[3], refl = 0;
+ float transparency = 0, ior = DEFAULT_IOR;
+ int cache = 0;
+ bool hasColor = false;
+ Color Clr;
+ SPDistanceNode Root;
+
+ s = getNextTag(strm);
+ while((s != "</sdf>") && strm)
+ {
+
+ if (s == "<color>")
+ {
+  readFloats(strm,vec);
+  Clr = Color(vec);
+  hasColor = true;
+ }
+
+ if (s == "<reflectivity>") refl = readOneFloat(strm);
+ if (s == "<transparency>") transparency = readOneFloat(strm);
+ if (s == "<ior>") ior = readOneFloat(strm);
+ if (s == "<cache>") cache = (int) readOneFloat(strm);
+
+ DistanceNode * Node = readDistance(s, strm);
+ if (Node != 0)
+ {
+  if (Root)
+  {
+   cerr << "A distance field has one function, combine its nodes\n";
+   malformed("distance field");
+  }
+  Root = SPDistanceNode(Node);
+ }
+
+ s = getNextTag(strm);
+}
+
+ if (!hasColor || !Root)
+ {
+  cerr << "Not enough information about the distance field\n"
+       << "It needs a <color> and a function\n";
+  malformed("distance field");
+ }
+
+ DistanceField * Obj = new DistanceField(Root, Clr, refl, cache);
+ Obj->setTransparency(transparency, ior);
+ return Obj;
+}
+
+
+HeightField * readHeightfield(istream &strm)
+{
+ string s, file, texture;
+ float vec[3], refl = 0, texscale = 1;
+ float transparency = 0, ior = DEFAULT_IOR;
+ bool data[4] = {false, false, false, false};
+
+ Vector3D Origin, Size;
+ Color Clr;
+
+ s = getNextTag(strm);
+ while((s != "</heightfield>") && strm)
+ {
+
+ if (s == "<file>")
+ {
+  file = readString(strm);
+  data[0] = true;
+ }
+
+ if (s == "<origin>")
+ {
+  readFloats(strm,vec);
+  Origin = Vector3D(vec);
+  data[1] = true;
+ }
+
+ if (s == "<size>")
+ {
+  readFloats(strm,vec);
+  Size = Vector3D(vec);
+  data[2] = true;
+ }
+
+ if (s == "<color>")
+ {
+  readFloats(strm,vec);
+  Clr = Color(vec);
+  data[3] = true;
+ }
+
+ if (s == "<reflectivity>") refl = readOneFloat(strm);
+ if (s == "<texture>") texture = readString(strm);
+ if (s == "<texscale>") texscale = readOneFloat(strm);
+ if (s == "<transparency>") transparency = readOneFloat(strm);
+ if (s == "<ior>") ior = readOneFloat(strm);
+
+ s = getNextTag(strm);
+}
+
+ for (int i = 0; i < 4; i++)
+ {
+  if (!data[i])
+  {
+  cerr << "Not enough information about Heightfield Object\n"
+       << "Missing field number " << i << endl;
+  malformed("height field");
+  }
+ }
+
+ HeightField * Obj = new HeightField(Origin, Size, Clr, refl);
+ if (!Obj->load(file))
+ {
+  delete Obj;
+  malformed("height field");
+ }
+ applyTexture(Obj, texture, texscale);
+ Obj->setTransparency(transparency, ior);
+ return Obj;
+}
+
+
+ParticleCloud * readParticles(istream &strm)
+{
+ string s, file, colors;
+ float vec[3], refl = 0;
+ float transparency = 0, ior = DEFAULT_IOR;
+ bool hasColor = false;
+ Color Clr(1, 1, 1);
+
+ s = getNextTag(strm);
+ while((s != "</particles>") && strm)
+ {
+
+ if (s == "<file>") file = readString(strm);
+ if (s == "<colors>") colors = readString(strm);
+
+ if (s == "<color>")
+ {
+  readFloats(strm,vec);
+  Clr = Color(vec);
+  hasColor = true;
+ }
+
+ if (s == "<reflectivity>") refl = readOneFloat(strm);
+ if (s == "<transparency>") transparency = readOneFloat(strm);
+ if (s == "<ior>") ior = readOneFloat(strm);
+
+ s = getNextTag(strm);
+}
+
+ if (file.empty() || (!hasColor && colors.empty()))
+ {
+  cerr << "Not enough information about the particles\n"
+       << "They need a <file> and a <color> or <colors>\n";
+  malformed("particle cloud");
+ }
+
+ ParticleCloud * Obj = new ParticleCloud(Clr, refl);
+ if (!Obj->load(file, colors))
+ {
+  delete Obj;
+  malformed("particle cloud");
+ }
+ Obj->setTransparency(transparency, ior);
+ return Obj;
+}
+
+
+ChunkedMesh * readChunkedMesh(istream &strm)
+{
+ string s, file;
+ float vec[3], refl = 0;
+ float transparency = 0, ior = DEFAULT_IOR;
+ unsigned int chunk = CHUNK_TRIANGLES;
+ bool data[2] = {false, false};
+
+ Color Clr;
+
+ s = getNextTag(strm);
+ while((s != "</chunkedmesh>") && strm)
+ {
+
+ if (s == "<file>")
+ {
+  file = readString(strm);
+  data[0] = true;
+ }
+
+ if (s == "<color>")
+ {
+  readFloats(strm,vec);
+  Clr = Color(vec);
+  data[1] = true;
+ }
+
+ if (s == "<reflectivity>") refl = readOneFloat(strm);
+ if (s == "<chunk>") chunk = (unsigned int) readOneFloat(strm);
+ if (s == "<transparency>") transparency = readOneFloat(strm);
+ if (s == "<ior>") ior = readOneFloat(strm);
+
+ s = getNextTag(strm);
+}
+
+ for (int i = 0; i < 2; i++)
+ {
+  if (!data[i])
+  {
+  cerr << "Not enough information about Chunked Mesh Object\n"
+       << "Missing field number " << i << endl;
+  malformed("chunked mesh");
+  }
+ }
+
+ ChunkedMesh * Mesh = new ChunkedMesh(Clr, refl, chunk);
+ if (!Mesh->open(file))
+ {
+  delete Mesh;
+  malformed("chunked mesh");
+ }
+ Mesh->setTransparency(transparency, ior);
+ return Mesh;
+}
+
+
+/** Reads the object introduced by a tag.
+* @return The object, or 0 if the tag does not introduce an object.
+*/
+SceneObject * readObject(const string & s, istream &strm, GroupMap & Groups)
+{
+ if (s == "<plane>") return readPlane(strm);
+ if (s == "<sphere>") return readSphere(strm);
+ if (s == "<cube>") return readCube(strm);
+ if (s == "<cylinder>") return readCylinder(strm);
+ if (s == "<mesh>") return readMesh(strm);
+ if (s == "<instance>") return readInstance(strm, Groups);
+ if (s == "<csg>") return readCSG(strm, Groups);
+ if (s == "<sdf>") return readSDF(strm);
+ if (s == "<heightfield>") return readHeightfield(strm);
+ if (s == "<particles>") return readParticles(strm);
+ if (s == "<chunkedmesh>") return readChunkedMesh(strm);
+
+ return 0;
+}
+
+
+/** The position of a stream reading a text, the end of the text once
+* the stream has run out.
+*/
+size_t textPos(istream & strm, const string & Text)
+{
+ if (!strm.good()) return Text.size();
+ return strm.tellg();
+}
+
+
+/** Appends to the text of an object the text of every group it instances,
+* so that the object counts as changed when one of those groups does.
+*/
+string withGroupSources(string Source, const map<string, string> & GroupSources)
+{
+ string Used;
+ size_t pos = 0;
+
+ while ((pos = Source.find("<of>", pos)) != string::npos)
+ {
+  pos += 4;
+  string name = Source.substr(pos, Source.find('<', pos) - pos);
+  Trim(name);
+
+  map<string, string>::const_iterator G = GroupSources.find(name);
+  if (G != GroupSources.end()) Used += G->second;
+ }
+
+ Trim(Source);
+ return Source + Used;
+}
+
+
+void readScene(istream & file, Scene * Sc, Camera ** Cr)
 {
 string s;
+GroupMap Groups;
+map<string, string> GroupSources;
+SceneObject * Obj;
+
+// The whole text is read first so that every object can keep its own
+string Text((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+istringstream strm(Text);
 
 cout << "Parsing analysis\n" ;
 
 while (strm)
 {
+size_t start = textPos(strm, Text);
 s = getNextTag(strm);
 
 cout << "TopTag= " << s << endl;
 
 
 //TODO: Convert to  lower/uppercase
-//TODO: Change this to something smarter with less code.
-if (s == "<plane>") Sc->AddSceneObject(SPSceneObject(readPlane(strm)));
-if (s == "<sphere>") Sc->AddSceneObject(SPSceneObject(readSphere(strm)));
 if (s == "<light>") Sc->AddLight(SPLight(readLight(strm))); 
 if (s == "<camera>") *Cr = readCamera(strm);
-if (s == "<cube>") Sc->AddSceneObject(SPSceneObject(readCube(strm)));
-if (s == "<cylinder>") Sc->AddSceneObject(SPSceneObject(readCylinder(strm)));
+if (s == "<group>")
+{
+ Group * G = readGroup(strm, Groups);
+ string Source = Text.substr(start, textPos(strm, Text) - start);
+
+ for (GroupMap::iterator i = Groups.begin(); i != Groups.end(); i++)
+  if (i->second.get() == G)
+   GroupSources[i->first] = withGroupSources(Source, GroupSources);
 }
 
-Sc->Describe();
+Obj = readObject(s, strm, Groups);
+if (Obj != 0)
+{
+ string Source = Text.substr(start, textPos(strm, Text) - start);
+ Sc->AddSceneObject(SPSceneObject(Obj), withGroupSources(Source, GroupSources));
+}
 }
 
+Sc->Describe();
+}
@@ -19,6 +19,11 @@
  ***************************************************************************/
 
 #include <iostream>
+#include <stdexcept>
 #include "scene.hh"
 
+/** Reads a scene description, adding its objects and lights to Sc.
+* @throw invalid_argument If the description is malformed. The details are
+* written to cerr, the objects read so far stay in Sc.
+*/
 extern  void readScene(istream & strm, Scene * Sc, Camera ** Cr);
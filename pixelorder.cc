@@ -0,0 +1,109 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file pixelorder.cc Implementation of the pixel orders
+*/
+
+#include <cassert>
+#include "pixelorder.hh"
+#include "morton.hh"
+
+
+/** The position of the d-th point of the Hilbert curve filling an n by n
+* square, n a power of two.
+*/
+static void hilbertPoint(unsigned int n, unsigned int d,
+                         unsigned int & x, unsigned int & y)
+{
+  x = y = 0;
+
+  for (unsigned int s = 1; s < n; s *= 2)
+  {
+    unsigned int rx = 1 & (d / 2);
+    unsigned int ry = 1 & (d ^ rx);
+
+    // Rotate the quadrant
+    if (ry == 0)
+    {
+      if (rx == 1)
+      {
+        x = s - 1 - x;
+        y = s - 1 - y;
+      }
+      unsigned int tmp = x;
+      x = y;
+      y = tmp;
+    }
+
+    x += s * rx;
+    y += s * ry;
+    d /= 4;
+  }
+}
+
+
+void makePixelOrder(PixelOrder Order, int Width, int Height,
+                    vector<unsigned int> & Pixels)
+{
+  assert((Width >= 0) && (Height >= 0));
+
+  Pixels.clear();
+  Pixels.reserve((size_t) Width * Height);
+
+  if (Order == ORDER_ROWS)
+  {
+    for (unsigned int p = 0; p < (unsigned int) Width * Height; p++)
+      Pixels.push_back(p);
+    return;
+  }
+
+  // The tiles on the right and bottom edges may be cut short, their
+  // missing pixels are skipped
+  for (int ty = 0; ty < Height; ty += TILE_SIZE)
+  {
+    for (int tx = 0; tx < Width; tx += TILE_SIZE)
+    {
+      for (unsigned int d = 0; d < TILE_SIZE * TILE_SIZE; d++)
+      {
+        unsigned int x, y;
+
+        if (Order == ORDER_MORTON)
+          mortonDecode2(d, x, y);
+        else
+          hilbertPoint(TILE_SIZE, d, x, y);
+
+        if ((tx + (int) x < Width) && (ty + (int) y < Height))
+          Pixels.push_back((ty + y) * Width + tx + x);
+      }
+    }
+  }
+}
+
+
+bool parsePixelOrder(const string & Name, PixelOrder & Order)
+{
+  if (Name == "rows") Order = ORDER_ROWS;
+  else if (Name == "morton") Order = ORDER_MORTON;
+  else if (Name == "hilbert") Order = ORDER_HILBERT;
+  else return false;
+
+  return true;
+}
@@ -0,0 +1,67 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file pixelorder.hh The orders in which the pixels of an image are rendered.
+*/
+
+#ifndef PIXELORDER_HH
+#define PIXELORDER_HH
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+
+/** The side of the square tiles walked by the curved orders. */
+const unsigned int TILE_SIZE = 16;
+
+/** The ways of walking through the pixels of an image.
+* The curved orders visit the image tile by tile, rows of tiles from the
+* top, and follow the curve within each tile, so consecutive camera rays
+* stay close together and keep touching the same objects and BVH nodes.
+*/
+enum PixelOrder
+{
+/** Row by row, left to right. */
+  ORDER_ROWS,
+/** The Z-curve (Morton order) within tiles. */
+  ORDER_MORTON,
+/** The Hilbert curve within tiles. */
+  ORDER_HILBERT
+};
+
+
+/** Lists the pixels of an image in the given order.
+* @param Order The order.
+* @param Width The width of the image.
+* @param Height The height of the image.
+* @param Pixels Receives the index y * Width + x of every pixel, in order.
+*/
+void makePixelOrder(PixelOrder Order, int Width, int Height,
+                    vector<unsigned int> & Pixels);
+
+/** Converts "rows", "morton" or "hilbert" to a PixelOrder.
+* @return False if the name is unknown.
+*/
+bool parsePixelOrder(const string & Name, PixelOrder & Order);
+
+#endif //PIXELORDER_HH
@@ -26,12 +26,28 @@
 #define RAY_HH
 
 #include <iostream>
+#include <cmath>
 #include "vector.hh"
 
+/** The far end of a ray that is not clipped. */
+const float RAY_INFINITY = HUGE_VALF;
+
 /** A camera ray implementation.
  * Originates at the position of the camera.
  * Is shot at a certain point in space.
- * Has a maximal travelling distance.
+ * Only the points between getTMin() and getTMax() belong to the ray.
+ *
+ * Next to the direction the ray keeps its inverse and the sign of each
+ * component, so that box tests in the acceleration structures need neither
+ * divisions nor branches.
+ *
+ * A ray may also stand for the narrow cone of directions through a pixel:
+ * its width grows along the ray, which tells textures how blurred a
+ * lookup should be. Rays start as lines, of width 0.
+ *
+ * In scenes with moving objects every ray also carries the moment it is
+ * traced at, within the time the shutter is open; the rays it spawns
+ * keep it.
  */
 class Ray
 {
@@ -39,19 +55,72 @@ class Ray
 private:
   Vector3D Origin, Direction;
 
+/** 1 / Direction, per component. */
+  Vector3D InvDirection;
+
+/** 1 if the direction is negative along the axis, 0 otherwise. */
+  int Sign[3];
+
+/** The parameter interval covered by the ray. */
+  float TMin, TMax;
+
+/** The width of the cone at the origin, and its growth per unit of t. */
+  float ConeWidth, ConeSpread;
+
+/** The scene time of the ray, see Scene::setMotionBlur(). */
+  float Time;
+
+/** Derives InvDirection and Sign from Direction. */
+  void Precompute();
+
 public:  
 
 /** The constructor.
 * @param Origin_ The position vector of the origin of the ray.
 * @param Direction_ The direction vector of the direction of the ray.
+* @param Normalize Set to false if Direction_ is known to have unit length.
+* The ray covers the interval [0, RAY_INFINITY].
 */
-  Ray(const Vector3D & Origin_, const Vector3D & Direction_);
+  Ray(const Vector3D & Origin_, const Vector3D & Direction_,
+      bool Normalize = true);
 
 /** Accessor for the position vector of the origin. */
-  const Vector3D getOrigin() const;
+  const Vector3D & getOrigin() const;
 
 /** Accessor for the direction vector of the origin. */
-  const Vector3D getDirection() const;
+  const Vector3D & getDirection() const;
+
+/** Accessor for the componentwise inverse of the direction. */
+  const Vector3D & getInvDirection() const;
+
+/** Returns 1 if the direction is negative along an axis, 0 otherwise. */
+  int getSign(int axis) const;
+
+/** The start of the parameter interval. */
+  float getTMin() const;
+
+/** The end of the parameter interval. */
+  float getTMax() const;
+
+/** Restricts the ray to the points between tmin and tmax. */
+  void setInterval(float tmin, float tmax);
+
+/** Makes the ray a cone.
+* @param Width The width at the origin.
+* @param Spread The growth of the width per unit of t.
+*/
+  void setCone(float Width, float Spread);
+
+/** The width of the cone at a certain "time". */
+  float getFootprint(float t) const;
+
+/** The scene time the ray is traced at, 0 unless objects move. Not to be
+* confused with the "time" parameter t along the ray.
+*/
+  float getTime() const;
+
+/** Sets the moment the ray is traced at. */
+  void setTime(float Time_);
 
 /** Returns the position of the ray after a certain "time". 
 * @param t The so-called "time" parameter.
@@ -60,15 +129,41 @@ public:
   const Vector3D getPoint(float t) const;
   const Ray reflect(const Vector3D & Intersection,
                          const Vector3D & Normal) const;
+
+/** The ray going on through a transparent surface, bent by Snell's law.
+* @param Intersection The point where the ray meets the surface.
+* @param Normal The outward normal of the surface, of any length. The ray
+* enters the object if it goes against the normal and leaves it otherwise.
+* @param Index The refractive index of the inside, the outside is air.
+* @param Refracted Receives the refracted ray.
+* @return False if the ray is totally reflected, Refracted is unchanged.
+*/
+  bool refract(const Vector3D & Intersection, const Vector3D & Normal,
+               float Index, Ray & Refracted) const;
 };
 
 
 
-inline Ray::Ray(const Vector3D & Origin_, const Vector3D & Direction_)
+inline Ray::Ray(const Vector3D & Origin_, const Vector3D & Direction_,
+                bool Normalize)
 {
   Origin = Origin_;
   Direction = Direction_;
-  Direction.normalize();
+  if (Normalize) Direction.normalize();
+  TMin = 0;
+  TMax = RAY_INFINITY;
+  ConeWidth = ConeSpread = 0;
+  Time = 0;
+  Precompute();
+}
+
+inline void Ray::Precompute()
+{
+  InvDirection = Vector3D(1.0f / Direction[0], 1.0f / Direction[1],
+                          1.0f / Direction[2]);
+
+  for (int i = 0; i < 3; i++)
+    Sign[i] = (InvDirection[i] < 0) ? 1 : 0;
 }
 
 inline const Vector3D Ray::getPoint(float t) const
@@ -77,16 +172,65 @@ inline const Vector3D Ray::getPoint(float t) const
   return Origin + t*Direction;
 }
 
-inline const Vector3D Ray::getOrigin() const
+inline const Vector3D & Ray::getOrigin() const
 {
   return Origin;
 }
 
-inline const Vector3D Ray::getDirection() const
+inline const Vector3D & Ray::getDirection() const
 {
   return Direction;
 }
 
+inline const Vector3D & Ray::getInvDirection() const
+{
+  return InvDirection;
+}
+
+inline int Ray::getSign(int axis) const
+{
+  assert((axis >= 0) && (axis < 3));
+  return Sign[axis];
+}
+
+inline float Ray::getTMin() const
+{
+  return TMin;
+}
+
+inline float Ray::getTMax() const
+{
+  return TMax;
+}
+
+inline void Ray::setInterval(float tmin, float tmax)
+{
+  assert(tmin <= tmax);
+  TMin = tmin;
+  TMax = tmax;
+}
+
+inline void Ray::setCone(float Width, float Spread)
+{
+  ConeWidth = Width;
+  ConeSpread = Spread;
+}
+
+inline float Ray::getFootprint(float t) const
+{
+  return ConeWidth + t * ConeSpread;
+}
+
+inline float Ray::getTime() const
+{
+  return Time;
+}
+
+inline void Ray::setTime(float Time_)
+{
+  Time = Time_;
+}
+
 inline const Ray Ray::reflect(const Vector3D & Intersection,
                                         const Vector3D & Normal) const
 {
@@ -99,7 +243,48 @@ inline const Ray Ray::reflect(const Vector3D & Intersection,
  //New reflected ray
  float delta = 0.0001; // Offset from original point
  
- return Ray(Intersection + NewVector * delta, NewVector);
+ Ray Reflected(Intersection + NewVector * delta, NewVector);
+ Reflected.Time = Time;
+
+ // A flat mirror keeps the spread, the cone goes on from its width here
+ if (ConeSpread > 0)
+   Reflected.setCone(getFootprint(dot(Intersection - Origin, Direction)),
+                     ConeSpread);
+ return Reflected;
+}
+
+inline bool Ray::refract(const Vector3D & Intersection,
+                         const Vector3D & Normal, float Index,
+                         Ray & Refracted) const
+{
+  Vector3D N = Normal;
+  N.normalize();
+
+  // Make the normal face the ray, eta is the ratio of the indices
+  float cosi = -dot(Direction, N), eta = 1 / Index;
+  if (cosi < 0)
+  {
+    N = -N;
+    cosi = -cosi;
+    eta = Index;
+  }
+
+  float k = 1 - eta * eta * (1 - cosi * cosi);
+  if (k < 0) return false;
+
+  Vector3D NewVector = eta * Direction + (eta * cosi - sqrtf(k)) * N;
+
+  // The offset goes through the surface, along the new ray
+  float delta = 0.0001;
+
+  Refracted = Ray(Intersection + NewVector * delta, NewVector);
+  Refracted.Time = Time;
+
+  // The cone is treated as if the surface were flat, like reflect() does
+  if (ConeSpread > 0)
+    Refracted.setCone(getFootprint(dot(Intersection - Origin, Direction)),
+                      ConeSpread);
+  return true;
 }
 
 #endif
@@ -0,0 +1,175 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file sampler.cc Implementation of the PixelSampler class
+*/
+
+#include "sampler.hh"
+
+
+const unsigned int SobolMatrices[SOBOL_DIMENSIONS][32] =
+{
+  {
+    0x80000000, 0x40000000, 0x20000000, 0x10000000,
+    0x08000000, 0x04000000, 0x02000000, 0x01000000,
+    0x00800000, 0x00400000, 0x00200000, 0x00100000,
+    0x00080000, 0x00040000, 0x00020000, 0x00010000,
+    0x00008000, 0x00004000, 0x00002000, 0x00001000,
+    0x00000800, 0x00000400, 0x00000200, 0x00000100,
+    0x00000080, 0x00000040, 0x00000020, 0x00000010,
+    0x00000008, 0x00000004, 0x00000002, 0x00000001
+  },
+  {
+    0x80000000, 0xc0000000, 0xa0000000, 0xf0000000,
+    0x88000000, 0xcc000000, 0xaa000000, 0xff000000,
+    0x80800000, 0xc0c00000, 0xa0a00000, 0xf0f00000,
+    0x88880000, 0xcccc0000, 0xaaaa0000, 0xffff0000,
+    0x80008000, 0xc000c000, 0xa000a000, 0xf000f000,
+    0x88008800, 0xcc00cc00, 0xaa00aa00, 0xff00ff00,
+    0x80808080, 0xc0c0c0c0, 0xa0a0a0a0, 0xf0f0f0f0,
+    0x88888888, 0xcccccccc, 0xaaaaaaaa, 0xffffffff
+  },
+  {
+    0x80000000, 0xc0000000, 0x60000000, 0x90000000,
+    0xe8000000, 0x5c000000, 0x8e000000, 0xc5000000,
+    0x68800000, 0x9cc00000, 0xee600000, 0x55900000,
+    0x80680000, 0xc09c0000, 0x60ee0000, 0x90550000,
+    0xe8808000, 0x5cc0c000, 0x8e606000, 0xc5909000,
+    0x6868e800, 0x9c9c5c00, 0xeeee8e00, 0x5555c500,
+    0x8000e880, 0xc0005cc0, 0x60008e60, 0x9000c590,
+    0xe8006868, 0x5c009c9c, 0x8e00eeee, 0xc5005555
+  }
+};
+
+
+/** A 32 bit integer hash, with little bias. */
+static inline unsigned int hashInt(unsigned int x)
+{
+  x ^= x >> 16;
+  x *= 0x7feb352du;
+  x ^= x >> 15;
+  x *= 0x846ca68bu;
+  x ^= x >> 16;
+  return x;
+}
+
+
+/** Mixes a value into a hash. */
+static inline unsigned int hashCombine(unsigned int Seed, unsigned int v)
+{
+  return hashInt(Seed ^ (v + 0x9e3779b9u + (Seed << 6) + (Seed >> 2)));
+}
+
+
+/** Reverses the order of the bits of a 32 bit number. */
+static inline unsigned int reverseBits(unsigned int x)
+{
+  x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+  x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+  x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+  x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+  return (x >> 16) | (x << 16);
+}
+
+
+/** An Owen scrambling of a 32 bit fraction: every bit is flipped or not
+* by a hash of the bits above it, so points in the same interval of any
+* power of two stay in one. The hash works from the low bits up, hence
+* the reversals.
+*/
+static inline unsigned int owenScramble(unsigned int x, unsigned int Seed)
+{
+  x = reverseBits(x);
+  x += Seed;
+  x ^= x * 0x6c50b47cu;
+  x ^= x * 0xb82f1e52u;
+  x ^= x * 0xc7afe638u;
+  x ^= x * 0x8d22f6e6u;
+  return reverseBits(x);
+}
+
+
+/** A 32 bit fraction as a float in [0, 1). */
+static inline float toUnit(unsigned int x)
+{
+  return (x >> 8) * (1.0f / (1 << 24));
+}
+
+
+PixelSampler::PixelSampler(int x, int y, SamplerType Type_)
+  : Type(Type_), Index(0)
+{
+  Seed = hashCombine(hashInt(x), y);
+}
+
+
+float PixelSampler::sobol(unsigned int Stream, unsigned int Dimension) const
+{
+  unsigned int StreamSeed = hashCombine(Seed, Stream);
+
+  // Scrambling the index shuffles the points, within every power of two
+  unsigned int i = owenScramble(Index, StreamSeed), x = 0;
+
+  for (unsigned int k = 0; i != 0; i >>= 1, k++)
+    if (i & 1) x ^= SobolMatrices[Dimension][k];
+
+  return toUnit(owenScramble(x, hashCombine(StreamSeed, Dimension)));
+}
+
+
+float PixelSampler::random(unsigned int Dimension) const
+{
+  return toUnit(hashCombine(hashCombine(Seed, Index), Dimension));
+}
+
+
+float PixelSampler::get1D(SampleDimension Use) const
+{
+  if (Type == SAMPLER_RANDOM) return random(2 * Use);
+
+  // The time goes with the position in the pixel, in the third dimension
+  if (Use == SAMPLE_TIME) return sobol(SAMPLE_PIXEL, 2);
+  return sobol(Use, 0);
+}
+
+
+void PixelSampler::get2D(SampleDimension Use, float & u, float & v) const
+{
+  if (Type == SAMPLER_RANDOM)
+  {
+    u = random(2 * Use);
+    v = random(2 * Use + 1);
+    return;
+  }
+
+  u = sobol(Use, 0);
+  v = sobol(Use, 1);
+}
+
+
+bool parseSamplerType(const string & Name, SamplerType & Type)
+{
+  if (Name == "sobol") Type = SAMPLER_SOBOL;
+  else if (Name == "random") Type = SAMPLER_RANDOM;
+  else return false;
+
+  return true;
+}
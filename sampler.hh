@@ -0,0 +1,125 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file sampler.hh The PixelSampler class, which places the rays of a
+* pixel.
+*/
+
+#ifndef SAMPLER_HH
+#define SAMPLER_HH
+
+#include <string>
+
+using namespace std;
+
+/** The number of dimensions of the Sobol sequence kept in the table. */
+const unsigned int SOBOL_DIMENSIONS = 3;
+
+/** The generator matrices of the first Sobol dimensions, one column of 32
+* bits per bit of the sample index, after Joe and Kuo.
+*/
+extern const unsigned int SobolMatrices[SOBOL_DIMENSIONS][32];
+
+/** How the samples of a pixel are placed. */
+enum SamplerType
+{
+/** Owen scrambled Sobol points, stratified in every dimension. */
+  SAMPLER_SOBOL,
+/** Independent uniform random numbers, for comparison. */
+  SAMPLER_RANDOM
+};
+
+/** What a sample is used for. Each use draws its own numbers. */
+enum SampleDimension
+{
+/** The position within the pixel, 2D. */
+  SAMPLE_PIXEL,
+/** The scene time, 1D. */
+  SAMPLE_TIME,
+/** The position on the lens, 2D. */
+  SAMPLE_LENS,
+/** The point on a light, 2D. */
+  SAMPLE_LIGHT
+};
+
+
+/** The numbers of the samples of one pixel.
+* The position in the pixel and the time come from the first three
+* dimensions of one Sobol sequence, so they are stratified together; the
+* other uses take the first two dimensions again with their own
+* scrambling. Every pixel shuffles and scrambles the points by a hash of
+* its position (Owen scrambling in the manner of Laine and Karras), so
+* neighbouring pixels do not share their patterns. Sample i of a pixel is
+* computed from i alone: nothing is allocated and the samples may be
+* taken in any order. The first 2^k samples are stratified best.
+*/
+class PixelSampler
+{
+private:
+
+/** The hash of the pixel. */
+  unsigned int Seed;
+
+/** The sequence. */
+  SamplerType Type;
+
+/** The current sample. */
+  unsigned int Index;
+
+/** The sample point of a dimension of the Sobol sequence, scrambled.
+* @param Stream Separates the uses that share dimensions.
+*/
+  float sobol(unsigned int Stream, unsigned int Dimension) const;
+
+/** A random number for a dimension of the current sample. */
+  float random(unsigned int Dimension) const;
+
+public:
+
+/** The constructor.
+* @param x The column of the pixel.
+* @param y The row of the pixel.
+* @param Type_ The sequence.
+*/
+  PixelSampler(int x, int y, SamplerType Type_ = SAMPLER_SOBOL);
+
+/** Moves on to sample i of the pixel. */
+  void setSample(unsigned int i);
+
+/** A number in [0, 1) for a 1D use of the current sample. */
+  float get1D(SampleDimension Use) const;
+
+/** Two numbers in [0, 1) for a 2D use of the current sample. */
+  void get2D(SampleDimension Use, float & u, float & v) const;
+};
+
+/** Converts "sobol" or "random" to a SamplerType.
+* @return False if the name is unknown.
+*/
+bool parseSamplerType(const string & Name, SamplerType & Type);
+
+
+inline void PixelSampler::setSample(unsigned int i)
+{
+  Index = i;
+}
+
+#endif //SAMPLER_HH
@@ -23,6 +23,7 @@
 */
 
 #include "scene.hh"
+#include "tonemap.hh"
 
 /** Just a handy function */
 float max(float f1, float f2)
@@ -34,62 +35,281 @@ float max(float f1, float f2)
 }
 
 
+/** The FNV-1a hash of a string. */
+static unsigned int hashString(const string & s)
+{
+  unsigned int h = 2166136261u;
+
+  for (unsigned int i = 0; i < s.size(); i++)
+    h = (h ^ (unsigned char) s[i]) * 16777619u;
+  return h;
+}
+
+
+RayBudget::RayBudget(int Rays_, const Ray & R): Rays(Rays_)
+{
+  unsigned int h = 2166136261u, bits;
+
+  for (int i = 0; i < 3; i++)
+  {
+    float f = R.getDirection()[i];
+    memcpy(&bits, &f, sizeof(bits));
+    h = (h ^ bits) * 16777619u;
+  }
+
+  // Rays of a pixel at other times draw other numbers; static scenes only
+  // trace at time 0 and keep theirs
+  if (R.getTime() != 0)
+  {
+    float f = R.getTime();
+    memcpy(&bits, &f, sizeof(bits));
+    h = (h ^ bits) * 16777619u;
+  }
+  State = h ? h : 1;
+}
+
+
+/** Xorshift, plenty for choosing rays. */
+float RayBudget::random()
+{
+  State ^= State << 13;
+  State ^= State >> 17;
+  State ^= State << 5;
+  return (State >> 8) * (1.0f / (1 << 24));
+}
+
+
+/** The part of the light a transparent surface reflects, after Schlick.
+* @param D The direction of the ray, of unit length.
+* @param N The normal of the surface, of any length.
+* @param Index The refractive index of the inside, the outside is air.
+* @return 1 if the light cannot leave the object there.
+*/
+static float fresnel(const Vector3D & D, Vector3D N, float Index)
+{
+  N.normalize();
+
+  float cosi = dot(D, N), n1 = 1, n2 = Index;
+
+  // Leaving the object
+  if (cosi > 0) swap(n1, n2);
+  cosi = fabsf(cosi);
+
+  // Past the critical angle only the cosine on the side of the thinner
+  // medium is meaningful, and there is none
+  float sint2 = (n1 / n2) * (n1 / n2) * (1 - cosi * cosi);
+  if (sint2 >= 1) return 1;
+
+  float c = (n1 > n2) ? sqrtf(1 - sint2) : cosi;
+  float r0 = (n1 - n2) / (n1 + n2);
+  r0 *= r0;
+
+  float m = 1 - c;
+  return r0 + (1 - r0) * m * m * m * m * m;
+}
+
+
+bool Scene::finalize()
+{
+  World = Group();
+  TouchBits.resize(SObjects.size());
+
+  for (unsigned int i = 0; i < SObjects.size(); i++)
+  {
+    if (!SObjects[i]->Finalize())
+    {
+      cerr << "Scene object " << i << " is degenerate and cannot be rendered\n";
+      return false;
+    }
+    World.AddObject(SObjects[i]);
+
+    // Objects built in code have no text and fall back to their index
+    unsigned int h = Sources[i].empty() ? i : hashString(Sources[i]);
+    TouchBits[i] = 1ull << (h % 64);
+  }
+
+  World.BuildBVH();
+  Moving = World.isMoving();
+  Finalized = true;
+  return true;
+}
+
+
 /** The rendering function.
 * @param cam The camera object describing the point of view from which the 
 * scene is looked at.
-* @param imgSize The size of the image in pixels.
-* @param out The stream to which the output should be directed.
-* @return No return value. It does however output an image to the provided stream.
+* @param Frame The image, its size gives the resolution.
+* @param Order The order in which the pixels are visited. It does not change
+* the image, only how well the caches are used.
+* @param GBuf Optional, receives the camera ray hits.
+* @return No return value. The colors of the pixels are stored in Frame.
 * This method will shoot rays out of each pixel in order to determine their color.
 * The color of the pixel is calculated by taking into account all the light objects
 * in the scene. As a result, if the colors are too bright they might eventually get
-* out of the [0,1] range in which color is defined by convention. In this case, the
-* Render method will use the ceiling function to limit those color components which 
-* exceed 1, to 1. The resulting image is directed to the out stream in the form of a
-* ASCII PNM image.
+* out of the [0,1] range in which color is defined by convention. They are stored
+* as they are; limiting them to the displayable range is the job of ToneMapper.
 * @see Camera
+* @see ToneMapper
 */
-void Scene::Render(const Camera & cam, int imgSize, ostream & out) const
+void Scene::Render(const Camera & cam, FrameBuffer & Frame,
+                   PixelOrder Order, GBuffer * GBuf) const
 {
-  out << "P3 " << imgSize << " " << imgSize << " " << 255 << endl;
-  short int k = 0;
-  float R,G,B,T;
-  
-  for (int y = 0; y < imgSize; y++)
+  int Width = Frame.getWidth(), Height = Frame.getHeight();
+  vector<unsigned int> Pixels;
+
+  assert(Finalized);
+
+  if (GBuf) GBuf->resize(Width, Height);
+
+  // A band of tile rows at a time: the order within the bands is that of
+  // the whole image, and huge images need no list of all their pixels
+  for (int y0 = 0; y0 < Height; y0 += TILE_SIZE)
   {
-   for (int x =0; x < imgSize; x++)
+    int Rows = min((int) TILE_SIZE, Height - y0);
+    makePixelOrder(Order, Width, Rows, Pixels);
+
+    for (unsigned int i = 0; i < Pixels.size(); i++)
     {
-      Ray pixelRay = cam.getRayForPixel(x,y,imgSize);
-      Color pixelColor = traceRay(pixelRay);
-      //Output 4 pixels per line
-      if (k == 4) 
-      { 
-       out << endl;
-       k = 0;
+      int x = Pixels[i] % Width, y = y0 + Pixels[i] / Width;
+
+      if (GBuf)
+      {
+        Ray pixelRay = cam.getRayForPixel(x, y, Width, Height);
+        Frame.setPixel(x, y, traceRay(pixelRay, 0, &GBuf->at(x, y)));
       }
-      k++; 
-      
-      R = pixelColor.get_red();
-      G = pixelColor.get_green();
-      B = pixelColor.get_blue();
-      
-      //Let's ceil them
-      R = ceil(((R > 1) ? 1 : R) * 255);
-      G = ceil(((G > 1) ? 1 : G) * 255);
-      B = ceil(((B > 1) ? 1 : B) * 255);
-          
-      
-      out << R << " " 
-          << G << " "
-          << B << " ";
-         
+      else
+        Frame.setPixel(x, y, tracePixel(cam, x, y, Width, Height));
     }
   }
 }
 
 
+/** Relighting.
+* The hits are stored as the same floats the full render shades with, and
+* the camera rays are generated the same way, so with unchanged lights the
+* image is exactly that of Render().
+*/
+void Scene::Relight(const Camera & cam, const GBuffer & GBuf,
+                    FrameBuffer & Frame) const
+{
+  int Width = GBuf.getWidth(), Height = GBuf.getHeight();
+
+  assert(Finalized);
+  assert((Frame.getWidth() == Width) && (Frame.getHeight() == Height));
+
+  for (int y = 0; y < Height; y++)
+  {
+    for (int x = 0; x < Width; x++)
+    {
+      const GBufferTexel & T = GBuf.at(x, y);
+
+      if (T.Object < 0)
+      {
+        Frame.setPixel(x, y, BACKGROUND_CLR);
+        continue;
+      }
+
+      Ray pixelRay = cam.getRayForPixel(x, y, Width, Height);
+
+      // The G-buffer has one hit per pixel, the tree of rays below a
+      // transparent surface is traced again in full
+      if (T.Transparency > 0)
+      {
+        Frame.setPixel(x, y, traceRay(pixelRay));
+        continue;
+      }
+
+      Vector3D P(T.Point[0], T.Point[1], T.Point[2]);
+      Vector3D N(T.Normal[0], T.Normal[1], T.Normal[2]);
+      Color Result = ShadePoint(P, N, Color(T.BaseColor[0], T.BaseColor[1],
+                                            T.BaseColor[2]));
+
+      // The same budget, and random numbers, as the camera ray had
+      RayBudget Budget(MaxRays - 1, pixelRay);
+      if ((T.Reflectivity > 0) && (Budget.Rays > 0))
+        Result += T.Reflectivity * traceRay(pixelRay.reflect(P, N), 1, 0,
+                                            T.Reflectivity, Budget);
+
+      Frame.setPixel(x, y, Result);
+    }
+  }
+}
+
+
+void Scene::RenderRows(const Camera & cam, int Height, int y0,
+                       FrameBuffer & Rows, PixelOrder Order) const
+{
+  int Width = Rows.getWidth();
+  vector<unsigned int> Pixels;
+
+  assert(Finalized);
+  assert((Order == ORDER_ROWS) || (y0 % TILE_SIZE == 0));
+  assert(y0 + Rows.getHeight() <= Height);
+
+  makePixelOrder(Order, Width, Rows.getHeight(), Pixels);
+
+  for (unsigned int i = 0; i < Pixels.size(); i++)
+  {
+    int x = Pixels[i] % Width, y = Pixels[i] / Width;
+    Rows.setPixel(x, y, tracePixel(cam, x, y0 + y, Width, Height));
+  }
+}
+
+
+/** Several samples per pixel.
+* The sampler spreads the rays of a pixel evenly over the pixel and the
+* shutter interval together, and differently in every pixel, so that the
+* noise is the same in every run and falls off quickly with the samples.
+* All times share the one tree of the scene, whose moving parts are
+* bounded over time by motion BVHs.
+*/
+Color Scene::tracePixel(const Camera & cam, int x, int y, int Width,
+                        int Height) const
+{
+  int Samples = Moving ? max(PixelSamples, MotionSamples) : PixelSamples;
+
+  if ((Samples == 1) && !Moving)
+    return traceRay(cam.getRayForPixel(x, y, Width, Height));
+
+  PixelSampler Sampler(x, y, Sampling);
+  Color Sum;
+  float u, v;
+
+  for (int i = 0; i < Samples; i++)
+  {
+    Sampler.setSample(i);
+    Sampler.get2D(SAMPLE_PIXEL, u, v);
+
+    Ray R = cam.getRayForPixel(x, y, Width, Height, u - 0.5f, v - 0.5f);
+    if (Moving)
+      R.setTime(ShutterOpen + Sampler.get1D(SAMPLE_TIME) *
+                (ShutterClose - ShutterOpen));
+    Sum += traceRay(R);
+  }
+
+  Sum *= 1.0f / Samples;
+  return Sum;
+}
+
+
+/** Renders the scene and outputs it to the provided stream in the form of
+* an ASCII PNM image, limiting the color components which exceed 1 to 1.
+* @see ToneMapper
+*/
+void Scene::Render(const Camera & cam, int imgSize, ostream & out) const
+{
+  FrameBuffer Frame(imgSize, imgSize);
+
+  Render(cam, Frame);
+  ToneMapper().writePPM(Frame, out);
+}
+
+
 /** Traces one ray and determines the color of a certain pixel.
 * @param R The ray to be traced.
+* @param depth The number of reflections that led to R.
+* @param Texel If not null, receives what R hit. The reflections only add
+* the objects they hit to Texel->Touched.
 * @return The color of the point of intersection with the closest object.
  
 * This method will check for intersections with all the objects in the
@@ -101,50 +321,132 @@ void Scene::Render(const Camera & cam, int imgSize, ostream & out) const
 * @see Ray
 */ 
 
-Color Scene::traceRay(const Ray & R, unsigned int depth) const
+Color Scene::traceRay(const Ray & R, unsigned int depth,
+                      GBufferTexel * Texel) const
 {
-  int i,k = 0;
-  float temp, t = 10e6;
-  int Ssize = SObjects.size(); 
-  int Lsize = Lights.size();
-  Color Result(0,0,0), TempColor;
-  Vector3D L,N, Intersection;
-  Ray reflected_ray(L,L);
-    
-  for(i = 0; i < Ssize; i++)
+  RayBudget Budget(max(MaxRays - (int) depth, 1), R);
+  return traceRay(R, depth, Texel, 1, Budget);
+}
+
+
+/** The ray tree of a pixel.
+* Opaque surfaces continue the ray with its reflection. Transparent ones
+* also take the color of the object only for 1 - Transparency() of the
+* light and split the rest between a reflected and a refracted ray, by the
+* Fresnel equations. The stronger of the two is traced first; the weaker
+* one is dropped, or only traced now and then, if its weight in the pixel
+* is below MinWeight, which keeps the image unbiased on average. When the
+* budget of the pixel runs out, the rays not started yet are left out.
+*/
+Color Scene::traceRay(const Ray & R, unsigned int depth, GBufferTexel * Texel,
+                      float Weight, RayBudget & Budget) const
+{
+  HitInfo Hit(R);
+
+  Budget.Rays--;
+
+  if (!Intersect(R, Hit))
   {
-   temp = SObjects[i]->Intersection(R);
-   if ((t > temp) && (temp != -1))
-   {
-    t = temp;
-    k = i; 
-   }
+    if (Texel && (depth == 0)) Texel->clear();
+    return BACKGROUND_CLR;
   }
-  
-  if(t == 10e6)  return BACKGROUND_CLR;
-  
-  //if (!SObjects[k]->contains(R.getPoint(t)))
-   //cerr << "False intersect with object k=" << k << " (t=" << t << ") at " << R.getPoint(t);
-  Intersection = R.getPoint(t);
-
-  for(i = 0; i < Lsize; i++)
+
+  Vector3D P = R.getPoint(Hit.t);
+  Color Base = Hit.Obj->getSurfaceColor(Hit.LocalPoint,
+                                        R.getFootprint(Hit.t));
+  Color Result = ShadePoint(P, Hit.N, Base);
+  float Refl = Hit.Obj->Reflectivity(), Transp = Hit.Obj->Transparency();
+
+  if (Texel && (depth > 0))
+    Texel->Touched |= touchBit(Hit.Index);
+  else if (Texel)
   {
-    L = Lights[i]->getPosition() - Intersection;
-    N = SObjects[k]->Normal(Intersection);
+    Texel->Object = Hit.Index;
+    Texel->Touched = touchBit(Hit.Index);
+    Texel->Reflectivity = Refl;
+    Texel->Transparency = Transp;
+    for (int i = 0; i < 3; i++)
+    {
+      Texel->Point[i] = P[i];
+      Texel->Normal[i] = Hit.N[i];
+    }
+    Texel->BaseColor[0] = Base.get_red();
+    Texel->BaseColor[1] = Base.get_green();
+    Texel->BaseColor[2] = Base.get_blue();
+  }
+
+  if ((depth >= MAX_DEPTH) || (Budget.Rays <= 0)) return Result;
+
+  //Check if object is reflective
+  if (Transp <= 0)
+  {
+    if (Refl > 0)
+    {
+      Color TempColor = traceRay(R.reflect(P, Hit.N), depth + 1, Texel,
+                                 Weight * Refl, Budget);
+      Result += Refl * TempColor;
+    }
+    return Result;
+  }
+
+  Result *= 1 - Transp;
+
+  // The weights of the reflected and the refracted ray
+  Ray Refracted = R;
+  bool through = R.refract(P, Hit.N, Hit.Obj->RefractiveIndex(), Refracted);
+  float F = through ? fresnel(R.getDirection(), Hit.N,
+                              Hit.Obj->RefractiveIndex()) : 1;
+  float k[2] = {Refl + Transp * F, Transp * (1 - F)};
+  int strong = (k[1] > k[0]) ? 1 : 0;
+
+  for (int j = 0; j < 2; j++)
+  {
+    int b = j ? 1 - strong : strong;
+    float w = Weight * k[b], scale = 1;
+
+    if ((k[b] <= 0) || (Budget.Rays <= 0)) continue;
+
+    // Russian roulette on the weaker ray
+    if (j && (w < MinWeight))
+    {
+      float p = w / MinWeight;
+      if (Budget.random() >= p) continue;
+      scale = 1 / p;
+      w = MinWeight;
+    }
+
+    Ray Next = b ? Refracted : R.reflect(P, Hit.N);
+    Result += (k[b] * scale) * traceRay(Next, depth + 1, Texel, w, Budget);
+  }
+
+  return Result;
+}
+
+
+Color Scene::Shade(const Ray & R, const HitInfo & Hit) const
+{
+  Color Base = Hit.Obj->getSurfaceColor(Hit.LocalPoint,
+                                        R.getFootprint(Hit.t));
+  return ShadePoint(R.getPoint(Hit.t), Hit.N, Base);
+}
+
+
+Color Scene::ShadePoint(const Vector3D & P, const Vector3D & N,
+                        const Color & Base) const
+{
+  int Lsize = Lights.size();
+  Color Result(0,0,0), TempColor;
+  Vector3D L;
+
+  for(int i = 0; i < Lsize; i++)
+  {
+    L = Lights[i]->getPosition() - P;
     TempColor = Lights[i]->getColor();
-    TempColor *= SObjects[k]->getColor(Intersection);
+    TempColor *= Base;
     TempColor *= max(dot(N,L),0);
     Result += TempColor;
   }
 
-   //Check if object is reflective or if we've reached max depth
-   if ((depth < 6) && (SObjects[k]->Reflectivity() > 0))
-   { 
-     reflected_ray = R.reflect(Intersection, SObjects[k]->Normal(Intersection));
-     TempColor = traceRay(reflected_ray, depth + 1);
-     Result += SObjects[k]->Reflectivity() * TempColor;
-   }
-
   return Result;
 }
 
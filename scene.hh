@@ -31,25 +31,38 @@
 */
 #include <boost/shared_ptr.hpp>
 #include "scene_objects/sceneobject.hh"
+#include "scene_objects/instance.hh"
 #include "color.hh"
 #include "ray.hh"
 #include "camera.hh"
 #include "light.hh"
+#include "framebuffer.hh"
+#include "pixelorder.hh"
+#include "gbuffer.hh"
+#include "sampler.hh"
 
 
 using namespace std;
 
-//Returned by Intersection(const Ray &) if there's no intersection.
-/** The result of the Intersection function if no intersection is detected 
-* @see SceneClass::Intersection()
-*/
-const int NO_INTERSECTION = -1;
-
 /** The background color of the scene.
 * @see Color
  */
 const Color BACKGROUND_CLR = Color(0.1,0.1,0.5);
 
+/** The number of reflections followed for every camera ray. */
+const unsigned int MAX_DEPTH = 6;
+
+/** The number of rays traced for a pixel at most, by default. */
+const int RAY_BUDGET = 64;
+
+/** Below this weight in the pixel, the weaker ray of a split at a
+* transparent surface is only traced now and then, by default.
+*/
+const float MIN_RAY_WEIGHT = 0.01;
+
+/** The times sampled per pixel in scenes with moving objects, by default. */
+const int MOTION_SAMPLES = 16;
+
 /** A shorter definition for a shared_pt<SceneObject> object */
 typedef boost::shared_ptr<SceneObject> SPSceneObject; 
 /** A shorter definition for a shared_pt<Light> object*/
@@ -57,6 +70,32 @@ typedef boost::shared_ptr<Light> SPLight;
 
 
 
+/** What is left to spend on the rays of one pixel.
+* Transparent surfaces split a ray in two, so the rays of a pixel form a
+* tree that could have 2^MAX_DEPTH leaves. Every ray traced takes one
+* from Rays, and no ray is started once they are gone. The random numbers
+* deciding whether weak rays are traced come from the camera ray, so a
+* pixel looks the same whatever the renderer and the order of the pixels.
+*/
+struct RayBudget
+{
+/** The rays that may still be traced. */
+  int Rays;
+
+/** The state of the random number generator, never 0. */
+  unsigned int State;
+
+/** The budget of a pixel.
+* @param Rays_ The rays the pixel may trace.
+* @param R Its camera ray, which seeds the random numbers.
+*/
+  RayBudget(int Rays_, const Ray & R);
+
+/** A random number in [0, 1). */
+  float random();
+};
+
+
 /** Describes the scene.
 * Has information about the surroundings:
 * light source, objects.
@@ -65,33 +104,202 @@ typedef boost::shared_ptr<Light> SPLight;
 */
 class Scene
 {
+private:
+
+/** The top level of the acceleration structure: a BVH over SObjects.
+* Instances and meshes carry their own bottom level BVHs.
+* This, not SObjects, is what rendering looks at.
+* @see finalize()
+*/
+  Group World;
 
+/** The bit of every object of SObjects in a TouchMask.
+* @see touchBit()
+*/
+  vector<TouchMask> TouchBits;
+
+/** Set by finalize(). */
+  bool Finalized;
+
+/** The ray budget of a pixel, see setRayBudget(). */
+  int MaxRays;
+  float MinWeight;
+
+/** True if some object moves, set by finalize(). */
+  bool Moving;
+
+/** The sampling of the shutter interval, see setMotionBlur(). */
+  int MotionSamples;
+  float ShutterOpen, ShutterClose;
+
+/** The samples of a pixel, see setSampling(). */
+  int PixelSamples;
+  SamplerType Sampling;
+
+/** Traces a ray within the budget of its pixel.
+* @param Weight What the color of R is multiplied by in the pixel.
+* @param Budget The rays left to the pixel, and its random numbers.
+*/
+  Color traceRay(const Ray & R, unsigned int depth, GBufferTexel * Texel,
+                 float Weight, RayBudget & Budget) const;
 
 public:
 
 /** An STL vector holding the Scene Objects */
   vector<SPSceneObject> SObjects;
 
+/** The scene file text each object of SObjects was read from, with the
+* text of the groups it instances. Empty for objects built in code.
+*/
+  vector<string> Sources;
+
 /** An STL vector holding Light objects */
   vector<SPLight> Lights;  
 
 /** Default constructor. Does nothing. */
-  Scene() {};
+  Scene(): Finalized(false), MaxRays(RAY_BUDGET),
+           MinWeight(MIN_RAY_WEIGHT), Moving(false),
+           MotionSamples(MOTION_SAMPLES), ShutterOpen(0), ShutterClose(1),
+           PixelSamples(1), Sampling(SAMPLER_SOBOL) {};
 
 /** Destructor. Does nothing. */
   ~Scene() {};
 
-/** Adds a new SceneObject to the scene */
-  void AddSceneObject(SPSceneObject SObject);
+/** Adds a new SceneObject to the scene
+* @param SObject The object.
+* @param Source The text it was read from, if any.
+*/
+  void AddSceneObject(SPSceneObject SObject, const string & Source = string());
 
 /** Adds a new Light object to the scene */
   void AddLight(SPLight LObject);
 
-/** Renders the scene. */
+/** Limits the work spent on each pixel.
+* @param MaxRays_ The number of rays traced for a pixel at most.
+* @param MinWeight_ Where a transparent surface splits a ray into a
+* reflected and a refracted one, the weaker of the two is traced only
+* with probability weight / MinWeight_ if its weight in the pixel is
+* below MinWeight_, and counts for as much more when it is.
+*/
+  void setRayBudget(int MaxRays_, float MinWeight_ = MIN_RAY_WEIGHT);
+
+/** Sets how moving objects are blurred. The keys of moving instances are
+* placed in a scene time, from 0 to 1 for evenly spaced keys; the shutter
+* is open over part of it and every pixel averages as many rays at
+* stratified times within it. Scenes where nothing moves ignore this.
+* @param Samples The rays per pixel at least, see setSampling().
+* @param Open The scene time the shutter opens at, 0 to 1.
+* @param Close The scene time it closes at, Open to 1; Close == Open
+* freezes time.
+*/
+  void setMotionBlur(int Samples, float Open = 0, float Close = 1);
+
+/** Sets how many rays are averaged for every pixel, spread over the
+* pixel. A single one goes through its center.
+* @param Samples The rays per pixel, at least 1. Moving scenes trace no
+* fewer than those of setMotionBlur().
+* @param Type How the rays are spread over the pixel and the shutter
+* interval.
+*/
+  void setSampling(int Samples, SamplerType Type = SAMPLER_SOBOL);
+
+/** True if some object of the finalized scene moves. */
+  bool isMoving() const;
+
+/** Prepares the scene for rendering.
+* Every object precomputes its intersection constants and is checked,
+* then the acceleration structure is built over SObjects. Must be called
+* after the last object is added and before rendering; the objects must
+* not be changed afterwards.
+* @return False, after reporting the culprit, if an object is degenerate.
+*/
+  bool finalize();
+
+/** Renders the scene into a HDR frame buffer.
+* @param cam The point of view.
+* @param Frame The image to fill. Its size sets the resolution.
+* @param Order The order in which the pixels are traced.
+* @param GBuf If given, receives what the camera ray of every pixel hit,
+* for Relight(). It is resized to the image.
+*/
+  void Render(const Camera & cam, FrameBuffer & Frame,
+              PixelOrder Order = ORDER_ROWS, GBuffer * GBuf = 0) const;
+
+/** Renders some rows of the image.
+* @param cam The point of view.
+* @param Height The height of the whole image, Rows gives its width.
+* @param y0 The first row rendered. For the curved orders a multiple of
+* TILE_SIZE, so that they visit the same tiles as for the whole image.
+* @param Rows Receives the rows y0 to y0 + Rows.getHeight() - 1.
+* @param Order The order in which the pixels are traced.
+*/
+  void RenderRows(const Camera & cam, int Height, int y0, FrameBuffer & Rows,
+                  PixelOrder Order = ORDER_ROWS) const;
+
+/** Renders the scene again from the camera ray hits of an earlier render.
+* Only the light loop and the reflected rays are traced, so the lights
+* may have changed since, but not the camera or the objects.
+* @param cam The camera the G-buffer was made with.
+* @param GBuf The hits. Its size sets the resolution.
+* @param Frame The image to fill, the same size as GBuf.
+*/
+  void Relight(const Camera & cam, const GBuffer & GBuf,
+               FrameBuffer & Frame) const;
+
+/** Renders the scene and writes it as a clamped ASCII PNM image. */
   void Render(const Camera & cam, int imgSize, ostream & out) const;
 
-/** Returns the color of the object that the ray falls on. */ 
-  Color traceRay(const Ray & R, unsigned int depth = 0) const;
+/** Returns the color of the object that the ray falls on.
+* The ray is the camera ray of its pixel, or one that follows depth of
+* them, and gets the rays of the budget that are left.
+* @param Texel If given, receives what the ray hit.
+*/
+  Color traceRay(const Ray & R, unsigned int depth = 0,
+                 GBufferTexel * Texel = 0) const;
+
+/** Returns the color of a pixel. With one sample per pixel and nothing
+* moving, that of the ray through its center; otherwise the average over
+* rays spread over the pixel and the shutter interval. The G-buffer,
+* relighting, the wavefront renderer and --watch only trace the center
+* of the pixels at scene time 0.
+* @param cam The point of view.
+* @param x The column of the pixel.
+* @param y The row of the pixel.
+* @param Width The width of the image.
+* @param Height The height of the image.
+*/
+  Color tracePixel(const Camera & cam, int x, int y, int Width,
+                   int Height) const;
+
+/** Finds the closest object along a ray.
+* @return False if the ray hits nothing.
+*/
+  bool Intersect(const Ray & R, HitInfo & Hit) const;
+
+/** The light reaching a hit point straight from the light sources.
+* Reflections are not included.
+* @param R The ray that found the hit.
+* @param Hit The hit, as filled by Intersect().
+*/
+  Color Shade(const Ray & R, const HitInfo & Hit) const;
+
+/** The light reaching a point straight from the light sources.
+* @param P The point, in world coordinates.
+* @param N The surface normal at P.
+* @param Base The color of the surface at P.
+*/
+  Color ShadePoint(const Vector3D & P, const Vector3D & N,
+                   const Color & Base) const;
+
+/** The bit that stands for an object in a TouchMask.
+* Taken from a hash of the object's source text, so that an object keeps
+* its bit when the scene is read again with other objects changed.
+* @param i The index of the object in SObjects.
+*/
+  TouchMask touchBit(unsigned int i) const;
+
+/** True once finalize() has succeeded. */
+  bool isFinalized() const;
 
 /** Prints information about the scene. 
 * Mostly used for debugging.
@@ -101,17 +309,62 @@ public:
 };
 
 
-inline void Scene::AddSceneObject(SPSceneObject SObject)
+inline void Scene::AddSceneObject(SPSceneObject SObject, const string & Source)
 { 
   //Check valid pointer
   assert(SObject != 0);
   
   //Should check for enough memory if the vector is resized?
   SObjects.push_back(SObject);
+  Sources.push_back(Source);
+  Finalized = false;
 }
 
 
 
+inline bool Scene::Intersect(const Ray & R, HitInfo & Hit) const
+{
+  return World.Intersect(R, Hit);
+}
+
+inline void Scene::setRayBudget(int MaxRays_, float MinWeight_)
+{
+  assert(MaxRays_ > 0);
+  MaxRays = MaxRays_;
+  MinWeight = MinWeight_;
+}
+
+inline void Scene::setMotionBlur(int Samples, float Open, float Close)
+{
+  assert((Samples > 0) && (0 <= Open) && (Open <= Close) && (Close <= 1));
+  MotionSamples = Samples;
+  ShutterOpen = Open;
+  ShutterClose = Close;
+}
+
+inline void Scene::setSampling(int Samples, SamplerType Type)
+{
+  assert(Samples > 0);
+  PixelSamples = Samples;
+  Sampling = Type;
+}
+
+inline bool Scene::isMoving() const
+{
+  return Moving;
+}
+
+inline TouchMask Scene::touchBit(unsigned int i) const
+{
+  assert(i < TouchBits.size());
+  return TouchBits[i];
+}
+
+inline bool Scene::isFinalized() const
+{
+  return Finalized;
+}
+
 inline void Scene::AddLight(SPLight LObject)
 {
   //Check valid pointer
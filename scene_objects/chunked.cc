@@ -0,0 +1,620 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file chunked.cc Implementation of ChunkedMesh and GeometryCache
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <fstream>
+#include <algorithm>
+#include <sys/stat.h>
+#include <boost/atomic.hpp>
+#include "chunked.hh"
+
+
+/** Chunks start at multiples of this in the chunk file, so that the
+* pages of one can be released without those of its neighbours.
+*/
+const size_t CHUNK_ALIGN = 4096;
+
+/** How far from a triangle a point may be and still lie on it. */
+const float CHUNK_EPSILON = 0.001;
+
+
+/** The start of a chunk file, followed by a ChunkEntry per chunk. */
+struct ChunkFileHeader
+{
+  char Magic[4];
+  unsigned int Chunks, NodeBytes, ChunkTriangles;
+};
+
+
+GeometryCache::GeometryCache(unsigned int MiB)
+{
+  resize(MiB);
+}
+
+
+void GeometryCache::resize(unsigned int MiB)
+{
+  ShardBytes = ((size_t) MiB << 20) / GEOMETRY_CACHE_SHARDS;
+
+  for (unsigned int i = 0; i < GEOMETRY_CACHE_SHARDS; i++)
+  {
+    boost::mutex::scoped_lock Guard(Shards[i].Lock);
+    Shards[i].Recent.clear();
+    Shards[i].Index.clear();
+    Shards[i].Bytes = 0;
+    Shards[i].Hits = Shards[i].Misses = 0;
+  }
+}
+
+
+SPGeometryChunk GeometryCache::getChunk(const ChunkedMesh & Mesh,
+                                        unsigned int i)
+{
+  unsigned long long Key = Mesh.chunkKey(i);
+  Shard & S = Shards[((Key * 0x9e3779b97f4a7c15ull) >> 32) %
+                     GEOMETRY_CACHE_SHARDS];
+
+  {
+    boost::mutex::scoped_lock Guard(S.Lock);
+    map<unsigned long long,
+        list<pair<unsigned long long, SPGeometryChunk> >::iterator>::iterator
+      Found = S.Index.find(Key);
+
+    if (Found != S.Index.end())
+    {
+      S.Hits++;
+      S.Recent.splice(S.Recent.begin(), S.Recent, Found->second);
+      return Found->second->second;
+    }
+    S.Misses++;
+  }
+
+  // Read without the lock, other threads may use the shard meanwhile
+  SPGeometryChunk Chunk = Mesh.readChunk(i);
+  if (!Chunk) return Chunk;
+
+  boost::mutex::scoped_lock Guard(S.Lock);
+  if (S.Index.count(Key)) return S.Index[Key]->second;
+
+  S.Recent.push_front(make_pair(Key, Chunk));
+  S.Index[Key] = S.Recent.begin();
+  S.Bytes += Chunk->Bytes();
+  while ((S.Bytes > ShardBytes) && (S.Recent.size() > 1))
+  {
+    S.Bytes -= S.Recent.back().second->Bytes();
+    S.Index.erase(S.Recent.back().first);
+    S.Recent.pop_back();
+  }
+  return Chunk;
+}
+
+
+unsigned long GeometryCache::lookups() const
+{
+  unsigned long n = 0;
+
+  for (unsigned int i = 0; i < GEOMETRY_CACHE_SHARDS; i++)
+  {
+    boost::mutex::scoped_lock Guard(Shards[i].Lock);
+    n += Shards[i].Hits + Shards[i].Misses;
+  }
+  return n;
+}
+
+
+void GeometryCache::report(ostream & out) const
+{
+  unsigned long Hits = 0, Misses = 0;
+  size_t Cached = 0, Bytes = 0;
+
+  for (unsigned int i = 0; i < GEOMETRY_CACHE_SHARDS; i++)
+  {
+    boost::mutex::scoped_lock Guard(Shards[i].Lock);
+    Hits += Shards[i].Hits;
+    Misses += Shards[i].Misses;
+    Cached += Shards[i].Recent.size();
+    Bytes += Shards[i].Bytes;
+  }
+
+  out << "Geometry cache: " << Hits + Misses << " lookups, "
+      << (Hits + Misses ? 100.0 * Hits / (Hits + Misses) : 0) << "% hits, "
+      << Misses << " chunks read, " << Cached << " chunks in "
+      << (Bytes >> 20) << " of " << ((ShardBytes * GEOMETRY_CACHE_SHARDS) >> 20)
+      << " MiB" << endl;
+}
+
+
+GeometryCache & geometryCache()
+{
+  static GeometryCache Cache;
+  return Cache;
+}
+
+
+/** The unit normal of a triangle given by 9 floats. */
+static const Vector3D triangleNormal(const float * V)
+{
+  Vector3D A(V[0], V[1], V[2]);
+  Vector3D N = cross(Vector3D(V[3], V[4], V[5]) - A,
+                     Vector3D(V[6], V[7], V[8]) - A);
+  N.normalize();
+  return N;
+}
+
+
+/** Orders triangles by the coordinate of their centroids along an axis. */
+class CentroidLess
+{
+  const vector<Vector3D> & Centroids;
+  int Axis;
+
+public:
+  CentroidLess(const vector<Vector3D> & Centroids_, int Axis_):
+  Centroids(Centroids_), Axis(Axis_) {}
+
+  bool operator()(unsigned int a, unsigned int b) const
+  {
+    return Centroids[a][Axis] < Centroids[b][Axis];
+  }
+};
+
+
+/** Cuts triangles into chunks of neighbours by splitting them in halves
+* along the longest side of the bounds of their centroids.
+* @param Order The triangles, reordered so that every chunk is a range.
+* @param Ranges Receives the chunks, as ranges of Order.
+*/
+static void splitChunks(const vector<Vector3D> & Centroids,
+                        vector<unsigned int> & Order, size_t Begin,
+                        size_t End, unsigned int Limit,
+                        vector<pair<size_t, size_t> > & Ranges)
+{
+  if (End - Begin <= Limit)
+  {
+    Ranges.push_back(make_pair(Begin, End));
+    return;
+  }
+
+  BBox Box;
+  for (size_t i = Begin; i < End; i++) Box.extend(Centroids[Order[i]]);
+
+  Vector3D D = Box.diagonal();
+  int Axis = (D[0] > D[1]) ? ((D[0] > D[2]) ? 0 : 2) : ((D[1] > D[2]) ? 1 : 2);
+  size_t Middle = Begin + (End - Begin) / 2;
+
+  nth_element(Order.begin() + Begin, Order.begin() + Middle,
+              Order.begin() + End, CentroidLess(Centroids, Axis));
+  splitChunks(Centroids, Order, Begin, Middle, Limit, Ranges);
+  splitChunks(Centroids, Order, Middle, End, Limit, Ranges);
+}
+
+
+/** Cuts the mesh of an OBJ file into chunks and writes the chunk file.
+* The mesh is read whole, once; the chunk file is written under another
+* name first and renamed at the end, so that a half written file is never
+* used.
+*/
+static bool makeChunkFile(const string & OBJ, const string & Path,
+                          unsigned int Limit)
+{
+  TriangleMesh Mesh(Color(), 0);
+  if (!Mesh.LoadOBJ(OBJ)) return false;
+
+  unsigned int n = Mesh.NumTriangles();
+  if (n == 0)
+  {
+    cerr << OBJ << " has no triangles" << endl;
+    return false;
+  }
+
+  vector<Vector3D> Centroids(n);
+  vector<unsigned int> Order(n);
+  for (unsigned int i = 0; i < n; i++)
+  {
+    Centroids[i] = (Mesh.getCorner(i, 0) + Mesh.getCorner(i, 1) +
+                    Mesh.getCorner(i, 2)) / 3;
+    Order[i] = i;
+  }
+
+  vector<pair<size_t, size_t> > Ranges;
+  splitChunks(Centroids, Order, 0, n, Limit, Ranges);
+  Centroids.clear();
+
+  string Temporary = Path + ".tmp";
+  ofstream out(Temporary.c_str(), ios::binary);
+  ChunkFileHeader Header = {{'C', 'H', 'N', 'K'}, (unsigned int) Ranges.size(),
+                            (unsigned int) sizeof(WideBVHNode), Limit};
+  vector<ChunkEntry> Entries(Ranges.size());
+
+  // The directory is written again once the chunks are placed
+  out.write((const char *) &Header, sizeof(Header));
+  out.write((const char *) &Entries[0], Entries.size() * sizeof(ChunkEntry));
+
+  for (unsigned int c = 0; c < Ranges.size(); c++)
+  {
+    size_t Position = out.tellp();
+    string Padding((CHUNK_ALIGN - Position % CHUNK_ALIGN) % CHUNK_ALIGN, 0);
+    out.write(Padding.data(), Padding.size());
+
+    ChunkEntry & E = Entries[c];
+    E.Offset = Position + Padding.size();
+    E.Triangles = Ranges[c].second - Ranges[c].first;
+    E.Pad = 0;
+
+    vector<float> Vertices(9 * (size_t) E.Triangles);
+    vector<BBox> Boxes(E.Triangles);
+    for (unsigned int i = 0; i < E.Triangles; i++)
+      for (int k = 0; k < 3; k++)
+      {
+        Vector3D V = Mesh.getCorner(Order[Ranges[c].first + i], k);
+        for (int a = 0; a < 3; a++) Vertices[9 * i + 3 * k + a] = V[a];
+        Boxes[i].extend(V);
+      }
+
+    WideBVH Tree;
+    Tree.Build(Boxes);
+    out.write((const char *) &Vertices[0], Vertices.size() * sizeof(float));
+    Tree.write(out);
+    E.Bytes = (size_t) out.tellp() - E.Offset;
+
+    BBox Box = Tree.Bounds();
+    for (int a = 0; a < 3; a++)
+    {
+      E.Min[a] = Box.Min[a];
+      E.Max[a] = Box.Max[a];
+    }
+  }
+
+  out.seekp(sizeof(Header));
+  out.write((const char *) &Entries[0], Entries.size() * sizeof(ChunkEntry));
+  out.close();
+
+  if (!out)
+  {
+    cerr << "Cannot write the chunk file " << Path << endl;
+    remove(Temporary.c_str());
+    return false;
+  }
+
+  cout << "Cut " << n << " triangles into " << Entries.size() << " chunks"
+       << endl;
+  return rename(Temporary.c_str(), Path.c_str()) == 0;
+}
+
+
+/** Reads the directory of a mapped chunk file.
+* @return False if the file is not a whole chunk file made by this build
+* with the same chunk size.
+*/
+static bool readDirectory(const MappedFile & File, unsigned int Limit,
+                          vector<ChunkEntry> & Chunks)
+{
+  ChunkFileHeader Header;
+
+  Chunks.clear();
+  if (!File.Base || (File.Length < sizeof(Header))) return false;
+
+  memcpy(&Header, File.Base, sizeof(Header));
+  if ((memcmp(Header.Magic, "CHNK", 4) != 0) ||
+      (Header.NodeBytes != sizeof(WideBVHNode)) ||
+      (Header.ChunkTriangles != Limit) || (Header.Chunks == 0) ||
+      (File.Length < sizeof(Header) + Header.Chunks * sizeof(ChunkEntry)))
+    return false;
+
+  Chunks.resize(Header.Chunks);
+  memcpy(&Chunks[0], File.Base + sizeof(Header),
+         Chunks.size() * sizeof(ChunkEntry));
+
+  for (unsigned int i = 0; i < Chunks.size(); i++)
+    if ((Chunks[i].Offset + Chunks[i].Bytes > File.Length) ||
+        (Chunks[i].Bytes < 9 * sizeof(float) * (size_t) Chunks[i].Triangles))
+    {
+      Chunks.clear();
+      return false;
+    }
+
+  return true;
+}
+
+
+ChunkedMesh::ChunkedMesh(const Color & Color_, float reflectivity_,
+                         unsigned int ChunkTriangles_):
+  SceneObject(Color_, reflectivity_),
+  ChunkTriangles(max(ChunkTriangles_, 1u)), Id(0)
+{
+}
+
+
+bool ChunkedMesh::open(const string & File)
+{
+  static boost::atomic<unsigned int> NextId(0);
+  struct stat Source, Cached;
+
+  if (stat(File.c_str(), &Source) != 0)
+  {
+    cerr << "Cannot find the mesh " << File << endl;
+    return false;
+  }
+
+  Path = File + ".chunks";
+  bool Fresh = (stat(Path.c_str(), &Cached) == 0) &&
+               (Cached.st_mtime >= Source.st_mtime);
+
+  if (Fresh)
+  {
+    Map.reset(new MappedFile(Path));
+    Fresh = readDirectory(*Map, ChunkTriangles, Chunks);
+  }
+
+  if (!Fresh)
+  {
+    cout << "Making the chunk file " << Path << endl;
+    Map.reset();
+    if (!makeChunkFile(File, Path, ChunkTriangles)) return false;
+
+    Map.reset(new MappedFile(Path));
+    if (!readDirectory(*Map, ChunkTriangles, Chunks))
+    {
+      cerr << Path << " is not a chunk file of this build" << endl;
+      return false;
+    }
+  }
+
+  Id = NextId++;
+  Top = WideBVH();
+  return true;
+}
+
+
+SPGeometryChunk ChunkedMesh::readChunk(unsigned int i) const
+{
+  const ChunkEntry & E = Chunks[i];
+  const char * Data = Map->Base + E.Offset;
+  size_t VertexBytes = 9 * sizeof(float) * (size_t) E.Triangles;
+
+  boost::shared_ptr<GeometryChunk> Chunk(new GeometryChunk);
+  Chunk->Vertices.resize(9 * (size_t) E.Triangles);
+  memcpy(&Chunk->Vertices[0], Data, VertexBytes);
+
+  MemoryBuffer Buffer(Data + VertexBytes, E.Bytes - VertexBytes);
+  istream in(&Buffer);
+  bool ok = Chunk->Tree.read(in);
+
+  // The chunk is copied, its pages of the file are not needed any more
+  Map->release(E.Offset, E.Bytes);
+
+  if (!ok)
+  {
+    cerr << "Cannot read chunk " << i << " of " << Path << endl;
+    return SPGeometryChunk();
+  }
+  return Chunk;
+}
+
+
+bool ChunkedMesh::Finalize()
+{
+  if (Chunks.empty()) return false;
+  if (!Top.empty()) return true;
+
+  vector<BBox> Boxes(Chunks.size());
+  size_t Triangles = 0;
+
+  for (unsigned int i = 0; i < Chunks.size(); i++)
+  {
+    const ChunkEntry & E = Chunks[i];
+    Boxes[i] = BBox(Vector3D(E.Min[0], E.Min[1], E.Min[2]),
+                    Vector3D(E.Max[0], E.Max[1], E.Max[2]));
+    Triangles += E.Triangles;
+  }
+
+  Top.Build(Boxes);
+
+  cout << "Chunked mesh: " << Triangles << " triangles in " << Chunks.size()
+       << " chunks of " << Path << endl;
+  return true;
+}
+
+
+/** The leaf test used when walking the BVH of a chunk. */
+class ChunkTriangleTest
+{
+  const GeometryChunk & Chunk;
+  const ShearedRay & SR;
+
+public:
+/** The closest triangle found so far. */
+  int tri;
+
+  ChunkTriangleTest(const GeometryChunk & Chunk_, const ShearedRay & SR_):
+  Chunk(Chunk_), SR(SR_), tri(-1) {}
+
+  bool operator()(unsigned int prim, float & tmax)
+  {
+    const float * V = &Chunk.Vertices[9 * (size_t) prim];
+    float t;
+
+    if (!intersectTriangle(SR, V, V + 3, V + 6, tmax, t)) return false;
+    tmax = t;
+    tri = prim;
+    return true;
+  }
+};
+
+
+/** The leaf test used when walking the chunks of a mesh: fetches a chunk
+* and walks its own BVH.
+*/
+class ChunkLeafTest
+{
+  const ChunkedMesh & Mesh;
+  const Ray & R;
+  const ShearedRay & SR;
+
+public:
+/** The normal of the closest triangle found so far. */
+  Vector3D N;
+
+  ChunkLeafTest(const ChunkedMesh & Mesh_, const Ray & R_,
+                const ShearedRay & SR_):
+  Mesh(Mesh_), R(R_), SR(SR_) {}
+
+  bool operator()(unsigned int chunk, float & tmax)
+  {
+    SPGeometryChunk Chunk = geometryCache().getChunk(Mesh, chunk);
+    if (!Chunk) return false;
+
+    ChunkTriangleTest Test(*Chunk, SR);
+    if (!Chunk->Tree.Traverse(R, tmax, Test)) return false;
+
+    N = triangleNormal(&Chunk->Vertices[9 * (size_t) Test.tri]);
+    return true;
+  }
+};
+
+
+/** The leaf test of ChunkedMesh::FindTriangle(): keeps the triangle whose
+* plane is closest to a point among those whose bounds hold it, and never
+* shortens the probe.
+*/
+class ChunkNearestTest
+{
+  const ChunkedMesh & Mesh;
+  const Vector3D & Point;
+
+public:
+/** The distance to the closest triangle so far, and its normal. */
+  float best;
+  Vector3D N;
+
+  ChunkNearestTest(const ChunkedMesh & Mesh_, const Vector3D & Point_):
+  Mesh(Mesh_), Point(Point_), best(-1) {}
+
+  bool operator()(unsigned int chunk, float & tmax)
+  {
+    SPGeometryChunk Chunk = geometryCache().getChunk(Mesh, chunk);
+    if (!Chunk) return false;
+
+    Vector3D Slack(CHUNK_EPSILON, CHUNK_EPSILON, CHUNK_EPSILON);
+    for (size_t i = 0; i < Chunk->Vertices.size(); i += 9)
+    {
+      const float * V = &Chunk->Vertices[i];
+      BBox Box;
+      for (int k = 0; k < 3; k++)
+        Box.extend(Vector3D(V[3 * k], V[3 * k + 1], V[3 * k + 2]));
+
+      bool Inside = true;
+      for (int a = 0; a < 3; a++)
+        if ((Point[a] < Box.Min[a] - Slack[a]) ||
+            (Point[a] > Box.Max[a] + Slack[a]))
+          Inside = false;
+      if (!Inside) continue;
+
+      Vector3D Normal = triangleNormal(V);
+      float d = fabs(dot(Point - Vector3D(V[0], V[1], V[2]), Normal));
+      if ((best < 0) || (d < best))
+      {
+        best = d;
+        N = Normal;
+      }
+    }
+    return false;
+  }
+};
+
+
+float ChunkedMesh::Intersection(const Ray & R) const
+{
+  HitInfo Hit(R);
+
+  if (Intersect(R, Hit))
+    return Hit.t;
+  else
+    return NO_INTERSECTION;
+}
+
+
+bool ChunkedMesh::Intersect(const Ray & R, HitInfo & Hit) const
+{
+  ShearedRay SR(R);
+  ChunkLeafTest Test(*this, R, SR);
+  float t = Hit.t;
+
+  if (!Top.Traverse(R, t, Test)) return false;
+
+  Hit.t = t;
+  Hit.Obj = this;
+  Hit.LocalPoint = R.getPoint(t);
+  Hit.N = Test.N;
+
+  // Triangles are two sided, the normal faces the viewer
+  if (dot(Hit.N, R.getDirection()) > 0) Hit.N *= -1;
+
+  return true;
+}
+
+
+float ChunkedMesh::FindTriangle(const Vector3D & Point, Vector3D & N) const
+{
+  // A short probe through the point meets the chunks around it
+  Vector3D Direction(1, 1, 1);
+  Direction.normalize();
+
+  Ray Probe(Point - CHUNK_EPSILON * Direction, Direction, false);
+  ChunkNearestTest Test(*this, Point);
+  float tmax = 2 * CHUNK_EPSILON;
+
+  Top.Traverse(Probe, tmax, Test);
+  N = Test.N;
+  return Test.best;
+}
+
+
+const Vector3D ChunkedMesh::Normal(const Vector3D & Point) const
+{
+  Vector3D N;
+
+  if (FindTriangle(Point, N) < 0) return Vector3D(0, 0, 1);
+  return N;
+}
+
+
+bool ChunkedMesh::contains(const Vector3D & Point) const
+{
+  Vector3D N;
+  float d = FindTriangle(Point, N);
+
+  return (d >= 0) && (d < CHUNK_EPSILON);
+}
+
+
+bool ChunkedMesh::Bounds(BBox & Box) const
+{
+  if (Top.empty()) return false;
+
+  Box = Top.Bounds();
+  return true;
+}
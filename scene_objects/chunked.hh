@@ -0,0 +1,248 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file chunked.hh Contains ChunkedMesh, a triangle mesh read in chunks
+* as rays reach them, and the GeometryCache that keeps the chunks
+*/
+
+#ifndef CHUNKED_HH
+#define CHUNKED_HH
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include "sceneobject.hh"
+#include "mappedfile.hh"
+#include "mesh.hh"
+#include "../wbvh.hh"
+
+using namespace std;
+
+
+/** The most triangles a chunk holds, unless the scene says otherwise. */
+const unsigned int CHUNK_TRIANGLES = 65536;
+
+/** The default size of the geometry cache, in MiB. */
+const unsigned int GEOMETRY_CACHE_MB = 256;
+
+/** The number of independently locked parts of the geometry cache. */
+const unsigned int GEOMETRY_CACHE_SHARDS = 8;
+
+
+/** A chunk of a ChunkedMesh, as it is in memory. */
+struct GeometryChunk
+{
+/** The corners of the triangles, 9 floats per triangle. */
+  vector<float> Vertices;
+
+/** The hierarchy over the triangles of the chunk. */
+  WideBVH Tree;
+
+/** The memory the chunk takes, in bytes. */
+  size_t Bytes() const;
+};
+
+typedef boost::shared_ptr<const GeometryChunk> SPGeometryChunk;
+
+
+class ChunkedMesh;
+
+/** The chunks of all chunked meshes that are in memory.
+* The cache keeps the chunks most recently used within a budget of
+* memory, dropping the least recently used ones to make room. Like the
+* TextureCache it is split into GEOMETRY_CACHE_SHARDS shards, each with a
+* lock, an LRU list and a part of the budget of its own, and a chunk
+* taken out of it stays valid for as long as it is held.
+*/
+class GeometryCache
+{
+private:
+
+/** A part of the cache. */
+  struct Shard
+  {
+    mutable boost::mutex Lock;
+
+/** The chunks, the most recently used first, with their keys. */
+    list<pair<unsigned long long, SPGeometryChunk> > Recent;
+
+/** Where each key is in Recent. */
+    map<unsigned long long,
+        list<pair<unsigned long long, SPGeometryChunk> >::iterator> Index;
+
+/** The memory taken by the chunks in Recent. */
+    size_t Bytes;
+
+/** The lookups found in the shard, and those that read the file. */
+    unsigned long Hits, Misses;
+
+    Shard(): Bytes(0), Hits(0), Misses(0) {}
+  };
+
+  Shard Shards[GEOMETRY_CACHE_SHARDS];
+
+/** The memory each shard may take. A shard keeps its last chunk even if
+* it is larger.
+*/
+  size_t ShardBytes;
+
+public:
+
+/** An empty cache.
+* @param MiB Its size.
+*/
+  GeometryCache(unsigned int MiB = GEOMETRY_CACHE_MB);
+
+/** Changes the size and empties the cache. Not while rendering. */
+  void resize(unsigned int MiB);
+
+/** Finds a chunk, reading it from the chunk file if it is not cached.
+* @return The chunk, null if it could not be read.
+*/
+  SPGeometryChunk getChunk(const ChunkedMesh & Mesh, unsigned int i);
+
+/** The number of lookups so far. */
+  unsigned long lookups() const;
+
+/** Writes the hit rate and the number of chunks read. */
+  void report(ostream & out) const;
+};
+
+
+/** The cache all chunked meshes read their chunks through. */
+GeometryCache & geometryCache();
+
+
+/** Where a chunk is in the chunk file, and its bounds. */
+struct ChunkEntry
+{
+  float Min[3], Max[3];
+  unsigned int Triangles, Pad;
+  unsigned long long Offset, Bytes;
+};
+
+
+/** A triangle mesh too large for the memory.
+* The mesh is read once from a Wavefront OBJ file and cut into chunks of
+* neighbouring triangles, which are saved in a chunk file, FILE.chunks
+* next to it, each with a BVH of its own. The chunk file is made again
+* when the OBJ file is newer.
+*
+* For rendering the chunk file is mapped into memory, and only a BVH over
+* the bounds of the chunks is kept: a chunk is read, through the
+* geometryCache(), when a ray first enters its bounds, and dropped again
+* when the cache needs the room. A thread whose ray needs a chunk that is
+* not in memory reads it and waits meanwhile.
+*/
+class ChunkedMesh : public SceneObject
+{
+private:
+
+/** The chunk file, mapped into memory. */
+  string Path;
+  boost::shared_ptr<MappedFile> Map;
+
+/** The chunks. */
+  vector<ChunkEntry> Chunks;
+
+/** The hierarchy over the bounds of the chunks. */
+  WideBVH Top;
+
+/** The most triangles in a chunk. */
+  unsigned int ChunkTriangles;
+
+/** Tells the chunks of this mesh from those of others in the cache. */
+  unsigned int Id;
+
+/** Finds the triangle a point lies on.
+* @param N Receives its normal.
+* @return The distance of the point to the plane of the triangle, or a
+* negative number if the point is not on any triangle.
+*/
+  float FindTriangle(const Vector3D & Point, Vector3D & N) const;
+
+public:
+
+/** The constructor. The mesh is read by open().
+* @param Color_ The color.
+* @param reflectivity_ The reflectivity.
+* @param ChunkTriangles_ The most triangles in a chunk.
+*/
+  ChunkedMesh(const Color & Color_, float reflectivity_ = 0,
+              unsigned int ChunkTriangles_ = CHUNK_TRIANGLES);
+
+  virtual ~ChunkedMesh() {}
+
+/** Maps the chunk file of an OBJ file, making it first if needed.
+* @return False, after saying why, if that failed.
+*/
+  bool open(const string & File);
+
+/** The number of chunks. */
+  unsigned int NumChunks() const;
+
+/** The key of a chunk in the cache. */
+  unsigned long long chunkKey(unsigned int i) const;
+
+/** Reads a chunk from the chunk file. */
+  SPGeometryChunk readChunk(unsigned int i) const;
+
+/** Builds the BVH over the chunks. Fails for an empty mesh. */
+  virtual bool Finalize();
+
+  virtual float Intersection(const Ray & R) const;
+
+/** Walks the chunks the ray enters, nearest first, reading those that are
+* not in memory, and reports the normal facing the incoming ray.
+*/
+  virtual bool Intersect(const Ray & R, HitInfo & Hit) const;
+
+/** Returns the normal of the triangle the point lies on. */
+  virtual const Vector3D Normal(const Vector3D & Point) const;
+
+  virtual bool contains(const Vector3D & Point) const;
+
+  virtual bool Bounds(BBox & Box) const;
+};
+
+
+inline size_t GeometryChunk::Bytes() const
+{
+  return Vertices.size() * sizeof(float) + Tree.NodeBytes() +
+         Tree.Indices.size() * sizeof(unsigned int);
+}
+
+inline unsigned int ChunkedMesh::NumChunks() const
+{
+  return Chunks.size();
+}
+
+inline unsigned long long ChunkedMesh::chunkKey(unsigned int i) const
+{
+  return ((unsigned long long) Id << 32) | i;
+}
+
+//CHUNKED_HH
+#endif
@@ -0,0 +1,228 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file csg.cc Implementation of the CSG class
+*/
+
+#include "csg.hh"
+
+
+/** True if a point inside the solids as given is inside their combination. */
+static inline bool inside(CSGOperation Op, bool inLeft, bool inRight)
+{
+  switch (Op)
+  {
+    case CSG_UNION: return inLeft || inRight;
+    case CSG_INTERSECTION: return inLeft && inRight;
+    default: return inLeft && !inRight;
+  }
+}
+
+
+/** Combines the spans of a ray inside two solids.
+* Walks the ends of both lists in order along the ray, keeping track of
+* which solids the ray is in, and emits an end wherever that changes
+* whether it is in the result. The surface of the solid taken away by a
+* difference faces the other way in the result.
+*/
+static void combine(CSGOperation Op, const SpanList & A, const SpanList & B,
+                    SpanList & Out)
+{
+  int i = 0, j = 0, nA = 2 * A.n, nB = 2 * B.n;
+  bool inA = false, inB = false, in = false;
+  Span Current;
+
+  while ((i < nA) || (j < nB))
+  {
+    bool fromA = (j >= nB) || ((i < nA) && (A.end(i).t <= B.end(j).t));
+    SpanEnd End = fromA ? A.end(i++) : B.end(j++);
+
+    if (fromA)
+      inA = !inA;
+    else
+      inB = !inB;
+
+    bool now = inside(Op, inA, inB);
+    if (now == in) continue;
+    in = now;
+
+    if (!fromA && (Op == CSG_DIFFERENCE)) End.N = -End.N;
+
+    if (in)
+      Current.In = End;
+    else
+    {
+      Current.Out = End;
+      Out.add(Current);
+    }
+  }
+}
+
+
+CSG::CSG(CSGOperation Op_, boost::shared_ptr<SceneObject> Left_,
+         boost::shared_ptr<SceneObject> Right_)
+  : Op(Op_), Left(Left_), Right(Right_), LeftBounded(false),
+    RightBounded(false)
+{
+  assert((Left != 0) && (Right != 0));
+  reflectivity = 0;
+}
+
+
+bool CSG::Finalize()
+{
+  if (!Left->isSolid() || !Right->isSolid()) return false;
+  if (!Left->Finalize() || !Right->Finalize()) return false;
+
+  LeftBounded = Left->Bounds(LeftBox);
+  RightBounded = Right->Bounds(RightBox);
+  return true;
+}
+
+
+bool CSG::Spans(const Ray & R, float tmax, SpanList & Out) const
+{
+  SpanList A, B;
+  float tnear;
+
+  // A solid whose box the ray misses has no spans that matter
+  if (!LeftBounded || LeftBox.hit(R, tmax, tnear))
+    Left->Spans(R, tmax, A);
+
+  // Nothing is left without the first solid, except for a union
+  if ((A.n == 0) && (Op != CSG_UNION)) return true;
+
+  if (!RightBounded || RightBox.hit(R, tmax, tnear))
+    Right->Spans(R, tmax, B);
+
+  if ((B.n == 0) && (Op == CSG_INTERSECTION)) return true;
+  if ((B.n == 0) || ((A.n == 0) && (Op == CSG_UNION)))
+  {
+    Out = (B.n == 0) ? A : B;
+    return true;
+  }
+
+  combine(Op, A, B, Out);
+  return true;
+}
+
+
+bool CSG::Intersect(const Ray & R, HitInfo & Hit) const
+{
+  SpanList List;
+
+  Spans(R, Hit.t, List);
+
+  // The ends come in order, the first one ahead of the ray is the hit
+  for (int i = 0; i < 2 * List.n; i++)
+  {
+    const SpanEnd & End = List.end(i);
+
+    if (End.t >= Hit.t) return false;
+    if ((End.t <= 0) || (End.t < R.getTMin())) continue;
+
+    Hit.t = End.t;
+    Hit.Obj = End.Obj;
+    Hit.LocalPoint = R.getPoint(End.t);
+    Hit.N = End.N;
+    return true;
+  }
+
+  return false;
+}
+
+
+float CSG::Intersection(const Ray & R) const
+{
+  HitInfo Hit(R);
+
+  if (Intersect(R, Hit))
+    return Hit.t;
+  else
+    return NO_INTERSECTION;
+}
+
+
+const Vector3D CSG::Normal(const Vector3D & Point) const
+{
+  if (Left->contains(Point)) return Left->Normal(Point);
+  if (Right->contains(Point))
+    return (Op == CSG_DIFFERENCE) ? -Right->Normal(Point) :
+                                    Right->Normal(Point);
+
+  assert(false); //Point not on either solid
+  return Vector3D();
+}
+
+
+bool CSG::contains(const Vector3D & Point) const
+{
+  return Left->contains(Point) || Right->contains(Point);
+}
+
+
+bool CSG::Bounds(BBox & Box) const
+{
+  BBox L, R;
+  bool hasL = Left->Bounds(L), hasR = Right->Bounds(R);
+
+  switch (Op)
+  {
+    case CSG_UNION:
+      if (!hasL || !hasR) return false;
+      Box = L;
+      Box.extend(R);
+      return true;
+
+    case CSG_INTERSECTION:
+      if (!hasL && !hasR) return false;
+      if (!hasL || !hasR)
+      {
+        Box = hasL ? L : R;
+        return true;
+      }
+      Box = L;
+      for (int i = 0; i < 3; i++)
+      {
+        Box.Min[i] = max(L.Min[i], R.Min[i]);
+        Box.Max[i] = min(L.Max[i], R.Max[i]);
+      }
+      // Solids that do not overlap leave nothing, keep a box all the same
+      if (Box.empty()) Box = L;
+      return true;
+
+    default:
+      if (!hasL) return false;
+      Box = L;
+      return true;
+  }
+}
+
+
+bool parseCSGOperation(const string & Name, CSGOperation & Op)
+{
+  if (Name == "union") Op = CSG_UNION;
+  else if (Name == "intersection") Op = CSG_INTERSECTION;
+  else if (Name == "difference") Op = CSG_DIFFERENCE;
+  else return false;
+
+  return true;
+}
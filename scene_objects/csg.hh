@@ -0,0 +1,125 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file csg.hh Contains the definition of CSG, constructive solid geometry
+*/
+
+#ifndef CSG_HH
+#define CSG_HH
+
+#include <string>
+#include <boost/shared_ptr.hpp>
+#include "sceneobject.hh"
+
+using namespace std;
+
+
+/** How a CSG node combines its two solids. */
+enum CSGOperation
+{
+/** The points inside either solid. */
+  CSG_UNION,
+/** The points inside both solids. */
+  CSG_INTERSECTION,
+/** The points inside the first solid but not the second. */
+  CSG_DIFFERENCE
+};
+
+
+/** A solid made of two others by a boolean operation.
+* The solids are spheres, cylinders closed by their caps, the half spaces
+* behind planes, or CSG nodes themselves. A ray is intersected with a
+* node by combining the spans of the ray inside its two solids, kept in
+* fixed size lists on the stack, and the closest end of the resulting
+* spans is the hit. A solid whose box the ray misses is taken as empty
+* without finding its spans, and the second solid is skipped altogether
+* when the first one already decides the result.
+*
+* The color and the other properties at a hit are those of the primitive
+* whose surface it is, so a hole cut by a difference takes the color of
+* the solid that cut it.
+*/
+class CSG : public SceneObject
+{
+private:
+
+/** The operation. */
+  CSGOperation Op;
+
+/** The two solids. */
+  boost::shared_ptr<SceneObject> Left, Right;
+
+/** The boxes of the solids, set by Finalize(). */
+  BBox LeftBox, RightBox;
+
+/** False for a solid without a box, a plane. */
+  bool LeftBounded, RightBounded;
+
+public:
+
+/** The constructor.
+* @param Op_ The operation.
+* @param Left_ The first solid.
+* @param Right_ The second solid, the one taken away by a difference.
+*/
+  CSG(CSGOperation Op_, boost::shared_ptr<SceneObject> Left_,
+      boost::shared_ptr<SceneObject> Right_);
+
+/** The destructor. Does nothing. */
+  virtual ~CSG() {}
+
+  virtual float Intersection(const Ray & R) const;
+
+/** Reports the closest end of a span of the ray inside the node. */
+  virtual bool Intersect(const Ray & R, HitInfo & Hit) const;
+
+/** Returns the normal of the solid the point lies on. */
+  virtual const Vector3D Normal(const Vector3D & Point) const;
+
+/** Determines whether a point lies on the surface of one of the solids. */
+  virtual bool contains(const Vector3D & Point) const;
+
+/** The box of the node, from those of its solids. Fails if the node has
+* points arbitrarily far away.
+*/
+  virtual bool Bounds(BBox & Box) const;
+
+/** Finalizes the solids and finds their boxes. Fails if one of them is
+* not solid.
+*/
+  virtual bool Finalize();
+
+  virtual bool isSolid() const
+  {
+    return true;
+  }
+
+  virtual bool Spans(const Ray & R, float tmax, SpanList & Out) const;
+};
+
+
+/** Parses the name of an operation: union, intersection or difference.
+* @return False if the name is unknown.
+*/
+bool parseCSGOperation(const string & Name, CSGOperation & Op);
+
+//CSG_HH
+#endif
@@ -0,0 +1,502 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file heightfield.cc Implementation of HeightField
+*/
+
+#include <cmath>
+#include <cctype>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include "heightfield.hh"
+#include "../framebuffer.hh"
+
+
+HeightField::HeightField(const Vector3D & Origin_, const Vector3D & Size_,
+                         const Color & Color_, float reflectivity_):
+  SceneObject(Color_, reflectivity_), Width(0), Height(0), Heights(0),
+  Origin(Origin_), Size(Size_), ScaleX(0), ScaleY(0)
+{
+}
+
+
+/** Reads a number of a PNM header, skipping blanks and comments. */
+static bool readHeaderNumber(istream & in, int & n)
+{
+  int c;
+
+  while ((c = in.peek()) != EOF)
+  {
+    if (c == '#')
+      while (((c = in.get()) != EOF) && (c != '\n'));
+    else if (isspace(c))
+      in.get();
+    else
+      break;
+  }
+
+  return (in >> n) && (n > 0);
+}
+
+
+bool HeightField::readPGM(const string & File)
+{
+  ifstream in(File.c_str(), ios::binary);
+  char Magic[2];
+  int Max;
+
+  if (!in.read(Magic, 2) || (Magic[0] != 'P') ||
+      ((Magic[1] != '2') && (Magic[1] != '5')))
+    return false;
+
+  if (!readHeaderNumber(in, Width) || !readHeaderNumber(in, Height) ||
+      !readHeaderNumber(in, Max) || (Max > 65535))
+  {
+    cerr << "Bad PGM header in " << File << endl;
+    return false;
+  }
+
+  size_t n = (size_t) Width * Height;
+  Owned.resize(n);
+
+  if (Magic[1] == '2')
+  {
+    int v;
+    for (size_t i = 0; i < n; i++)
+    {
+      if (!(in >> v)) break;
+      Owned[i] = (float) v / Max;
+    }
+  }
+  else
+  {
+    // A single blank ends the header, then 1 or 2 bytes, most
+    // significant first, per sample
+    in.get();
+    int Bytes = (Max < 256) ? 1 : 2;
+    vector<unsigned char> Row((size_t) Width * Bytes);
+
+    for (int y = 0; y < Height; y++)
+    {
+      if (!in.read((char *) &Row[0], Row.size())) break;
+      for (int x = 0; x < Width; x++)
+      {
+        int v = (Bytes == 1) ? Row[x] : ((Row[2 * x] << 8) | Row[2 * x + 1]);
+        Owned[(size_t) y * Width + x] = (float) v / Max;
+      }
+    }
+  }
+
+  if (!in)
+  {
+    cerr << "The PGM image " << File << " is cut short" << endl;
+    return false;
+  }
+
+  Heights = &Owned[0];
+  return true;
+}
+
+
+bool HeightField::mapRaw(const string & File)
+{
+  Map.reset(new MappedFile(File));
+  if (!Map->Base)
+  {
+    cerr << "Cannot map " << File << endl;
+    return false;
+  }
+
+  size_t n = Map->Length / sizeof(float);
+  int Side = (int) llround(sqrt((double) n));
+
+  if ((Map->Length % sizeof(float) != 0) || ((size_t) Side * Side != n) ||
+      (Side < 2))
+  {
+    cerr << File << " is not a square grid of floats" << endl;
+    Map.reset();
+    return false;
+  }
+
+  Width = Height = Side;
+  Heights = (const float *) Map->Base;
+
+  if (!littleEndian())
+  {
+    Owned.assign(Heights, Heights + n);
+    swapBytes(&Owned[0], n);
+    Heights = &Owned[0];
+    Map.reset();
+  }
+  return true;
+}
+
+
+bool HeightField::load(const string & File)
+{
+  Heights = 0;
+  Owned.clear();
+  Map.reset();
+  MinMax.clear();
+
+  ifstream in(File.c_str(), ios::binary);
+  if (!in)
+  {
+    cerr << "Cannot open the height field " << File << endl;
+    return false;
+  }
+
+  char Magic[2] = {0, 0};
+  in.read(Magic, 2);
+  in.close();
+
+  bool PGM = (Magic[0] == 'P') && ((Magic[1] == '2') || (Magic[1] == '5'));
+  if (!(PGM ? readPGM(File) : mapRaw(File))) return false;
+
+  if ((Width < 2) || (Height < 2))
+  {
+    cerr << "The height field " << File << " needs 2 x 2 samples" << endl;
+    Heights = 0;
+    return false;
+  }
+  return true;
+}
+
+
+bool HeightField::Finalize()
+{
+  if (!Heights || (Width < 2) || (Height < 2) || (Size[0] <= 0) ||
+      (Size[1] <= 0))
+    return false;
+
+  ScaleX = (Width - 1) / Size[0];
+  ScaleY = (Height - 1) / Size[1];
+
+  if (MinMax.empty()) buildHierarchy();
+  return true;
+}
+
+
+void HeightField::buildHierarchy()
+{
+  const int L = HEIGHTFIELD_LEAF;
+  int lw = (Width - 2) / L + 1, lh = (Height - 2) / L + 1;
+
+  LevelWidth.clear();
+  LevelHeight.clear();
+  MinMax.clear();
+
+  while (true)
+  {
+    LevelWidth.push_back(lw);
+    LevelHeight.push_back(lh);
+    MinMax.push_back(vector<float>(2 * (size_t) lw * lh));
+    if ((lw == 1) && (lh == 1)) break;
+    lw = (lw + 1) / 2;
+    lh = (lh + 1) / 2;
+  }
+
+  // The leaves, from the samples at the corners of their quads
+  vector<float> & Leaves = MinMax[0];
+  for (int ly = 0; ly < LevelHeight[0]; ly++)
+    for (int lx = 0; lx < LevelWidth[0]; lx++)
+    {
+      int x0 = lx * L, y0 = ly * L;
+      int x1 = min(x0 + L, Width - 1), y1 = min(y0 + L, Height - 1);
+      float lo = at(x0, y0), hi = lo;
+
+      for (int y = y0; y <= y1; y++)
+        for (int x = x0; x <= x1; x++)
+        {
+          float h = at(x, y);
+          lo = min(lo, h);
+          hi = max(hi, h);
+        }
+
+      float zlo = Origin[2] + lo * Size[2], zhi = Origin[2] + hi * Size[2];
+      float * M = &Leaves[2 * ((size_t) ly * LevelWidth[0] + lx)];
+      M[0] = min(zlo, zhi);
+      M[1] = max(zlo, zhi);
+    }
+
+  // Every other node spans its up to four children
+  for (unsigned int l = 1; l < MinMax.size(); l++)
+    for (int y = 0; y < LevelHeight[l]; y++)
+      for (int x = 0; x < LevelWidth[l]; x++)
+      {
+        float * M = &MinMax[l][2 * ((size_t) y * LevelWidth[l] + x)];
+        M[0] = FLT_MAX;
+        M[1] = -FLT_MAX;
+
+        for (int cy = 2 * y; cy < min(2 * y + 2, LevelHeight[l - 1]); cy++)
+          for (int cx = 2 * x; cx < min(2 * x + 2, LevelWidth[l - 1]); cx++)
+          {
+            const float * C =
+              &MinMax[l - 1][2 * ((size_t) cy * LevelWidth[l - 1] + cx)];
+            M[0] = min(M[0], C[0]);
+            M[1] = max(M[1], C[1]);
+          }
+      }
+}
+
+
+const BBox HeightField::nodeBox(int Level, int x, int y) const
+{
+  int Span = HEIGHTFIELD_LEAF << Level;
+  int x0 = x * Span, y0 = y * Span;
+  const float * M = &MinMax[Level][2 * ((size_t) y * LevelWidth[Level] + x)];
+
+  return BBox(Vector3D(x0, y0, M[0]),
+              Vector3D(min(x0 + Span, Width - 1), min(y0 + Span, Height - 1),
+                       M[1]));
+}
+
+
+bool HeightField::intersectLeaf(const Ray & G, const ShearedRay & SR,
+                                int lx, int ly, float & t) const
+{
+  int x0 = lx * HEIGHTFIELD_LEAF, y0 = ly * HEIGHTFIELD_LEAF;
+  int x1 = min(x0 + HEIGHTFIELD_LEAF, Width - 1);
+  int y1 = min(y0 + HEIGHTFIELD_LEAF, Height - 1);
+  bool found = false;
+  float tHit, tnear;
+
+  for (int y = y0; y < y1; y++)
+    for (int x = x0; x < x1; x++)
+    {
+      float A[3] = {(float) x, (float) y, Origin[2] + at(x, y) * Size[2]};
+      float B[3] = {(float) x + 1, (float) y,
+                    Origin[2] + at(x + 1, y) * Size[2]};
+      float C[3] = {(float) x + 1, (float) y + 1,
+                    Origin[2] + at(x + 1, y + 1) * Size[2]};
+      float D[3] = {(float) x, (float) y + 1,
+                    Origin[2] + at(x, y + 1) * Size[2]};
+
+      // Most quads of a leaf are not under the ray at all
+      float lo = min(min(A[2], B[2]), min(C[2], D[2]));
+      float hi = max(max(A[2], B[2]), max(C[2], D[2]));
+      if (!BBox(Vector3D(x, y, lo), Vector3D(x + 1, y + 1, hi)).hit(G, t, tnear))
+        continue;
+
+      if (intersectTriangle(SR, A, B, C, t, tHit) && (tHit >= G.getTMin()))
+      {
+        t = tHit;
+        found = true;
+      }
+      if (intersectTriangle(SR, A, C, D, t, tHit) && (tHit >= G.getTMin()))
+      {
+        t = tHit;
+        found = true;
+      }
+    }
+
+  return found;
+}
+
+
+/** The maximal depth of the traversal stack: up to three nodes are left
+* behind at each of as many levels as a 32 bit coordinate has.
+*/
+const int HEIGHTFIELD_STACK = 3 * 32 + 1;
+
+
+bool HeightField::Intersect(const Ray & R, HitInfo & Hit) const
+{
+  if (MinMax.empty()) return false;
+
+  // In grid units x and y count samples; z and t stay the same
+  const Vector3D & O = R.getOrigin();
+  const Vector3D & D = R.getDirection();
+  Ray G(Vector3D((O[0] - Origin[0]) * ScaleX, (O[1] - Origin[1]) * ScaleY,
+                 O[2]),
+        Vector3D(D[0] * ScaleX, D[1] * ScaleY, D[2]), false);
+  G.setInterval(R.getTMin(), R.getTMax());
+  ShearedRay SR(G);
+
+  struct Entry
+  {
+    int Level, x, y;
+    float tnear;
+  } Stack[HEIGHTFIELD_STACK];
+
+  float t = Hit.t, tnear;
+  bool found = false;
+  int Top = MinMax.size() - 1, n = 0;
+
+  if (!nodeBox(Top, 0, 0).hit(G, t, tnear)) return false;
+  Entry Root = {Top, 0, 0, tnear};
+  Stack[n++] = Root;
+
+  while (n > 0)
+  {
+    Entry E = Stack[--n];
+    if (E.tnear >= t) continue;
+
+    if (E.Level == 0)
+    {
+      if (intersectLeaf(G, SR, E.x, E.y, t)) found = true;
+      continue;
+    }
+
+    // The children the ray enters, pushed farthest first
+    Entry Children[4];
+    int k = 0, l = E.Level - 1;
+
+    for (int cy = 2 * E.y; cy < min(2 * E.y + 2, LevelHeight[l]); cy++)
+      for (int cx = 2 * E.x; cx < min(2 * E.x + 2, LevelWidth[l]); cx++)
+        if (nodeBox(l, cx, cy).hit(G, t, tnear))
+        {
+          Entry C = {l, cx, cy, tnear};
+          int i = k++;
+          for (; (i > 0) && (Children[i - 1].tnear < tnear); i--)
+            Children[i] = Children[i - 1];
+          Children[i] = C;
+        }
+
+    for (int i = 0; i < k; i++) Stack[n++] = Children[i];
+  }
+
+  if (!found) return false;
+
+  Hit.t = t;
+  Hit.Obj = this;
+  Hit.LocalPoint = R.getPoint(t);
+  Hit.N = Normal(Hit.LocalPoint);
+  return true;
+}
+
+
+float HeightField::Intersection(const Ray & R) const
+{
+  HitInfo Hit(R);
+
+  if (Intersect(R, Hit))
+    return Hit.t;
+  else
+    return NO_INTERSECTION;
+}
+
+
+const Vector3D HeightField::gradient(int x, int y) const
+{
+  int xl = max(x - 1, 0), xr = min(x + 1, Width - 1);
+  int yl = max(y - 1, 0), yr = min(y + 1, Height - 1);
+
+  float dx = (at(xr, y) - at(xl, y)) * Size[2] / (xr - xl);
+  float dy = (at(x, yr) - at(x, yl)) * Size[2] / (yr - yl);
+  return Vector3D(-dx, -dy, 1);
+}
+
+
+bool HeightField::triangleAt(float gx, float gy, int X[3], int Y[3],
+                             float W[3]) const
+{
+  const float Slack = 0.001f;
+  if ((gx < -Slack) || (gy < -Slack) || (gx > Width - 1 + Slack) ||
+      (gy > Height - 1 + Slack))
+    return false;
+
+  gx = max(0.0f, min(gx, (float) (Width - 1)));
+  gy = max(0.0f, min(gy, (float) (Height - 1)));
+
+  int qx = min((int) gx, Width - 2), qy = min((int) gy, Height - 2);
+  float fx = gx - qx, fy = gy - qy;
+
+  // The quad is split along its diagonal from (qx, qy)
+  X[0] = qx;
+  Y[0] = qy;
+  X[1] = qx + 1;
+  Y[1] = qy + 1;
+  if (fx >= fy)
+  {
+    X[2] = qx + 1;
+    Y[2] = qy;
+    W[0] = 1 - fx;
+    W[1] = fy;
+    W[2] = fx - fy;
+  }
+  else
+  {
+    X[2] = qx;
+    Y[2] = qy + 1;
+    W[0] = 1 - fy;
+    W[1] = fx;
+    W[2] = fy - fx;
+  }
+  return true;
+}
+
+
+const Vector3D HeightField::Normal(const Vector3D & Point) const
+{
+  int X[3], Y[3];
+  float W[3];
+
+  if (!triangleAt((Point[0] - Origin[0]) * ScaleX,
+                  (Point[1] - Origin[1]) * ScaleY, X, Y, W))
+    return Vector3D(0, 0, 1);
+
+  Vector3D N;
+  for (int i = 0; i < 3; i++) N += W[i] * gradient(X[i], Y[i]);
+
+  // Back from grid units, where a slope is ScaleX times flatter
+  N = Vector3D(N[0] * ScaleX, N[1] * ScaleY, N[2]);
+  N.normalize();
+  return N;
+}
+
+
+bool HeightField::contains(const Vector3D & Point) const
+{
+  int X[3], Y[3];
+  float W[3];
+
+  if (MinMax.empty() ||
+      !triangleAt((Point[0] - Origin[0]) * ScaleX,
+                  (Point[1] - Origin[1]) * ScaleY, X, Y, W))
+    return false;
+
+  float h = 0;
+  for (int i = 0; i < 3; i++) h += W[i] * at(X[i], Y[i]);
+  return fabsf(Point[2] - (Origin[2] + h * Size[2])) < 0.001;
+}
+
+
+bool HeightField::Bounds(BBox & Box) const
+{
+  if (MinMax.empty()) return false;
+
+  const vector<float> & Top = MinMax.back();
+  Box = BBox(Vector3D(Origin[0], Origin[1], Top[0]),
+             Vector3D(Origin[0] + Size[0], Origin[1] + Size[1], Top[1]));
+  return true;
+}
+
+
+bool HeightField::surfaceUV(const Vector3D & Point, float & u, float & v,
+                            float & TexSize) const
+{
+  u = (Point[0] - Origin[0]) / Size[0];
+  v = (Point[1] - Origin[1]) / Size[1];
+  TexSize = max(Size[0], Size[1]);
+  return true;
+}
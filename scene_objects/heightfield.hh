@@ -0,0 +1,175 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file heightfield.hh Contains the definition of HeightField, a terrain
+* given by a grid of heights
+*/
+
+#ifndef HEIGHTFIELD_HH
+#define HEIGHTFIELD_HH
+
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include "sceneobject.hh"
+#include "mesh.hh"
+#include "mappedfile.hh"
+
+using namespace std;
+
+
+/** The leaves of the min/max hierarchy of a height field are blocks of
+* this many quads along each side.
+*/
+const int HEIGHTFIELD_LEAF = 4;
+
+
+/** A terrain: a grid of heights over a rectangle of the xy plane.
+* Each square of four neighbouring samples, a quad, is made of two
+* triangles, shaded with normals interpolated from the slopes of the grid
+* at their corners.
+*
+* The heights come from a grayscale PGM image, white being 1, or from a
+* raw file of little endian floats for a square grid, as terrain tools
+* write them. Raw files are mapped into memory rather than copied, so the
+* heights of a grid of 16k x 16k samples are not held twice.
+*
+* Rays walk a quadtree whose nodes hold the lowest and highest height
+* below them: a node is a box, and only the children whose boxes the ray
+* enters, nearest first, are visited, so large flat or low areas are
+* crossed in a few steps. Its leaves are blocks of HEIGHTFIELD_LEAF x
+* HEIGHTFIELD_LEAF quads, whose triangles are intersected exactly.
+*/
+class HeightField : public SceneObject
+{
+private:
+
+/** The number of samples along x and y. */
+  int Width, Height;
+
+/** The heights, row by row, in Owned or in the mapped file. */
+  const float * Heights;
+  vector<float> Owned;
+  boost::shared_ptr<MappedFile> Map;
+
+/** The corner of the grid with the smallest coordinates, the size of
+* the rectangle it covers and the height of a sample of 1.
+*/
+  Vector3D Origin, Size;
+
+/** Grid units per world unit along x and y. */
+  float ScaleX, ScaleY;
+
+/** The number of leaves along x and y at each level of the hierarchy,
+* level 0 being the leaves.
+*/
+  vector<int> LevelWidth, LevelHeight;
+
+/** The lowest and the highest height of every node, level by level, row
+* by row, two floats per node.
+*/
+  vector<vector<float> > MinMax;
+
+/** The height of a sample. */
+  float at(int x, int y) const;
+
+/** The normal of the grid at a sample, from the slopes to its
+* neighbours, in grid units.
+*/
+  const Vector3D gradient(int x, int y) const;
+
+/** The triangle of the grid below a point.
+* @param gx,gy The point in grid units.
+* @param X,Y Receive the samples at the corners of the triangle.
+* @param W Receives the weights of the corners at the point.
+* @return False if the point is not above the grid.
+*/
+  bool triangleAt(float gx, float gy, int X[3], int Y[3], float W[3]) const;
+
+/** The box of a node of the hierarchy, in grid units but for z. */
+  const BBox nodeBox(int Level, int x, int y) const;
+
+/** Builds the min/max hierarchy. */
+  void buildHierarchy();
+
+/** Intersects a ray with the triangles of a leaf.
+* @param G The ray in grid units, with the same "time parameter".
+* @param SR G, sheared for the triangle tests.
+* @param lx,ly The leaf.
+* @param t The closest hit so far, updated on success.
+* @return True if a closer hit was found.
+*/
+  bool intersectLeaf(const Ray & G, const ShearedRay & SR, int lx, int ly,
+                     float & t) const;
+
+/** Reads a grayscale PGM image into Owned. */
+  bool readPGM(const string & File);
+
+/** Maps a raw file of floats. */
+  bool mapRaw(const string & File);
+
+public:
+
+/** The constructor. The heights are read by load().
+* @param Origin_ The corner of the grid with the smallest coordinates.
+* @param Size_ The extent along x and y, and the height of a sample of 1.
+* @param Color_ The color.
+* @param reflectivity_ The reflectivity.
+*/
+  HeightField(const Vector3D & Origin_, const Vector3D & Size_,
+              const Color & Color_, float reflectivity_ = 0);
+
+  virtual ~HeightField() {}
+
+/** Reads the heights, from a PGM image, P2 or P5 with 8 or 16 bits, or
+* else from a raw file of floats.
+* @return False, after saying why, if the file cannot be used.
+*/
+  bool load(const string & File);
+
+  virtual float Intersection(const Ray & R) const;
+
+/** Walks the hierarchy down to the triangles the ray meets. */
+  virtual bool Intersect(const Ray & R, HitInfo & Hit) const;
+
+/** The interpolated normal of the surface at a point above the grid. */
+  virtual const Vector3D Normal(const Vector3D & Point) const;
+
+  virtual bool contains(const Vector3D & Point) const;
+
+  virtual bool Bounds(BBox & Box) const;
+
+/** Builds the hierarchy. Fails without heights or for a degenerate size. */
+  virtual bool Finalize();
+
+/** Texture coordinates: the texture covers the grid once. */
+  virtual bool surfaceUV(const Vector3D & Point, float & u, float & v,
+                         float & TexSize) const;
+};
+
+
+inline float HeightField::at(int x, int y) const
+{
+  return Heights[(size_t) y * Width + x];
+}
+
+//HEIGHTFIELD_HH
+#endif
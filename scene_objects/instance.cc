@@ -0,0 +1,522 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <algorithm>
+#include "instance.hh"
+
+
+/** The leaf test of the motion BVH of a group, whose primitives are the
+* members from Base on.
+*/
+class MovingLeafTest
+{
+  ObjectLeafTest<vector<boost::shared_ptr<SceneObject> > > & Test;
+  unsigned int Base;
+
+public:
+  MovingLeafTest(ObjectLeafTest<vector<boost::shared_ptr<SceneObject> > > &
+                 Test_, unsigned int Base_): Test(Test_), Base(Base_) {}
+
+  bool operator()(unsigned int prim, float & tmax)
+  {
+    return Test(Base + prim, tmax);
+  }
+};
+
+
+/** Intersects geometry placed in world space by a transformation, see
+* Instance::Intersect().
+*/
+static bool intersectPlaced(const SceneObject & Geometry,
+                            const Transform & ToWorld, const Ray & R,
+                            HitInfo & Hit)
+{
+  Vector3D D = ToWorld.inverseVector(R.getDirection());
+
+  // The local ray is normalized again, which rescales distances
+  float scale = D.magn();
+  D /= scale;
+
+  Ray Local(ToWorld.inversePoint(R.getOrigin()), D, false);
+  Local.setInterval(R.getTMin() * scale, R.getTMax() * scale);
+  Local.setTime(R.getTime());
+  HitInfo LocalHit(Local);
+
+  LocalHit.t = Hit.t * scale;
+  if (!Geometry.Intersect(Local, LocalHit)) return false;
+
+  Hit.t = LocalHit.t / scale;
+  Hit.Obj = LocalHit.Obj;
+  Hit.LocalPoint = LocalHit.LocalPoint;
+  // Keep the length of the normal, shading depends on it for planes
+  float length = LocalHit.N.magn();
+  Hit.N = ToWorld.normal(LocalHit.N);
+  Hit.N.normalize();
+  Hit.N *= length;
+  return true;
+}
+
+
+void Group::BuildBVH()
+{
+  vector<BBox> Boxes, Starts, Ends;
+  unsigned int Segments = min(MotionSegments(), MOTION_BVH_MAX_SEGMENTS);
+  vector<boost::shared_ptr<SceneObject> > Bounded;
+  vector<unsigned int> BoundedAdded;
+  BBox Box, End;
+
+  Unbounded.clear();
+
+  // Bounded members go first, in the order the BVHs refer to them
+  for (unsigned int i = 0; i < Objects.size(); i++)
+  {
+    if (!Objects[i]->isMoving() && Objects[i]->Bounds(Box))
+    {
+      Boxes.push_back(Box);
+      Bounded.push_back(Objects[i]);
+      BoundedAdded.push_back(Added[i]);
+    }
+  }
+
+  MovingBase = Bounded.size();
+  for (unsigned int i = 0; i < Objects.size(); i++)
+  {
+    if (Objects[i]->isMoving() && Objects[i]->MotionBounds(0, 1, Box, End))
+    {
+      for (unsigned int k = 0; k < Segments; k++)
+      {
+        Objects[i]->MotionBounds((float) k / Segments,
+                                 (float) (k + 1) / Segments, Box, End);
+        Starts.push_back(Box);
+        Ends.push_back(End);
+      }
+      Bounded.push_back(Objects[i]);
+      BoundedAdded.push_back(Added[i]);
+    }
+  }
+
+  for (unsigned int i = 0; i < Objects.size(); i++)
+  {
+    if (!Objects[i]->Bounds(Box))
+    {
+      Unbounded.push_back(Bounded.size());
+      Bounded.push_back(Objects[i]);
+      BoundedAdded.push_back(Added[i]);
+    }
+  }
+
+  Objects.swap(Bounded);
+  Added.swap(BoundedAdded);
+  Tree.Build(Boxes);
+  Moving.Build(Starts, Ends, Segments);
+}
+
+
+bool Group::Finalize()
+{
+  if (Finalized) return true;
+
+  for (unsigned int i = 0; i < Objects.size(); i++)
+    if (!Objects[i]->Finalize()) return false;
+
+  BuildBVH();
+  Finalized = true;
+  return true;
+}
+
+
+float Group::Intersection(const Ray & R) const
+{
+  HitInfo Hit(R);
+
+  if (Intersect(R, Hit))
+    return Hit.t;
+  else
+    return NO_INTERSECTION;
+}
+
+
+bool Group::Intersect(const Ray & R, HitInfo & Hit) const
+{
+  bool found = false;
+
+  for (unsigned int i = 0; i < Unbounded.size(); i++)
+  {
+    if (Objects[Unbounded[i]]->Intersect(R, Hit))
+    {
+      Hit.Index = Unbounded[i];
+      found = true;
+    }
+  }
+
+  ObjectLeafTest<vector<boost::shared_ptr<SceneObject> > >
+    Test(Objects, R, Hit);
+  float t = Hit.t;
+
+  if (Tree.Traverse(R, t, Test)) found = true;
+
+  MovingLeafTest MovingTest(Test, MovingBase);
+  if (Moving.Traverse(R, t, MovingTest)) found = true;
+
+  if (found) Hit.Index = Added[Hit.Index];
+  return found;
+}
+
+
+const Vector3D Group::Normal(const Vector3D & Point) const
+{
+  for (unsigned int i = 0; i < Objects.size(); i++)
+    if (Objects[i]->contains(Point)) return Objects[i]->Normal(Point);
+
+  assert(false); //Point not on any member of the group
+  return Vector3D();
+}
+
+
+bool Group::contains(const Vector3D & Point) const
+{
+  for (unsigned int i = 0; i < Objects.size(); i++)
+    if (Objects[i]->contains(Point)) return true;
+
+  return false;
+}
+
+
+bool Group::Bounds(BBox & Box) const
+{
+  if (!Unbounded.empty() || (Tree.empty() && Moving.empty())) return false;
+  Box = Tree.Bounds();
+  Box.extend(Moving.Bounds());
+  return true;
+}
+
+
+bool Group::isMoving() const
+{
+  for (unsigned int i = 0; i < Objects.size(); i++)
+    if (Objects[i]->isMoving()) return true;
+
+  return false;
+}
+
+
+unsigned int Group::MotionSegments() const
+{
+  unsigned int Segments = 1;
+
+  for (unsigned int i = 0; i < Objects.size(); i++)
+    if (Objects[i]->isMoving())
+      Segments = max(Segments, Objects[i]->MotionSegments());
+
+  return Segments;
+}
+
+
+bool Group::MotionBounds(float t0, float t1, BBox & Start, BBox & End) const
+{
+  BBox Box0, Box1;
+
+  if (!Unbounded.empty() || (Tree.empty() && Moving.empty())) return false;
+
+  // The blend of the unions contains the blend of every member
+  Start = End = Tree.Bounds();
+  for (unsigned int i = MovingBase; i < Objects.size(); i++)
+  {
+    Objects[i]->MotionBounds(t0, t1, Box0, Box1);
+    Start.extend(Box0);
+    End.extend(Box1);
+  }
+  return true;
+}
+
+
+
+Instance::Instance(boost::shared_ptr<SceneObject> Geometry_,
+                   const Transform & ToWorld_)
+{
+  assert(Geometry_ != 0);
+  Geometry = Geometry_;
+  ToWorld = ToWorld_;
+  reflectivity = 0;
+}
+
+
+float Instance::Intersection(const Ray & R) const
+{
+  HitInfo Hit(R);
+
+  if (Intersect(R, Hit))
+    return Hit.t;
+  else
+    return NO_INTERSECTION;
+}
+
+
+bool Instance::Intersect(const Ray & R, HitInfo & Hit) const
+{
+  return intersectPlaced(*Geometry, ToWorld, R, Hit);
+}
+
+
+const Vector3D Instance::Normal(const Vector3D & Point) const
+{
+  Vector3D N = ToWorld.normal(Geometry->Normal(ToWorld.inversePoint(Point)));
+  N.normalize();
+  return N;
+}
+
+
+bool Instance::contains(const Vector3D & Point) const
+{
+  return Geometry->contains(ToWorld.inversePoint(Point));
+}
+
+
+bool Instance::Finalize()
+{
+  return Geometry->Finalize();
+}
+
+
+bool Instance::Bounds(BBox & Box) const
+{
+  BBox Local;
+  if (!Geometry->Bounds(Local)) return false;
+  Box = ToWorld.box(Local);
+  return true;
+}
+
+
+bool Instance::isMoving() const
+{
+  return Geometry->isMoving();
+}
+
+
+unsigned int Instance::MotionSegments() const
+{
+  return Geometry->MotionSegments();
+}
+
+
+bool Instance::MotionBounds(float t0, float t1, BBox & Start, BBox & End)
+  const
+{
+  BBox Local0, Local1;
+  if (!Geometry->MotionBounds(t0, t1, Local0, Local1)) return false;
+  Start = ToWorld.box(Local0);
+  End = ToWorld.box(Local1);
+  return true;
+}
+
+
+
+MovingInstance::MovingInstance(boost::shared_ptr<SceneObject> Geometry_,
+                               const vector<float> & Times_,
+                               const vector<Transform> & Keys_)
+{
+  assert((Geometry_ != 0) && !Keys_.empty() &&
+         (Times_.size() == Keys_.size()));
+  Geometry = Geometry_;
+  Times = Times_;
+  Keys = Keys_;
+  reflectivity = 0;
+
+  for (unsigned int k = 0; k < Keys.size(); k++)
+  {
+    assert(Keys[k].mirrors() == Keys[0].mirrors());
+    Frames.push_back(Keyframe(Keys[k]));
+  }
+}
+
+
+const Transform MovingInstance::at(float time) const
+{
+  if (time <= Times.front()) return Keys.front();
+  if (time >= Times.back()) return Keys.back();
+
+  // The first key after the time, there is one before it
+  unsigned int k = upper_bound(Times.begin(), Times.end(), time) -
+                   Times.begin();
+  float s = (time - Times[k - 1]) / (Times[k] - Times[k - 1]);
+  return Keyframe::interpolate(Frames[k - 1], Frames[k], s).transform();
+}
+
+
+const BBox MovingInstance::stepBox(float time) const
+{
+  if (time <= StepTimes.front()) return StepBoxes.front();
+  if (time >= StepTimes.back()) return StepBoxes.back();
+
+  unsigned int k = upper_bound(StepTimes.begin(), StepTimes.end(), time) -
+                   StepTimes.begin();
+  float s = (time - StepTimes[k - 1]) / (StepTimes[k] - StepTimes[k - 1]);
+  const BBox & A = StepBoxes[k - 1], & B = StepBoxes[k];
+  return BBox(A.Min + s * (B.Min - A.Min), A.Max + s * (B.Max - A.Max));
+}
+
+
+float MovingInstance::Intersection(const Ray & R) const
+{
+  HitInfo Hit(R);
+
+  if (Intersect(R, Hit))
+    return Hit.t;
+  else
+    return NO_INTERSECTION;
+}
+
+
+bool MovingInstance::Intersect(const Ray & R, HitInfo & Hit) const
+{
+  float tnear;
+
+  // The motion BVH only knows a straight line between two boxes, the step
+  // boxes follow the path more closely and spare blending the keys
+  if (!StepBoxes.empty() && !stepBox(R.getTime()).hit(R, Hit.t, tnear))
+    return false;
+
+  return intersectPlaced(*Geometry, at(R.getTime()), R, Hit);
+}
+
+
+const Vector3D MovingInstance::Normal(const Vector3D & Point) const
+{
+  Transform ToWorld = at(0);
+  Vector3D N = ToWorld.normal(Geometry->Normal(ToWorld.inversePoint(Point)));
+  N.normalize();
+  return N;
+}
+
+
+bool MovingInstance::contains(const Vector3D & Point) const
+{
+  return Geometry->contains(at(0).inversePoint(Point));
+}
+
+
+bool MovingInstance::Finalize()
+{
+  if (!Geometry->Finalize()) return false;
+
+  BBox Local;
+  StepTimes.clear();
+  StepBoxes.clear();
+  if (!Geometry->Bounds(Local)) return true;
+
+  // The geometry lies within the hull of the corners of its box, wherever
+  // it is placed, so it is enough to follow the corners. A corner c is at
+  // T(s) + R(s) S(s) c: the translation moves it along a line, but the
+  // turn by an angle a bends its path by up to h^2 / 8 times the second
+  // derivative, a^2 |S c| + 2 a |S1 c - S0 c|, away from the chord of a
+  // step of length h
+  vector<float> Pads(1, 0);
+  StepTimes.push_back(Times[0]);
+  StepBoxes.push_back(Keys[0].box(Local));
+
+  for (unsigned int k = 1; k < Keys.size(); k++)
+  {
+    float a = Keyframe::angle(Frames[k - 1], Frames[k]), Pad = 0;
+    int Steps = max((int) ceil(a / MOTION_STEP_ANGLE), 1);
+
+    for (int corner = 0; corner < 8; corner++)
+    {
+      Vector3D c((corner & 1) ? Local.Max[0] : Local.Min[0],
+                 (corner & 2) ? Local.Max[1] : Local.Min[1],
+                 (corner & 4) ? Local.Max[2] : Local.Min[2]);
+      Vector3D c0 = Frames[k - 1].scale(c), c1 = Frames[k].scale(c);
+      float Bend = a * a * max(c0.magn(), c1.magn()) + 2 * a * (c1 - c0).magn();
+      Pad = max(Pad, Bend / (8 * Steps * Steps));
+    }
+
+    Pads.back() = max(Pads.back(), Pad);
+    for (int i = 1; i < Steps; i++)
+    {
+      float time = Times[k - 1] + (Times[k] - Times[k - 1]) * i / Steps;
+      StepTimes.push_back(time);
+      StepBoxes.push_back(at(time).box(Local));
+      Pads.push_back(Pad);
+    }
+    StepTimes.push_back(Times[k]);
+    StepBoxes.push_back(Keys[k].box(Local));
+    Pads.push_back(Pad);
+  }
+
+  for (unsigned int i = 0; i < StepBoxes.size(); i++)
+  {
+    StepBoxes[i].Min -= Vector3D(Pads[i], Pads[i], Pads[i]);
+    StepBoxes[i].Max += Vector3D(Pads[i], Pads[i], Pads[i]);
+  }
+
+  return true;
+}
+
+
+unsigned int MovingInstance::MotionSegments() const
+{
+  return max((int) StepTimes.size() - 1, 1);
+}
+
+
+bool MovingInstance::MotionBounds(float t0, float t1, BBox & Start,
+                                  BBox & End) const
+{
+  if (StepBoxes.empty()) return false;
+
+  Start = stepBox(t0);
+  End = stepBox(t1);
+
+  // The step boxes are the corners of the bounds over time; where a step
+  // sticks out of the blend of Start and End, both are grown to cover it
+  for (unsigned int k = 0; k < StepTimes.size(); k++)
+  {
+    if ((StepTimes[k] <= t0) || (StepTimes[k] >= t1)) continue;
+
+    float s = (StepTimes[k] - t0) / (t1 - t0);
+    BBox Blend(Start.Min + s * (End.Min - Start.Min),
+               Start.Max + s * (End.Max - Start.Max));
+    for (int i = 0; i < 3; i++)
+    {
+      float Below = Blend.Min[i] - StepBoxes[k].Min[i];
+      float Above = StepBoxes[k].Max[i] - Blend.Max[i];
+
+      if (Below > 0)
+      {
+        Start.Min[i] -= Below;
+        End.Min[i] -= Below;
+      }
+      if (Above > 0)
+      {
+        Start.Max[i] += Above;
+        End.Max[i] += Above;
+      }
+    }
+  }
+  return true;
+}
+
+
+bool MovingInstance::Bounds(BBox & Box) const
+{
+  BBox End;
+  if (!MotionBounds(0, 1, Box, End)) return false;
+  Box.extend(End);
+  return true;
+}
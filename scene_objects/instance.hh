@@ -0,0 +1,278 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file instance.hh Contains the definition of Group and Instance
+*/
+
+#ifndef INSTANCE_HH
+#define INSTANCE_HH
+
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include "sceneobject.hh"
+#include "../wbvh.hh"
+#include "../motionbvh.hh"
+#include "../transform.hh"
+
+using namespace std;
+
+
+/** A collection of objects sharing one BVH.
+* Groups are never rendered directly: they are the shared geometry that
+* Instance objects place in the scene, so a group is stored once no matter
+* how many times it appears.
+*
+* Members that move while the shutter is open get a MotionBVH of their
+* own, so the static members keep the compact wide BVH.
+*/
+class Group : public SceneObject
+{
+private:
+
+/** The members of the group. */
+  vector<boost::shared_ptr<SceneObject> > Objects;
+
+/** The members without bounds (planes), tested one by one. */
+  vector<unsigned int> Unbounded;
+
+/** The position in which each member was added, BuildBVH() reorders them. */
+  vector<unsigned int> Added;
+
+/** The BVH over the bounded members, in local coordinates. */
+  WideBVH Tree;
+
+/** The BVH over the moving members, which follow the static ones. */
+  MotionBVH Moving;
+
+/** The position of the first moving member. */
+  unsigned int MovingBase;
+
+/** Set once Finalize() has run, a group shared by several instances is
+* only built once.
+*/
+  bool Finalized;
+
+public:
+
+/** The constructor. Builds an empty group. */
+  Group(): SceneObject(Color(0, 0, 0), 0), MovingBase(0), Finalized(false) {}
+
+/** The destructor. Does nothing. */
+  virtual ~Group() {}
+
+/** Adds an object to the group. */
+  void AddObject(boost::shared_ptr<SceneObject> Object);
+
+/** The number of objects in the group. */
+  unsigned int size() const;
+
+/** Builds the BVH. Must be called once all objects are added. */
+  void BuildBVH();
+
+/** Finalizes the members and builds the BVH. */
+  virtual bool Finalize();
+
+  virtual float Intersection(const Ray & R) const;
+
+/** Reports the closest hit among the members. Hit.Index is set to the
+* position in which the member was added.
+*/
+  virtual bool Intersect(const Ray & R, HitInfo & Hit) const;
+
+/** Returns the normal of the member the point lies on. */
+  virtual const Vector3D Normal(const Vector3D & Point) const;
+
+/** Determines whether a point lies on one of the members. */
+  virtual bool contains(const Vector3D & Point) const;
+
+  virtual bool Bounds(BBox & Box) const;
+
+/** True if any member moves. */
+  virtual bool isMoving() const;
+
+/** The most segments any member asks for. */
+  virtual unsigned int MotionSegments() const;
+
+  virtual bool MotionBounds(float t0, float t1, BBox & Start, BBox & End)
+    const;
+};
+
+
+/** A placement of shared geometry in the scene.
+* Holds a transformation and a reference to the geometry (usually a Group);
+* rays are moved into the local space of the geometry instead of the
+* geometry being copied into world space.
+*/
+class Instance : public SceneObject
+{
+private:
+
+/** The shared geometry. */
+  boost::shared_ptr<SceneObject> Geometry;
+
+/** Maps the local space of the geometry to world space. */
+  Transform ToWorld;
+
+public:
+
+/** The constructor.
+* @param Geometry_ The geometry to place.
+* @param ToWorld_ The transformation from local to world space.
+*/
+  Instance(boost::shared_ptr<SceneObject> Geometry_,
+           const Transform & ToWorld_);
+
+/** The destructor. Does nothing. */
+  virtual ~Instance() {}
+
+  virtual float Intersection(const Ray & R) const;
+
+/** Intersects the geometry with the ray moved to local space. The normal
+* is reported in world space, the hit point in the space of the member
+* that was hit.
+*/
+  virtual bool Intersect(const Ray & R, HitInfo & Hit) const;
+
+  virtual const Vector3D Normal(const Vector3D & Point) const;
+
+  virtual bool contains(const Vector3D & Point) const;
+
+  virtual bool Bounds(BBox & Box) const;
+
+/** Finalizes the geometry. */
+  virtual bool Finalize();
+
+/** True if the geometry moves. */
+  virtual bool isMoving() const;
+
+  virtual unsigned int MotionSegments() const;
+
+  virtual bool MotionBounds(float t0, float t1, BBox & Start, BBox & End)
+    const;
+};
+
+
+/** The largest turn between two of the times a moving instance is bounded
+* at, in radians. A turn bends the path of the geometry away from the
+* straight line between two boxes; it is cut into steps this large, and
+* the boxes grown by how far the path can stray within a step.
+*/
+const float MOTION_STEP_ANGLE = M_PI / 12;
+
+
+/** A placement of shared geometry that moves while the shutter is open.
+* The placement is given at a few keyframes, and blended between the two
+* keys around the time of a ray as Keyframe::interpolate() does. Before
+* the first key and after the last one the instance stands still.
+*/
+class MovingInstance : public SceneObject
+{
+private:
+
+/** The shared geometry. */
+  boost::shared_ptr<SceneObject> Geometry;
+
+/** The times of the keys, increasing, 0 to 1 over the shutter interval. */
+  vector<float> Times;
+
+/** The transformation from local to world space at each key. */
+  vector<Transform> Keys;
+
+/** The keys taken apart for blending. */
+  vector<Keyframe> Frames;
+
+/** The times the geometry is bounded at: the keys, and between two keys
+* enough steps for a turn of at most MOTION_STEP_ANGLE each.
+*/
+  vector<float> StepTimes;
+
+/** The bounds of the geometry at StepTimes, in world space. Between two
+* steps the geometry stays within the blend of their boxes.
+*/
+  vector<BBox> StepBoxes;
+
+/** The box blended between the step boxes around a time. */
+  const BBox stepBox(float time) const;
+
+public:
+
+/** The constructor.
+* @param Geometry_ The geometry to place.
+* @param Times_ The times of the keys, increasing.
+* @param Keys_ The transformation from local to world space at each key.
+* Either all of them mirror or none.
+*/
+  MovingInstance(boost::shared_ptr<SceneObject> Geometry_,
+                 const vector<float> & Times_,
+                 const vector<Transform> & Keys_);
+
+/** The destructor. Does nothing. */
+  virtual ~MovingInstance() {}
+
+/** The transformation from local to world space at a certain time. */
+  const Transform at(float time) const;
+
+  virtual float Intersection(const Ray & R) const;
+
+/** Intersects the geometry placed where it is at the time of the ray. */
+  virtual bool Intersect(const Ray & R, HitInfo & Hit) const;
+
+/** The normal and containment tests place the geometry at time 0. */
+  virtual const Vector3D Normal(const Vector3D & Point) const;
+
+  virtual bool contains(const Vector3D & Point) const;
+
+  virtual bool Bounds(BBox & Box) const;
+
+/** Finalizes the geometry and bounds it at the steps. */
+  virtual bool Finalize();
+
+  virtual bool isMoving() const
+  {
+    return true;
+  }
+
+/** One segment between every two steps. */
+  virtual unsigned int MotionSegments() const;
+
+/** Bounds the motion: the blend of the two boxes also contains the
+* geometry at the steps in between.
+*/
+  virtual bool MotionBounds(float t0, float t1, BBox & Start, BBox & End)
+    const;
+};
+
+
+inline unsigned int Group::size() const
+{
+  return Objects.size();
+}
+
+inline void Group::AddObject(boost::shared_ptr<SceneObject> Object)
+{
+  assert(Object != 0);
+  Added.push_back(Objects.size());
+  Objects.push_back(Object);
+  Finalized = false;
+}
+
+//INSTANCE_HH
+#endif
@@ -0,0 +1,68 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file mappedfile.cc Implementation of MappedFile
+*/
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include "mappedfile.hh"
+
+
+MappedFile::MappedFile(const string & Path) : Base(0), Length(0)
+{
+  int fd = open(Path.c_str(), O_RDONLY);
+  if (fd < 0) return;
+
+  struct stat Info;
+  if ((fstat(fd, &Info) == 0) && (Info.st_size > 0))
+  {
+    void * p = mmap(0, Info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p != MAP_FAILED)
+    {
+      Base = (const char *) p;
+      Length = Info.st_size;
+    }
+  }
+
+  // The mapping stays valid without the descriptor
+  close(fd);
+}
+
+
+MappedFile::~MappedFile()
+{
+  if (Base) munmap((void *) Base, Length);
+}
+
+
+void MappedFile::release(size_t Offset, size_t Bytes) const
+{
+  size_t Page = sysconf(_SC_PAGESIZE);
+  size_t Start = (Offset + Page - 1) / Page * Page;
+  size_t End = min(Offset + Bytes, Length) / Page * Page;
+
+  if (Base && (End > Start))
+    madvise((void *) (Base + Start), End - Start, MADV_DONTNEED);
+}
@@ -0,0 +1,72 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file mappedfile.hh Contains MappedFile, a file mapped into memory for
+* reading
+*/
+
+#ifndef MAPPEDFILE_HH
+#define MAPPEDFILE_HH
+
+#include <string>
+#include <streambuf>
+
+using namespace std;
+
+
+/** A file mapped into memory for reading. Its pages are only read from
+* the disk when they are first used, and may be dropped again when the
+* memory runs short.
+*/
+struct MappedFile
+{
+/** The start of the mapping, null if it failed, and its length. */
+  const char * Base;
+  size_t Length;
+
+/** Maps a whole file. */
+  MappedFile(const string & Path);
+
+/** Unmaps the file. */
+  ~MappedFile();
+
+/** Lets the system drop the pages of a part of the file, which are read
+* again if they are used later. Only whole pages within the part go.
+*/
+  void release(size_t Offset, size_t Bytes) const;
+};
+
+
+/** A stream buffer over memory, e.g. a part of a mapped file, so that an
+* istream can read it in place.
+*/
+class MemoryBuffer : public streambuf
+{
+public:
+  MemoryBuffer(const char * Data, size_t Length)
+  {
+    char * p = const_cast<char *>(Data);
+    setg(p, p, p + Length);
+  }
+};
+
+//MAPPEDFILE_HH
+#endif
@@ -0,0 +1,353 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "mesh.hh"
+
+
+ShearedRay::ShearedRay(const Ray & R)
+{
+  Vector3D D = R.getDirection(), P = R.getOrigin();
+
+  // The dominant axis of the direction becomes z
+  kz = 0;
+  if (fabs(D[1]) > fabs(D[kz])) kz = 1;
+  if (fabs(D[2]) > fabs(D[kz])) kz = 2;
+  kx = (kz + 1) % 3;
+  ky = (kx + 1) % 3;
+
+  // Keep the winding of the triangles
+  if (D[kz] < 0) { int tmp = kx; kx = ky; ky = tmp; }
+
+  Sx = D[kx] / D[kz];
+  Sy = D[ky] / D[kz];
+  Sz = 1.0f / D[kz];
+
+  O[0] = P[0];
+  O[1] = P[1];
+  O[2] = P[2];
+}
+
+
+bool intersectTriangle(const ShearedRay & SR, const float * A,
+                       const float * B, const float * C,
+                       float tmax, float & t)
+{
+  // Vertices relative to the ray origin
+  float Ax = A[SR.kx] - SR.O[SR.kx], Ay = A[SR.ky] - SR.O[SR.ky],
+        Az = A[SR.kz] - SR.O[SR.kz];
+  float Bx = B[SR.kx] - SR.O[SR.kx], By = B[SR.ky] - SR.O[SR.ky],
+        Bz = B[SR.kz] - SR.O[SR.kz];
+  float Cx = C[SR.kx] - SR.O[SR.kx], Cy = C[SR.ky] - SR.O[SR.ky],
+        Cz = C[SR.kz] - SR.O[SR.kz];
+
+  // Shear so that the ray points along +z
+  Ax -= SR.Sx * Az;  Ay -= SR.Sy * Az;
+  Bx -= SR.Sx * Bz;  By -= SR.Sy * Bz;
+  Cx -= SR.Sx * Cz;  Cy -= SR.Sy * Cz;
+
+  // Scaled barycentric coordinates
+  float U = Cx * By - Cy * Bx;
+  float V = Ax * Cy - Ay * Cx;
+  float W = Bx * Ay - By * Ax;
+
+  // Fall back to double precision on the edges
+  if ((U == 0) || (V == 0) || (W == 0))
+  {
+    U = (float) ((double) Cx * By - (double) Cy * Bx);
+    V = (float) ((double) Ax * Cy - (double) Ay * Cx);
+    W = (float) ((double) Bx * Ay - (double) By * Ax);
+  }
+
+  if (((U < 0) || (V < 0) || (W < 0)) && ((U > 0) || (V > 0) || (W > 0)))
+    return false;
+
+  float det = U + V + W;
+  if (det == 0) return false;
+
+  float T = (U * Az + V * Bz + W * Cz) * SR.Sz;
+
+  // Compare against [0, tmax] without dividing by det
+  if (det < 0)
+  {
+    if ((T >= 0) || (T < tmax * det)) return false;
+  }
+  else if ((T <= 0) || (T > tmax * det)) return false;
+
+  t = T / det;
+  return true;
+}
+
+
+/** The leaf test used when walking the BVH of a mesh. */
+class MeshLeafTest
+{
+  const TriangleMesh & Mesh;
+  const ShearedRay & SR;
+
+public:
+/** The closest triangle found so far. */
+  int tri;
+
+  MeshLeafTest(const TriangleMesh & Mesh_, const ShearedRay & SR_):
+  Mesh(Mesh_), SR(SR_), tri(-1) {}
+
+  bool operator()(unsigned int prim, float & tmax)
+  {
+    float t;
+    if (!Mesh.IntersectTriangle(prim, SR, tmax, t)) return false;
+    tmax = t;
+    tri = prim;
+    return true;
+  }
+};
+
+
+TriangleMesh::TriangleMesh(const Color & Color_, float reflectivity_):
+SceneObject(Color_, reflectivity_)
+{
+}
+
+
+/** Reads one face index, returning it as a zero based vertex index.
+* Handles the v, v/vt, v//vn and v/vt/vn forms as well as negative
+* (relative) indices.
+*/
+static bool readFaceIndex(char * & p, unsigned int nverts, unsigned int & idx)
+{
+  char * end;
+  long i = strtol(p, &end, 10);
+
+  if (end == p) return false;
+
+  // Skip texture and normal indices
+  while (*end && (*end != ' ') && (*end != '\t') &&
+         (*end != '\r') && (*end != '\n')) end++;
+  p = end;
+
+  if (i < 0) i += nverts;
+  else i--;
+
+  if ((i < 0) || ((unsigned long) i >= nverts)) return false;
+  idx = i;
+  return true;
+}
+
+
+bool TriangleMesh::LoadOBJ(const string & FileName)
+{
+  FILE * f = fopen(FileName.c_str(), "r");
+  if (f == 0)
+  {
+    cerr << "Could not open mesh file " << FileName << endl;
+    return false;
+  }
+
+  // Large stdio buffer, the file is read sequentially only once
+  static const size_t BUF_SIZE = 1 << 20;
+  char * Buffer = new char[BUF_SIZE];
+  setvbuf(f, Buffer, _IOFBF, BUF_SIZE);
+
+  char line[4096];
+  unsigned int lineNo = 0, skipped = 0;
+  vector<unsigned int> Face;
+
+  while (fgets(line, sizeof(line), f))
+  {
+    char * p = line;
+    lineNo++;
+
+    while ((*p == ' ') || (*p == '\t')) p++;
+
+    if ((p[0] == 'v') && ((p[1] == ' ') || (p[1] == '\t')))
+    {
+      float x, y, z;
+      p += 2;
+      x = strtof(p, &p);
+      y = strtof(p, &p);
+      z = strtof(p, &p);
+      AddVertex(Vector3D(x, y, z));
+    }
+    else if ((p[0] == 'f') && ((p[1] == ' ') || (p[1] == '\t')))
+    {
+      unsigned int cur, nverts = NumVertices();
+      bool valid = true;
+      p += 2;
+
+      // All indices are checked before any triangle is added, so that a
+      // malformed face is dropped whole
+      Face.clear();
+      while (true)
+      {
+        while ((*p == ' ') || (*p == '\t')) p++;
+        if ((*p == 0) || (*p == '\r') || (*p == '\n')) break;
+
+        if (!readFaceIndex(p, nverts, cur))
+        {
+          valid = false;
+          break;
+        }
+        Face.push_back(cur);
+      }
+
+      if (!valid)
+      {
+        skipped++;
+        continue;
+      }
+
+      // Triangle fan around the first vertex
+      for (unsigned int i = 2; i < Face.size(); i++)
+        AddTriangle(Face[0], Face[i - 1], Face[i]);
+    }
+  }
+
+  fclose(f);
+  delete [] Buffer;
+
+  if (skipped > 0)
+    cerr << "Skipped " << skipped << " malformed faces in " << FileName << endl;
+
+  cout << "Read " << NumVertices() << " vertices and " << NumTriangles()
+       << " triangles from " << FileName << endl;
+
+  return true;
+}
+
+
+void TriangleMesh::BuildBVH()
+{
+  unsigned int n = NumTriangles();
+  vector<BBox> Boxes(n);
+
+  for (unsigned int i = 0; i < n; i++)
+  {
+    Boxes[i].extend(getVertex(Indices[3 * i]));
+    Boxes[i].extend(getVertex(Indices[3 * i + 1]));
+    Boxes[i].extend(getVertex(Indices[3 * i + 2]));
+  }
+
+  Tree.Build(Boxes);
+
+  cout << "Mesh BVH: " << Tree.Nodes.size() << " nodes, "
+       << Tree.NodeBytes() / 1024 << " kB" << endl;
+}
+
+
+bool TriangleMesh::Finalize()
+{
+  if (NumTriangles() == 0) return false;
+  if (Tree.empty()) BuildBVH();
+  return true;
+}
+
+
+const Vector3D TriangleMesh::TriangleNormal(unsigned int tri) const
+{
+  Vector3D A = getVertex(Indices[3 * tri]);
+  Vector3D N = cross(getVertex(Indices[3 * tri + 1]) - A,
+                     getVertex(Indices[3 * tri + 2]) - A);
+  N.normalize();
+  return N;
+}
+
+
+float TriangleMesh::Intersection(const Ray & R) const
+{
+  HitInfo Hit(R);
+
+  if (Intersect(R, Hit))
+    return Hit.t;
+  else
+    return NO_INTERSECTION;
+}
+
+
+bool TriangleMesh::Intersect(const Ray & R, HitInfo & Hit) const
+{
+  ShearedRay SR(R);
+  MeshLeafTest Test(*this, SR);
+  float t = Hit.t;
+
+  if (!Tree.Traverse(R, t, Test)) return false;
+
+  Hit.t = t;
+  Hit.Obj = this;
+  Hit.LocalPoint = R.getPoint(t);
+  Hit.N = TriangleNormal(Test.tri);
+
+  // Triangles are two sided, the normal faces the viewer
+  if (dot(Hit.N, R.getDirection()) > 0) Hit.N *= -1;
+
+  return true;
+}
+
+
+int TriangleMesh::FindTriangle(const Vector3D & Point) const
+{
+  float best = FLT_MAX;
+  int tri = -1;
+
+  for (unsigned int i = 0; i < NumTriangles(); i++)
+  {
+    float d = fabs(dot(Point - getVertex(Indices[3 * i]), TriangleNormal(i)));
+    if (d < best)
+    {
+      best = d;
+      tri = i;
+    }
+  }
+
+  return tri;
+}
+
+
+const Vector3D TriangleMesh::Normal(const Vector3D & Point) const
+{
+  int tri = FindTriangle(Point);
+  assert(tri >= 0);
+  return TriangleNormal(tri);
+}
+
+
+bool TriangleMesh::contains(const Vector3D & Point) const
+{
+  BBox Box;
+  if (!Bounds(Box)) return false;
+
+  for (int i = 0; i < 3; i++)
+    if ((Point[i] < Box.Min[i] - 0.001) || (Point[i] > Box.Max[i] + 0.001))
+      return false;
+
+  int tri = FindTriangle(Point);
+  return (tri >= 0) &&
+         (fabs(dot(Point - getVertex(Indices[3 * tri]),
+                   TriangleNormal(tri))) < 0.001);
+}
+
+
+bool TriangleMesh::Bounds(BBox & Box) const
+{
+  if (Tree.empty()) return false;
+  Box = Tree.Bounds();
+  return true;
+}
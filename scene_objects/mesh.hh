@@ -0,0 +1,209 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file mesh.hh Contains the definition of TriangleMesh
+*/
+
+#ifndef MESH_HH
+#define MESH_HH
+
+#include <string>
+#include <vector>
+#include "sceneobject.hh"
+#include "../wbvh.hh"
+
+using namespace std;
+
+
+/** The per-ray constants of the watertight ray/triangle test.
+* The ray is sheared so that it points along +z, after which every
+* triangle test is a handful of multiply-adds without divisions.
+*/
+struct ShearedRay
+{
+/** The axes permuted so that kz is the dominant ray direction. */
+  int kx, ky, kz;
+
+/** The shear and scale constants. */
+  float Sx, Sy, Sz;
+
+/** The ray origin. */
+  float O[3];
+
+/** Computes the constants for a ray. */
+  ShearedRay(const Ray & R);
+};
+
+
+/** Watertight ray/triangle intersection.
+* @param SR The sheared ray.
+* @param A,B,C The vertices of the triangle.
+* @param tmax Hits further than this are ignored.
+* @param t Receives the distance of the hit.
+* @return True if the ray hits the triangle between 0 and tmax.
+*/
+bool intersectTriangle(const ShearedRay & SR, const float * A,
+                       const float * B, const float * C,
+                       float tmax, float & t);
+
+
+/** A mesh of triangles sharing an indexed vertex buffer.
+* The triangles are kept in a BVH of their own so that the cost of a ray
+* grows with the logarithm of the triangle count. Intersections use the
+* watertight algorithm of Woop, Benthin and Wald, so rays never slip
+* through the shared edges of neighbouring triangles.
+*/
+class TriangleMesh : public SceneObject
+{
+private:
+
+/** The vertex positions, packed as x, y, z. */
+  vector<float> Vertices;
+
+/** Three indices into Vertices (in vertex units) per triangle. */
+  vector<unsigned int> Indices;
+
+/** The hierarchy over the triangles. */
+  WideBVH Tree;
+
+/** Returns the index of the triangle closest to a point, -1 if none. */
+  int FindTriangle(const Vector3D & Point) const;
+
+public:
+
+/** The constructor. Builds an empty mesh.
+* @param Color_ The color of the mesh.
+* @param reflectivity_ The reflectivity of the mesh.
+*/
+  TriangleMesh(const Color & Color_, float reflectivity_ = 0);
+
+/** The destructor. Does nothing. */
+  virtual ~TriangleMesh() {}
+
+/** Reads the vertices and faces of a Wavefront OBJ file.
+* The file is streamed line by line; normals, texture coordinates and
+* materials are ignored and polygons are split into triangle fans.
+* @param FileName The path of the file.
+* @return False if the file could not be read.
+*/
+  bool LoadOBJ(const string & FileName);
+
+/** Appends a vertex and returns its index. */
+  unsigned int AddVertex(const Vector3D & V);
+
+/** Appends a triangle made of three existing vertices. */
+  void AddTriangle(unsigned int a, unsigned int b, unsigned int c);
+
+/** Builds the BVH. Must be called once all triangles are added. */
+  void BuildBVH();
+
+/** Builds the BVH unless that is already done. Fails for an empty mesh. */
+  virtual bool Finalize();
+
+/** The number of triangles in the mesh. */
+  unsigned int NumTriangles() const;
+
+/** The number of vertices in the mesh. */
+  unsigned int NumVertices() const;
+
+/** The position of a vertex. */
+  const Vector3D getVertex(unsigned int i) const;
+
+/** A corner of a triangle, 0, 1 or 2. */
+  const Vector3D getCorner(unsigned int tri, int k) const;
+
+/** The unit geometric normal of a triangle. */
+  const Vector3D TriangleNormal(unsigned int tri) const;
+
+/** Watertight intersection with one triangle.
+* @param tri The triangle.
+* @param SR The sheared ray.
+* @param tmax Hits further than this are ignored.
+* @param t Receives the distance of the hit.
+*/
+  bool IntersectTriangle(unsigned int tri, const ShearedRay & SR,
+                         float tmax, float & t) const;
+
+  virtual float Intersection(const Ray & R) const;
+
+/** Finds the closest triangle through the BVH and reports its normal,
+* facing the incoming ray.
+*/
+  virtual bool Intersect(const Ray & R, HitInfo & Hit) const;
+
+/** Returns the normal of the triangle the point lies on. */
+  virtual const Vector3D Normal(const Vector3D & Point) const;
+
+/** Determines whether a point lies on one of the triangles. */
+  virtual bool contains(const Vector3D & Point) const;
+
+  virtual bool Bounds(BBox & Box) const;
+};
+
+
+inline bool TriangleMesh::IntersectTriangle(unsigned int tri,
+                                            const ShearedRay & SR,
+                                            float tmax, float & t) const
+{
+  const unsigned int * I = &Indices[3 * tri];
+  return intersectTriangle(SR, &Vertices[3 * I[0]], &Vertices[3 * I[1]],
+                           &Vertices[3 * I[2]], tmax, t);
+}
+
+inline unsigned int TriangleMesh::NumTriangles() const
+{
+  return Indices.size() / 3;
+}
+
+inline unsigned int TriangleMesh::NumVertices() const
+{
+  return Vertices.size() / 3;
+}
+
+inline const Vector3D TriangleMesh::getVertex(unsigned int i) const
+{
+  return Vector3D(Vertices[3 * i], Vertices[3 * i + 1], Vertices[3 * i + 2]);
+}
+
+inline const Vector3D TriangleMesh::getCorner(unsigned int tri, int k) const
+{
+  return getVertex(Indices[3 * tri + k]);
+}
+
+inline unsigned int TriangleMesh::AddVertex(const Vector3D & V)
+{
+  Vertices.push_back(V[0]);
+  Vertices.push_back(V[1]);
+  Vertices.push_back(V[2]);
+  return NumVertices() - 1;
+}
+
+inline void TriangleMesh::AddTriangle(unsigned int a, unsigned int b,
+                                      unsigned int c)
+{
+  assert((a < NumVertices()) && (b < NumVertices()) && (c < NumVertices()));
+  Indices.push_back(a);
+  Indices.push_back(b);
+  Indices.push_back(c);
+}
+
+//MESH_HH
+#endif
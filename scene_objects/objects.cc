@@ -19,6 +19,55 @@
  ***************************************************************************/
 
 #include "objects.hh"
+#include "../texture.hh"
+
+
+const Color SceneObject::getSurfaceColor(const Vector3D & Point,
+                                         float Footprint) const
+{
+  Color Base = getColor(Point);
+  float u, v, Size;
+
+  if (!Texture || !surfaceUV(Point, u, v, Size)) return Base;
+
+  return Texture->lookup(u * TextureScale, v * TextureScale,
+                         Footprint * TextureScale / Size) * Base;
+}
+
+
+/** A unit vector across a direction, any of them. */
+static Vector3D across(const Vector3D & Direction)
+{
+  Vector3D Helper = (fabs(Direction[0]) < 0.9) ? Vector3D(1, 0, 0) :
+                                                 Vector3D(0, 1, 0);
+  Vector3D Across = cross(Helper, Direction);
+  Across.normalize();
+  return Across;
+}
+
+
+bool Plane::surfaceUV(const Vector3D & Point, float & u, float & v,
+                      float & Size) const
+{
+  Vector3D U = across(NNormal);
+
+  u = dot(Point, U);
+  v = dot(Point, cross(NNormal, U));
+  Size = 1;
+  return true;
+}
+
+
+bool Sphere::surfaceUV(const Vector3D & Point, float & u, float & v,
+                       float & Size) const
+{
+  Vector3D D = (Point - Center) / Radius;
+
+  u = 0.5 + atan2(D[1], D[0]) / (2 * M_PI);
+  v = acos(max(-1.0f, min(1.0f, D[2]))) / M_PI;
+  Size = M_PI * Radius;
+  return true;
+}
 
 
 Cylinder::Cylinder(const Vector3D & Center,
@@ -35,16 +84,29 @@ Cylinder::Cylinder(const Vector3D & Center,
  height = Height;
  center = Center;
  orient = Orientation;
+ Finalize();
 }
 
 
-float Cylinder::Intersection(const Ray & R) const
+bool Cylinder::Finalize()
 {
- vector<float> vec;
- Vector3D Cpar, Cperp, Ppar, Pperp, Dpar, Dperp;
- 
+ if (!(orient.magn2() > 0) || !isfinite(orient.magn2()) ||
+     !isfinite(center.magn2()) || !(radius >= 0) || !(height >= 0))
+   return false;
+
  Cpar = project(center, orient);
  Cperp = center - Cpar;
+ CperpDot = dot(Cperp, Cperp);
+ radius2 = radius * radius;
+ half_height = height / 2;
+ return true;
+}
+
+
+float Cylinder::Intersection(const Ray & R) const
+{
+ Vector3D Ppar, Pperp, Dpar, Dperp;
+ float roots[2];
 
  Ppar = project(R.getOrigin(), orient);
  Pperp = R.getOrigin() - Ppar;
@@ -52,21 +114,97 @@ float Cylinder::Intersection(const Ray & R) const
  Dpar = project(R.getDirection(), orient);
  Dperp = R.getDirection() - Dpar;
 
- Sphere S(Cperp, radius, Color(0,0,0));
- Ray newRay(Pperp, Dperp);
- 
- S.AllIntersections(newRay, vec);
- if (vec[0] == NO_INTERSECTION) return vec[0];
- 
- for (unsigned int i = 0; i < vec.size(); i++)
+ //A ray parallel to the axis never crosses the side of the cylinder
+ float scale = Dperp.magn();
+ if (scale == 0) return NO_INTERSECTION;
+
+ //Intersect the cross section, a circle around Cperp, in the plane
+ //across the axis
+ int n = sphereRoots(Pperp, Dperp / scale, Cperp, CperpDot, radius2, roots);
+
+ for (int i = 0; i < n; i++)
  {
-  if ((Ppar + Dpar * vec[i] - Cpar).magn() < height / 2)
-   return vec[i];
+  //The roots run along the normalized Dperp, go back to the parameter of R
+  float t = roots[i] / scale;
+  if ((t > 0) && ((Ppar + Dpar * t - Cpar).magn() < half_height))
+   return t;
  }
 
  return NO_INTERSECTION;
 }
 
+bool Cylinder::Spans(const Ray & R, float tmax, SpanList & Out) const
+{
+ Vector3D Axis = orient;
+ Axis.normalize();
+
+ //Between the caps, going along or against the axis
+ float s0 = dot(R.getOrigin() - center, Axis);
+ float ds = dot(R.getDirection(), Axis);
+ Span Inside = {{-RAY_INFINITY, -Axis, this}, {RAY_INFINITY, Axis, this}};
+
+ if (ds == 0)
+ {
+  if (fabs(s0) > half_height) return true;
+ }
+ else
+ {
+  Inside.In.t = (-half_height - s0) / ds;
+  Inside.Out.t = (half_height - s0) / ds;
+  if (ds < 0)
+  {
+   swap(Inside.In.t, Inside.Out.t);
+   swap(Inside.In.N, Inside.Out.N);
+  }
+ }
+
+ //Within the radius, the roots of the cross section as in Intersection()
+ Vector3D Pperp = R.getOrigin() - project(R.getOrigin(), orient);
+ Vector3D Dperp = R.getDirection() - project(R.getDirection(), orient);
+ float scale = Dperp.magn();
+
+ if (scale == 0)
+ {
+  if ((Pperp - Cperp).magn2() >= radius2) return true;
+ }
+ else
+ {
+  float roots[2];
+  if (sphereRoots(Pperp, Dperp / scale, Cperp, CperpDot, radius2, roots) < 2)
+   return true;
+
+  float t0 = roots[0] / scale, t1 = roots[1] / scale;
+  if (t0 > Inside.In.t)
+  {
+   Inside.In.t = t0;
+   Inside.In.N = Normal(R.getPoint(t0));
+  }
+  if (t1 < Inside.Out.t)
+  {
+   Inside.Out.t = t1;
+   Inside.Out.N = Normal(R.getPoint(t1));
+  }
+ }
+
+ if (Inside.In.t < Inside.Out.t) Out.add(Inside);
+ return true;
+}
+
+bool Cylinder::surfaceUV(const Vector3D & Point, float & u, float & v,
+                         float & Size) const
+{
+  if (!(height > 0) || !(radius > 0)) return false;
+
+  Vector3D Axis = orient;
+  Axis.normalize();
+  Vector3D B = across(Axis), C = cross(Axis, B), W = Point - center;
+
+  u = 0.5 + atan2(dot(W, C), dot(W, B)) / (2 * M_PI);
+  v = 0.5 - dot(W, Axis) / height;
+  Size = min((float) (2 * M_PI * radius), height);
+  return true;
+}
+
 const Vector3D Cylinder::Normal(const Vector3D & Point) const
 {
   Vector3D V = Point - center;
@@ -75,6 +213,21 @@ const Vector3D Cylinder::Normal(const Vector3D & Point) const
   return Vperp;
 }
 
+bool Cylinder::Bounds(BBox & Box) const
+{
+  Vector3D Axis = orient, Extent;
+  Axis.normalize();
+
+  for (int i = 0; i < 3; i++)
+  {
+    float rim = 1 - Axis[i] * Axis[i];
+    Extent[i] = fabs(Axis[i]) * height / 2 + radius * sqrt((rim > 0) ? rim : 0);
+  }
+
+  Box = BBox(center - Extent, center + Extent);
+  return true;
+}
+
 bool Cylinder::contains(const Vector3D & Point) const
 {
   Vector3D V = Point - center;
@@ -84,6 +237,23 @@ bool Cylinder::contains(const Vector3D & Point) const
 
 
 
+bool Cube::surfaceUV(const Vector3D & Point, float & u, float & v,
+                     float & Size) const
+{
+  Vector3D P = Point - Center;
+  int a = 0;
+
+  // The face is across the axis the point is furthest along
+  for (int i = 1; i < 3; i++)
+    if (fabs(P[i]) > fabs(P[a])) a = i;
+
+  u = (P[(a + 1) % 3] / side_length) + 0.5;
+  v = 0.5 - (P[(a + 2) % 3] / side_length);
+  Size = side_length;
+  return true;
+}
+
+
 Cube::Cube(const Vector3D & v1,
 		 const Vector3D & v2,
 		 const Vector3D & v3,
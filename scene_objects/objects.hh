@@ -38,6 +38,44 @@ using namespace std;
 const short int ERROR_MULT = 3;
 
 
+/** Finds where a ray crosses the surface of a sphere.
+* @param P The origin of the ray.
+* @param D The direction of the ray.
+* @param Center The center of the sphere.
+* @param CenterDot dot(Center, Center).
+* @param Radius2 The squared radius.
+* @param t Receives the roots, the smallest first.
+* @return The number of roots: 0, 1 for a tangent ray, or 2.
+*/
+inline int sphereRoots(const Vector3D & P, const Vector3D & D,
+                       const Vector3D & Center, float CenterDot,
+                       float Radius2, float t[2])
+{
+  float double_a, b, c, delta;
+
+  // "a" is calculated as twice as much as needed, to save calculations later
+  double_a = 2 * dot(D,D);
+  b = 2 * (dot(P,D) - dot(D,Center));
+  c = dot(P,P) + CenterDot - 2 * dot(P,Center) - Radius2;
+  delta = b * b - 2 * double_a * c;
+
+  //If the discriminant is closer to zero than the error, return 1p
+  if (abs(delta) < ERROR_MULT * FLT_EPSILON)
+  {
+    t[0] = -b / double_a;
+    return 1;
+  }
+
+  if (delta < 0) return 0;
+
+  delta = sqrt(delta);
+
+  t[0] = (-b - delta) / double_a;
+  t[1] = (-b + delta) / double_a;
+  return 2;
+}
+
+
 /** Describes a plane, extends SceneObject. */
 class Plane : public SceneObject
 {
@@ -46,6 +84,9 @@ private:
 /** The distance to the origin of the coordinate system */
   float SDistance; 
 
+/** SDistance in units of NNormal, used for intersections. */
+  float NDistance;
+
 /** The normal to the plane, in any point. */
   Vector3D NNormal, //The normalized copy
 /** The normal to the plane, non-normalized. */
@@ -60,15 +101,15 @@ public:
 * Sets NNormal to Normal_ and normalizes it.
 */
 
-  Plane() {}
+  Plane(): SDistance(0), NDistance(0) {}
 
   Plane(float FromOrigin, Vector3D Normal_,
         const Color & Color_,
         float reflectivity_ = 0 ):SceneObject(Color_, reflectivity_)
   {
    SDistance = FromOrigin;
-   PNormal = NNormal = Normal_;
-   NNormal.normalize();
+   PNormal = Normal_;
+   Finalize();
   }
 
 /** The destructor. Does nothing */
@@ -92,6 +133,26 @@ public:
 /** Determines whether a certain point belongs to the plane. */
   virtual bool contains(const Vector3D & Point) const;
 
+/** Derives NNormal and NDistance. Fails for a zero normal. */
+  virtual bool Finalize();
+
+/** A plane is solid as the half space behind it, on the other side than
+* its normal points to.
+*/
+  virtual bool isSolid() const
+  {
+    return true;
+  }
+
+/** The part of the ray behind the plane. */
+  virtual bool Spans(const Ray & R, float tmax, SpanList & Out) const;
+
+/** Texture coordinates along two directions in the plane, in units of
+* distance.
+*/
+  virtual bool surfaceUV(const Vector3D & Point, float & u, float & v,
+                         float & Size) const;
+
 /** Returns the color at a certain point. */
   virtual const Color getColor(const Vector3D & Point) const
   {
@@ -109,13 +170,26 @@ public:
 inline void Plane::setDistance(float Distance)
 {
   SDistance = Distance;
+  Finalize();
 }
 
 inline void Plane::setNormal(const Vector3D & Normal_)
 {
-   
-  PNormal = NNormal = Normal_;
+  PNormal = Normal_;
+  Finalize();
+}
+
+inline bool Plane::Finalize()
+{
+  float length = PNormal.magn();
+
+  if (!(length > 0) || !isfinite(length) || !isfinite(SDistance))
+    return false;
+
+  NNormal = PNormal;
   NNormal.normalize();
+  NDistance = SDistance / length;
+  return true;
 }
 
 
@@ -145,12 +219,12 @@ inline float Plane::Intersection(const Ray & R) const
  Vector3D P = R.getOrigin();
  Vector3D D = R.getDirection();
  
- float t, dotprod = dot(PNormal,D);
+ float t, dotprod = dot(NNormal,D);
  
  //If Normal dot  D = 0, then no intersection
  if (dotprod == 0) return NO_INTERSECTION;
  
- t = - (dot(P,PNormal) + SDistance) / dotprod;
+ t = - (dot(P,NNormal) + NDistance) / dotprod;
  
  if (t <= 0) 
   return NO_INTERSECTION;
@@ -158,11 +232,36 @@ inline float Plane::Intersection(const Ray & R) const
   return t; 
 }
 
+// Shading uses the normal as given, its length scales the lighting
 inline const Vector3D Plane::Normal(const Vector3D & Point) const
 {
   return PNormal;
 }
 
+inline bool Plane::Spans(const Ray & R, float tmax, SpanList & Out) const
+{
+  float dist = dot(R.getOrigin(), NNormal) + NDistance;
+  float dotprod = dot(NNormal, R.getDirection());
+  Span Behind = {{-RAY_INFINITY, PNormal, this}, {RAY_INFINITY, PNormal, this}};
+
+  // Parallel to the plane, the ray is either all behind it or not at all
+  if (dotprod == 0)
+  {
+    if (dist < 0) Out.add(Behind);
+    return true;
+  }
+
+  // Going along the normal leaves the half space
+  float t = -dist / dotprod;
+  if (dotprod > 0)
+    Behind.Out.t = t;
+  else
+    Behind.In.t = t;
+
+  Out.add(Behind);
+  return true;
+}
+
 
 
 
@@ -176,6 +275,9 @@ private:
 /** The radius of the sphere. */
   float Radius;
 
+/** dot(Center, Center) and Radius * Radius, set by Finalize(). */
+  float CenterDot, Radius2;
+
 public:
 
 /** The constructor.
@@ -191,6 +293,7 @@ public:
   assert(Radius_ > 0);
   Radius = Radius_;
   Center = Center_;
+  Finalize();
   }
   
 /** The destructor. Does nothing. */
@@ -214,6 +317,26 @@ public:
 /** Determines whether a certain point belongs to the sphere. */
   virtual bool contains(const Vector3D & Point) const;
 
+/** The box around the sphere. */
+  virtual bool Bounds(BBox & Box) const;
+
+  virtual bool isSolid() const
+  {
+    return true;
+  }
+
+/** The part of the ray between the two roots. */
+  virtual bool Spans(const Ray & R, float tmax, SpanList & Out) const;
+
+/** Derives CenterDot and Radius2. */
+  virtual bool Finalize();
+
+/** Texture coordinates: u is the longitude around the z axis, v runs
+* from the top pole to the bottom one.
+*/
+  virtual bool surfaceUV(const Vector3D & Point, float & u, float & v,
+                         float & Size) const;
+
 /** Returns the color of the sphere at a certain point. */
   virtual const Color getColor(const Vector3D & Point) const
   {
@@ -232,6 +355,13 @@ inline bool Sphere::contains(const Vector3D & Point) const
   return ((Point - Center).magn() < Radius + 0.01);
 }
 
+inline bool Sphere::Bounds(BBox & Box) const
+{
+  Vector3D Extent(Radius, Radius, Radius);
+  Box = BBox(Center - Extent, Center + Extent);
+  return true;
+}
+
 inline const Vector3D Sphere::getCenter() const
 {
   return Center;
@@ -242,82 +372,43 @@ inline const float Sphere::getRadius() const
   return Radius;
 }
 
+inline bool Sphere::Finalize()
+{
+  if (!(Radius > 0) || !isfinite(Radius) || !isfinite(Center.magn2()))
+    return false;
+
+  CenterDot = dot(Center,Center);
+  Radius2 = Radius * Radius;
+  return true;
+}
+
 inline float Sphere::Intersection(const Ray & R) const
 {
-  Vector3D D = R.getDirection();
-  Vector3D P = R.getOrigin();
-  
-  float double_a,b,c, delta, t1, t2;
-  
-  // "a" is calculated as twice as much as needed, to save calculations later
-  double_a = 2 * dot(D,D);
-  b = 2 * (dot(P,D) - dot(D,Center));
-  c = dot(P,P) + dot(Center,Center) - 2 * dot(P,Center) - Radius * Radius;
-  delta = b * b - 2 * double_a * c;
-  
-  //If the discriminant is closer to zero than the error, return 1p
-  if (abs(delta) < ERROR_MULT * FLT_EPSILON) 
-  {
-   t1 =  -b / double_a;
-   if (t1 > 0)
-    return t1;    
-   else  
-    return NO_INTERSECTION;
-  }
-  
-  if (delta < 0) return NO_INTERSECTION;
-  
-  delta = sqrt(delta);
-  
-  t1 = (-b - delta) /  double_a;
-  if ( t1 > 0)    
-   return t1;    
- 
-  t2 = (-b + delta) /  double_a;
-  if ( t2 > 0) 
-    return t2;    
-  else
-    return NO_INTERSECTION;  
+  float t[2];
+  int n = sphereRoots(R.getOrigin(), R.getDirection(), Center, CenterDot,
+                      Radius2, t);
+
+  for (int i = 0; i < n; i++)
+    if (t[i] > 0) return t[i];
+
+  return NO_INTERSECTION;
 }
 
 inline void Sphere::AllIntersections(const Ray & R, vector<float> & vec) const
 {
-  Vector3D D = R.getDirection();
-  Vector3D P = R.getOrigin();
-  
-  float double_a,b,c, delta, t1, t2;
-  
-  // "a" is calculated as twice as much as needed, to save calculations later
-  double_a = 2 * dot(D,D);
-  b = 2 * (dot(P,D) - dot(D,Center));
-  c = dot(P,P) + dot(Center,Center) - 2 * dot(P,Center) - Radius * Radius;
-  delta = b * b - 2 * double_a * c;
-  
-  //If the discriminant is closer to zero than the error, return 1p
-  if (abs(delta) < ERROR_MULT * FLT_EPSILON) 
-  {
-   t1 =  -b / double_a;
-   if (t1 > 0)
-    vec.push_back(t1);    
-   else  
+  float t[2];
+  int n = sphereRoots(R.getOrigin(), R.getDirection(), Center, CenterDot,
+                      Radius2, t);
+
+  if (n == 0)
     vec.push_back(NO_INTERSECTION);
-  
-  return;
-  }
-  
-  if (delta < 0) 
+  else if (n == 1)
+    vec.push_back((t[0] > 0) ? t[0] : NO_INTERSECTION);
+  else
   {
-   vec.push_back(NO_INTERSECTION);
-   return;
+    vec.push_back(t[0]);
+    vec.push_back(t[1]);
   }
-  
-  delta = sqrt(delta);
-  
-  t1 = (-b - delta) /  double_a;
-  t2 = (-b + delta) /  double_a;
-  
-  vec.push_back(t1);
-  vec.push_back(t2);
 }
 
 inline const Vector3D Sphere::Normal(const Vector3D & Point) const
@@ -327,6 +418,21 @@ inline const Vector3D Sphere::Normal(const Vector3D & Point) const
   return N;
 }
 
+inline bool Sphere::Spans(const Ray & R, float tmax, SpanList & Out) const
+{
+  float t[2];
+  int n = sphereRoots(R.getOrigin(), R.getDirection(), Center, CenterDot,
+                      Radius2, t);
+
+  // A tangent ray touches the surface but has no inside
+  if (n < 2) return true;
+
+  Span Inside = {{t[0], (R.getPoint(t[0]) - Center) / Radius, this},
+                 {t[1], (R.getPoint(t[1]) - Center) / Radius, this}};
+  Out.add(Inside);
+  return true;
+}
+
 
 class Cylinder : public SceneObject
 {
@@ -336,6 +442,12 @@ class Cylinder : public SceneObject
   float radius;
   float height;
 
+  // Set by Finalize()
+  /** The parts of the center along and across the axis. */
+  Vector3D Cpar, Cperp;
+  /** dot(Cperp, Cperp), the squared radius and half the height. */
+  float CperpDot, radius2, half_height;
+
  public:
   Cylinder(const Vector3D & Center,
            const Vector3D & Orientation,
@@ -352,6 +464,26 @@ class Cylinder : public SceneObject
 /** Determines whether a point belongs to the object (within an error). */
   virtual bool contains(const Vector3D & Point) const; 
 
+/** The box around the (finite) cylinder. */
+  virtual bool Bounds(BBox & Box) const;
+
+/** Only rendered on its own the cylinder is open, in a CSG node it is
+* closed by its caps.
+*/
+  virtual bool isSolid() const
+  {
+    return true;
+  }
+
+/** The part of the ray within the radius and between the caps. */
+  virtual bool Spans(const Ray & R, float tmax, SpanList & Out) const;
+
+/** Projects the center on the axis once instead of for every ray. */
+  virtual bool Finalize();
+
+/** Texture coordinates: u goes around the axis, v along it. */
+  virtual bool surfaceUV(const Vector3D & Point, float & u, float & v,
+                         float & Size) const;
 };
 
 
@@ -381,7 +513,15 @@ public:
 /** Determines whether a point belongs to the object (within an error). */
   virtual bool contains(const Vector3D & Point) const;
 
+/** The box around the cube. */
+  virtual bool Bounds(BBox & Box) const;
+
+/** Finalizes the faces. */
+  virtual bool Finalize();
 
+/** Texture coordinates: every face shows the whole texture once. */
+  virtual bool surfaceUV(const Vector3D & Point, float & u, float & v,
+                         float & Size) const;
 };
 
 
@@ -393,15 +533,32 @@ inline bool Cube::contains(const Vector3D & Point) const
 }
 
 
+inline bool Cube::Bounds(BBox & Box) const
+{
+  // Hits are only accepted within the sphere around the cube, see contains()
+  float r = side_length * sqrt(0.75) + ERROR_MULT * FLT_EPSILON;
+  Vector3D Extent(r, r, r);
+  Box = BBox(Center - Extent, Center + Extent);
+  return true;
+}
+
+inline bool Cube::Finalize()
+{
+  for (int i = 0; i < 6; i++)
+    if (!P[i].Finalize()) return false;
+
+  return true;
+}
+
 inline float Cube::Intersection(const Ray & R) const
 { 
   int i;
-  float temp, t = 10e6;
+  float temp, t = NO_INTERSECTION;
 
   for(i = 0; i < 6; i++)
   {
    temp = P[i].Intersection(R);
-   if ((t > temp) && (temp != -1))
+   if ((temp != NO_INTERSECTION) && ((t == NO_INTERSECTION) || (temp < t)))
    {
     t = temp;
    }
@@ -409,7 +566,7 @@ inline float Cube::Intersection(const Ray & R) const
   
  // cout << "Searching for cube t=" << t << endl; 
   
-  if (t != 10e6)
+  if (t != NO_INTERSECTION)
   { 
   //cout << "Verifying inter at " << R.getPoint(t) << endl;
     if (contains(R.getPoint(t))) 
@@ -0,0 +1,331 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file particles.cc Implementation of ParticleCloud
+*/
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sys/stat.h>
+#include "particles.hh"
+#include "objects.hh"
+#include "../framebuffer.hh"
+
+
+/** The leaf test used when walking the BVH of a particle cloud. */
+class ParticleLeafTest
+{
+  const ParticleCloud & Cloud;
+  const Ray & R;
+
+public:
+/** The closest particle found so far. */
+  int particle;
+
+  ParticleLeafTest(const ParticleCloud & Cloud_, const Ray & R_):
+  Cloud(Cloud_), R(R_), particle(-1) {}
+
+  bool operator()(unsigned int prim, float & tmax)
+  {
+    Vector3D Center = Cloud.getCenter(prim);
+    float Radius = Cloud.getRadius(prim), t[2];
+    int n = sphereRoots(R.getOrigin(), R.getDirection(), Center,
+                        dot(Center, Center), Radius * Radius, t);
+
+    for (int i = 0; i < n; i++)
+      if ((t[i] > 0) && (t[i] >= R.getTMin()) && (t[i] < tmax))
+      {
+        tmax = t[i];
+        particle = prim;
+        return true;
+      }
+
+    return false;
+  }
+};
+
+
+/** The leaf test of FindParticle(): keeps the particle whose surface is
+* closest to a point, and never shortens the probe.
+*/
+class ParticleNearestTest
+{
+  const ParticleCloud & Cloud;
+  const Vector3D & Point;
+
+public:
+/** The closest particle so far and the distance to its surface. */
+  int particle;
+  float best;
+
+  ParticleNearestTest(const ParticleCloud & Cloud_, const Vector3D & Point_):
+  Cloud(Cloud_), Point(Point_), particle(-1), best(PARTICLE_EPSILON) {}
+
+  bool operator()(unsigned int prim, float & tmax)
+  {
+    float d = fabs((Point - Cloud.getCenter(prim)).magn() -
+                   Cloud.getRadius(prim));
+    if (d < best)
+    {
+      best = d;
+      particle = prim;
+    }
+    return false;
+  }
+};
+
+
+ParticleCloud::ParticleCloud(const Color & Color_, float reflectivity_):
+  SceneObject(Color_, reflectivity_), Count(0), Spheres(0), ByteColors(0),
+  FloatColors(0)
+{
+}
+
+
+/** Maps a file of floats, or reads it swapped on a big endian machine.
+* @param Owned Receives the floats if they had to be swapped.
+* @return The floats, or 0 if the file could not be mapped.
+*/
+static const float * mapFloats(const string & File,
+                               boost::shared_ptr<MappedFile> & Map,
+                               vector<float> & Owned)
+{
+  Map.reset(new MappedFile(File));
+  if (!Map->Base)
+  {
+    cerr << "Cannot map " << File << endl;
+    Map.reset();
+    return 0;
+  }
+
+  if (littleEndian()) return (const float *) Map->Base;
+
+  const float * Floats = (const float *) Map->Base;
+  Owned.assign(Floats, Floats + Map->Length / sizeof(float));
+  swapBytes(&Owned[0], Owned.size());
+  Map.reset();
+  return &Owned[0];
+}
+
+
+bool ParticleCloud::load(const string & File, const string & ColorFile)
+{
+  Count = 0;
+  Tree = WideBVH();
+  Path = File;
+
+  Spheres = mapFloats(File, Map, Owned);
+  if (!Spheres) return false;
+
+  size_t Bytes = Map ? Map->Length : Owned.size() * sizeof(float);
+  size_t n = Bytes / (4 * sizeof(float));
+  if ((Bytes % (4 * sizeof(float)) != 0) || (n == 0) || (n > PARTICLE_MAX))
+  {
+    cerr << File << " is not a file of up to " << PARTICLE_MAX
+         << " particles of 4 floats" << endl;
+    Spheres = 0;
+    return false;
+  }
+  Count = n;
+
+  ByteColors = 0;
+  FloatColors = 0;
+  if (ColorFile.empty()) return true;
+
+  // The size of the file tells bytes from floats
+  ColorMap.reset(new MappedFile(ColorFile));
+  size_t ColorBytes = ColorMap->Base ? ColorMap->Length : 0;
+
+  if (ColorBytes == 3 * (size_t) Count)
+    ByteColors = (const unsigned char *) ColorMap->Base;
+  else if (ColorBytes == 3 * sizeof(float) * (size_t) Count)
+    FloatColors = mapFloats(ColorFile, ColorMap, OwnedColors);
+  else
+  {
+    cerr << ColorFile << " does not hold 3 bytes or 3 floats for each of the "
+         << Count << " particles" << endl;
+    ColorMap.reset();
+    return false;
+  }
+  return true;
+}
+
+
+bool ParticleCloud::readTree()
+{
+  struct stat Source, Cached;
+  string TreePath = Path + ".bvh";
+
+  if ((stat(Path.c_str(), &Source) != 0) ||
+      (stat(TreePath.c_str(), &Cached) != 0) ||
+      (Cached.st_mtime < Source.st_mtime))
+    return false;
+
+  ifstream in(TreePath.c_str(), ios::binary);
+  string magic;
+  unsigned int n, NodeBytes;
+
+  in >> magic >> n >> NodeBytes;
+  if (!in || (magic != "PBVH") || (n != Count) ||
+      (NodeBytes != sizeof(WideBVHNode)))
+    return false;
+  in.get();    // The newline after the header
+
+  return Tree.read(in) && (Tree.Indices.size() == Count);
+}
+
+
+void ParticleCloud::writeTree() const
+{
+  string TreePath = Path + ".bvh", Temporary = TreePath + ".tmp";
+
+  // Written under another name first, so that a half written file is
+  // never read
+  {
+    ofstream out(Temporary.c_str(), ios::binary);
+    out << "PBVH\n" << Count << " " << sizeof(WideBVHNode) << "\n";
+    if (!out || !Tree.write(out))
+    {
+      cerr << "Cannot save the particle BVH as " << TreePath << endl;
+      remove(Temporary.c_str());
+      return;
+    }
+  }
+
+  rename(Temporary.c_str(), TreePath.c_str());
+}
+
+
+bool ParticleCloud::Finalize()
+{
+  if (Count == 0) return false;
+  if (!Tree.empty()) return true;
+
+  if (readTree())
+    cout << "Read the particle BVH from " << Path << ".bvh" << endl;
+  else
+  {
+    vector<BBox> Boxes(Count);
+
+    for (unsigned int i = 0; i < Count; i++)
+    {
+      float r = fabs(getRadius(i));
+      Vector3D Extent(r, r, r);
+      Boxes[i] = BBox(getCenter(i) - Extent, getCenter(i) + Extent);
+    }
+
+    Tree.Build(Boxes);
+    writeTree();
+  }
+
+  cout << "Particle BVH: " << Count << " particles, " << Tree.Nodes.size()
+       << " nodes, " << (Tree.NodeBytes() + Count * sizeof(unsigned int)) / 1024
+       << " kB" << endl;
+  return true;
+}
+
+
+float ParticleCloud::Intersection(const Ray & R) const
+{
+  HitInfo Hit(R);
+
+  if (Intersect(R, Hit))
+    return Hit.t;
+  else
+    return NO_INTERSECTION;
+}
+
+
+bool ParticleCloud::Intersect(const Ray & R, HitInfo & Hit) const
+{
+  ParticleLeafTest Test(*this, R);
+  float t = Hit.t;
+
+  if (!Tree.Traverse(R, t, Test)) return false;
+
+  Hit.t = t;
+  Hit.Obj = this;
+  Hit.LocalPoint = R.getPoint(t);
+  Hit.N = (Hit.LocalPoint - getCenter(Test.particle)) /
+          getRadius(Test.particle);
+  return true;
+}
+
+
+int ParticleCloud::FindParticle(const Vector3D & Point) const
+{
+  // A short probe through the point meets the boxes around it, along a
+  // diagonal so that it is not parallel to their sides
+  Vector3D Direction(1, 1, 1);
+  Direction.normalize();
+
+  Ray Probe(Point - PARTICLE_EPSILON * Direction, Direction, false);
+  ParticleNearestTest Test(*this, Point);
+  float tmax = 2 * PARTICLE_EPSILON;
+
+  Tree.Traverse(Probe, tmax, Test);
+  return Test.particle;
+}
+
+
+const Vector3D ParticleCloud::Normal(const Vector3D & Point) const
+{
+  int i = FindParticle(Point);
+  if (i < 0) return Vector3D(0, 0, 1);
+
+  Vector3D N = Point - getCenter(i);
+  N.normalize();
+  return N;
+}
+
+
+bool ParticleCloud::contains(const Vector3D & Point) const
+{
+  return FindParticle(Point) >= 0;
+}
+
+
+const Color ParticleCloud::getColor(const Vector3D & Point) const
+{
+  if (!ByteColors && !FloatColors) return BaseColor;
+
+  int i = FindParticle(Point);
+  if (i < 0) return BaseColor;
+
+  if (ByteColors)
+  {
+    const unsigned char * C = ByteColors + 3 * (size_t) i;
+    return Color(C[0] / 255.0f, C[1] / 255.0f, C[2] / 255.0f);
+  }
+
+  const float * C = FloatColors + 3 * (size_t) i;
+  return Color(C[0], C[1], C[2]);
+}
+
+
+bool ParticleCloud::Bounds(BBox & Box) const
+{
+  if (Tree.empty()) return false;
+
+  Box = Tree.Bounds();
+  return true;
+}
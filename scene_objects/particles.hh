@@ -0,0 +1,159 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file particles.hh Contains the definition of ParticleCloud, a great
+* many spheres read from a binary file
+*/
+
+#ifndef PARTICLES_HH
+#define PARTICLES_HH
+
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include "sceneobject.hh"
+#include "mappedfile.hh"
+#include "../wbvh.hh"
+
+using namespace std;
+
+
+/** The most particles a cloud can hold, as the leaves of WideBVH
+* address them with 29 bits.
+*/
+const unsigned int PARTICLE_MAX = 1u << 29;
+
+/** How far from a particle a point may be and still lie on it. */
+const float PARTICLE_EPSILON = 0.001;
+
+
+/** A cloud of spheres, as simulations write them.
+* The particles are read from a file of packed little endian floats, four
+* per particle: the center and the radius. The file is mapped into memory
+* and no object is made per particle, so a cloud takes little more memory
+* than its file and the BVH over it, about 18 bytes per particle.
+*
+* An optional color file gives every particle a color of its own instead
+* of the color of the cloud, either as three bytes or as three floats per
+* particle.
+*
+* The BVH is saved next to the particle file, with .bvh appended, and
+* read back instead of built as long as it is newer than the file.
+*/
+class ParticleCloud : public SceneObject
+{
+private:
+
+/** The number of particles. */
+  unsigned int Count;
+
+/** The centers and radii, in the mapped file or, if the bytes had to be
+* swapped, in Owned.
+*/
+  const float * Spheres;
+  vector<float> Owned;
+  boost::shared_ptr<MappedFile> Map;
+
+/** The colors, 3 bytes or 3 floats per particle, or neither. */
+  const unsigned char * ByteColors;
+  const float * FloatColors;
+  vector<float> OwnedColors;
+  boost::shared_ptr<MappedFile> ColorMap;
+
+/** The particle file, which names the BVH file. */
+  string Path;
+
+/** The hierarchy over the particles. */
+  WideBVH Tree;
+
+/** Reads the BVH file, if it is there and newer than the particles. */
+  bool readTree();
+
+/** Saves the BVH next to the particles. */
+  void writeTree() const;
+
+public:
+
+/** The constructor. The particles are read by load().
+* @param Color_ The color of the particles without a color file.
+* @param reflectivity_ The reflectivity.
+*/
+  ParticleCloud(const Color & Color_, float reflectivity_ = 0);
+
+  virtual ~ParticleCloud() {}
+
+/** Maps the particle file and the color file, if one is given.
+* @return False, after saying why, if either cannot be used.
+*/
+  bool load(const string & File, const string & ColorFile = "");
+
+/** The number of particles. */
+  unsigned int size() const;
+
+/** The center of a particle. */
+  const Vector3D getCenter(unsigned int i) const;
+
+/** The radius of a particle. */
+  float getRadius(unsigned int i) const;
+
+/** Returns the particle whose surface is closest to a point, -1 if no
+* surface is within PARTICLE_EPSILON.
+*/
+  int FindParticle(const Vector3D & Point) const;
+
+/** Builds the BVH, or reads it back. Fails without particles. */
+  virtual bool Finalize();
+
+  virtual float Intersection(const Ray & R) const;
+
+/** Finds the closest particle through the BVH. */
+  virtual bool Intersect(const Ray & R, HitInfo & Hit) const;
+
+/** The normal of the particle the point lies on. */
+  virtual const Vector3D Normal(const Vector3D & Point) const;
+
+  virtual bool contains(const Vector3D & Point) const;
+
+/** The color of the particle the point lies on. */
+  virtual const Color getColor(const Vector3D & Point) const;
+
+  virtual bool Bounds(BBox & Box) const;
+};
+
+
+inline unsigned int ParticleCloud::size() const
+{
+  return Count;
+}
+
+inline const Vector3D ParticleCloud::getCenter(unsigned int i) const
+{
+  return Vector3D(Spheres[4 * (size_t) i], Spheres[4 * (size_t) i + 1],
+                  Spheres[4 * (size_t) i + 2]);
+}
+
+inline float ParticleCloud::getRadius(unsigned int i) const
+{
+  return Spheres[4 * (size_t) i + 3];
+}
+
+//PARTICLES_HH
+#endif
@@ -25,8 +25,112 @@
 #ifndef SCENEOBJECT_HH
 #define SCENEOBJECT_HH
 
+#include <boost/shared_ptr.hpp>
 #include "../color.hh"
 #include "../ray.hh"
+#include "../bbox.hh"
+
+//Returned by Intersection(const Ray &) if there's no intersection.
+/** The result of the Intersection function if no intersection is detected 
+* @see SceneClass::Intersection()
+*/
+const int NO_INTERSECTION = -1;
+
+class SceneObject;
+class ImageTexture;
+
+/** The refractive index of transparent objects that do not give one,
+* about that of glass.
+*/
+const float DEFAULT_IOR = 1.5;
+
+/** Describes the closest intersection found so far along a ray.
+* Filled by SceneObject::Intersect().
+*/
+struct HitInfo
+{
+/** The "time parameter" of the closest hit. */
+  float t;
+
+/** The object providing the color and reflectivity of the surface.
+* Zero as long as nothing was hit.
+*/
+  const SceneObject * Obj;
+
+/** The surface normal at the hit point. */
+  Vector3D N;
+
+/** The hit point in the coordinates of Obj. */
+  Vector3D LocalPoint;
+
+/** The position of the object that was hit in the list the caller gave,
+* e.g. Scene::SObjects. When groups are nested it is the outermost
+* member, an instance rather than the primitive inside it. -1 if nothing
+* was hit.
+*/
+  int Index;
+
+/** Nothing hit yet, anything along an unclipped ray is closer. */
+  HitInfo(): t(RAY_INFINITY), Obj(0), Index(-1) {}
+
+/** Nothing hit yet, only hits within the interval of R count. */
+  HitInfo(const Ray & R): t(R.getTMax()), Obj(0), Index(-1) {}
+};
+
+/** The most spans a SpanList holds. */
+const int MAX_SPANS = 8;
+
+/** A point where a ray crosses the surface of a solid. */
+struct SpanEnd
+{
+/** The "time parameter" of the point. */
+  float t;
+
+/** The outward normal of the surface there. */
+  Vector3D N;
+
+/** The primitive whose surface it is. */
+  const SceneObject * Obj;
+};
+
+/** A part of a ray inside a solid, entered at In and left at Out. */
+struct Span
+{
+  SpanEnd In, Out;
+};
+
+/** The parts of a ray inside a solid, in order along the ray and apart
+* from each other. They are kept in place rather than in a vector, as
+* many lists are made for every ray; when a list is full the further
+* spans are dropped.
+* @see SceneObject::Spans()
+*/
+struct SpanList
+{
+/** The number of spans. */
+  int n;
+
+/** The spans. */
+  Span S[MAX_SPANS];
+
+/** An empty list. */
+  SpanList(): n(0) {}
+
+/** Appends a span beyond the last one, if there is room. */
+  void add(const Span & Next)
+  {
+    if (n < MAX_SPANS) S[n++] = Next;
+  }
+
+/** The i-th crossing of the surface: In of S[i / 2] for even i, Out for
+* odd i.
+*/
+  const SpanEnd & end(int i) const
+  {
+    return (i & 1) ? S[i / 2].Out : S[i / 2].In;
+  }
+};
+
 
 /** A base class for objects in 3D */
 class SceneObject
@@ -36,13 +140,25 @@ protected:
 /** The base color of the object. */
   Color BaseColor;
   float reflectivity;
+
+/** The part of the light that goes through the surface, and the
+* refractive index of the inside.
+*/
+  float transparency, ior;
+
+/** The image texture, null if the object has none. */
+  boost::shared_ptr<ImageTexture> Texture;
+
+/** The texture coordinates are multiplied by it. */
+  float TextureScale;
   
 public:
 
 /** The only constructor */
   SceneObject(Color BaseColor_, float reflectivity_): 
-  BaseColor(BaseColor_), reflectivity(reflectivity_) {}
-  SceneObject() {}
+  BaseColor(BaseColor_), reflectivity(reflectivity_), transparency(0),
+  ior(DEFAULT_IOR), TextureScale(1) {}
+  SceneObject(): transparency(0), ior(DEFAULT_IOR), TextureScale(1) {}
   
 /** The desctructor. 
 * Does nothing.
@@ -58,9 +174,98 @@ public:
 */
   virtual float Intersection(const Ray & R) const = 0;
 
+/** Records an intersection if it is closer than the one in Hit.
+* The default implementation relies on Intersection() and Normal(), objects
+* made of many primitives override it to report the primitive they hit.
+* @param R The ray.
+* @param Hit The closest hit so far, updated on success.
+* @return True if Hit was updated.
+*/
+  virtual bool Intersect(const Ray & R, HitInfo & Hit) const
+  {
+    float t = Intersection(R);
+    if ((t == NO_INTERSECTION) || (t < R.getTMin()) || (t >= Hit.t))
+      return false;
+
+    Hit.t = t;
+    Hit.Obj = this;
+    Hit.LocalPoint = R.getPoint(t);
+    Hit.N = Normal(Hit.LocalPoint);
+    return true;
+  }
+
+/** Precomputes the constants the intersection code relies on and checks
+* that the object is well formed. Called by Scene::finalize() once the
+* scene is read; the object must not be changed afterwards.
+* @return False if the object is degenerate and cannot be rendered.
+*/
+  virtual bool Finalize()
+  {
+    return true;
+  }
+
+/** Computes an axis aligned box containing the object.
+* @return False for unbounded objects such as planes.
+*/
+  virtual bool Bounds(BBox & Box) const
+  {
+    return false;
+  }
+
+/** True if the object moves while the shutter is open, so that what a ray
+* hits depends on Ray::getTime(). Bounds() then covers the whole motion.
+*/
+  virtual bool isMoving() const
+  {
+    return false;
+  }
+
+/** Into how many equal parts scene time should be cut for the motion to
+* be close to linear within each, see MotionBounds().
+*/
+  virtual unsigned int MotionSegments() const
+  {
+    return 1;
+  }
+
+/** Computes the bounds of the object at two scene times. In between the
+* object lies within the linear blend of the two boxes.
+* @param t0 The earlier time.
+* @param t1 The later time.
+* @param Start Receives the box at t0.
+* @param End Receives the box at t1.
+* @return False for unbounded objects.
+*/
+  virtual bool MotionBounds(float t0, float t1, BBox & Start, BBox & End) const
+  {
+    if (!Bounds(Start)) return false;
+    End = Start;
+    return true;
+  }
+
 /** Returns the normal to the surface of the object at a certain point. */
   virtual const Vector3D Normal(const Vector3D & Point) const = 0;
 
+/** True if the object encloses a volume, and so implements Spans(). */
+  virtual bool isSolid() const
+  {
+    return false;
+  }
+
+/** Finds the parts of a ray inside the object, for constructive solid
+* geometry.
+* @param R The ray. Its whole line counts, also behind the origin.
+* @param tmax Only the spans between R.getTMin() and tmax need to be
+* right, those the object can tell are elsewhere may be left out.
+* @param Out Receives the spans, it is empty on entry.
+* @return False if the object is not solid.
+* @see CSG
+*/
+  virtual bool Spans(const Ray & R, float tmax, SpanList & Out) const
+  {
+    return false;
+  }
+
 /** Determines whether a point belongs to the object (within an error). */
   virtual bool contains(const Vector3D & Point) const = 0;
 
@@ -70,6 +275,36 @@ public:
     return BaseColor;
   }
 
+/** The texture coordinates of a point on the surface, before TextureScale.
+* @param Size Receives the distance on the surface that one unit of u or
+* v spans, roughly.
+* @return False if the object has no texture coordinates.
+*/
+  virtual bool surfaceUV(const Vector3D & Point, float & u, float & v,
+                         float & Size) const
+  {
+    return false;
+  }
+
+/** The color of the object at a point, the image texture times the color
+* returned by getColor().
+* @param Footprint The width of the area seen around the point, which
+* picks the detail of the texture.
+*/
+  const Color getSurfaceColor(const Vector3D & Point, float Footprint) const;
+
+/** Puts an image texture on the object.
+* @param Texture_ The texture.
+* @param Scale The texture repeats Scale times over the texture
+* coordinates of the object.
+*/
+  void setTexture(const boost::shared_ptr<ImageTexture> & Texture_,
+                  float Scale = 1)
+  {
+    Texture = Texture_;
+    TextureScale = Scale;
+  }
+
 /** An mutator for the color of the object. */
  void setColor(Color Color_)
  {
@@ -77,10 +312,59 @@ public:
  }
 
 /** An accesor to the reflectivity of the object.*/
- float Reflectivity()
+ float Reflectivity() const
   {
    return reflectivity;
   }
+
+/** Makes the object transparent.
+* @param transparency_ The part of the light that goes through the surface
+* rather than being reflected or taking the color of the object, 0 to 1.
+* @param ior_ The refractive index of the inside, the outside is air.
+*/
+ void setTransparency(float transparency_, float ior_ = DEFAULT_IOR)
+ {
+   transparency = transparency_;
+   ior = ior_;
+ }
+
+/** An accessor to the transparency of the object. */
+ float Transparency() const
+ {
+   return transparency;
+ }
+
+/** An accessor to the refractive index of the inside of the object. */
+ float RefractiveIndex() const
+ {
+   return ior;
+ }
+};
+
+
+/** The leaf test used when walking a BVH built over scene objects.
+* ObjectList is any random access container of (smart) pointers to
+* SceneObject. The position of the object hit is stored in Hit.Index.
+* @see BVH::Traverse()
+*/
+template <class ObjectList>
+class ObjectLeafTest
+{
+  const ObjectList & Objects;
+  const Ray & R;
+  HitInfo & Hit;
+
+public:
+  ObjectLeafTest(const ObjectList & Objects_, const Ray & R_, HitInfo & Hit_):
+  Objects(Objects_), R(R_), Hit(Hit_) {}
+
+  bool operator()(unsigned int prim, float & tmax)
+  {
+    if (!Objects[prim]->Intersect(R, Hit)) return false;
+    Hit.Index = prim;
+    tmax = Hit.t;
+    return true;
+  }
 };
 
 #endif //SCENEOBJECT_HH
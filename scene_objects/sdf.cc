@@ -0,0 +1,466 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file sdf.cc Implementation of DistanceField and the distance nodes
+*/
+
+#include <cmath>
+#include "sdf.hh"
+
+
+/** The smooth minimum of two distances, a fillet of radius about k where
+* they are close. The plain minimum for k = 0.
+*/
+static inline float smoothMin(float a, float b, float k)
+{
+  if (k <= 0) return min(a, b);
+
+  float h = max(k - fabsf(a - b), 0.0f) / k;
+  return min(a, b) - h * h * k * 0.25f;
+}
+
+
+/** The part of a ray within a box, entry and exit.
+* @return False if the ray misses the box between R.getTMin() and tmax.
+*/
+static bool clip(const BBox & Box, const Ray & R, float tmax, float & t0,
+                 float & t1)
+{
+  const Vector3D & O = R.getOrigin();
+  const Vector3D & InvDir = R.getInvDirection();
+
+  t0 = R.getTMin();
+  t1 = tmax;
+  for (int i = 0; i < 3; i++)
+  {
+    int s = R.getSign(i);
+    float tA = ((s ? Box.Max : Box.Min)[i] - O[i]) * InvDir[i];
+    float tB = ((s ? Box.Min : Box.Max)[i] - O[i]) * InvDir[i];
+    t0 = (tA > t0) ? tA : t0;
+    t1 = (tB < t1) ? tB : t1;
+  }
+
+  return t0 <= t1;
+}
+
+
+float DistanceSphere::distance(const Vector3D & P) const
+{
+  return (P - Center).magn() - Radius;
+}
+
+bool DistanceSphere::bounds(BBox & Box) const
+{
+  Vector3D Extent(Radius, Radius, Radius);
+  Box = BBox(Center - Extent, Center + Extent);
+  return true;
+}
+
+
+DistanceBox::DistanceBox(const Vector3D & Center_, const Vector3D & Half_,
+                         float Rounding_):
+  Center(Center_), Half(Half_), Rounding(Rounding_)
+{
+  for (int i = 0; i < 3; i++)
+    Rounding = min(Rounding, Half[i]);
+}
+
+float DistanceBox::distance(const Vector3D & P) const
+{
+  Vector3D Q = P - Center, Outside;
+  float inside = -HUGE_VALF;
+
+  for (int i = 0; i < 3; i++)
+  {
+    float q = fabsf(Q[i]) - (Half[i] - Rounding);
+    Outside[i] = max(q, 0.0f);
+    inside = max(inside, q);
+  }
+
+  return Outside.magn() + min(inside, 0.0f) - Rounding;
+}
+
+bool DistanceBox::bounds(BBox & Box) const
+{
+  Box = BBox(Center - Half, Center + Half);
+  return true;
+}
+
+
+float DistanceCapsule::distance(const Vector3D & P) const
+{
+  Vector3D PA = P - A, BA = B - A;
+  float length2 = dot(BA, BA);
+  float h = (length2 > 0) ? dot(PA, BA) / length2 : 0;
+
+  h = max(0.0f, min(1.0f, h));
+  return (PA - BA * h).magn() - Radius;
+}
+
+bool DistanceCapsule::bounds(BBox & Box) const
+{
+  Vector3D Extent(Radius, Radius, Radius);
+  Box = BBox(A - Extent, A + Extent);
+  Box.extend(BBox(B - Extent, B + Extent));
+  return true;
+}
+
+
+float DistanceTorus::distance(const Vector3D & P) const
+{
+  Vector3D Q = P - Center;
+  float across = sqrtf(Q[0] * Q[0] + Q[1] * Q[1]) - Major;
+
+  return sqrtf(across * across + Q[2] * Q[2]) - Minor;
+}
+
+bool DistanceTorus::bounds(BBox & Box) const
+{
+  float r = Major + Minor;
+  Vector3D Extent(r, r, Minor);
+  Box = BBox(Center - Extent, Center + Extent);
+  return true;
+}
+
+
+float DistanceCombine::distance(const Vector3D & P) const
+{
+  float a = Left->distance(P), b = Right->distance(P);
+
+  switch (Op)
+  {
+    case CSG_UNION: return smoothMin(a, b, Blend);
+    case CSG_INTERSECTION: return -smoothMin(-a, -b, Blend);
+    default: return -smoothMin(-a, b, Blend);
+  }
+}
+
+bool DistanceCombine::bounds(BBox & Box) const
+{
+  BBox L, R;
+  bool hasL = Left->bounds(L), hasR = Right->bounds(R);
+
+  switch (Op)
+  {
+    case CSG_UNION:
+    {
+      if (!hasL || !hasR) return false;
+
+      // The fillet adds up to a quarter of the blend radius
+      float k = max(Blend, 0.0f) * 0.25f;
+      Vector3D Extent(k, k, k);
+      Box = L;
+      Box.extend(R);
+      Box = BBox(Box.Min - Extent, Box.Max + Extent);
+      return true;
+    }
+
+    case CSG_INTERSECTION:
+      if (!hasL && !hasR) return false;
+      if (!hasL || !hasR)
+      {
+        Box = hasL ? L : R;
+        return true;
+      }
+      Box = L;
+      for (int i = 0; i < 3; i++)
+      {
+        Box.Min[i] = max(L.Min[i], R.Min[i]);
+        Box.Max[i] = min(L.Max[i], R.Max[i]);
+      }
+      if (Box.empty()) Box = L;
+      return true;
+
+    default:
+      if (!hasL) return false;
+      Box = L;
+      return true;
+  }
+}
+
+
+void SphereTraceStats::record(unsigned long steps, unsigned long evaluations,
+                              unsigned long cached)
+{
+  Rays++;
+  Steps += steps;
+  Evaluations += evaluations;
+  Cached += cached;
+
+  unsigned long m = MaxSteps.load();
+  while ((steps > m) && !MaxSteps.compare_exchange_weak(m, steps)) {}
+}
+
+unsigned long SphereTraceStats::rays() const
+{
+  return Rays.load();
+}
+
+void SphereTraceStats::report(ostream & out) const
+{
+  unsigned long n = Rays.load(), steps = Steps.load();
+
+  out << "Sphere tracing: " << n << " rays, "
+      << (n ? (double) steps / n : 0) << " steps per ray, at most "
+      << MaxSteps.load() << ", " << Evaluations.load()
+      << " evaluations, " << (steps ? 100.0 * Cached.load() / steps : 0)
+      << "% of the steps from the brick cache" << endl;
+}
+
+SphereTraceStats & sphereTraceStats()
+{
+  static SphereTraceStats Stats;
+  return Stats;
+}
+
+
+DistanceField::DistanceField(SPDistanceNode Root_, const Color & Color_,
+                             float reflectivity_, int CacheResolution_):
+  SceneObject(Color_, reflectivity_), Root(Root_),
+  CacheResolution(CacheResolution_), Cell(0), CellDiagonal(0)
+{
+  assert(Root != 0);
+  Bricks[0] = Bricks[1] = Bricks[2] = 0;
+}
+
+
+bool DistanceField::Finalize()
+{
+  if (!Root->bounds(Box)) return false;
+
+  // A little room, so that rays start tracing outside the surface
+  Vector3D Margin = Box.diagonal() * 0.001f +
+                    Vector3D(SDF_EPSILON, SDF_EPSILON, SDF_EPSILON);
+  Box = BBox(Box.Min - Margin, Box.Max + Margin);
+
+  if (CacheResolution > 0) buildCache();
+  return true;
+}
+
+
+void DistanceField::buildCache()
+{
+  const int Side = SDF_BRICK + 1, BrickSamples = Side * Side * Side;
+  Vector3D Extent = Box.diagonal();
+
+  Cell = max(Extent[0], max(Extent[1], Extent[2])) / CacheResolution;
+  CellDiagonal = Cell * sqrtf(3.0f);
+  GridOrigin = Box.Min;
+
+  for (int a = 0; a < 3; a++)
+    Bricks[a] = max(1, (int) ceil(Extent[a] / (Cell * SDF_BRICK)));
+
+  int n = Bricks[0] * Bricks[1] * Bricks[2];
+  float HalfDiagonal = CellDiagonal * SDF_BRICK / 2;
+
+  BrickStart.assign(n, -1);
+  BrickBound.assign(n, 0);
+  Samples.clear();
+
+  for (int i = 0; i < n; i++)
+  {
+    int b[3] = {i % Bricks[0], (i / Bricks[0]) % Bricks[1],
+                i / (Bricks[0] * Bricks[1])};
+    Vector3D Corner = GridOrigin;
+    for (int a = 0; a < 3; a++) Corner[a] += b[a] * SDF_BRICK * Cell;
+
+    Vector3D Center = Corner + Vector3D(1, 1, 1) * (SDF_BRICK * Cell / 2);
+    float d = Root->distance(Center);
+
+    // Far from the surface one bound does for the whole brick, and it
+    // still allows steps of a few cells
+    if (fabsf(d) - HalfDiagonal > 2 * CellDiagonal)
+    {
+      BrickBound[i] = (d > 0) ? d - HalfDiagonal : d + HalfDiagonal;
+      continue;
+    }
+
+    BrickStart[i] = Samples.size();
+    Samples.resize(Samples.size() + BrickSamples);
+    float * S = &Samples[BrickStart[i]];
+
+    for (int z = 0; z < Side; z++)
+      for (int y = 0; y < Side; y++)
+        for (int x = 0; x < Side; x++)
+          *S++ = Root->distance(Corner + Vector3D(x, y, z) * Cell);
+  }
+}
+
+
+/** With the cache, a lower bound of the distance comes from the brick
+* the point is in. The samples of a brick near the surface are
+* interpolated; as the function changes by at most the distance between
+* two points, and the corners of a cell are on average at most half its
+* diagonal away from a point in it, the interpolation is off by at most
+* half a diagonal. The function is evaluated where the bound gets too
+* small to be useful.
+*/
+float DistanceField::estimate(const Vector3D & P, bool & exact) const
+{
+  exact = false;
+
+  if (CacheResolution > 0)
+  {
+    float g[3];
+    int b[3];
+    bool inGrid = true;
+
+    for (int a = 0; a < 3; a++)
+    {
+      g[a] = (P[a] - GridOrigin[a]) / Cell;
+      b[a] = (int) (g[a] / SDF_BRICK);
+      if ((g[a] < 0) || (b[a] >= Bricks[a])) inGrid = false;
+    }
+
+    if (inGrid)
+    {
+      int i = (b[2] * Bricks[1] + b[1]) * Bricks[0] + b[0];
+
+      if (BrickStart[i] < 0) return BrickBound[i];
+
+      const int Side = SDF_BRICK + 1;
+      const float * S = &Samples[BrickStart[i]];
+      int c[3];
+      float f[3];
+
+      for (int a = 0; a < 3; a++)
+      {
+        float l = g[a] - b[a] * SDF_BRICK;
+        c[a] = min((int) l, SDF_BRICK - 1);
+        f[a] = l - c[a];
+      }
+
+      const float * S0 = S + (c[2] * Side + c[1]) * Side + c[0];
+      const float * S1 = S0 + Side * Side;
+      float v00 = S0[0] + (S0[1] - S0[0]) * f[0];
+      float v10 = S0[Side] + (S0[Side + 1] - S0[Side]) * f[0];
+      float v01 = S1[0] + (S1[1] - S1[0]) * f[0];
+      float v11 = S1[Side] + (S1[Side + 1] - S1[Side]) * f[0];
+      float v0 = v00 + (v10 - v00) * f[1], v1 = v01 + (v11 - v01) * f[1];
+      float v = v0 + (v1 - v0) * f[2];
+
+      float slack = CellDiagonal / 2;
+      if (fabsf(v) > 2 * slack)
+        return (v > 0) ? v - slack : v + slack;
+    }
+  }
+
+  exact = true;
+  return Root->distance(P);
+}
+
+
+bool DistanceField::Intersect(const Ray & R, HitInfo & Hit) const
+{
+  float t0, t1;
+
+  if (!clip(Box, R, Hit.t, t0, t1)) return false;
+
+  float t = t0, tPrev = t0, prevR = 0, omega = SDF_RELAXATION, sign = 1;
+  unsigned long steps = 0, evaluations = 0, cached = 0;
+  bool found = false, exact;
+
+  for (int i = 0; (i < SDF_MAX_STEPS) && (t <= t1); i++)
+  {
+    float r = estimate(R.getPoint(t), exact);
+
+    steps++;
+    if (exact)
+      evaluations++;
+    else
+      cached++;
+
+    // A ray that starts inside, e.g. through glass, looks for the way out
+    if ((i == 0) && (r < 0)) sign = -1;
+    r *= sign;
+
+    // The spheres of the last two points leave a gap, or the surface was
+    // crossed: the relaxed step may have jumped over a part of the surface.
+    // Go back to where a plain step would have gone.
+    if ((i > 0) && (omega > 1) && ((r < 0) || (r + prevR < t - tPrev)))
+    {
+      t = tPrev + prevR;
+      omega = 1;
+      continue;
+    }
+
+    // The first point may lie on the surface the ray comes from
+    if ((i > 0) && (r < SDF_EPSILON))
+    {
+      found = true;
+      break;
+    }
+
+    tPrev = t;
+    prevR = r;
+    t += max(omega * r, SDF_EPSILON);
+  }
+
+  sphereTraceStats().record(steps, evaluations, cached);
+
+  if (!found || (t > t1) || (t <= 0)) return false;
+
+  Hit.t = t;
+  Hit.Obj = this;
+  Hit.LocalPoint = R.getPoint(t);
+  Hit.N = Normal(Hit.LocalPoint);
+  return true;
+}
+
+
+float DistanceField::Intersection(const Ray & R) const
+{
+  HitInfo Hit(R);
+
+  if (Intersect(R, Hit))
+    return Hit.t;
+  else
+    return NO_INTERSECTION;
+}
+
+
+/** The gradient from four evaluations at the corners of a tetrahedron. */
+const Vector3D DistanceField::Normal(const Vector3D & Point) const
+{
+  const float h = 5 * SDF_EPSILON;
+  const Vector3D K[4] = {Vector3D(1, -1, -1), Vector3D(-1, -1, 1),
+                         Vector3D(-1, 1, -1), Vector3D(1, 1, 1)};
+  Vector3D N;
+
+  for (int i = 0; i < 4; i++)
+    N += K[i] * Root->distance(Point + K[i] * h);
+
+  if (N.magn2() > 0) N.normalize();
+  return N;
+}
+
+
+bool DistanceField::contains(const Vector3D & Point) const
+{
+  return fabsf(Root->distance(Point)) < 0.001;
+}
+
+
+bool DistanceField::Bounds(BBox & Box_) const
+{
+  Box_ = Box;
+  return true;
+}
@@ -0,0 +1,289 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file sdf.hh Contains the DistanceField class, a surface given by a
+* signed distance function, and the nodes its function is built of.
+*/
+
+#ifndef SDF_HH
+#define SDF_HH
+
+#include <iostream>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/atomic.hpp>
+#include "sceneobject.hh"
+#include "csg.hh"
+
+using namespace std;
+
+
+/** Sphere tracing stops this close to the surface. */
+const float SDF_EPSILON = 2e-5;
+
+/** The most steps along a ray before giving up. */
+const int SDF_MAX_STEPS = 256;
+
+/** The over-relaxation of the steps: how far beyond the distance to the
+* surface each step goes, as long as that is safe.
+*/
+const float SDF_RELAXATION = 1.5;
+
+/** The brick cache keeps the distances of bricks of this many cells per
+* axis.
+*/
+const int SDF_BRICK = 8;
+
+
+/** A node of a distance function: a primitive, or an operator over
+* two nodes.
+*/
+class DistanceNode
+{
+public:
+
+  virtual ~DistanceNode() {}
+
+/** The signed distance of a point to the surface, negative inside. An
+* estimate for the smooth operators, which never overstates it by much.
+*/
+  virtual float distance(const Vector3D & P) const = 0;
+
+/** A box holding the inside, false if it is unbounded. */
+  virtual bool bounds(BBox & Box) const = 0;
+};
+
+typedef boost::shared_ptr<DistanceNode> SPDistanceNode;
+
+
+/** A ball. */
+class DistanceSphere : public DistanceNode
+{
+  Vector3D Center;
+  float Radius;
+
+public:
+  DistanceSphere(const Vector3D & Center_, float Radius_):
+    Center(Center_), Radius(Radius_) {}
+
+  virtual float distance(const Vector3D & P) const;
+  virtual bool bounds(BBox & Box) const;
+};
+
+
+/** An axis aligned box, its edges optionally rounded. */
+class DistanceBox : public DistanceNode
+{
+  Vector3D Center, Half;
+  float Rounding;
+
+public:
+/** The constructor.
+* @param Center_ The center.
+* @param Half_ Half the size along each axis, the rounding included.
+* @param Rounding_ The radius of the edges.
+*/
+  DistanceBox(const Vector3D & Center_, const Vector3D & Half_,
+              float Rounding_ = 0);
+
+  virtual float distance(const Vector3D & P) const;
+  virtual bool bounds(BBox & Box) const;
+};
+
+
+/** The points within a radius of a segment. */
+class DistanceCapsule : public DistanceNode
+{
+  Vector3D A, B;
+  float Radius;
+
+public:
+  DistanceCapsule(const Vector3D & A_, const Vector3D & B_, float Radius_):
+    A(A_), B(B_), Radius(Radius_) {}
+
+  virtual float distance(const Vector3D & P) const;
+  virtual bool bounds(BBox & Box) const;
+};
+
+
+/** A ring around the z axis. */
+class DistanceTorus : public DistanceNode
+{
+  Vector3D Center;
+  float Major, Minor;
+
+public:
+/** The constructor.
+* @param Center_ The center.
+* @param Major_ The radius of the ring.
+* @param Minor_ The radius of its cross section.
+*/
+  DistanceTorus(const Vector3D & Center_, float Major_, float Minor_):
+    Center(Center_), Major(Major_), Minor(Minor_) {}
+
+  virtual float distance(const Vector3D & P) const;
+  virtual bool bounds(BBox & Box) const;
+};
+
+
+/** The union, intersection or difference of two nodes. With a blend
+* radius the surfaces meet in a smooth fillet of about that size instead
+* of an edge.
+*/
+class DistanceCombine : public DistanceNode
+{
+  CSGOperation Op;
+  float Blend;
+  SPDistanceNode Left, Right;
+
+public:
+  DistanceCombine(CSGOperation Op_, float Blend_, SPDistanceNode Left_,
+                  SPDistanceNode Right_):
+    Op(Op_), Blend(Blend_), Left(Left_), Right(Right_) {}
+
+  virtual float distance(const Vector3D & P) const;
+  virtual bool bounds(BBox & Box) const;
+};
+
+
+/** Counts the sphere tracing steps of all distance fields. */
+class SphereTraceStats
+{
+private:
+
+/** The rays traced through a field, their steps, the largest number of
+* steps of a ray, and the evaluations of a distance function.
+*/
+  boost::atomic<unsigned long> Rays, Steps, MaxSteps, Evaluations;
+
+/** The steps that took their distance from a brick cache. */
+  boost::atomic<unsigned long> Cached;
+
+public:
+
+  SphereTraceStats(): Rays(0), Steps(0), MaxSteps(0), Evaluations(0),
+                      Cached(0) {}
+
+/** Adds the counts of one ray. */
+  void record(unsigned long steps, unsigned long evaluations,
+              unsigned long cached);
+
+/** The number of rays traced so far. */
+  unsigned long rays() const;
+
+/** Prints the counts. */
+  void report(ostream & out) const;
+};
+
+/** The counts shared by all distance fields. */
+SphereTraceStats & sphereTraceStats();
+
+
+/** A surface given by a signed distance function, rendered by sphere
+* tracing: a ray advances by the distance to the surface, which cannot
+* skip over it, until it is close enough. Only the part of the ray inside
+* the box of the function is traced. The steps are over-relaxed, going
+* further than the distance while the spheres of consecutive points keep
+* overlapping, and fall back to plain steps when they do not.
+*
+* An optional brick cache samples the function on a grid over the box
+* once, so that most steps read a distance instead of evaluating the
+* tree. Only the bricks near the surface keep their samples, the others
+* a single bound. The cached values are only used as lower bounds of the
+* distance, so steps stay safe, and the last steps near the surface and
+* the normals evaluate the function itself.
+*/
+class DistanceField : public SceneObject
+{
+private:
+
+/** The distance function. */
+  SPDistanceNode Root;
+
+/** The box the surface lies in, set by Finalize(). */
+  BBox Box;
+
+/** The cells of the brick cache along the longest side of the box, 0
+* for no cache.
+*/
+  int CacheResolution;
+
+/** The corner of the cache grid, its cell size and cell diagonal. */
+  Vector3D GridOrigin;
+  float Cell, CellDiagonal;
+
+/** The number of bricks along each axis. */
+  int Bricks[3];
+
+/** Per brick, where its samples start in Samples, or -1 for a brick
+* away from the surface.
+*/
+  vector<int> BrickStart;
+
+/** Per brick away from the surface, a signed lower bound of the
+* distance within it.
+*/
+  vector<float> BrickBound;
+
+/** The samples of the bricks near the surface, (SDF_BRICK + 1)^3 each. */
+  vector<float> Samples;
+
+/** Samples the function into the brick cache. */
+  void buildCache();
+
+/** The distance at a point, or a lower bound of it with the same sign.
+* @param exact Set if the function itself was evaluated.
+*/
+  float estimate(const Vector3D & P, bool & exact) const;
+
+public:
+
+/** The constructor.
+* @param Root_ The distance function.
+* @param Color_ The color of the surface.
+* @param reflectivity_ Its reflectivity.
+* @param CacheResolution_ The resolution of the brick cache, 0 for none.
+*/
+  DistanceField(SPDistanceNode Root_, const Color & Color_,
+                float reflectivity_ = 0, int CacheResolution_ = 0);
+
+  virtual ~DistanceField() {}
+
+  virtual float Intersection(const Ray & R) const;
+
+/** Sphere traces the ray within its interval and the box. */
+  virtual bool Intersect(const Ray & R, HitInfo & Hit) const;
+
+/** The gradient of the function. */
+  virtual const Vector3D Normal(const Vector3D & Point) const;
+
+  virtual bool contains(const Vector3D & Point) const;
+
+  virtual bool Bounds(BBox & Box_) const;
+
+/** Finds the box and builds the brick cache. Fails for an unbounded
+* function.
+*/
+  virtual bool Finalize();
+};
+
+//SDF_HH
+#endif
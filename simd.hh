@@ -0,0 +1,203 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file simd.hh A 4-lane float type used by Vector3D and Color.
+*
+* The implementation is picked at compile time: SSE2 on x86, NEON on
+* 64 bit ARM, and plain floats everywhere else or when RT_SCALAR_MATH is
+* defined. Defining RT_FAST_RSQRT makes normalization use the hardware
+* reciprocal square root estimate (refined by one Newton step) instead of
+* a square root and a division.
+*
+* All operations round exactly like the scalar code they replace (the dot
+* product adds x, y and z in that order), so the choice of implementation
+* does not change rendered images, except with RT_FAST_RSQRT.
+*/
+
+#ifndef SIMD_HH
+#define SIMD_HH
+
+#include <cmath>
+
+#if !defined(RT_SCALAR_MATH) && defined(__SSE2__)
+#define RT_SIMD_SSE
+#include <emmintrin.h>
+#elif !defined(RT_SCALAR_MATH) && defined(__ARM_NEON) && defined(__aarch64__)
+#define RT_SIMD_NEON
+#include <arm_neon.h>
+#else
+#define RT_SIMD_SCALAR
+#endif
+
+
+#if defined(RT_SIMD_SSE)
+
+/** Four floats in one register. */
+typedef __m128 simd4f;
+
+inline simd4f simd_set(float x, float y, float z, float w)
+{
+  return _mm_set_ps(w, z, y, x);
+}
+
+inline simd4f simd_splat(float f)
+{
+  return _mm_set1_ps(f);
+}
+
+inline simd4f simd_add(simd4f a, simd4f b) { return _mm_add_ps(a, b); }
+inline simd4f simd_sub(simd4f a, simd4f b) { return _mm_sub_ps(a, b); }
+inline simd4f simd_mul(simd4f a, simd4f b) { return _mm_mul_ps(a, b); }
+inline simd4f simd_div(simd4f a, simd4f b) { return _mm_div_ps(a, b); }
+
+/** x * x' + y * y' + z * z', added in that order. */
+inline float simd_dot3(simd4f a, simd4f b)
+{
+  simd4f m = _mm_mul_ps(a, b);
+  simd4f s = _mm_add_ss(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 1, 1, 1)));
+  s = _mm_add_ss(s, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 2, 2, 2)));
+  return _mm_cvtss_f32(s);
+}
+
+/** The cross product of the first three lanes. The fourth lane is 0. */
+inline simd4f simd_cross3(simd4f a, simd4f b)
+{
+  simd4f a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+  simd4f b_zxy = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 1, 0, 2));
+  simd4f a_zxy = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 1, 0, 2));
+  simd4f b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+  return _mm_sub_ps(_mm_mul_ps(a_yzx, b_zxy), _mm_mul_ps(a_zxy, b_yzx));
+}
+
+/** An approximation of 1 / sqrt(f), good to about 22 bits. */
+inline float simd_rsqrt(float f)
+{
+  float r = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(f)));
+  return r * (1.5f - 0.5f * f * r * r);
+}
+
+#elif defined(RT_SIMD_NEON)
+
+typedef float32x4_t simd4f;
+
+inline simd4f simd_set(float x, float y, float z, float w)
+{
+  float f[4] = {x, y, z, w};
+  return vld1q_f32(f);
+}
+
+inline simd4f simd_splat(float f)
+{
+  return vdupq_n_f32(f);
+}
+
+inline simd4f simd_add(simd4f a, simd4f b) { return vaddq_f32(a, b); }
+inline simd4f simd_sub(simd4f a, simd4f b) { return vsubq_f32(a, b); }
+inline simd4f simd_mul(simd4f a, simd4f b) { return vmulq_f32(a, b); }
+inline simd4f simd_div(simd4f a, simd4f b) { return vdivq_f32(a, b); }
+
+inline float simd_dot3(simd4f a, simd4f b)
+{
+  simd4f m = vmulq_f32(a, b);
+  return (vgetq_lane_f32(m, 0) + vgetq_lane_f32(m, 1)) + vgetq_lane_f32(m, 2);
+}
+
+/** Rotates the xyz lanes: (x, y, z, w) becomes (y, z, x, w). */
+inline simd4f neon_yzx(simd4f a)
+{
+  simd4f r = vextq_f32(a, a, 1);
+  r = vsetq_lane_f32(vgetq_lane_f32(a, 0), r, 2);
+  return vsetq_lane_f32(vgetq_lane_f32(a, 3), r, 3);
+}
+
+inline simd4f simd_cross3(simd4f a, simd4f b)
+{
+  simd4f a_yzx = neon_yzx(a), b_yzx = neon_yzx(b);
+  return vsubq_f32(vmulq_f32(a_yzx, neon_yzx(b_yzx)),
+                   vmulq_f32(neon_yzx(a_yzx), b_yzx));
+}
+
+inline float simd_rsqrt(float f)
+{
+  float r = vrsqrtes_f32(f);
+  return r * vrsqrtss_f32(f * r, r);
+}
+
+#else
+
+/** Four floats, handled one at a time. */
+struct simd4f
+{
+  float f[4];
+};
+
+inline simd4f simd_set(float x, float y, float z, float w)
+{
+  simd4f r;
+  r.f[0] = x;  r.f[1] = y;  r.f[2] = z;  r.f[3] = w;
+  return r;
+}
+
+inline simd4f simd_splat(float f)
+{
+  return simd_set(f, f, f, f);
+}
+
+inline simd4f simd_add(simd4f a, simd4f b)
+{
+  return simd_set(a.f[0] + b.f[0], a.f[1] + b.f[1], a.f[2] + b.f[2], a.f[3] + b.f[3]);
+}
+
+inline simd4f simd_sub(simd4f a, simd4f b)
+{
+  return simd_set(a.f[0] - b.f[0], a.f[1] - b.f[1], a.f[2] - b.f[2], a.f[3] - b.f[3]);
+}
+
+inline simd4f simd_mul(simd4f a, simd4f b)
+{
+  return simd_set(a.f[0] * b.f[0], a.f[1] * b.f[1], a.f[2] * b.f[2], a.f[3] * b.f[3]);
+}
+
+inline simd4f simd_div(simd4f a, simd4f b)
+{
+  return simd_set(a.f[0] / b.f[0], a.f[1] / b.f[1], a.f[2] / b.f[2], a.f[3] / b.f[3]);
+}
+
+inline float simd_dot3(simd4f a, simd4f b)
+{
+  return a.f[0] * b.f[0] + a.f[1] * b.f[1] + a.f[2] * b.f[2];
+}
+
+inline simd4f simd_cross3(simd4f a, simd4f b)
+{
+  return simd_set(a.f[1] * b.f[2] - a.f[2] * b.f[1],
+                  a.f[2] * b.f[0] - a.f[0] * b.f[2],
+                  a.f[0] * b.f[1] - a.f[1] * b.f[0], 0);
+}
+
+inline float simd_rsqrt(float f)
+{
+  return 1 / sqrt(f);
+}
+
+#endif
+
+#endif //SIMD_HH
@@ -0,0 +1,434 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file texture.cc Implementation of the image textures and their tile cache
+*/
+
+#include <fstream>
+#include <cmath>
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <boost/atomic.hpp>
+#include "framebuffer.hh"
+#include "texture.hh"
+
+
+/** The texels of a tile, and its size in the cache file. */
+const int TILE_TEXELS = (TEXTURE_TILE + 1) * (TEXTURE_TILE + 1);
+const size_t TILE_BYTES = 3 * sizeof(float) * TILE_TEXELS;
+
+
+/** Reads a binary (P6) or plain (P3) PNM image with up to 8 bit colors. */
+static bool readPPM(istream & in, FrameBuffer & Image)
+{
+  string magic;
+  int w, h, maxval;
+
+  in >> magic >> w >> h >> maxval;
+  if (!in || ((magic != "P6") && (magic != "P3")) || (w <= 0) || (h <= 0) ||
+      (maxval <= 0) || (maxval > 255))
+    return false;
+  in.get();    // The single whitespace after the header
+
+  Image.resize(w, h);
+  for (int y = 0; y < h; y++)
+  {
+    for (int x = 0; x < w; x++)
+    {
+      int rgb[3];
+
+      if (magic == "P6")
+        for (int c = 0; c < 3; c++) rgb[c] = (unsigned char) in.get();
+      else
+        in >> rgb[0] >> rgb[1] >> rgb[2];
+
+      Image.setPixel(x, y, Color(rgb[0] / (float) maxval,
+                                 rgb[1] / (float) maxval,
+                                 rgb[2] / (float) maxval));
+    }
+  }
+  return (bool) in;
+}
+
+
+/** Writes the mip pyramid of an image as a cache file.
+* The file is written under another name first and renamed at the end,
+* so that a half written file is never used.
+*/
+static bool makeMipFile(const string & Image, const string & Path)
+{
+  FrameBuffer Source;
+  ifstream in(Image.c_str(), ios::binary);
+  size_t dot = Image.rfind('.');
+  string Extension = (dot == string::npos) ? string() : Image.substr(dot);
+  bool ok = ((Extension == ".pfm") || (Extension == ".PFM")) ?
+            Source.readPFM(in) : readPPM(in, Source);
+
+  if (!ok)
+  {
+    cerr << "Cannot read the texture " << Image << " as PPM or PFM" << endl;
+    return false;
+  }
+
+  int w = Source.getWidth(), h = Source.getHeight(), Levels = 1;
+  vector<float> Texels(3 * (size_t) w * h), Tile(3 * TILE_TEXELS);
+
+  for (int y = 0; y < h; y++) Source.getRow(y, &Texels[3 * (size_t) y * w]);
+  Source.resize(0, 0);
+  for (int s = max(w, h); s > 1; s /= 2) Levels++;
+
+  string Temporary = Path + ".tmp";
+  ofstream out(Temporary.c_str(), ios::binary);
+  out << "MIPT\n" << w << " " << h << " " << Levels << " " << TEXTURE_TILE
+      << "\n";
+
+  for (int l = 0; l < Levels; l++)
+  {
+    // The extra row and column of a tile come from the next one, wrapping
+    for (int ty = 0; ty * TEXTURE_TILE < h; ty++)
+    {
+      for (int tx = 0; tx * TEXTURE_TILE < w; tx++)
+      {
+        for (int j = 0; j <= TEXTURE_TILE; j++)
+        {
+          int y = (ty * TEXTURE_TILE + j) % h;
+          for (int i = 0; i <= TEXTURE_TILE; i++)
+          {
+            int x = (tx * TEXTURE_TILE + i) % w;
+            for (int c = 0; c < 3; c++)
+              Tile[3 * (j * (TEXTURE_TILE + 1) + i) + c] =
+                Texels[3 * ((size_t) y * w + x) + c];
+          }
+        }
+        out.write((const char *) &Tile[0], TILE_BYTES);
+      }
+    }
+
+    // The next level averages 2x2 texels, odd edges are repeated
+    int w2 = max(1, w / 2), h2 = max(1, h / 2);
+    vector<float> Smaller(3 * (size_t) w2 * h2);
+
+    for (int y = 0; y < h2; y++)
+    {
+      int y0 = min(2 * y, h - 1), y1 = min(2 * y + 1, h - 1);
+      for (int x = 0; x < w2; x++)
+      {
+        int x0 = min(2 * x, w - 1), x1 = min(2 * x + 1, w - 1);
+        for (int c = 0; c < 3; c++)
+          Smaller[3 * ((size_t) y * w2 + x) + c] = 0.25f *
+            (Texels[3 * ((size_t) y0 * w + x0) + c] +
+             Texels[3 * ((size_t) y0 * w + x1) + c] +
+             Texels[3 * ((size_t) y1 * w + x0) + c] +
+             Texels[3 * ((size_t) y1 * w + x1) + c]);
+      }
+    }
+
+    Texels.swap(Smaller);
+    w = w2;
+    h = h2;
+  }
+
+  out.close();
+  if (!out || (rename(Temporary.c_str(), Path.c_str()) != 0))
+  {
+    cerr << "Cannot write the texture cache file " << Path << endl;
+    unlink(Temporary.c_str());
+    return false;
+  }
+  return true;
+}
+
+
+TextureCache::TextureCache(unsigned int MiB)
+{
+  resize(MiB);
+}
+
+
+void TextureCache::resize(unsigned int MiB)
+{
+  size_t Tiles = ((size_t) MiB << 20) / TILE_BYTES;
+  ShardTiles = max((size_t) 1, Tiles / TEXTURE_CACHE_SHARDS);
+
+  for (unsigned int i = 0; i < TEXTURE_CACHE_SHARDS; i++)
+  {
+    boost::mutex::scoped_lock Guard(Shards[i].Lock);
+    Shards[i].Recent.clear();
+    Shards[i].Index.clear();
+    Shards[i].Hits = Shards[i].Misses = 0;
+  }
+}
+
+
+TextureTile TextureCache::getTile(const ImageTexture & Tex, int Level,
+                                  int tx, int ty)
+{
+  unsigned long long Key = Tex.tileKey(Level, tx, ty);
+  Shard & S = Shards[((Key * 0x9e3779b97f4a7c15ull) >> 32) %
+                     TEXTURE_CACHE_SHARDS];
+
+  {
+    boost::mutex::scoped_lock Guard(S.Lock);
+    map<unsigned long long,
+        list<pair<unsigned long long, TextureTile> >::iterator>::iterator
+      Found = S.Index.find(Key);
+
+    if (Found != S.Index.end())
+    {
+      S.Hits++;
+      S.Recent.splice(S.Recent.begin(), S.Recent, Found->second);
+      return Found->second->second;
+    }
+    S.Misses++;
+  }
+
+  // Read without the lock, other threads may use the shard meanwhile
+  boost::shared_ptr<vector<float> > Tile(new vector<float>(3 * TILE_TEXELS));
+  if (!Tex.readTile(Level, tx, ty, &(*Tile)[0])) return TextureTile();
+
+  boost::mutex::scoped_lock Guard(S.Lock);
+  if (S.Index.count(Key)) return S.Index[Key]->second;
+
+  S.Recent.push_front(make_pair(Key, TextureTile(Tile)));
+  S.Index[Key] = S.Recent.begin();
+  while (S.Recent.size() > ShardTiles)
+  {
+    S.Index.erase(S.Recent.back().first);
+    S.Recent.pop_back();
+  }
+  return Tile;
+}
+
+
+unsigned long TextureCache::lookups() const
+{
+  unsigned long n = 0;
+
+  for (unsigned int i = 0; i < TEXTURE_CACHE_SHARDS; i++)
+  {
+    boost::mutex::scoped_lock Guard(Shards[i].Lock);
+    n += Shards[i].Hits + Shards[i].Misses;
+  }
+  return n;
+}
+
+
+void TextureCache::report(ostream & out) const
+{
+  unsigned long Hits = 0, Misses = 0;
+  size_t Cached = 0;
+
+  for (unsigned int i = 0; i < TEXTURE_CACHE_SHARDS; i++)
+  {
+    boost::mutex::scoped_lock Guard(Shards[i].Lock);
+    Hits += Shards[i].Hits;
+    Misses += Shards[i].Misses;
+    Cached += Shards[i].Recent.size();
+  }
+
+  out << "Texture cache: " << Hits + Misses << " lookups, "
+      << (Hits + Misses ? 100.0 * Hits / (Hits + Misses) : 0) << "% hits, "
+      << Misses << " tiles read, " << Cached << " of "
+      << ShardTiles * TEXTURE_CACHE_SHARDS << " tiles in use" << endl;
+}
+
+
+TextureCache & textureCache()
+{
+  static TextureCache Cache;
+  return Cache;
+}
+
+
+ImageTexture::ImageTexture()
+  : fd(-1), Id(0), Modified(0)
+{
+}
+
+
+ImageTexture::~ImageTexture()
+{
+  if (fd >= 0) close(fd);
+}
+
+
+bool ImageTexture::open(const string & Image)
+{
+  static boost::atomic<unsigned int> NextId(0);
+  struct stat Source, Cached;
+
+  if (stat(Image.c_str(), &Source) != 0)
+  {
+    cerr << "Cannot find the texture " << Image << endl;
+    return false;
+  }
+
+  Path = Image + ".mip";
+  if ((stat(Path.c_str(), &Cached) != 0) || (Cached.st_mtime < Source.st_mtime))
+  {
+    cout << "Making the texture cache file " << Path << endl;
+    if (!makeMipFile(Image, Path)) return false;
+  }
+
+  ifstream in(Path.c_str(), ios::binary);
+  string magic;
+  int w, h, n, Tile;
+
+  in >> magic >> w >> h >> n >> Tile;
+  if (!in || (magic != "MIPT") || (w <= 0) || (h <= 0) || (n <= 0) ||
+      (Tile != TEXTURE_TILE))
+  {
+    cerr << Path << " is not a texture cache file of this build" << endl;
+    return false;
+  }
+  in.get();    // The newline after the header
+
+  off_t Offset = in.tellg();
+  Levels.resize(n);
+  for (int l = 0; l < n; l++)
+  {
+    Level & L = Levels[l];
+    L.Width = max(1, w >> l);
+    L.Height = max(1, h >> l);
+    L.TilesX = (L.Width + TEXTURE_TILE - 1) / TEXTURE_TILE;
+    L.TilesY = (L.Height + TEXTURE_TILE - 1) / TEXTURE_TILE;
+    L.Offset = Offset;
+    Offset += (off_t) L.TilesX * L.TilesY * TILE_BYTES;
+  }
+
+  fd = ::open(Path.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    cerr << "Cannot open " << Path << endl;
+    return false;
+  }
+
+  Id = NextId++;
+  Modified = Source.st_mtime;
+  return true;
+}
+
+
+boost::shared_ptr<ImageTexture> ImageTexture::load(const string & Image)
+{
+  static boost::mutex Lock;
+  static map<string, boost::shared_ptr<ImageTexture> > Loaded;
+  boost::mutex::scoped_lock Guard(Lock);
+  struct stat Source;
+
+  map<string, boost::shared_ptr<ImageTexture> >::iterator Found =
+    Loaded.find(Image);
+  if ((Found != Loaded.end()) && (stat(Image.c_str(), &Source) == 0) &&
+      (Source.st_mtime == Found->second->Modified))
+    return Found->second;
+
+  boost::shared_ptr<ImageTexture> Texture(new ImageTexture);
+  if (!Texture->open(Image)) return boost::shared_ptr<ImageTexture>();
+
+  Loaded[Image] = Texture;
+  return Texture;
+}
+
+
+bool ImageTexture::readTile(int l, int tx, int ty, float * Texels) const
+{
+  const Level & L = Levels[l];
+  off_t Offset = L.Offset + ((off_t) ty * L.TilesX + tx) * TILE_BYTES;
+  char * Data = (char *) Texels;
+  size_t n = TILE_BYTES;
+
+  while (n > 0)
+  {
+    ssize_t k = pread(fd, Data, n, Offset);
+    if ((k < 0) && (errno == EINTR)) continue;
+    if (k <= 0) return false;
+
+    Data += k;
+    n -= k;
+    Offset += k;
+  }
+  return true;
+}
+
+
+unsigned long long ImageTexture::tileKey(int l, int tx, int ty) const
+{
+  return ((unsigned long long) Id << 48) | ((unsigned long long) l << 42) |
+         ((unsigned long long) ty << 21) | (unsigned long long) tx;
+}
+
+
+int ImageTexture::levels() const
+{
+  return Levels.size();
+}
+
+
+Color ImageTexture::bilinear(int l, float u, float v) const
+{
+  const Level & L = Levels[l];
+  float x = (u - floor(u)) * L.Width - 0.5f;
+  float y = (v - floor(v)) * L.Height - 0.5f;
+  int x0 = (int) floor(x), y0 = (int) floor(y);
+  float fx = x - x0, fy = y - y0;
+
+  // The texels left of the first column and above the first row wrap
+  if (x0 < 0) x0 += L.Width;
+  if (y0 < 0) y0 += L.Height;
+  if (x0 >= L.Width) x0 -= L.Width;
+  if (y0 >= L.Height) y0 -= L.Height;
+
+  TextureTile Tile = textureCache().getTile(*this, l, x0 / TEXTURE_TILE,
+                                            y0 / TEXTURE_TILE);
+  if (!Tile) return Color(0, 0, 0);
+
+  const float * Top = &(*Tile)[3 * ((y0 % TEXTURE_TILE) * (TEXTURE_TILE + 1) +
+                                    x0 % TEXTURE_TILE)];
+  const float * Bottom = Top + 3 * (TEXTURE_TILE + 1);
+  float rgb[3];
+
+  for (int c = 0; c < 3; c++)
+    rgb[c] = (1 - fy) * ((1 - fx) * Top[c] + fx * Top[c + 3]) +
+             fy * ((1 - fx) * Bottom[c] + fx * Bottom[c + 3]);
+  return Color(rgb[0], rgb[1], rgb[2]);
+}
+
+
+Color ImageTexture::lookup(float u, float v, float Footprint) const
+{
+  if (!isfinite(u) || !isfinite(v)) return Color(0, 0, 0);
+
+  // The level whose texels are as large as the footprint
+  float Texels = Footprint * max(Levels[0].Width, Levels[0].Height);
+  float Lod = (Texels > 1) ? log2(Texels) : 0;
+  int Last = Levels.size() - 1;
+
+  if (Lod >= Last) return bilinear(Last, u, v);
+
+  int l = (int) Lod;
+  float f = Lod - l;
+  Color C = bilinear(l, u, v);
+  if (f > 0) C = (1 - f) * C + f * bilinear(l + 1, u, v);
+  return C;
+}
@@ -0,0 +1,203 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file texture.hh Image textures, kept as tiled mip pyramids in cache
+* files and read through a bounded cache of tiles.
+*/
+
+#ifndef TEXTURE_HH
+#define TEXTURE_HH
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <ctime>
+#include <sys/types.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include "color.hh"
+
+using namespace std;
+
+
+/** The side of a texture tile, in texels. */
+const int TEXTURE_TILE = 32;
+
+/** The number of independently locked parts of the tile cache. */
+const unsigned int TEXTURE_CACHE_SHARDS = 16;
+
+/** The size of the tile cache by default, in MiB. */
+const unsigned int TEXTURE_CACHE_MB = 64;
+
+
+/** The texels of a tile, 3 floats each, row by row. A tile holds one
+* more row and column than TEXTURE_TILE, those of the next tile, so that
+* bilinear filtering never needs a second tile.
+*/
+typedef boost::shared_ptr<const vector<float> > TextureTile;
+
+
+class ImageTexture;
+
+
+/** A cache of texture tiles shared by all textures and render threads.
+* Its size is fixed; the least recently used tiles make room for new
+* ones. Tiles are spread over TEXTURE_CACHE_SHARDS shards by a hash of
+* their key, each with a lock and an LRU list of its own, so threads
+* rarely wait for each other. A tile taken out of the cache stays valid
+* for as long as it is held, even if the cache drops it meanwhile.
+*/
+class TextureCache
+{
+private:
+
+/** A part of the cache. */
+  struct Shard
+  {
+    mutable boost::mutex Lock;
+
+/** The tiles, the most recently used first, with their keys. */
+    list<pair<unsigned long long, TextureTile> > Recent;
+
+/** Where each key is in Recent. */
+    map<unsigned long long,
+        list<pair<unsigned long long, TextureTile> >::iterator> Index;
+
+/** The lookups found in the shard, and those that read the file. */
+    unsigned long Hits, Misses;
+
+    Shard(): Hits(0), Misses(0) {}
+  };
+
+  Shard Shards[TEXTURE_CACHE_SHARDS];
+
+/** The number of tiles each shard keeps. */
+  size_t ShardTiles;
+
+public:
+
+/** An empty cache.
+* @param MiB Its size.
+*/
+  TextureCache(unsigned int MiB = TEXTURE_CACHE_MB);
+
+/** Changes the size and empties the cache. Not while rendering. */
+  void resize(unsigned int MiB);
+
+/** Finds a tile, reading it from the texture file if it is not cached.
+* @return The tile, null if it could not be read.
+*/
+  TextureTile getTile(const ImageTexture & Tex, int Level, int tx, int ty);
+
+/** The number of lookups so far. */
+  unsigned long lookups() const;
+
+/** Writes the hit rate and the number of tiles read. */
+  void report(ostream & out) const;
+};
+
+
+/** The cache all textures read their tiles through. */
+TextureCache & textureCache();
+
+
+/** An image texture.
+* The image is converted once to a cache file, FILE.mip next to it, which
+* holds its mip pyramid cut into tiles, level after level and row of
+* tiles after row of tiles. Rendering only reads the tiles it needs, so
+* the textures of a scene may be far larger than the memory. The cache
+* file is made again when the image is newer.
+*
+* Texture coordinates repeat: u runs left to right and v top to bottom
+* over [0, 1). Lookups filter bilinearly between the two mip levels whose
+* texels are closest to the size of the footprint.
+*/
+class ImageTexture
+{
+private:
+
+/** One level of the pyramid. */
+  struct Level
+  {
+    int Width, Height, TilesX, TilesY;
+
+/** Where the first tile starts in the file. */
+    off_t Offset;
+  };
+
+/** The cache file. */
+  string Path;
+
+/** Its file descriptor, -1 if it is not open. */
+  int fd;
+
+/** Tells the tiles of different textures apart in the cache. */
+  unsigned int Id;
+
+/** When the image was changed, as of opening it. */
+  time_t Modified;
+
+/** The levels, the full image first. */
+  vector<Level> Levels;
+
+/** The texels of one level, with bilinear filtering. */
+  Color bilinear(int l, float u, float v) const;
+
+public:
+
+/** A texture with no image yet. */
+  ImageTexture();
+
+/** Opens the cache file of an image, PPM or PFM, making it if needed.
+* @return False, after saying why, if that failed.
+*/
+  bool open(const string & Image);
+
+/** Closes the cache file. */
+  ~ImageTexture();
+
+/** Opens a texture, or finds it if it was opened before and the image
+* has not changed since.
+* @return The texture, null if it could not be opened.
+*/
+  static boost::shared_ptr<ImageTexture> load(const string & Image);
+
+/** The color at some texture coordinates.
+* @param Footprint The size of the area seen, in texture coordinates.
+*/
+  Color lookup(float u, float v, float Footprint) const;
+
+/** Reads a tile from the file.
+* @param Texels Receives (TEXTURE_TILE + 1)^2 texels.
+* @return False if the file could not be read.
+*/
+  bool readTile(int l, int tx, int ty, float * Texels) const;
+
+/** The key of a tile in the cache. */
+  unsigned long long tileKey(int l, int tx, int ty) const;
+
+/** The number of mip levels. */
+  int levels() const;
+};
+
+#endif //TEXTURE_HH
@@ -0,0 +1,118 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file threadpool.cc Implementation of the ThreadPool class
+*/
+
+#include <cassert>
+#include "threadpool.hh"
+
+
+ThreadPool::ThreadPool(unsigned int Threads, const NumaTopology & Topology_,
+                       bool Pin_)
+  : Queues(Topology_.nodes()), Topology(Topology_), Pin(Pin_), Submitted(0),
+    Stopping(false)
+{
+  assert(Threads > 0);
+
+  for (unsigned int i = 0; i < Threads; i++)
+    Workers.create_thread(boost::bind(&ThreadPool::work, this,
+                                      i % Topology.nodes()));
+}
+
+
+ThreadPool::~ThreadPool()
+{
+  {
+    boost::mutex::scoped_lock Guard(Lock);
+    Stopping = true;
+  }
+  Ready.notify_all();
+  Workers.join_all();
+}
+
+
+void ThreadPool::submit(const boost::function<void ()> & Task, int Priority,
+                        int Node)
+{
+  assert((Node >= 0) && (Node < nodes()));
+
+  Entry E;
+  E.Priority = Priority;
+  E.Task = Task;
+
+  {
+    boost::mutex::scoped_lock Guard(Lock);
+    E.Sequence = Submitted++;
+    Queues[Node].push(E);
+  }
+  Ready.notify_one();
+}
+
+
+unsigned int ThreadPool::size() const
+{
+  return Workers.size();
+}
+
+
+int ThreadPool::nodes() const
+{
+  return Queues.size();
+}
+
+
+int ThreadPool::pickQueue(int Node) const
+{
+  if (!Queues[Node].empty()) return Node;
+
+  // Take the most urgent task of the other nodes
+  int Best = -1;
+  for (int n = 0; n < nodes(); n++)
+  {
+    if (Queues[n].empty()) continue;
+    if ((Best < 0) || (Queues[Best].top() < Queues[n].top())) Best = n;
+  }
+  return Best;
+}
+
+
+void ThreadPool::work(int Node)
+{
+  if (Pin) Topology.pinThread(Node);
+
+  while (true)
+  {
+    boost::function<void ()> Task;
+
+    {
+      boost::mutex::scoped_lock Guard(Lock);
+      int q;
+      while (((q = pickQueue(Node)) < 0) && !Stopping) Ready.wait(Guard);
+      if (q < 0) return;
+
+      Task = Queues[q].top().Task;
+      Queues[q].pop();
+    }
+
+    Task();
+  }
+}
@@ -0,0 +1,128 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file threadpool.hh The ThreadPool class, worker threads running tasks by
+* priority.
+*/
+
+#ifndef THREADPOOL_HH
+#define THREADPOOL_HH
+
+#include <queue>
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include "numa.hh"
+
+using namespace std;
+
+
+/** A fixed set of worker threads taking tasks from a shared queue.
+* Tasks with a higher priority run first, tasks of equal priority in the
+* order they were submitted. A running task is never interrupted.
+* Given a NUMA layout, the workers are dealt out to its nodes and every
+* node has a queue of its own. Workers run the tasks of their node first
+* and only take those of other nodes when it has none, so the priorities
+* hold within each node.
+*/
+class ThreadPool
+{
+private:
+
+/** A task waiting in the queue. */
+  struct Entry
+  {
+    int Priority;
+    unsigned long Sequence;
+    boost::function<void ()> Task;
+
+    /** The order of the queue: the top entry runs next. */
+    bool operator<(const Entry & Other) const
+    {
+      if (Priority != Other.Priority) return Priority < Other.Priority;
+      return Sequence > Other.Sequence;
+    }
+  };
+
+/** The waiting tasks of each node. */
+  vector<priority_queue<Entry> > Queues;
+
+/** The nodes of the workers. */
+  NumaTopology Topology;
+
+/** Whether the workers are pinned to the processors of their node. */
+  bool Pin;
+
+/** The number of tasks submitted so far. */
+  unsigned long Submitted;
+
+/** Set by the destructor to let the workers go. */
+  bool Stopping;
+
+/** Guards Queues, Submitted and Stopping. */
+  boost::mutex Lock;
+
+/** Signalled when a task is queued or the pool stops. */
+  boost::condition_variable Ready;
+
+/** The worker threads. */
+  boost::thread_group Workers;
+
+/** The loop of a worker thread.
+* @param Node The node of the worker.
+*/
+  void work(int Node);
+
+/** The queue a worker of a node takes its next task from, -1 if all are
+* empty. Lock must be held.
+*/
+  int pickQueue(int Node) const;
+
+public:
+
+/** Starts the workers.
+* @param Threads The number of workers, at least one.
+* @param Topology_ The nodes to deal the workers out to.
+* @param Pin_ Pin each worker to the processors of its node.
+*/
+  ThreadPool(unsigned int Threads,
+             const NumaTopology & Topology_ = NumaTopology(),
+             bool Pin_ = false);
+
+/** Runs the tasks still queued, then stops the workers. */
+  ~ThreadPool();
+
+/** Queues a task.
+* @param Task The task.
+* @param Priority Tasks with a higher priority run first.
+* @param Node The node whose workers should run it.
+*/
+  void submit(const boost::function<void ()> & Task, int Priority = 0,
+              int Node = 0);
+
+/** The number of worker threads. */
+  unsigned int size() const;
+
+/** The number of nodes the workers are dealt out to. */
+  int nodes() const;
+};
+
+#endif //THREADPOOL_HH
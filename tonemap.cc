@@ -0,0 +1,166 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file tonemap.cc Implementation of the ToneMapper class
+*/
+
+#include <cmath>
+#include <string>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "tonemap.hh"
+
+
+ToneMapper::ToneMapper()
+{
+  Exposure = 1;
+  Curve = TONE_CLAMP;
+  setGamma(1);
+}
+
+
+void ToneMapper::setGamma(float Gamma_)
+{
+  assert(Gamma_ > 0);
+  Gamma = Gamma_;
+  Lut.clear();
+
+  if (Gamma == 1) return;
+
+  Lut.resize(LUT_SIZE);
+  for (int i = 0; i < LUT_SIZE; i++)
+    Lut[i] = (unsigned char) ceil(pow(i / (float) (LUT_SIZE - 1), 1 / Gamma) * 255);
+}
+
+
+void ToneMapper::MapRow(const float * in, unsigned char * out, int n) const
+{
+  int i = 0;
+
+#ifdef __SSE2__
+  __m128 exposure = _mm_set1_ps(Exposure);
+  __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1);
+  __m128 scale = _mm_set1_ps(Lut.empty() ? 255 : LUT_SIZE - 1);
+  int values[4];
+
+  for (; i + 4 <= n; i += 4)
+  {
+    __m128 v = _mm_mul_ps(_mm_loadu_ps(in + i), exposure);
+    if (Curve == TONE_REINHARD) v = _mm_div_ps(v, _mm_add_ps(one, v));
+    v = _mm_mul_ps(_mm_min_ps(_mm_max_ps(v, zero), one), scale);
+
+    __m128i q;
+    if (Lut.empty())
+    {
+      // ceil(v) as the truncation plus one where something was cut off
+      q = _mm_cvttps_epi32(v);
+      __m128 cut = _mm_cmplt_ps(_mm_cvtepi32_ps(q), v);
+      q = _mm_sub_epi32(q, _mm_castps_si128(cut));
+    }
+    else
+      q = _mm_cvtps_epi32(v);
+
+    _mm_storeu_si128((__m128i *) values, q);
+    for (int k = 0; k < 4; k++)
+      out[i + k] = Lut.empty() ? values[k] : Lut[values[k]];
+  }
+#endif
+
+  for (; i < n; i++)
+  {
+    float v = in[i] * Exposure;
+    if (Curve == TONE_REINHARD) v = v / (1 + v);
+    v = (v < 0) ? 0 : ((v > 1) ? 1 : v);
+
+    if (Lut.empty())
+      out[i] = (unsigned char) ceil(v * 255);
+    else
+      out[i] = Lut[(int) (v * (LUT_SIZE - 1) + 0.5f)];
+  }
+}
+
+
+void ToneMapper::Map(const FrameBuffer & Frame, vector<unsigned char> & Out) const
+{
+  int w = Frame.getWidth(), h = Frame.getHeight();
+  vector<float> Row(3 * w);
+
+  Out.resize(3 * (size_t) w * h);
+
+  for (int y = 0; y < h; y++)
+  {
+    Frame.getRow(y, &Row[0]);
+    MapRow(&Row[0], &Out[3 * (size_t) y * w], 3 * w);
+  }
+}
+
+
+void ToneMapper::writePPM(const FrameBuffer & Frame, ostream & out,
+                          bool ascii) const
+{
+  int w = Frame.getWidth(), h = Frame.getHeight();
+  vector<float> Row(3 * w);
+  vector<unsigned char> Bytes(3 * w);
+  short int k = 0;
+
+  if (!ascii)
+    out << "P6\n" << w << " " << h << "\n255\n";
+  else
+    out << "P3 " << w << " " << h << " " << 255 << endl;
+
+  for (int y = 0; y < h; y++)
+  {
+    Frame.getRow(y, &Row[0]);
+    MapRow(&Row[0], &Bytes[0], 3 * w);
+
+    if (!ascii)
+    {
+      out.write((const char *) &Bytes[0], Bytes.size());
+      continue;
+    }
+
+    for (int x = 0; x < w; x++)
+    {
+      //Output 4 pixels per line
+      if (k == 4)
+      {
+       out << endl;
+       k = 0;
+      }
+      k++;
+
+      out << (int) Bytes[3 * x] << " "
+          << (int) Bytes[3 * x + 1] << " "
+          << (int) Bytes[3 * x + 2] << " ";
+    }
+  }
+}
+
+
+bool parseToneCurve(const string & Name, ToneCurve & Curve)
+{
+  if (Name == "clamp") Curve = TONE_CLAMP;
+  else if (Name == "reinhard") Curve = TONE_REINHARD;
+  else return false;
+
+  return true;
+}
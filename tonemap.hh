@@ -0,0 +1,116 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file tonemap.hh The ToneMapper class, turning HDR images into 8 bit ones.
+*/
+
+#ifndef TONEMAP_HH
+#define TONEMAP_HH
+
+#include <iostream>
+#include <vector>
+#include "framebuffer.hh"
+
+using namespace std;
+
+/** The curves mapping scene radiance to display values. */
+enum ToneCurve
+{
+/** Values over 1 are clipped. */
+  TONE_CLAMP,
+/** x / (1 + x), compresses highlights instead of clipping them. */
+  TONE_REINHARD
+};
+
+
+/** Converts a FrameBuffer to 8 bits per channel.
+* The pipeline is: scale by Exposure, apply the curve, clamp to [0,1],
+* apply the gamma and quantize. With the defaults (exposure 1, gamma 1,
+* clamping) the result is ceil(min(x, 1) * 255), as the renderer has always
+* produced.
+*/
+class ToneMapper
+{
+public:
+
+/** The factor applied to every channel first. */
+  float Exposure;
+
+/** The tone curve. */
+  ToneCurve Curve;
+
+/** The default constructor. Sets up the classic clamping. */
+  ToneMapper();
+
+/** Sets the display gamma. 1 leaves the values linear. */
+  void setGamma(float Gamma_);
+
+/** The display gamma. */
+  float getGamma() const;
+
+/** Maps n channel values.
+* @param in The linear values.
+* @param out Receives the 8 bit values.
+* @param n The number of values.
+*/
+  void MapRow(const float * in, unsigned char * out, int n) const;
+
+/** Maps a whole image.
+* @param Frame The image.
+* @param Out Receives 3 bytes per pixel, row by row.
+*/
+  void Map(const FrameBuffer & Frame, vector<unsigned char> & Out) const;
+
+/** Maps an image and writes it as a PNM file.
+* @param Frame The image.
+* @param out The stream.
+* @param ascii True for the plain (P3) format, false for the binary one (P6).
+*/
+  void writePPM(const FrameBuffer & Frame, ostream & out,
+                bool ascii = true) const;
+
+private:
+
+/** The size of the gamma lookup table. */
+  static const int LUT_SIZE = 4096;
+
+/** The display gamma. */
+  float Gamma;
+
+/** The gamma lookup table, indexed by the clamped value times LUT_SIZE-1.
+* Empty when the gamma is 1.
+*/
+  vector<unsigned char> Lut;
+};
+
+
+inline float ToneMapper::getGamma() const
+{
+  return Gamma;
+}
+
+
+/** Parses the name of a tone curve ("clamp" or "reinhard").
+* @return False if the name is unknown.
+*/
+bool parseToneCurve(const string & Name, ToneCurve & Curve);
+
+#endif //TONEMAP_HH
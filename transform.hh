@@ -0,0 +1,474 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file transform.hh The Transform class, an affine transformation of space.
+*/
+
+#ifndef TRANSFORM_HH
+#define TRANSFORM_HH
+
+#include <cmath>
+#include <algorithm>
+#include "vector.hh"
+#include "bbox.hh"
+
+/** An affine transformation, stored together with its inverse.
+* Points are transformed as M * p + T, where M is the 3x3 part of the
+* matrix and T the translation (the fourth column).
+*/
+class Transform
+{
+  friend class Keyframe;
+
+private:
+
+/** The matrix of the transformation, 3 rows of 4 columns. */
+  float m[3][4];
+
+/** The matrix of the inverse transformation. */
+  float inv[3][4];
+
+/** Applies a 3x4 matrix to a point or, with w = 0, to a direction. */
+  static const Vector3D apply(const float a[3][4], const Vector3D & V, float w);
+
+/** Multiplies two 3x4 matrices (the implicit fourth row is 0 0 0 1). */
+  static void multiply(const float a[3][4], const float b[3][4], float r[3][4]);
+
+/** Inverts a 3x4 matrix by its cofactors. The matrix must not be singular. */
+  static void invert(const float a[3][4], float r[3][4]);
+
+public:
+
+/** The default constructor. Builds the identity. */
+  Transform();
+
+/** A translation by a vector. */
+  static const Transform translate(const Vector3D & Offset);
+
+/** A scaling along the axes. All factors must be non-zero. */
+  static const Transform scale(const Vector3D & Factors);
+
+/** A rotation around one of the axes.
+* @param axis 0, 1 or 2 for x, y and z.
+* @param degrees The angle, counter clockwise when looking down the axis.
+*/
+  static const Transform rotate(int axis, float degrees);
+
+/** The composition: (A * B)(p) == A(B(p)). */
+  const Transform operator*(const Transform & Other) const;
+
+/** The inverse transformation. */
+  const Transform inverse() const;
+
+/** True if the transformation mirrors space, its determinant is negative. */
+  bool mirrors() const;
+
+/** Transforms a position vector. */
+  const Vector3D point(const Vector3D & P) const;
+
+/** Transforms a direction vector (ignores the translation). */
+  const Vector3D vector(const Vector3D & V) const;
+
+/** Transforms a surface normal (with the inverse transpose). */
+  const Vector3D normal(const Vector3D & N) const;
+
+/** Transforms a position vector with the inverse transformation. */
+  const Vector3D inversePoint(const Vector3D & P) const;
+
+/** Transforms a direction vector with the inverse transformation. */
+  const Vector3D inverseVector(const Vector3D & V) const;
+
+/** The bounding box of a transformed box. */
+  const BBox box(const BBox & B) const;
+};
+
+
+inline Transform::Transform()
+{
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 4; j++)
+      m[i][j] = inv[i][j] = (i == j) ? 1 : 0;
+}
+
+inline const Vector3D Transform::apply(const float a[3][4],
+                                       const Vector3D & V, float w)
+{
+  return Vector3D(a[0][0] * V[0] + a[0][1] * V[1] + a[0][2] * V[2] + a[0][3] * w,
+                  a[1][0] * V[0] + a[1][1] * V[1] + a[1][2] * V[2] + a[1][3] * w,
+                  a[2][0] * V[0] + a[2][1] * V[1] + a[2][2] * V[2] + a[2][3] * w);
+}
+
+inline void Transform::multiply(const float a[3][4], const float b[3][4],
+                                float r[3][4])
+{
+  for (int i = 0; i < 3; i++)
+  {
+    for (int j = 0; j < 4; j++)
+      r[i][j] = a[i][0] * b[0][j] + a[i][1] * b[1][j] + a[i][2] * b[2][j];
+    r[i][3] += a[i][3];
+  }
+}
+
+inline void Transform::invert(const float a[3][4], float r[3][4])
+{
+  // The inverse of the 3x3 part is its adjugate over the determinant
+  for (int i = 0; i < 3; i++)
+  {
+    int i1 = (i + 1) % 3, i2 = (i + 2) % 3;
+    for (int j = 0; j < 3; j++)
+    {
+      int j1 = (j + 1) % 3, j2 = (j + 2) % 3;
+      r[j][i] = a[i1][j1] * a[i2][j2] - a[i1][j2] * a[i2][j1];
+    }
+  }
+
+  float det = a[0][0] * r[0][0] + a[0][1] * r[1][0] + a[0][2] * r[2][0];
+  assert(det != 0);
+
+  for (int i = 0; i < 3; i++)
+  {
+    for (int j = 0; j < 3; j++) r[i][j] /= det;
+    r[i][3] = 0;
+  }
+
+  // Then undo the translation: p = M^-1 (q - T)
+  for (int i = 0; i < 3; i++)
+    r[i][3] = -(r[i][0] * a[0][3] + r[i][1] * a[1][3] + r[i][2] * a[2][3]);
+}
+
+inline const Transform Transform::translate(const Vector3D & Offset)
+{
+  Transform T;
+  for (int i = 0; i < 3; i++)
+  {
+    T.m[i][3] = Offset[i];
+    T.inv[i][3] = -Offset[i];
+  }
+  return T;
+}
+
+inline const Transform Transform::scale(const Vector3D & Factors)
+{
+  Transform T;
+  for (int i = 0; i < 3; i++)
+  {
+    assert(Factors[i] != 0);
+    T.m[i][i] = Factors[i];
+    T.inv[i][i] = 1 / Factors[i];
+  }
+  return T;
+}
+
+inline const Transform Transform::rotate(int axis, float degrees)
+{
+  assert((axis >= 0) && (axis < 3));
+
+  Transform T;
+  float c = cos(degrees * M_PI / 180), s = sin(degrees * M_PI / 180);
+  int a = (axis + 1) % 3, b = (axis + 2) % 3;
+
+  T.m[a][a] = c;   T.m[a][b] = -s;
+  T.m[b][a] = s;   T.m[b][b] = c;
+
+  // The inverse of a rotation is its transpose
+  T.inv[a][a] = c;   T.inv[a][b] = s;
+  T.inv[b][a] = -s;  T.inv[b][b] = c;
+
+  return T;
+}
+
+inline const Transform Transform::operator*(const Transform & Other) const
+{
+  Transform T;
+  multiply(m, Other.m, T.m);
+  multiply(Other.inv, inv, T.inv);
+  return T;
+}
+
+inline const Transform Transform::inverse() const
+{
+  Transform T;
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 4; j++)
+    {
+      T.m[i][j] = inv[i][j];
+      T.inv[i][j] = m[i][j];
+    }
+  return T;
+}
+
+inline bool Transform::mirrors() const
+{
+  return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+         m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+         m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]) < 0;
+}
+
+inline const Vector3D Transform::point(const Vector3D & P) const
+{
+  return apply(m, P, 1);
+}
+
+inline const Vector3D Transform::vector(const Vector3D & V) const
+{
+  return apply(m, V, 0);
+}
+
+inline const Vector3D Transform::normal(const Vector3D & N) const
+{
+  // Multiply by the transpose of the inverse
+  return Vector3D(inv[0][0] * N[0] + inv[1][0] * N[1] + inv[2][0] * N[2],
+                  inv[0][1] * N[0] + inv[1][1] * N[1] + inv[2][1] * N[2],
+                  inv[0][2] * N[0] + inv[1][2] * N[1] + inv[2][2] * N[2]);
+}
+
+inline const Vector3D Transform::inversePoint(const Vector3D & P) const
+{
+  return apply(inv, P, 1);
+}
+
+inline const Vector3D Transform::inverseVector(const Vector3D & V) const
+{
+  return apply(inv, V, 0);
+}
+
+inline const BBox Transform::box(const BBox & B) const
+{
+  BBox Result;
+  if (B.empty()) return Result;
+
+  for (int corner = 0; corner < 8; corner++)
+    Result.extend(point(Vector3D((corner & 1) ? B.Max[0] : B.Min[0],
+                                 (corner & 2) ? B.Max[1] : B.Min[1],
+                                 (corner & 4) ? B.Max[2] : B.Min[2])));
+  return Result;
+}
+
+
+
+/** A transformation taken apart for blending keyframes: M = T * R * S, a
+* translation T, a rotation R and a symmetric scaling S, which also holds
+* any stretching along other than the axes of R and any mirroring. Two
+* keyframes are blended part by part, T and S linearly and R at a steady
+* pace along the shortest arc, so objects keep their shape while they
+* turn. The blend is never singular as long as both keyframes mirror or
+* neither does.
+*/
+class Keyframe
+{
+private:
+
+/** The translation. */
+  Vector3D Translation;
+
+/** The rotation, a unit quaternion: x, y, z and w. */
+  double Rotation[4];
+
+/** The scaling, positive definite, or negative definite if the
+* transformation mirrors.
+*/
+  double Scale[3][3];
+
+/** An uninitialized keyframe, filled by interpolate(). */
+  Keyframe() {}
+
+public:
+
+/** Takes a transformation apart. It must not be singular. */
+  explicit Keyframe(const Transform & T);
+
+/** The transformation put together again. */
+  const Transform transform() const;
+
+/** The blend of two keyframes, A for s = 0 and B for s = 1. Both must
+* mirror or neither.
+*/
+  static const Keyframe interpolate(const Keyframe & A, const Keyframe & B,
+                                    float s);
+
+/** The angle the rotation turns by from A to B, 0 to pi radians. */
+  static float angle(const Keyframe & A, const Keyframe & B);
+
+/** Applies the scaling alone to a vector. */
+  const Vector3D scale(const Vector3D & V) const;
+};
+
+
+inline Keyframe::Keyframe(const Transform & T)
+{
+  double R[3][3];
+
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 3; j++) R[i][j] = T.m[i][j];
+  Translation = Vector3D(T.m[0][3], T.m[1][3], T.m[2][3]);
+
+  // The rotation of the polar decomposition is the limit of averaging the
+  // matrix with its inverse transpose, which is its cofactor matrix over
+  // the determinant
+  for (int k = 0; k < 100; k++)
+  {
+    double C[3][3], det, change = 0;
+
+    for (int i = 0; i < 3; i++)
+    {
+      int i1 = (i + 1) % 3, i2 = (i + 2) % 3;
+      for (int j = 0; j < 3; j++)
+      {
+        int j1 = (j + 1) % 3, j2 = (j + 2) % 3;
+        C[i][j] = R[i1][j1] * R[i2][j2] - R[i1][j2] * R[i2][j1];
+      }
+    }
+
+    det = R[0][0] * C[0][0] + R[0][1] * C[0][1] + R[0][2] * C[0][2];
+    assert(det != 0);
+
+    for (int i = 0; i < 3; i++)
+      for (int j = 0; j < 3; j++)
+      {
+        double next = 0.5 * (R[i][j] + C[i][j] / det);
+        change = max(change, fabs(next - R[i][j]));
+        R[i][j] = next;
+      }
+
+    if (change < 1e-12) break;
+  }
+
+  // A mirroring goes to the scaling, R must be a rotation
+  if (T.mirrors())
+    for (int i = 0; i < 3; i++)
+      for (int j = 0; j < 3; j++) R[i][j] = -R[i][j];
+
+  // S = R^T M, symmetric up to rounding
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 3; j++)
+      Scale[i][j] = R[0][i] * T.m[0][j] + R[1][i] * T.m[1][j] +
+                    R[2][i] * T.m[2][j];
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < i; j++)
+      Scale[i][j] = Scale[j][i] = 0.5 * (Scale[i][j] + Scale[j][i]);
+
+  // The quaternion of R, from its largest component
+  double trace = R[0][0] + R[1][1] + R[2][2];
+  if (trace > 0)
+  {
+    double r = sqrt(1 + trace), f = 0.5 / r;
+    Rotation[3] = 0.5 * r;
+    Rotation[0] = (R[2][1] - R[1][2]) * f;
+    Rotation[1] = (R[0][2] - R[2][0]) * f;
+    Rotation[2] = (R[1][0] - R[0][1]) * f;
+  }
+  else
+  {
+    int i = 0;
+    if (R[1][1] > R[i][i]) i = 1;
+    if (R[2][2] > R[i][i]) i = 2;
+
+    int j = (i + 1) % 3, k = (i + 2) % 3;
+    double r = sqrt(1 + R[i][i] - R[j][j] - R[k][k]), f = 0.5 / r;
+    Rotation[i] = 0.5 * r;
+    Rotation[3] = (R[k][j] - R[j][k]) * f;
+    Rotation[j] = (R[j][i] + R[i][j]) * f;
+    Rotation[k] = (R[k][i] + R[i][k]) * f;
+  }
+}
+
+inline const Transform Keyframe::transform() const
+{
+  const double * q = Rotation;
+  double R[3][3] =
+  {
+    { 1 - 2 * (q[1] * q[1] + q[2] * q[2]), 2 * (q[0] * q[1] - q[3] * q[2]),
+      2 * (q[0] * q[2] + q[3] * q[1]) },
+    { 2 * (q[0] * q[1] + q[3] * q[2]), 1 - 2 * (q[0] * q[0] + q[2] * q[2]),
+      2 * (q[1] * q[2] - q[3] * q[0]) },
+    { 2 * (q[0] * q[2] - q[3] * q[1]), 2 * (q[1] * q[2] + q[3] * q[0]),
+      1 - 2 * (q[0] * q[0] + q[1] * q[1]) }
+  };
+
+  Transform T;
+  for (int i = 0; i < 3; i++)
+  {
+    for (int j = 0; j < 3; j++)
+      T.m[i][j] = R[i][0] * Scale[0][j] + R[i][1] * Scale[1][j] +
+                  R[i][2] * Scale[2][j];
+    T.m[i][3] = Translation[i];
+  }
+  Transform::invert(T.m, T.inv);
+  return T;
+}
+
+inline const Keyframe Keyframe::interpolate(const Keyframe & A,
+                                            const Keyframe & B, float s)
+{
+  Keyframe K;
+
+  K.Translation = A.Translation + s * (B.Translation - A.Translation);
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 3; j++)
+      K.Scale[i][j] = A.Scale[i][j] + s * (B.Scale[i][j] - A.Scale[i][j]);
+
+  // q and -q are the same rotation, the one closer to A takes the short way
+  double d = 0, sign = 1, a, b;
+  for (int i = 0; i < 4; i++) d += A.Rotation[i] * B.Rotation[i];
+  if (d < 0)
+  {
+    d = -d;
+    sign = -1;
+  }
+
+  if (d > 1 - 1e-9)
+  {
+    a = 1 - s;
+    b = s;
+  }
+  else
+  {
+    double theta = acos(d);
+    a = sin((1 - s) * theta) / sin(theta);
+    b = sin(s * theta) / sin(theta);
+  }
+
+  double n = 0;
+  for (int i = 0; i < 4; i++)
+  {
+    K.Rotation[i] = a * A.Rotation[i] + sign * b * B.Rotation[i];
+    n += K.Rotation[i] * K.Rotation[i];
+  }
+  for (int i = 0; i < 4; i++) K.Rotation[i] /= sqrt(n);
+
+  return K;
+}
+
+inline float Keyframe::angle(const Keyframe & A, const Keyframe & B)
+{
+  double d = 0;
+  for (int i = 0; i < 4; i++) d += A.Rotation[i] * B.Rotation[i];
+  return 2 * acos(min(fabs(d), 1.0));
+}
+
+inline const Vector3D Keyframe::scale(const Vector3D & V) const
+{
+  return Vector3D(Scale[0][0] * V[0] + Scale[0][1] * V[1] + Scale[0][2] * V[2],
+                  Scale[1][0] * V[0] + Scale[1][1] * V[1] + Scale[1][2] * V[2],
+                  Scale[2][0] * V[0] + Scale[2][1] * V[1] + Scale[2][2] * V[2]);
+}
+
+#endif //TRANSFORM_HH
@@ -10,6 +10,7 @@
 #include <iostream>
 #include <cassert>
 #include <cmath>
+#include "simd.hh"
 
 using namespace std;
 
@@ -27,6 +28,10 @@ typedef unsigned int uint;
 * (1, 0, 0), (0, 1, 0) and (0, 0, 1).
 * The class lacks a desctructor because it makes no use of dynamically 
 * allocated objects.
+*
+* The components are kept in a 16 byte aligned register of four floats
+* (the fourth is always 0) so that the arithmetic maps to SIMD
+* instructions. See simd.hh.
 */
 
 
@@ -42,9 +47,19 @@ class Vector3D
   * vec[0] == x
   * vec[1] == y
   * vec[2] == z
+  * vec[3] == 0, padding so that the vector fills a SIMD register
   */
-  
-  float vec[3];
+  union
+  {
+    float vec[4];
+    simd4f v;
+  };
+
+  /** Builds a vector straight from a register. */
+  explicit Vector3D(simd4f v_);
+
+  friend const float dot(const Vector3D &V1, const Vector3D &V2);
+  friend const Vector3D cross(const Vector3D &Left, const Vector3D &Right);
   
  public:
  
@@ -128,25 +143,24 @@ class Vector3D
 //Default constructor
 inline Vector3D::Vector3D()
 {
-  vec[0] = 0;
-  vec[1] = 0;
-  vec[2] = 0;
+  v = simd_splat(0);
 }  
  
 // Constructor with initialization componentwise 
 inline Vector3D::Vector3D(float x, float y, float z)
 {
-  vec[0] = x;
-  vec[1] = y;
-  vec[2] = z;
+  v = simd_set(x, y, z, 0);
 }
   
 
 inline Vector3D::Vector3D(float * vec_)
 {
-  vec[0] = vec_[0];
-  vec[1] = vec_[1];
-  vec[2] = vec_[2];
+  v = simd_set(vec_[0], vec_[1], vec_[2], 0);
+}
+
+inline Vector3D::Vector3D(simd4f v_)
+{
+  v = v_;
 }
 
 // [] operator overload, used on the RIGHT HAND SIDE,  
@@ -168,18 +182,14 @@ inline float & Vector3D::operator[](uint index)
   
 inline Vector3D & Vector3D::operator+=(const Vector3D & Other)
 {
-  vec[0] += Other[0];
-  vec[1] += Other[1];
-  vec[2] += Other[2];
+  v = simd_add(v, Other.v);
   
   return *this;
 }
      
 inline Vector3D & Vector3D::operator-=(const Vector3D & Other)
 {
-  vec[0] -= Other[0];
-  vec[1] -= Other[1];
-  vec[2] -= Other[2];
+  v = simd_sub(v, Other.v);
   
   return *this;
 }
@@ -187,9 +197,7 @@ inline Vector3D & Vector3D::operator-=(const Vector3D & Other)
 
 inline Vector3D & Vector3D::operator*=(const float scalar)
 {
-  vec[0] *= scalar;
-  vec[1] *= scalar;
-  vec[2] *= scalar;
+  v = simd_mul(v, simd_splat(scalar));
   
   return *this; 
 }
@@ -200,9 +208,7 @@ inline Vector3D & Vector3D::operator/=(const float scalar)
 {
   assert(scalar != 0);
    
-  vec[0] /= scalar;
-  vec[1] /= scalar;
-  vec[2] /= scalar;
+  v = simd_div(v, simd_splat(scalar));
   
   return *this; 
 } 
@@ -277,7 +283,7 @@ inline const Vector3D operator/(const Vector3D & RHS, const float scalar)
 */
 inline const float dot(const Vector3D &V1, const Vector3D &V2)
 {
-  return V1[0] * V2[0] + V1[1] * V2[1] + V1[2] * V2[2];
+  return simd_dot3(V1.v, V2.v);
 }
 
 //Vector cross product
@@ -292,11 +298,7 @@ inline const float dot(const Vector3D &V1, const Vector3D &V2)
 */
 inline const Vector3D cross(const Vector3D &Left, const Vector3D &Right)
 {
-  Vector3D NewVector;
-  NewVector[0] = Left[1] * Right[2] - Left[2] * Right[1];
-  NewVector[1] = Left[2] * Right[0] - Left[0] * Right[2];
-  NewVector[2] = Left[0] * Right[1] - Left[1] * Right[0];
-  return NewVector;
+  return Vector3D(simd_cross3(Left.v, Right.v));
 }
 
 inline const Vector3D project(const Vector3D & Left, const Vector3D & Right)
@@ -320,11 +322,11 @@ inline const float Vector3D::magn() const
 // Normalizes the vector
 inline void Vector3D::normalize()
 {
-  float magnitude = magn();
-
-  vec[0] /= magnitude;
-  vec[1] /= magnitude;
-  vec[2] /= magnitude;  
+#ifdef RT_FAST_RSQRT
+  v = simd_mul(v, simd_splat(simd_rsqrt(magn2())));
+#else
+  v = simd_div(v, simd_splat(magn()));
+#endif
 }
 
 // Left shift operator for output to streams  
@@ -0,0 +1,386 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file watch.cc Implementation of the SceneWatcher class
+*/
+
+#include <fstream>
+#include <map>
+#include <cmath>
+#include <ctime>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include "watch.hh"
+#include "parser.hh"
+#include "bbox.hh"
+
+
+/** True if two vectors are exactly the same. */
+static bool sameVector(const Vector3D & a, const Vector3D & b)
+{
+  return (a[0] == b[0]) && (a[1] == b[1]) && (a[2] == b[2]);
+}
+
+/** True if two colors are exactly the same. */
+static bool sameColor(const Color & a, const Color & b)
+{
+  return (a.get_red() == b.get_red()) && (a.get_green() == b.get_green()) &&
+         (a.get_blue() == b.get_blue());
+}
+
+/** True if two cameras produce the same rays. */
+static bool sameCamera(const Camera & a, const Camera & b)
+{
+  return sameVector(a.Pos, b.Pos) && sameVector(a.Dir, b.Dir) &&
+         sameVector(a.Up, b.Up) && sameVector(a.Right, b.Right) &&
+         (a.Dist == b.Dist);
+}
+
+/** True if two scenes have the same lights, in the same order. */
+static bool sameLights(const Scene & a, const Scene & b)
+{
+  if (a.Lights.size() != b.Lights.size()) return false;
+
+  for (unsigned int i = 0; i < a.Lights.size(); i++)
+  {
+    if (!sameVector(a.Lights[i]->getPosition(), b.Lights[i]->getPosition()) ||
+        !sameColor(a.Lights[i]->getColor(), b.Lights[i]->getColor()))
+      return false;
+  }
+  return true;
+}
+
+
+/** The pixels whose camera rays may hit a box.
+* The corners of the box are projected on the image; the rectangle around
+* them, grown by a pixel against rounding, holds the projection of the
+* whole box. It is empty (x0 > x1 or y0 > y1) if the box is off screen.
+* @return False if the box reaches behind the camera, then any pixel may.
+*/
+static bool projectBox(const Camera & cam, const BBox & Box, int imgSize,
+                       int & x0, int & y0, int & x1, int & y1)
+{
+  float xmin = HUGE_VALF, ymin = HUGE_VALF, xmax = -HUGE_VALF, ymax = -HUGE_VALF;
+
+  for (int c = 0; c < 8; c++)
+  {
+    Vector3D Corner((c & 1) ? Box.Max[0] : Box.Min[0],
+                    (c & 2) ? Box.Max[1] : Box.Min[1],
+                    (c & 4) ? Box.Max[2] : Box.Min[2]);
+    Vector3D D = Corner - cam.Pos;
+    float z = dot(D, cam.Dir);
+
+    if (z <= 0) return false;
+
+    // The inverse of Camera::getRayForPixel()
+    float x = (0.5 + cam.Dist * dot(D, cam.Right) / z) * (imgSize - 1);
+    float y = (0.5 - cam.Dist * dot(D, cam.Up) / z) * (imgSize - 1);
+
+    if (x < xmin) xmin = x;
+    if (x > xmax) xmax = x;
+    if (y < ymin) ymin = y;
+    if (y > ymax) ymax = y;
+  }
+
+  x0 = (int) max(floor(xmin) - 1, 0.0f);
+  y0 = (int) max(floor(ymin) - 1, 0.0f);
+  x1 = (int) min(ceil(xmax) + 1, (float) imgSize) - 1;
+  y1 = (int) min(ceil(ymax) + 1, (float) imgSize) - 1;
+  return true;
+}
+
+
+/** Follows the reflections of a ray as Scene::traceRay() would.
+* @param Sc The scene.
+* @param R The first reflected ray.
+* @param Objects The objects looked for, by index in Sc.SObjects.
+* @return True if one of the rays hits one of the objects, or a
+* transparent object, through which anything may be seen.
+*/
+static bool reflectionsHit(const Scene & Sc, Ray R, const vector<bool> & Objects)
+{
+  for (unsigned int depth = 1; ; depth++)
+  {
+    HitInfo Hit(R);
+
+    if (!Sc.Intersect(R, Hit)) return false;
+    if (Objects[Hit.Index]) return true;
+    if (Hit.Obj->Transparency() > 0) return true;
+    if ((depth >= MAX_DEPTH) || (Hit.Obj->Reflectivity() <= 0)) return false;
+
+    R = R.reflect(R.getPoint(Hit.t), Hit.N);
+  }
+}
+
+
+SceneWatcher::SceneWatcher(const string & File_, int imgSize_,
+                           PixelOrder Order_, bool Half)
+  : File(File_), imgSize(imgSize_), Order(Order_), Sc(0), Cr(0),
+    Frame(imgSize_, imgSize_, Half), GBuf(imgSize_, imgSize_)
+{
+  // Editors often save by renaming a new file over the old one, so the
+  // directory is watched rather than the file
+  size_t slash = File.rfind('/');
+  Dir = (slash == string::npos) ? string(".") : File.substr(0, slash + 1);
+  Name = (slash == string::npos) ? File : File.substr(slash + 1);
+
+  Inotify = inotify_init();
+  if ((Inotify >= 0) &&
+      (inotify_add_watch(Inotify, Dir.c_str(),
+                         IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0))
+  {
+    close(Inotify);
+    Inotify = -1;
+  }
+}
+
+
+SceneWatcher::~SceneWatcher()
+{
+  if (Inotify >= 0) close(Inotify);
+  delete Sc;
+  delete Cr;
+}
+
+
+bool SceneWatcher::update()
+{
+  ifstream fin(File.c_str());
+  if (!fin)
+  {
+    cerr << "Could not open " << File << endl;
+    return false;
+  }
+
+  Scene * New = new Scene;
+  Camera * NewCr = 0;
+
+  try
+  {
+    readScene(fin, New, &NewCr);
+  }
+  catch (invalid_argument & e)
+  {
+    // Keep watching, the next save may fix it
+    cerr << File << ": " << e.what() << endl;
+    delete New;
+    delete NewCr;
+    return false;
+  }
+
+  if (NewCr == 0)
+  {
+    cerr << "The scene has no camera\n";
+    delete New;
+    return false;
+  }
+  if (!New->finalize())
+  {
+    delete New;
+    delete NewCr;
+    return false;
+  }
+
+  clock_t start = clock();
+  unsigned int traced;
+
+  if ((Sc == 0) || !sameCamera(*Cr, *NewCr))
+  {
+    renderAll(*New, *NewCr);
+    traced = imgSize * imgSize;
+  }
+  else
+    traced = renderChanges(*New);
+
+  cout << "Traced " << traced << " of " << imgSize * imgSize << " pixels in "
+       << (double) (clock() - start) / CLOCKS_PER_SEC << "s" << endl;
+
+  delete Sc;
+  delete Cr;
+  Sc = New;
+  Cr = NewCr;
+  return true;
+}
+
+
+void SceneWatcher::renderAll(const Scene & New, const Camera & NewCr)
+{
+  New.Render(NewCr, Frame, Order, &GBuf);
+}
+
+
+unsigned int SceneWatcher::renderChanges(const Scene & New)
+{
+  const Scene & Old = *Sc;
+  unsigned int nOld = Old.SObjects.size(), nNew = New.SObjects.size();
+
+  // Pair the objects whose text did not change; what is left over was
+  // removed from the old scene or added to the new one
+  map<string, vector<int> > Unpaired;
+  vector<int> OldToNew(nOld, -1);
+  vector<bool> Added(nNew, true);
+
+  for (int i = nOld - 1; i >= 0; i--)
+    if (!Old.Sources[i].empty()) Unpaired[Old.Sources[i]].push_back(i);
+
+  for (unsigned int i = 0; i < nNew; i++)
+  {
+    map<string, vector<int> >::iterator P = Unpaired.find(New.Sources[i]);
+    if ((P == Unpaired.end()) || P->second.empty()) continue;
+
+    OldToNew[P->second.back()] = i;
+    P->second.pop_back();
+    Added[i] = false;
+  }
+
+  bool objectsChanged = (nOld != nNew);
+  TouchMask Removed = 0;
+  vector<bool> Dirty((size_t) imgSize * imgSize, false);
+  bool allDirty = false;
+
+  for (unsigned int i = 0; i < nOld; i++)
+  {
+    if (OldToNew[i] >= 0) continue;
+    objectsChanged = true;
+    Removed |= Old.touchBit(i);
+  }
+  for (unsigned int i = 0; i < nNew; i++)
+    if (Added[i]) objectsChanged = true;
+
+  bool lightsChanged = !sameLights(Old, New);
+
+  if (!objectsChanged && !lightsChanged) return 0;
+
+  // Without shadows a light reaches every visible point, so changed lights
+  // mean shading everything again; the hits are still good if the objects
+  // are the same
+  if (!objectsChanged)
+  {
+    New.Relight(*Cr, GBuf, Frame);
+    return imgSize * imgSize;
+  }
+  if (lightsChanged)
+  {
+    renderAll(New, *Cr);
+    return imgSize * imgSize;
+  }
+
+  // The pixels over the old and new places of the changed objects
+  for (unsigned int k = 0; (k < nOld + nNew) && !allDirty; k++)
+  {
+    bool isOld = (k < nOld);
+    unsigned int i = isOld ? k : k - nOld;
+    if (isOld ? (OldToNew[i] >= 0) : !Added[i]) continue;
+
+    BBox Box;
+    int x0, y0, x1, y1;
+    const SPSceneObject & Obj = isOld ? Old.SObjects[i] : New.SObjects[i];
+
+    if (!Obj->Bounds(Box) || !projectBox(*Cr, Box, imgSize, x0, y0, x1, y1))
+    {
+      allDirty = true;
+      break;
+    }
+
+    for (int y = y0; y <= y1; y++)
+      for (int x = x0; x <= x1; x++)
+        Dirty[(size_t) y * imgSize + x] = true;
+  }
+
+  if (allDirty)
+  {
+    renderAll(New, *Cr);
+    return imgSize * imgSize;
+  }
+
+  // The pixels whose rays saw a removed object, or whose reflections now
+  // meet an added one. The others keep their color and their hit, which
+  // only needs the index of its object in the new scene.
+  unsigned int traced = 0;
+  vector<unsigned int> Pixels;
+
+  makePixelOrder(Order, imgSize, imgSize, Pixels);
+
+  for (unsigned int p = 0; p < Pixels.size(); p++)
+  {
+    int x = Pixels[p] % imgSize, y = Pixels[p] / imgSize;
+    GBufferTexel & T = GBuf.at(x, y);
+
+    // The rays through transparent objects are not followed, the pixels
+    // seeing one are traced again
+    if (!Dirty[Pixels[p]] && !(T.Touched & Removed) && (T.Transparency > 0))
+      Dirty[Pixels[p]] = true;
+    else if (!Dirty[Pixels[p]] && !(T.Touched & Removed) &&
+             (T.Reflectivity > 0))
+    {
+      Vector3D P(T.Point[0], T.Point[1], T.Point[2]);
+      Vector3D N(T.Normal[0], T.Normal[1], T.Normal[2]);
+      Ray pixelRay = Cr->getRayForPixel(x, y, imgSize);
+
+      Dirty[Pixels[p]] = reflectionsHit(New, pixelRay.reflect(P, N), Added);
+    }
+
+    if (Dirty[Pixels[p]] || (T.Touched & Removed))
+    {
+      Ray pixelRay = Cr->getRayForPixel(x, y, imgSize);
+      Frame.setPixel(x, y, New.traceRay(pixelRay, 0, &T));
+      traced++;
+    }
+    else if (T.Object >= 0)
+      T.Object = OldToNew[T.Object];
+  }
+
+  return traced;
+}
+
+
+bool SceneWatcher::wait()
+{
+  if (Inotify < 0)
+  {
+    cerr << "Cannot watch " << Dir << " for changes\n";
+    return false;
+  }
+
+  char Buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  bool changed = false;
+
+  while (!changed)
+  {
+    ssize_t len = read(Inotify, Buffer, sizeof(Buffer));
+    if (len <= 0) return false;
+
+    for (char * e = Buffer; e < Buffer + len; )
+    {
+      struct inotify_event * Event = (struct inotify_event *) e;
+      if ((Event->len > 0) && (Name == Event->name)) changed = true;
+      e += sizeof(struct inotify_event) + Event->len;
+    }
+  }
+
+  // A save often comes as several events; let them settle
+  struct pollfd Poll = { Inotify, POLLIN, 0 };
+  while (poll(&Poll, 1, 100) > 0)
+    if (read(Inotify, Buffer, sizeof(Buffer)) <= 0) return false;
+
+  return true;
+}
@@ -0,0 +1,114 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file watch.hh The SceneWatcher class, re-rendering a scene file as it is
+* edited.
+*/
+
+#ifndef WATCH_HH
+#define WATCH_HH
+
+#include <string>
+#include "scene.hh"
+#include "gbuffer.hh"
+
+using namespace std;
+
+
+/** Keeps a scene file rendered while it is being edited.
+* Every time the file is saved it is read again and compared with the
+* previous version, object by object (by their text) and light by light.
+* Only the pixels that may have changed are traced again:
+* - if only lights changed, every pixel is relit from the G-buffer;
+* - if objects changed, the pixels covered by the old and new bounds of
+*   the changed objects, the pixels whose camera ray or reflections hit
+*   one of the old objects (from the touch masks of the G-buffer), and
+*   the pixels whose reflections now hit one of the new objects.
+* A new camera, or a changed object without bounds such as a plane, makes
+* the whole image be rendered again.
+*/
+class SceneWatcher
+{
+private:
+
+/** The scene file, and the directory and name it is watched by. */
+  string File, Dir, Name;
+
+/** The size of the image. */
+  int imgSize;
+
+/** The order of the pixels in full renders. */
+  PixelOrder Order;
+
+/** The scene and camera of the last successful update, or 0. */
+  Scene * Sc;
+  Camera * Cr;
+
+/** The image and the camera ray hits of the last update. */
+  FrameBuffer Frame;
+  GBuffer GBuf;
+
+/** The inotify descriptor, -1 if watching could not be set up. */
+  int Inotify;
+
+/** Renders the whole image with a new scene. */
+  void renderAll(const Scene & New, const Camera & NewCr);
+
+/** Renders only what changed since the last update.
+* @return The number of pixels traced.
+*/
+  unsigned int renderChanges(const Scene & New);
+
+public:
+
+/** The constructor. Nothing is read before the first update().
+* @param File_ The scene file.
+* @param imgSize_ The size of the image.
+* @param Order_ The order of the pixels in full renders.
+* @param Half Keep the image in half floats.
+*/
+  SceneWatcher(const string & File_, int imgSize_, PixelOrder Order_,
+               bool Half = false);
+
+/** The destructor. */
+  ~SceneWatcher();
+
+/** Reads the scene file and renders what changed since the last update.
+* @return False, leaving the image as it was, if the file cannot be used.
+*/
+  bool update();
+
+/** Waits until the scene file is written again.
+* @return False if the file cannot be watched.
+*/
+  bool wait();
+
+/** The image of the last successful update. */
+  const FrameBuffer & getFrame() const;
+};
+
+
+inline const FrameBuffer & SceneWatcher::getFrame() const
+{
+  return Frame;
+}
+
+#endif //WATCH_HH
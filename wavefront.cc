@@ -0,0 +1,237 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file wavefront.cc Implementation of the WavefrontRenderer class
+*/
+
+#include "wavefront.hh"
+#include "morton.hh"
+
+
+WavefrontRenderer::WavefrontRenderer(const Scene & Sc_,
+                                     unsigned int BatchSize_,
+                                     bool SortRays_, PixelOrder Order_):
+Sc(Sc_), BatchSize(BatchSize_), SortRays(SortRays_), Order(Order_),
+RayCount(0),
+SortTime(0), IntersectTime(0), ShadeTime(0)
+{
+  assert(BatchSize > 0);
+}
+
+
+void WavefrontRenderer::Render(const Camera & cam, FrameBuffer & Frame)
+{
+  int Width = Frame.getWidth(), Height = Frame.getHeight();
+
+  assert(Sc.isFinalized());
+
+  unsigned int total = (unsigned int) Width * Height;
+
+  makePixelOrder(Order, Width, Height, OrderedPixels);
+
+  for (unsigned int first = 0; first < total; first += BatchSize)
+  {
+    unsigned int count = min(BatchSize, total - first);
+
+    Generate(cam, Width, Height, first, count);
+
+    for (unsigned int depth = 0; Current.size() > 0; depth++)
+    {
+      clock_t start = clock();
+
+      // Camera rays are coherent already
+      if (SortRays && (depth > 0)) SortStage();
+      clock_t sorted = clock();
+      IntersectStage();
+      clock_t intersected = clock();
+      ShadeStage(depth);
+
+      SortTime += sorted - start;
+      IntersectTime += intersected - sorted;
+      ShadeTime += clock() - intersected;
+      swap(Current, Next);
+    }
+
+    Resolve(Frame, first, count);
+  }
+}
+
+
+void WavefrontRenderer::PrintStats(ostream & out) const
+{
+  out << "Wavefront: " << RayCount << " rays, "
+      << "sort " << (double) SortTime / CLOCKS_PER_SEC << "s, "
+      << "intersect " << (double) IntersectTime / CLOCKS_PER_SEC << "s, "
+      << "shade " << (double) ShadeTime / CLOCKS_PER_SEC << "s" << endl;
+}
+
+
+void WavefrontRenderer::Generate(const Camera & cam, int Width, int Height,
+                                 unsigned int first, unsigned int count)
+{
+  Current.clear();
+  Current.Rays.reserve(count);
+  Current.Pixels.reserve(count);
+  Bounces.clear();
+
+  for (unsigned int i = 0; i < count; i++)
+  {
+    unsigned int p = OrderedPixels[first + i];
+    Current.push(cam.getRayForPixel(p % Width, p / Width, Width, Height),
+                 i);
+  }
+}
+
+
+void WavefrontRenderer::SortStage()
+{
+  unsigned int n = Current.size();
+  if (n < 2) return;
+
+  // Quantize the origins to 9 bits per axis within their bounds
+  BBox Box;
+  for (unsigned int i = 0; i < n; i++) Box.extend(Current.Rays[i].getOrigin());
+
+  Vector3D Diag = Box.diagonal();
+  float Scale[3];
+  for (int a = 0; a < 3; a++)
+    Scale[a] = (Diag[a] > 0) ? 511.0f / Diag[a] : 0;
+
+  Keys.resize(n);
+  for (unsigned int i = 0; i < n; i++)
+  {
+    const Ray & R = Current.Rays[i];
+    const Vector3D & O = R.getOrigin();
+    unsigned int q[3];
+
+    for (int a = 0; a < 3; a++)
+    {
+      float f = (O[a] - Box.Min[a]) * Scale[a];
+      q[a] = (f > 0) ? ((f < 511) ? (unsigned int) f : 511) : 0;
+    }
+
+    unsigned int octant = R.getSign(0) | (R.getSign(1) << 1) |
+                          (R.getSign(2) << 2);
+    Keys[i] = (octant << 27) | morton3(q[0], q[1], q[2]);
+  }
+
+  radixSort(Keys, SortOrder);
+
+  Next.clear();
+  Next.Rays.reserve(n);
+  Next.Pixels.reserve(n);
+  for (unsigned int i = 0; i < n; i++)
+    Next.push(Current.Rays[SortOrder[i]], Current.Pixels[SortOrder[i]]);
+
+  swap(Current, Next);
+}
+
+
+void WavefrontRenderer::IntersectStage()
+{
+  unsigned int n = Current.size();
+
+  Hits.resize(n);
+  RayCount += n;
+
+  for (unsigned int i = 0; i < n; i++)
+  {
+    Hits[i] = HitInfo(Current.Rays[i]);
+    Sc.Intersect(Current.Rays[i], Hits[i]);
+  }
+}
+
+
+void WavefrontRenderer::ShadeStage(unsigned int depth)
+{
+  unsigned int n = Current.size();
+
+  Bounces.push_back(vector<ShadeRecord>(n));
+  vector<ShadeRecord> & Records = Bounces.back();
+  Next.clear();
+
+  for (unsigned int i = 0; i < n; i++)
+  {
+    const Ray & R = Current.Rays[i];
+    const HitInfo & Hit = Hits[i];
+    ShadeRecord & Rec = Records[i];
+
+    Rec.Pixel = Current.Pixels[i];
+    Rec.Reflectivity = 0;
+
+    if (Hit.Obj == 0)
+    {
+      Rec.Direct = BACKGROUND_CLR;
+      continue;
+    }
+
+    // A transparent surface splits the ray, more than one ray per pixel
+    // and bounce would not fit the queues: the tree below it is traced
+    // depth first
+    if (Hit.Obj->Transparency() > 0)
+    {
+      Rec.Direct = Sc.traceRay(R, depth);
+      continue;
+    }
+
+    Rec.Direct = Sc.Shade(R, Hit);
+
+    if ((depth < MAX_DEPTH) && (Hit.Obj->Reflectivity() > 0))
+    {
+      Rec.Reflectivity = Hit.Obj->Reflectivity();
+      Next.push(R.reflect(R.getPoint(Hit.t), Hit.N), Rec.Pixel);
+    }
+  }
+}
+
+
+void WavefrontRenderer::Resolve(FrameBuffer & Frame, unsigned int first,
+                                unsigned int count)
+{
+  int Width = Frame.getWidth();
+
+  Pixels.assign(count, Color(0, 0, 0));
+
+  // A pixel has at most one ray per bounce, and a ray with a reflection
+  // always has its reflected ray in the next bounce. Going backwards,
+  // Pixels holds the color of the reflected ray when its parent is reached.
+  for (int b = Bounces.size() - 1; b >= 0; b--)
+  {
+    const vector<ShadeRecord> & Records = Bounces[b];
+
+    for (unsigned int i = 0; i < Records.size(); i++)
+    {
+      const ShadeRecord & Rec = Records[i];
+      Color Result = Rec.Direct;
+
+      if (Rec.Reflectivity > 0)
+        Result += Rec.Reflectivity * Pixels[Rec.Pixel];
+
+      Pixels[Rec.Pixel] = Result;
+    }
+  }
+
+  for (unsigned int i = 0; i < count; i++)
+  {
+    unsigned int p = OrderedPixels[first + i];
+    Frame.setPixel(p % Width, p / Width, Pixels[i]);
+  }
+}
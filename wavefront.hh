@@ -0,0 +1,205 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file wavefront.hh The WavefrontRenderer class, a breadth first renderer.
+*/
+
+#ifndef WAVEFRONT_HH
+#define WAVEFRONT_HH
+
+#include <vector>
+#include <ctime>
+#include "scene.hh"
+
+using namespace std;
+
+
+/** The number of pixels rendered together by default. */
+const unsigned int WAVEFRONT_BATCH = 1 << 16;
+
+
+/** Rays waiting for the next stage, kept as parallel arrays.
+* Entry i is the ray Rays[i], whose light ends up in pixel Pixels[i].
+*/
+struct RayQueue
+{
+  vector<Ray> Rays;
+  vector<unsigned int> Pixels;
+
+/** Removes all the rays. */
+  void clear();
+
+/** The number of rays in the queue. */
+  unsigned int size() const;
+
+/** Appends a ray heading for a pixel. */
+  void push(const Ray & R, unsigned int Pixel);
+};
+
+
+/** What the shading stage found out about one ray.
+* The color of the ray is Direct + Reflectivity * (the color of the
+* reflected ray), exactly as Scene::traceRay() adds it up.
+*/
+struct ShadeRecord
+{
+/** The light reaching the hit point from the light sources, or the
+* background color if the ray hit nothing.
+*/
+  Color Direct;
+
+/** The weight of the reflected ray, 0 if there is none. */
+  float Reflectivity;
+
+/** The position of the pixel within the batch. */
+  unsigned int Pixel;
+};
+
+
+/** Renders a scene one bounce at a time instead of one pixel at a time.
+* The pixels are taken in batches. For each batch the camera rays are
+* generated into a queue, then every bounce runs as separate stages over
+* the whole queue: all rays are intersected, all hits are shaded, and the
+* reflected rays are collected into the queue of the next bounce. Each
+* stage is a tight loop over flat arrays, which keeps the data of one kind
+* of work in the caches.
+*
+* Once the last bounce is done the shading records are added up from the
+* deepest bounce back to the camera, in the order traceRay() uses, so
+* the image is the same as the recursive renderer's to the last bit.
+*
+* Reflections off curved surfaces scatter, so neighbouring pixels soon
+* trace rays that have nothing in common. With ray sorting on, the queue
+* of every bounce after the first is reordered before intersection so
+* that rays with the same direction octant and nearby origins are traced
+* one after the other.
+*/
+class WavefrontRenderer
+{
+private:
+
+/** The scene, which must be finalized. */
+  const Scene & Sc;
+
+/** The number of pixels per batch. */
+  unsigned int BatchSize;
+
+/** Sort the reflected rays before tracing them. */
+  bool SortRays;
+
+/** The order in which the pixels are fed to the batches. */
+  PixelOrder Order;
+
+/** Every pixel of the image, in that order. */
+  vector<unsigned int> OrderedPixels;
+
+/** Scratch space of the sorting stage. */
+  vector<unsigned int> Keys, SortOrder;
+
+/** The rays of the current and of the next bounce. */
+  RayQueue Current, Next;
+
+/** The hits of the rays in Current. */
+  vector<HitInfo> Hits;
+
+/** The shading records of every bounce of the batch. */
+  vector<vector<ShadeRecord> > Bounces;
+
+/** The color of every pixel of the batch while the bounces are added up. */
+  vector<Color> Pixels;
+
+/** The number of rays traced, over all renders. */
+  unsigned long RayCount;
+
+/** The processor time spent in each stage, in clock() ticks. */
+  clock_t SortTime, IntersectTime, ShadeTime;
+
+/** Fills Current with the camera rays of the pixels
+* OrderedPixels[first, first + count).
+*/
+  void Generate(const Camera & cam, int Width, int Height,
+                unsigned int first, unsigned int count);
+
+/** Reorders Current by direction octant and Morton code of the origin.
+* The pixel of each ray travels with it, so the results still land in
+* the right place.
+*/
+  void SortStage();
+
+/** Intersects every ray in Current with the scene. */
+  void IntersectStage();
+
+/** Shades the hits of Current and queues the reflected rays in Next. */
+  void ShadeStage(unsigned int depth);
+
+/** Adds the bounces up and stores the batch in the frame. */
+  void Resolve(FrameBuffer & Frame, unsigned int first, unsigned int count);
+
+public:
+
+/** The constructor.
+* @param Sc_ The scene to render.
+* @param BatchSize_ The number of pixels in flight at once.
+* @param SortRays_ Sort the reflected rays for coherence.
+* @param Order_ The order in which the pixels are taken.
+*/
+  WavefrontRenderer(const Scene & Sc_,
+                    unsigned int BatchSize_ = WAVEFRONT_BATCH,
+                    bool SortRays_ = false,
+                    PixelOrder Order_ = ORDER_ROWS);
+
+/** Renders the scene. Same contract as Scene::Render().
+* @param cam The point of view.
+* @param Frame The image to fill. Its size sets the resolution.
+*/
+  void Render(const Camera & cam, FrameBuffer & Frame);
+
+/** The number of rays traced so far. */
+  unsigned long Rays() const;
+
+/** Prints the ray count and the time spent in each stage. */
+  void PrintStats(ostream & out) const;
+};
+
+
+inline void RayQueue::clear()
+{
+  Rays.clear();
+  Pixels.clear();
+}
+
+inline unsigned int RayQueue::size() const
+{
+  return Rays.size();
+}
+
+inline void RayQueue::push(const Ray & R, unsigned int Pixel)
+{
+  Rays.push_back(R);
+  Pixels.push_back(Pixel);
+}
+
+inline unsigned long WavefrontRenderer::Rays() const
+{
+  return RayCount;
+}
+
+#endif //WAVEFRONT_HH
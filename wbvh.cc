@@ -0,0 +1,237 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file wbvh.cc Construction and saving of the wide BVH.
+*/
+
+#include "wbvh.hh"
+
+/** The child boxes are grown by this fraction of their size before they are
+* quantized, to stay conservative under the rounding of the traversal.
+*/
+const float WBVH_PADDING = 1.0f / (1 << 20);
+
+
+/** The box of a binary node. */
+static const BBox nodeBox(const BVHNode & Node)
+{
+  return BBox(Vector3D(Node.Min[0], Node.Min[1], Node.Min[2]),
+              Vector3D(Node.Max[0], Node.Max[1], Node.Max[2]));
+}
+
+
+void WideBVH::Build(const vector<BBox> & PrimBounds)
+{
+  BVH Binary;
+  Binary.Build(PrimBounds, WBVH_MAX_LEAF);
+  Build(Binary);
+}
+
+
+void WideBVH::Build(const BVH & Binary)
+{
+  Nodes.clear();
+  Indices.clear();
+
+  if (Binary.empty()) return;
+
+  RootBox = Binary.Bounds();
+  Indices.reserve(Binary.Indices.size());
+
+  // A wide node replaces at least two binary nodes
+  Nodes.reserve(Binary.Nodes.size() / 2 + 1);
+  Nodes.push_back(WideBVHNode());
+  Collapse(Binary, 0, 0);
+}
+
+
+void WideBVH::Collapse(const BVH & Binary, unsigned int bnode,
+                       unsigned int index)
+{
+  vector<unsigned int> Kids;
+  const vector<BVHNode> & B = Binary.Nodes;
+  int i, a;
+
+  if (B[bnode].Count > 0)
+    Kids.push_back(bnode);
+  else
+  {
+    Kids.push_back(bnode + 1);
+    Kids.push_back(B[bnode].Offset);
+  }
+
+  // Open the interior child with the largest surface until the node is full
+  while (Kids.size() < (unsigned int) WBVH_WIDTH)
+  {
+    int best = -1;
+    float bestArea = -1;
+
+    for (i = 0; i < (int) Kids.size(); i++)
+    {
+      float area = nodeBox(B[Kids[i]]).area();
+      if ((B[Kids[i]].Count == 0) && (area > bestArea))
+      {
+        bestArea = area;
+        best = i;
+      }
+    }
+
+    if (best < 0) break;
+
+    unsigned int open = Kids[best];
+    Kids[best] = open + 1;
+    Kids.push_back(B[open].Offset);
+  }
+
+  WideBVHNode N;
+  memset(&N, 0, sizeof(N));
+
+  BBox Box, KidBox[WBVH_WIDTH];
+  for (i = 0; i < (int) Kids.size(); i++)
+  {
+    KidBox[i] = nodeBox(B[Kids[i]]);
+    Vector3D Pad = KidBox[i].diagonal() * WBVH_PADDING;
+    for (a = 0; a < 3; a++)
+    {
+      Pad[a] += fabs(KidBox[i].Min[a]) * WBVH_PADDING;
+      Pad[a] += fabs(KidBox[i].Max[a]) * WBVH_PADDING;
+    }
+    KidBox[i].Min -= Pad;
+    KidBox[i].Max += Pad;
+    Box.extend(KidBox[i]);
+  }
+
+  // Quantize the children on a grid of 255 steps of 2^Exp along each axis
+  for (a = 0; a < 3; a++)
+  {
+    float extent = Box.Max[a] - Box.Min[a];
+    int e = (extent > 0) ? (int) ceil(log2(extent / 255)) : -126;
+    bool fits = false;
+
+    N.Origin[a] = Box.Min[a];
+
+    while (!fits)
+    {
+      if (e < -126) e = -126;
+      assert(e <= 127);
+
+      float step = exp2i(e);
+      fits = true;
+
+      for (i = 0; i < (int) Kids.size(); i++)
+      {
+        float lo = floor((KidBox[i].Min[a] - N.Origin[a]) / step);
+        float hi = ceil((KidBox[i].Max[a] - N.Origin[a]) / step);
+
+        while ((lo > 0) && (N.Origin[a] + lo * step > KidBox[i].Min[a])) lo--;
+        while (N.Origin[a] + hi * step < KidBox[i].Max[a]) hi++;
+
+        if (hi > 255)
+        {
+          fits = false;
+          e++;
+          break;
+        }
+
+        N.QMin[a][i] = (unsigned char) lo;
+        N.QMax[a][i] = (unsigned char) hi;
+      }
+    }
+
+    N.Exp[a] = e;
+  }
+
+  // Interior children are allocated next to each other, leaf primitives too
+  vector<unsigned int> Interior;
+  N.ChildBase = Nodes.size();
+  N.PrimBase = Indices.size();
+
+  for (i = 0; i < (int) Kids.size(); i++)
+  {
+    const BVHNode & Kid = B[Kids[i]];
+
+    if (Kid.Count == 0)
+    {
+      N.Meta[i] = 0x80 | Interior.size();
+      Interior.push_back(Kids[i]);
+    }
+    else
+    {
+      assert(Kid.Count <= WBVH_MAX_LEAF);
+      N.Meta[i] = (Kid.Count << 5) | (Indices.size() - N.PrimBase);
+      for (unsigned int k = 0; k < Kid.Count; k++)
+        Indices.push_back(Binary.Indices[Kid.Offset + k]);
+    }
+  }
+
+  Nodes[index] = N;
+  Nodes.resize(Nodes.size() + Interior.size());
+
+  for (i = 0; i < (int) Interior.size(); i++)
+    Collapse(Binary, Interior[i], N.ChildBase + i);
+}
+
+
+bool WideBVH::write(ostream & out) const
+{
+  unsigned int Counts[2] = {(unsigned int) Nodes.size(),
+                            (unsigned int) Indices.size()};
+  float Box[6] = {RootBox.Min[0], RootBox.Min[1], RootBox.Min[2],
+                  RootBox.Max[0], RootBox.Max[1], RootBox.Max[2]};
+
+  out.write((const char *) Counts, sizeof(Counts));
+  out.write((const char *) Box, sizeof(Box));
+  if (Counts[0] > 0)
+    out.write((const char *) &Nodes[0], Counts[0] * sizeof(WideBVHNode));
+  if (Counts[1] > 0)
+    out.write((const char *) &Indices[0], Counts[1] * sizeof(unsigned int));
+  return out.good();
+}
+
+
+bool WideBVH::read(istream & in)
+{
+  unsigned int Counts[2];
+  float Box[6];
+
+  Nodes.clear();
+  Indices.clear();
+
+  if (!in.read((char *) Counts, sizeof(Counts)) ||
+      !in.read((char *) Box, sizeof(Box)))
+    return false;
+
+  Nodes.resize(Counts[0]);
+  Indices.resize(Counts[1]);
+  if (((Counts[0] > 0) &&
+       !in.read((char *) &Nodes[0], Counts[0] * sizeof(WideBVHNode))) ||
+      ((Counts[1] > 0) &&
+       !in.read((char *) &Indices[0], Counts[1] * sizeof(unsigned int))))
+  {
+    Nodes.clear();
+    Indices.clear();
+    return false;
+  }
+
+  RootBox = BBox(Vector3D(Box[0], Box[1], Box[2]),
+                 Vector3D(Box[3], Box[4], Box[5]));
+  return true;
+}
@@ -0,0 +1,318 @@
+/***************************************************************************
+ *   Copyright (C) 2007 by Eugeniu Plamadeala   *
+ *   eugeniu@caltech.edu   *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+* @file wbvh.hh A compressed 8-wide BVH with quantized child bounds.
+*/
+
+#ifndef WBVH_HH
+#define WBVH_HH
+
+#include <vector>
+#include <cstring>
+#include <iostream>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "bvh.hh"
+
+using namespace std;
+
+/** The number of children of a node of the wide BVH. */
+const int WBVH_WIDTH = 8;
+
+/** The largest leaf the wide BVH can encode. Binary trees that are to be
+* collapsed must be built with leaves no larger than this.
+*/
+const unsigned int WBVH_MAX_LEAF = 3;
+
+/** A node of the wide BVH (80 bytes for 8 children).
+* The children are stored as 8 bit offsets from the corner Origin in units
+* of 2^Exp, rounded outwards, so the boxes are conservative. Interior
+* children are stored contiguously from ChildBase and the primitives of
+* all leaf children contiguously from PrimBase.
+*/
+struct WideBVHNode
+{
+/** The lower corner of the quantization grid. */
+  float Origin[3];
+
+/** The exponents of the grid spacing along each axis. */
+  signed char Exp[3];
+
+/** Unused, keeps the following fields aligned. */
+  unsigned char Pad;
+
+/** The index of the first interior child. */
+  unsigned int ChildBase;
+
+/** The index in WideBVH::Indices of the first primitive of the leaves. */
+  unsigned int PrimBase;
+
+/** Per child: 0 if the slot is empty, 0x80 | slot for interior children,
+* (count << 5) | offset for leaves.
+*/
+  unsigned char Meta[WBVH_WIDTH];
+
+/** The quantized lower bounds, one row per axis. */
+  unsigned char QMin[3][WBVH_WIDTH];
+
+/** The quantized upper bounds, one row per axis. */
+  unsigned char QMax[3][WBVH_WIDTH];
+};
+
+
+/** An 8-wide BVH obtained by collapsing a binary SAH tree.
+* Each node stores its children with 8 bit bounds relative to the node, so
+* a node costs 80 bytes instead of the 8 * 32 bytes of the binary nodes it
+* replaces, and a traversal step tests all 8 children at once.
+*/
+class WideBVH
+{
+public:
+
+/** The nodes, the root being the first one. */
+  vector<WideBVHNode> Nodes;
+
+/** The primitive indices referenced by the leaves. */
+  vector<unsigned int> Indices;
+
+/** Builds the wide tree by collapsing a binary one.
+* @param Binary A tree with leaves of at most WBVH_MAX_LEAF primitives.
+*/
+  void Build(const BVH & Binary);
+
+/** Builds a binary tree over the primitives and collapses it. */
+  void Build(const vector<BBox> & PrimBounds);
+
+/** True if the hierarchy holds no primitives. */
+  bool empty() const;
+
+/** The bounds of the whole hierarchy. */
+  const BBox Bounds() const;
+
+/** The memory used by the nodes, in bytes. */
+  size_t NodeBytes() const;
+
+/** Writes the hierarchy, as it is in memory, so only a build for the
+* same machine can read it back.
+*/
+  bool write(ostream & out) const;
+
+/** Reads a hierarchy saved by write().
+* @return False if the stream ends early, the hierarchy is then empty.
+*/
+  bool read(istream & in);
+
+/** Walks the hierarchy front to back along a ray.
+* Same contract as BVH::Traverse().
+*/
+  template <class LeafTest>
+  bool Traverse(const Ray & R, float & tmax, LeafTest & Test) const;
+
+private:
+
+/** The exact bounds of the root. */
+  BBox RootBox;
+
+/** Fills Nodes[index] from the binary node bnode. */
+  void Collapse(const BVH & Binary, unsigned int bnode, unsigned int index);
+};
+
+
+/** Returns 2^e as a float. */
+inline float exp2i(int e)
+{
+  unsigned int bits = (unsigned int) (e + 127) << 23;
+  float f;
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+
+/** Intersects a ray with the 8 children of a wide node.
+* @param Node The node.
+* @param O The ray origin.
+* @param Inv The inverse of the ray direction.
+* @param Neg For each axis, 1 if the ray direction is negative.
+* @param tmin Entries before this distance are moved up to it.
+* @param tmax Entries past this distance are ignored.
+* @param tnear Receives the entry distance of every child.
+* @return A bit mask of the children hit by the ray.
+*/
+inline unsigned int hitWideNode(const WideBVHNode & Node, const float O[3],
+                                const float Inv[3], const int Neg[3],
+                                float tmin, float tmax,
+                                float tnear[WBVH_WIDTH])
+{
+#ifdef __SSE2__
+  __m128 t0[2], t1[2];
+
+  t0[0] = t0[1] = _mm_set1_ps(tmin);
+  t1[0] = t1[1] = _mm_set1_ps(tmax);
+
+  for (int a = 0; a < 3; a++)
+  {
+    // t = (Origin - O) * Inv + q * (2^Exp * Inv)
+    __m128 base = _mm_set1_ps((Node.Origin[a] - O[a]) * Inv[a]);
+    __m128 step = _mm_set1_ps(exp2i(Node.Exp[a]) * Inv[a]);
+    const unsigned char * Near = Neg[a] ? Node.QMax[a] : Node.QMin[a];
+    const unsigned char * Far = Neg[a] ? Node.QMin[a] : Node.QMax[a];
+
+    __m128i qn = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) Near),
+                                   _mm_setzero_si128());
+    __m128i qf = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) Far),
+                                   _mm_setzero_si128());
+
+    for (int h = 0; h < 2; h++)
+    {
+      __m128i n32 = h ? _mm_unpackhi_epi16(qn, _mm_setzero_si128())
+                      : _mm_unpacklo_epi16(qn, _mm_setzero_si128());
+      __m128i f32 = h ? _mm_unpackhi_epi16(qf, _mm_setzero_si128())
+                      : _mm_unpacklo_epi16(qf, _mm_setzero_si128());
+      __m128 tn = _mm_add_ps(base, _mm_mul_ps(_mm_cvtepi32_ps(n32), step));
+      __m128 tf = _mm_add_ps(base, _mm_mul_ps(_mm_cvtepi32_ps(f32), step));
+      t0[h] = _mm_max_ps(t0[h], tn);
+      t1[h] = _mm_min_ps(t1[h], tf);
+    }
+  }
+
+  _mm_storeu_ps(tnear, t0[0]);
+  _mm_storeu_ps(tnear + 4, t0[1]);
+
+  unsigned int mask = _mm_movemask_ps(_mm_cmple_ps(t0[0], t1[0])) |
+                      (_mm_movemask_ps(_mm_cmple_ps(t0[1], t1[1])) << 4);
+#else
+  unsigned int mask = 0;
+
+  for (int i = 0; i < WBVH_WIDTH; i++)
+  {
+    float t0 = tmin, t1 = tmax;
+
+    for (int a = 0; a < 3; a++)
+    {
+      float base = (Node.Origin[a] - O[a]) * Inv[a];
+      float step = exp2i(Node.Exp[a]) * Inv[a];
+      float tn = base + (Neg[a] ? Node.QMax[a][i] : Node.QMin[a][i]) * step;
+      float tf = base + (Neg[a] ? Node.QMin[a][i] : Node.QMax[a][i]) * step;
+      t0 = (tn > t0) ? tn : t0;
+      t1 = (tf < t1) ? tf : t1;
+    }
+
+    tnear[i] = t0;
+    if (t0 <= t1) mask |= 1 << i;
+  }
+#endif
+
+  // Empty slots are never hit
+  for (int i = 0; i < WBVH_WIDTH; i++)
+    if (Node.Meta[i] == 0) mask &= ~(1 << i);
+
+  return mask;
+}
+
+
+inline bool WideBVH::empty() const
+{
+  return Nodes.empty();
+}
+
+inline const BBox WideBVH::Bounds() const
+{
+  return RootBox;
+}
+
+inline size_t WideBVH::NodeBytes() const
+{
+  return Nodes.size() * sizeof(WideBVHNode);
+}
+
+template <class LeafTest>
+bool WideBVH::Traverse(const Ray & R, float & tmax, LeafTest & Test) const
+{
+  if (Nodes.empty()) return false;
+
+  // Entries with the top bit set are leaves: offset << 2 | count
+  const unsigned int LEAF = 0x80000000u;
+
+  const Vector3D & Origin = R.getOrigin(), & InvDir = R.getInvDirection();
+  float O[3], Inv[3], tmin = R.getTMin(), tnear[WBVH_WIDTH], tentry;
+  int Neg[3];
+  unsigned int Stack[WBVH_WIDTH * BVH_MAX_DEPTH];
+  int top = 0;
+  bool found = false;
+
+  for (int i = 0; i < 3; i++)
+  {
+    O[i] = Origin[i];
+    Inv[i] = InvDir[i];
+    Neg[i] = R.getSign(i);
+  }
+
+  if (!RootBox.hit(R, tmax, tentry)) return false;
+  Stack[top++] = 0;
+
+  while (top > 0)
+  {
+    unsigned int entry = Stack[--top];
+
+    if (entry & LEAF)
+    {
+      unsigned int offset = (entry & ~LEAF) >> 2, count = entry & 3;
+      for (unsigned int i = 0; i < count; i++)
+        if (Test(Indices[offset + i], tmax)) found = true;
+      continue;
+    }
+
+    const WideBVHNode & Node = Nodes[entry];
+    unsigned int mask = hitWideNode(Node, O, Inv, Neg, tmin, tmax, tnear);
+    unsigned int order[WBVH_WIDTH];
+    int n = 0;
+
+    // Sort the children that were hit by entry distance, far ones first
+    for (int i = 0; i < WBVH_WIDTH; i++)
+    {
+      if (!(mask & (1 << i))) continue;
+
+      int k = n++;
+      while ((k > 0) && (tnear[order[k - 1]] < tnear[i]))
+      {
+        order[k] = order[k - 1];
+        k--;
+      }
+      order[k] = i;
+    }
+
+    for (int k = 0; k < n; k++)
+    {
+      unsigned char meta = Node.Meta[order[k]];
+
+      if (meta & 0x80)
+        Stack[top++] = Node.ChildBase + (meta & 0x7f);
+      else
+        Stack[top++] = LEAF | ((Node.PrimBase + (meta & 0x1f)) << 2) |
+                       (meta >> 5);
+    }
+  }
+
+  return found;
+}
+
+#endif //WBVH_HH